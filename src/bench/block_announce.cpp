@@ -0,0 +1,106 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <bench/data.h>
+
+#include <blockencodings.h>
+#include <clientversion.h>
+#include <net.h>
+#include <netmessagemaker.h>
+#include <primitives/block.h>
+#include <protocol.h>
+#include <streams.h>
+#include <version.h>
+
+#include <memory>
+#include <vector>
+
+//! Peers a block is announced to
+static const int BLOCK_ANNOUNCE_PEERS = 128;
+
+// A block queued to many peers, serialized and hashed for each of them as
+// before, or once for all of them, with the send queues sharing the payload.
+
+namespace {
+struct AnnouncePeers {
+    CConnman connman{0x1337, 0x1337};
+    std::vector<std::unique_ptr<CNode>> nodes;
+    CBlock block;
+
+    AnnouncePeers()
+    {
+        CDataStream stream(benchmark::data::block413567, SER_NETWORK, PROTOCOL_VERSION);
+        stream >> block;
+        for (int i = 0; i < BLOCK_ANNOUNCE_PEERS; i++) {
+            CAddress addr(CService(CNetAddr(), 8333), NODE_NONE);
+            nodes.emplace_back(new CNode(i, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", false));
+        }
+    }
+
+    //! Drop what was queued, as if it was sent
+    void Clear()
+    {
+        for (auto& node : nodes) {
+            LOCK(node->cs_vSend);
+            node->vSendMsg.clear();
+            node->nSendSize = 0;
+            node->fPauseSend = false;
+        }
+    }
+};
+} // namespace
+
+static void BlockAnnouncePerPeer(benchmark::State& state)
+{
+    AnnouncePeers peers;
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    while (state.KeepRunning()) {
+        for (auto& node : peers.nodes)
+            peers.connman.PushMessage(node.get(), msgMaker.Make(NetMsgType::BLOCK, peers.block));
+        peers.Clear();
+    }
+}
+
+static void BlockAnnounceShared(benchmark::State& state)
+{
+    AnnouncePeers peers;
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    while (state.KeepRunning()) {
+        const std::shared_ptr<const CSharedNetPayload> payload = msgMaker.SerializeShared(0, peers.block);
+        for (auto& node : peers.nodes)
+            peers.connman.PushMessage(node.get(), CNetMsgMaker::MakeShared(NetMsgType::BLOCK, payload));
+        peers.Clear();
+    }
+}
+
+static void CmpctBlockAnnouncePerPeer(benchmark::State& state)
+{
+    AnnouncePeers peers;
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    const CBlockHeaderAndShortTxIDs cmpctblock(peers.block, true);
+    while (state.KeepRunning()) {
+        for (auto& node : peers.nodes)
+            peers.connman.PushMessage(node.get(), msgMaker.Make(NetMsgType::CMPCTBLOCK, cmpctblock));
+        peers.Clear();
+    }
+}
+
+static void CmpctBlockAnnounceShared(benchmark::State& state)
+{
+    AnnouncePeers peers;
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    const CBlockHeaderAndShortTxIDs cmpctblock(peers.block, true);
+    while (state.KeepRunning()) {
+        const std::shared_ptr<const CSharedNetPayload> payload = msgMaker.SerializeShared(0, cmpctblock);
+        for (auto& node : peers.nodes)
+            peers.connman.PushMessage(node.get(), CNetMsgMaker::MakeShared(NetMsgType::CMPCTBLOCK, payload));
+        peers.Clear();
+    }
+}
+
+BENCHMARK(BlockAnnouncePerPeer, 2);
+BENCHMARK(BlockAnnounceShared, 50);
+BENCHMARK(CmpctBlockAnnouncePerPeer, 100);
+BENCHMARK(CmpctBlockAnnounceShared, 1000);
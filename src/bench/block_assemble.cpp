@@ -3,10 +3,14 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <bench/bench.h>
+#include <chainparams.h>
 #include <consensus/validation.h>
 #include <crypto/sha256.h>
+#include <miner.h>
+#include <scheduler.h>
 #include <test/util.h>
 #include <txmempool.h>
+#include <util/memory.h>
 #include <validation.h>
 
 
@@ -50,4 +54,75 @@ static void AssembleBlock(benchmark::State& state)
     }
 }
 
+// A mempool of some thousand transactions at different feerates, fanning out
+// from the coinbases of mined blocks as far as the descendant limit allows
+static void FillMempool()
+{
+    const std::vector<unsigned char> op_true{OP_TRUE};
+    CScriptWitness witness;
+    witness.stack.push_back(op_true);
+
+    uint256 witness_program;
+    CSHA256().Write(&op_true[0], op_true.size()).Finalize(witness_program.begin());
+
+    const CScript SCRIPT_PUB{CScript(OP_0) << std::vector<unsigned char>{witness_program.begin(), witness_program.end()}};
+
+    constexpr size_t NUM_BLOCKS{400};
+    constexpr size_t FAN_OUT{24};
+    std::vector<CTxIn> coinbases;
+    for (size_t b{0}; b < NUM_BLOCKS; ++b) {
+        CTxIn txin = MineBlock(SCRIPT_PUB);
+        if (NUM_BLOCKS - b >= COINBASE_MATURITY)
+            coinbases.push_back(txin);
+    }
+
+    LOCK(::cs_main); // Required for ::AcceptToMemoryPool.
+    size_t n{0};
+    for (CTxIn& coinbase : coinbases) {
+        CMutableTransaction parent;
+        parent.vin.push_back(coinbase);
+        parent.vin.back().scriptWitness = witness;
+        for (size_t i{0}; i < FAN_OUT; ++i) {
+            parent.vout.emplace_back(COIN / 2, SCRIPT_PUB);
+        }
+        std::vector<CTransactionRef> txs{MakeTransactionRef(parent)};
+        for (size_t i{0}; i < FAN_OUT; ++i) {
+            CMutableTransaction child;
+            child.vin.emplace_back(COutPoint(parent.GetHash(), i));
+            child.vin.back().scriptWitness = witness;
+            child.vout.emplace_back(COIN / 2 - 1000 - 10 * (++n * 7919 % 1000), SCRIPT_PUB);
+            txs.push_back(MakeTransactionRef(child));
+        }
+        for (const auto& txr : txs) {
+            CValidationState state;
+            bool ret{::AcceptToMemoryPool(::mempool, state, txr, nullptr /* pfMissingInputs */, nullptr /* plTxnReplaced */, false /* bypass_limits */, /* nAbsurdFee */ 0)};
+            assert(ret);
+        }
+    }
+}
+
+static void AssembleBlockLargeMempool(benchmark::State& state)
+{
+    FillMempool();
+    while (state.KeepRunning()) {
+        BlockAssembler(Params()).CreateNewBlock(CScript() << OP_TRUE);
+    }
+}
+
+// The template as getblocktemplate gets it: copied out of the one maintained
+static void BlockTemplateCacheLargeMempool(benchmark::State& state)
+{
+    FillMempool();
+    CScheduler scheduler;
+    BlockTemplateCache cache(Params(), scheduler);
+    while (state.KeepRunning()) {
+        const CBlockIndex* tip;
+        unsigned int transactions_updated;
+        auto block_template = MakeUnique<CBlockTemplate>(*cache.Get(tip, transactions_updated));
+        assert(block_template->block.vtx.size() > 1);
+    }
+}
+
 BENCHMARK(AssembleBlock, 700);
+BENCHMARK(AssembleBlockLargeMempool, 5);
+BENCHMARK(BlockTemplateCacheLargeMempool, 20000);
@@ -0,0 +1,261 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <bench/data.h>
+
+#include <blockencodings.h>
+#include <compressor.h>
+#include <consensus/merkle.h>
+#include <pubkey.h>
+#include <random.h>
+#include <script/interpreter.h>
+#include <script/standard.h>
+#include <streams.h>
+#include <txmempool.h>
+#include <version.h>
+
+#include <cstring>
+
+// Compression ratio and speed of the codecs used to compress the transactions
+// of chunk-coded blocks, measured over block 413567 and over synthetic blocks
+// of the kinds seen since: segwit-heavy blocks, batch payouts and
+// consolidations.
+
+#define DIV_CEIL(a, b) (((a) + (b) - 1) / (b))
+
+static CBlock ReadRealBlock()
+{
+    CBlock block;
+    CDataStream stream(benchmark::data::block413567, SER_NETWORK, PROTOCOL_VERSION);
+    stream >> block;
+    return block;
+}
+
+namespace {
+// Builds synthetic blocks out of the signatures and compressed keys of the
+// P2PKH spends of block 413567, as the codecs only compress valid ones
+class SyntheticBlockBuilder
+{
+private:
+    std::vector<std::pair<valtype, valtype>> m_sig_keys;
+    size_t m_next_sig_key = 0;
+    FastRandomContext m_rng{true};
+    CBlock m_block;
+
+public:
+    SyntheticBlockBuilder()
+    {
+        for (const CTransactionRef& tx : ReadRealBlock().vtx) {
+            for (const CTxIn& in : tx->vin) {
+                std::vector<valtype> stack;
+                if (EvalScript(stack, in.scriptSig, SCRIPT_VERIFY_NONE, BaseSignatureChecker(), SigVersion::BASE) &&
+                    stack.size() == 2 && stack[1].size() == CPubKey::COMPRESSED_PUBLIC_KEY_SIZE) {
+                    m_sig_keys.emplace_back(stack[0], stack[1]);
+                }
+            }
+        }
+        assert(m_sig_keys.size() > 1000);
+
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].scriptSig = CScript() << 600000 << OP_0;
+        coinbase.vout.resize(1);
+        coinbase.vout[0].nValue = 1250000000;
+        coinbase.vout[0].scriptPubKey = RandomScript(TX_WITNESS_V0_KEYHASH);
+        m_block.vtx.push_back(MakeTransactionRef(coinbase));
+    }
+
+    //! A signature and key not used before
+    const std::pair<valtype, valtype>& NextSigKey()
+    {
+        return m_sig_keys[m_next_sig_key++ % m_sig_keys.size()];
+    }
+
+    CScript RandomScript(txnouttype type)
+    {
+        const uint256 hash = m_rng.rand256();
+        switch (type) {
+        case TX_PUBKEYHASH: return GetScriptForDestination(PKHash(uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20))));
+        case TX_SCRIPTHASH: return GetScriptForDestination(ScriptHash(uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20))));
+        case TX_WITNESS_V0_SCRIPTHASH: return GetScriptForDestination(WitnessV0ScriptHash(hash));
+        default: return GetScriptForDestination(WitnessV0KeyHash(uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20))));
+        }
+    }
+
+    CScript RandomPayeeScript()
+    {
+        static const txnouttype types[] = {TX_PUBKEYHASH, TX_SCRIPTHASH, TX_WITNESS_V0_KEYHASH, TX_WITNESS_V0_SCRIPTHASH};
+        return RandomScript(types[m_rng.randrange(4)]);
+    }
+
+    COutPoint RandomPrevOut() { return COutPoint(m_rng.rand256(), m_rng.randrange(4)); }
+
+    //! A P2WPKH spend, nested in P2SH if asked
+    CTxIn WitnessSpend(const COutPoint& prevout, const std::pair<valtype, valtype>& sig_key, bool nested = false)
+    {
+        CTxIn in(prevout, CScript(), CTxIn::SEQUENCE_FINAL - 2);
+        in.scriptWitness.stack = {sig_key.first, sig_key.second};
+        if (nested) {
+            const CScript redeem_script = GetScriptForDestination(WitnessV0KeyHash(CPubKey(sig_key.second).GetID()));
+            in.scriptSig = CScript() << valtype(redeem_script.begin(), redeem_script.end());
+        }
+        return in;
+    }
+
+    CMutableTransaction NewTx() const
+    {
+        CMutableTransaction tx;
+        tx.nVersion = 2;
+        tx.nLockTime = 599990;
+        return tx;
+    }
+
+    COutPoint Add(const CMutableTransaction& tx, uint32_t n = 0)
+    {
+        m_block.vtx.push_back(MakeTransactionRef(tx));
+        return COutPoint(m_block.vtx.back()->GetHash(), n);
+    }
+
+    CAmount RandomAmount() { return 10000 + m_rng.randrange(100000000); }
+    bool RandomBool(uint32_t one_in) { return m_rng.randrange(one_in) == 0; }
+    uint64_t RandomRange(uint64_t range) { return m_rng.randrange(range); }
+
+    CBlock GetBlock()
+    {
+        m_block.nVersion = 0x20000000;
+        m_block.nTime = 1570000000;
+        m_block.nBits = 0x1715a35c;
+        m_block.hashMerkleRoot = BlockMerkleRoot(m_block);
+        return m_block;
+    }
+};
+} // namespace
+
+// Payments with change, mostly from and to native segwit keys. One in five
+// spends the change of the previous payment, as wallets chain unconfirmed
+// change.
+static CBlock BuildSegwitHeavyBlock()
+{
+    SyntheticBlockBuilder builder;
+    COutPoint change;
+    for (int i = 0; i < 2500; i++) {
+        CMutableTransaction tx = builder.NewTx();
+        const size_t n_in = builder.RandomBool(3) ? 2 : 1;
+        for (size_t j = 0; j < n_in; j++) {
+            const COutPoint prevout = (j == 0 && i > 0 && builder.RandomBool(5)) ? change : builder.RandomPrevOut();
+            tx.vin.push_back(builder.WitnessSpend(prevout, builder.NextSigKey(), builder.RandomBool(4)));
+        }
+        tx.vout.emplace_back(builder.RandomAmount(), builder.RandomPayeeScript());
+        tx.vout.emplace_back(builder.RandomAmount(), builder.RandomScript(TX_WITNESS_V0_KEYHASH));
+        change = builder.Add(tx, 1);
+    }
+    return builder.GetBlock();
+}
+
+// An exchange paying out withdrawals in batches, each funded by the change
+// of the previous batch plus a deposit, and paying its change back to the
+// same hot wallet key
+static CBlock BuildBatchPayoutBlock()
+{
+    SyntheticBlockBuilder builder;
+    const std::pair<valtype, valtype> hot_wallet = builder.NextSigKey();
+    const CScript hot_wallet_script = GetScriptForDestination(WitnessV0KeyHash(CPubKey(hot_wallet.second).GetID()));
+    COutPoint change = builder.RandomPrevOut();
+    for (int i = 0; i < 20; i++) {
+        CMutableTransaction tx = builder.NewTx();
+        tx.vin.push_back(builder.WitnessSpend(change, hot_wallet));
+        tx.vin.push_back(builder.WitnessSpend(builder.RandomPrevOut(), hot_wallet));
+        for (int j = 0; j < 250; j++)
+            tx.vout.emplace_back(builder.RandomAmount(), builder.RandomPayeeScript());
+        tx.vout.emplace_back(builder.RandomAmount(), hot_wallet_script);
+        change = builder.Add(tx, tx.vout.size() - 1);
+    }
+    return builder.GetBlock();
+}
+
+// Sweeps of deposit addresses into one cold wallet. The deposits of a sweep
+// come from a few funding txns, each paying many deposit addresses.
+static CBlock BuildConsolidationBlock()
+{
+    SyntheticBlockBuilder builder;
+    const CScript cold_wallet_script = builder.RandomScript(TX_WITNESS_V0_SCRIPTHASH);
+    for (int i = 0; i < 25; i++) {
+        CMutableTransaction tx = builder.NewTx();
+        std::vector<uint256> funding_txids(8);
+        for (uint256& txid : funding_txids)
+            txid = builder.RandomPrevOut().hash;
+        for (int j = 0; j < 100; j++) {
+            const COutPoint prevout(funding_txids[builder.RandomRange(funding_txids.size())], builder.RandomRange(50));
+            tx.vin.push_back(builder.WitnessSpend(prevout, builder.NextSigKey(), true));
+        }
+        tx.vout.emplace_back(builder.RandomAmount(), cold_wallet_script);
+        builder.Add(tx);
+    }
+    return builder.GetBlock();
+}
+
+static void EncodeChunkCodedBlock(benchmark::State& state, const char* kind, const CBlock& block, codec_version_t codec_version)
+{
+    const size_t block_size = GetSerializeSize(block, PROTOCOL_VERSION);
+    size_t header_size = 0, coded_size = 0;
+    while (state.KeepRunning()) {
+        CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, codec_version, true);
+        ChunkCodedBlock codedBlock(block, headerAndIDs);
+        header_size = GetSerializeSize(headerAndIDs, PROTOCOL_VERSION);
+        coded_size = codedBlock.GetCodedBlock().size();
+    }
+
+    fprintf(stderr, "%s block, codec v%u: %lu block bytes coded into %lu header bytes + %lu chunk-coded bytes (%lu chunks), ratio %.3f\n",
+            kind, codec_version, block_size, header_size, coded_size, coded_size / FEC_CHUNK_SIZE,
+            double(header_size + coded_size) / block_size);
+}
+
+static void DecodeChunkCodedBlock(benchmark::State& state, const CBlock& block, codec_version_t codec_version)
+{
+    const std::vector<std::pair<uint256, CTransactionRef>> no_extra_txn;
+    const CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, codec_version, true);
+    const std::vector<unsigned char> coded_block = ChunkCodedBlock(block, headerAndIDs).GetCodedBlock();
+
+    // Decode every txn from the chunks, ie receive blocks with an empty mempool
+    CTxMemPool pool;
+    while (state.KeepRunning()) {
+        PartiallyDownloadedChunkBlock partialBlock(&pool);
+        ReadStatus status = partialBlock.InitData(headerAndIDs, no_extra_txn);
+        assert(status == READ_STATUS_OK);
+        for (size_t j = 0; j < DIV_CEIL(coded_block.size(), FEC_CHUNK_SIZE); j++) {
+            memcpy(partialBlock.GetChunk(j), &coded_block[j * FEC_CHUNK_SIZE], FEC_CHUNK_SIZE);
+            partialBlock.MarkChunkAvailable(j);
+        }
+        status = partialBlock.FinalizeBlock();
+        assert(status == READ_STATUS_OK);
+        assert(BlockMerkleRoot(*partialBlock.GetBlock()) == block.hashMerkleRoot);
+    }
+}
+
+static void EncodeChunkCodedRealBlockV1(benchmark::State& state) { EncodeChunkCodedBlock(state, "Real", ReadRealBlock(), codec_version_t::v1); }
+static void EncodeChunkCodedRealBlockV2(benchmark::State& state) { EncodeChunkCodedBlock(state, "Real", ReadRealBlock(), codec_version_t::v2); }
+static void EncodeChunkCodedSegwitHeavyBlockV1(benchmark::State& state) { EncodeChunkCodedBlock(state, "Segwit-heavy", BuildSegwitHeavyBlock(), codec_version_t::v1); }
+static void EncodeChunkCodedSegwitHeavyBlockV2(benchmark::State& state) { EncodeChunkCodedBlock(state, "Segwit-heavy", BuildSegwitHeavyBlock(), codec_version_t::v2); }
+static void EncodeChunkCodedBatchPayoutBlockV1(benchmark::State& state) { EncodeChunkCodedBlock(state, "Batch payout", BuildBatchPayoutBlock(), codec_version_t::v1); }
+static void EncodeChunkCodedBatchPayoutBlockV2(benchmark::State& state) { EncodeChunkCodedBlock(state, "Batch payout", BuildBatchPayoutBlock(), codec_version_t::v2); }
+static void EncodeChunkCodedConsolidationBlockV1(benchmark::State& state) { EncodeChunkCodedBlock(state, "Consolidation", BuildConsolidationBlock(), codec_version_t::v1); }
+static void EncodeChunkCodedConsolidationBlockV2(benchmark::State& state) { EncodeChunkCodedBlock(state, "Consolidation", BuildConsolidationBlock(), codec_version_t::v2); }
+static void DecodeChunkCodedRealBlockV1(benchmark::State& state) { DecodeChunkCodedBlock(state, ReadRealBlock(), codec_version_t::v1); }
+static void DecodeChunkCodedRealBlockV2(benchmark::State& state) { DecodeChunkCodedBlock(state, ReadRealBlock(), codec_version_t::v2); }
+static void DecodeChunkCodedSegwitHeavyBlockV1(benchmark::State& state) { DecodeChunkCodedBlock(state, BuildSegwitHeavyBlock(), codec_version_t::v1); }
+static void DecodeChunkCodedSegwitHeavyBlockV2(benchmark::State& state) { DecodeChunkCodedBlock(state, BuildSegwitHeavyBlock(), codec_version_t::v2); }
+
+BENCHMARK(EncodeChunkCodedRealBlockV1, 20);
+BENCHMARK(EncodeChunkCodedRealBlockV2, 20);
+BENCHMARK(EncodeChunkCodedSegwitHeavyBlockV1, 20);
+BENCHMARK(EncodeChunkCodedSegwitHeavyBlockV2, 20);
+BENCHMARK(EncodeChunkCodedBatchPayoutBlockV1, 20);
+BENCHMARK(EncodeChunkCodedBatchPayoutBlockV2, 20);
+BENCHMARK(EncodeChunkCodedConsolidationBlockV1, 20);
+BENCHMARK(EncodeChunkCodedConsolidationBlockV2, 20);
+BENCHMARK(DecodeChunkCodedRealBlockV1, 20);
+BENCHMARK(DecodeChunkCodedRealBlockV2, 20);
+BENCHMARK(DecodeChunkCodedSegwitHeavyBlockV1, 20);
+BENCHMARK(DecodeChunkCodedSegwitHeavyBlockV2, 20);
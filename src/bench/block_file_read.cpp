@@ -0,0 +1,130 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <bench/data.h>
+
+#include <blockfilemap.h>
+#include <clientversion.h>
+#include <crypto/common.h>
+#include <flatfile.h>
+#include <fs.h>
+#include <primitives/block.h>
+#include <random.h>
+#include <streams.h>
+
+#include <algorithm>
+#include <vector>
+
+//! Copies of the benchmark block in the block file
+static const int BLOCK_FILE_BLOCKS = 32;
+
+// Blocks read through buffered file I/O, the way ReadBlockFromDisk does
+// without mappings, or deserialized straight from a mapping of the file, in
+// file order or in random order.
+
+namespace {
+class BlockFile
+{
+public:
+    const fs::path dir;
+    FlatFileSeq seq;
+    std::vector<FlatFilePos> positions;
+
+    BlockFile() : dir(fs::temp_directory_path() / fs::unique_path("bench_blockfile_%%%%%%%%")), seq(dir, "blk", 16 << 20)
+    {
+        fs::create_directories(dir);
+        const std::vector<uint8_t>& raw = benchmark::data::block413567;
+        FILE* file = seq.Open(FlatFilePos(0, 0));
+        assert(file);
+        unsigned char header[8] = {0xf9, 0xbe, 0xb4, 0xd9};
+        WriteLE32(header + 4, raw.size());
+        for (int n = 0; n < BLOCK_FILE_BLOCKS; n++) {
+            positions.emplace_back(0, ftell(file) + sizeof(header));
+            assert(fwrite(header, 1, sizeof(header), file) == sizeof(header));
+            assert(fwrite(raw.data(), 1, raw.size(), file) == raw.size());
+        }
+        fclose(file);
+    }
+
+    ~BlockFile() { fs::remove_all(dir); }
+
+    std::vector<FlatFilePos> Order(bool random) const
+    {
+        std::vector<FlatFilePos> order = positions;
+        if (random)
+            Shuffle(order.begin(), order.end(), FastRandomContext(true));
+        return order;
+    }
+};
+} // namespace
+
+static void ReadBlockFile(benchmark::State& state, bool random)
+{
+    BlockFile blocks;
+    const std::vector<FlatFilePos> order = blocks.Order(random);
+    while (state.KeepRunning()) {
+        for (const FlatFilePos& pos : order) {
+            CAutoFile file(blocks.seq.Open(pos, true), SER_DISK, CLIENT_VERSION);
+            CBlock block;
+            file >> block;
+            assert(!block.vtx.empty());
+        }
+    }
+}
+
+static void MapBlockFile(benchmark::State& state, bool random)
+{
+    BlockFile blocks;
+    BlockFileMaps maps;
+    const std::vector<FlatFilePos> order = blocks.Order(random);
+    while (state.KeepRunning()) {
+        for (const FlatFilePos& pos : order) {
+            MappedBlockData data;
+            assert(maps.Read(blocks.seq, pos, benchmark::data::block413567.size(), data));
+            CBlock block;
+            SpanReader(SER_DISK, CLIENT_VERSION, data.span()) >> block;
+            assert(!block.vtx.empty());
+        }
+    }
+}
+
+// Raw blocks as served to peers, copied out of the file or referenced in the mapping
+static void ReadRawBlockFile(benchmark::State& state)
+{
+    BlockFile blocks;
+    const std::vector<FlatFilePos> order = blocks.Order(true);
+    while (state.KeepRunning()) {
+        for (const FlatFilePos& pos : order) {
+            CAutoFile file(blocks.seq.Open(pos, true), SER_DISK, CLIENT_VERSION);
+            std::vector<uint8_t> block(benchmark::data::block413567.size());
+            file.read((char*)block.data(), block.size());
+        }
+    }
+}
+
+static void MapRawBlockFile(benchmark::State& state)
+{
+    BlockFile blocks;
+    BlockFileMaps maps;
+    const std::vector<FlatFilePos> order = blocks.Order(true);
+    while (state.KeepRunning()) {
+        for (const FlatFilePos& pos : order) {
+            MappedBlockData data;
+            assert(maps.Read(blocks.seq, pos, benchmark::data::block413567.size(), data));
+        }
+    }
+}
+
+static void ReadBlockFileSequential(benchmark::State& state) { ReadBlockFile(state, false); }
+static void ReadBlockFileRandom(benchmark::State& state) { ReadBlockFile(state, true); }
+static void MapBlockFileSequential(benchmark::State& state) { MapBlockFile(state, false); }
+static void MapBlockFileRandom(benchmark::State& state) { MapBlockFile(state, true); }
+
+BENCHMARK(ReadBlockFileSequential, 5);
+BENCHMARK(ReadBlockFileRandom, 5);
+BENCHMARK(MapBlockFileSequential, 5);
+BENCHMARK(MapBlockFileRandom, 5);
+BENCHMARK(ReadRawBlockFile, 20);
+BENCHMARK(MapRawBlockFile, 20);
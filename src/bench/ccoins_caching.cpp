@@ -5,8 +5,12 @@
 #include <bench/bench.h>
 #include <coins.h>
 #include <policy/policy.h>
+#include <random.h>
 #include <script/signingprovider.h>
+#include <txdb.h>
+#include <util/time.h>
 
+#include <algorithm>
 #include <vector>
 
 // FIXME: Dedup with SetupDummyInputs in test/transaction_tests.cpp.
@@ -86,3 +90,113 @@ static void CCoinsCaching(benchmark::State& state)
 }
 
 BENCHMARK(CCoinsCaching, 170 * 1000);
+
+static const size_t LARGE_CACHE_COINS = 100000;
+
+static std::vector<COutPoint> FillCache(CCoinsViewCache& coins, size_t n)
+{
+    std::vector<COutPoint> outpoints;
+    outpoints.reserve(n);
+    FastRandomContext rng(true);
+    for (size_t i = 0; i < n; i++) {
+        outpoints.emplace_back(rng.rand256(), i % 4);
+        coins.AddCoin(outpoints.back(), Coin(CTxOut(i, CScript() << OP_TRUE), 1, false), false);
+    }
+    return outpoints;
+}
+
+// Lookups of coins in a large cache, in random order
+static void CCoinsCachingAccessCoin(benchmark::State& state)
+{
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(&coinsDummy);
+    const std::vector<COutPoint> outpoints = FillCache(coins, LARGE_CACHE_COINS);
+
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const Coin& coin = coins.AccessCoin(outpoints[i++ % outpoints.size()]);
+        assert(!coin.IsSpent());
+    }
+}
+
+// Creation and spending of fresh coins, i.e. allocation and release of cache
+// entries, on top of a large cache
+static void CCoinsCachingAddSpend(benchmark::State& state)
+{
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(&coinsDummy);
+    FillCache(coins, LARGE_CACHE_COINS);
+
+    // Output indexes past the ones used by FillCache, to not collide with its coins
+    FastRandomContext rng(true);
+    std::vector<COutPoint> outpoints(100);
+    for (COutPoint& outpoint : outpoints)
+        outpoint = COutPoint(rng.rand256(), 4);
+    while (state.KeepRunning()) {
+        for (const COutPoint& outpoint : outpoints)
+            coins.AddCoin(outpoint, Coin(CTxOut(1, CScript() << OP_TRUE), 1, false), false);
+        for (const COutPoint& outpoint : outpoints)
+            coins.SpendCoin(outpoint);
+    }
+}
+
+// Memory used per coin by a large cache, compared to a map using the default
+// allocator
+static void CCoinsCachingMemoryUsage(benchmark::State& state)
+{
+    size_t pool_usage = 0, std_usage = 0;
+    while (state.KeepRunning()) {
+        CCoinsView coinsDummy;
+        CCoinsViewCache coins(&coinsDummy);
+        FillCache(coins, LARGE_CACHE_COINS);
+        pool_usage = coins.DynamicMemoryUsage();
+
+        std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> std_map;
+        size_t coins_usage = 0;
+        FastRandomContext rng(true);
+        for (size_t i = 0; i < LARGE_CACHE_COINS; i++) {
+            CCoinsCacheEntry& entry = std_map[COutPoint(rng.rand256(), i % 4)];
+            entry.coin = Coin(CTxOut(i, CScript() << OP_TRUE), 1, false);
+            coins_usage += entry.coin.DynamicMemoryUsage();
+        }
+        std_usage = memusage::DynamicUsage(std_map) + coins_usage;
+    }
+    fprintf(stderr, "CCoinsViewCache with %lu coins: %.1f bytes per coin (%.1f with the default allocator)\n",
+            LARGE_CACHE_COINS, (double)pool_usage / LARGE_CACHE_COINS, (double)std_usage / LARGE_CACHE_COINS);
+}
+
+// Time taken by a flush of a cache of dirty coins to an in-memory database,
+// i.e. the time cs_main is held, with a synchronous write or with the dirty
+// coins written from a snapshot in the background
+static void CCoinsCachingFlush(benchmark::State& state)
+{
+    int64_t full_max = 0, background_max = 0;
+    while (state.KeepRunning()) {
+        for (const bool background : {false, true}) {
+            CCoinsViewDB db("bench_flush", 64 << 20, true, true);
+            CCoinsViewBackgroundFlush flushview(&db, db);
+            CCoinsViewCache coins(&flushview);
+            FillCache(coins, LARGE_CACHE_COINS);
+            coins.SetBestBlock(uint256S("01"));
+
+            const int64_t start = GetTimeMicros();
+            if (background) {
+                CCoinsMap snapshot;
+                coins.SnapshotDirty(snapshot);
+                flushview.StartWrite(std::move(snapshot), coins.GetBestBlock());
+            } else {
+                assert(coins.Flush());
+            }
+            int64_t& longest = background ? background_max : full_max;
+            longest = std::max(longest, GetTimeMicros() - start);
+            assert(flushview.Wait());
+        }
+    }
+    fprintf(stderr, "Flush of %lu coins, longest: %.2fms synchronously, %.2fms in the background\n",
+            LARGE_CACHE_COINS, full_max * 0.001, background_max * 0.001);
+}
+
+BENCHMARK(CCoinsCachingAccessCoin, 5 * 1000 * 1000);
+BENCHMARK(CCoinsCachingAddSpend, 20 * 1000);
+BENCHMARK(CCoinsCachingMemoryUsage, 5);
+BENCHMARK(CCoinsCachingFlush, 2);
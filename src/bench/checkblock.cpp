@@ -10,6 +10,8 @@
 #include <streams.h>
 #include <consensus/validation.h>
 
+#include <boost/thread.hpp>
+
 // These are the two major time-sinks which happen after we have fully received
 // a block off the wire, but before we can relay the block on to peers using
 // compact block relay.
@@ -48,5 +50,38 @@ static void DeserializeAndCheckBlockTest(benchmark::State& state)
     }
 }
 
+// Context-free checks of an already deserialized block, on this thread alone
+// or spread over the block check threads.
+static void CheckBlockTest(benchmark::State& state, int threads)
+{
+    CDataStream stream(benchmark::data::block413567, SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+
+    const int prev_threads = nScriptCheckThreads;
+    nScriptCheckThreads = threads;
+    boost::thread_group threadGroup;
+    for (int i = 0; i < threads - 1; i++)
+        threadGroup.create_thread([i]() { return ThreadBlockCheck(i); });
+
+    while (state.KeepRunning()) {
+        block.fChecked = false;
+        CValidationState validationState;
+        bool checked = CheckBlock(block, validationState, chainParams->GetConsensus());
+        assert(checked);
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    nScriptCheckThreads = prev_threads;
+}
+
+static void CheckBlockSerialTest(benchmark::State& state) { CheckBlockTest(state, 1); }
+static void CheckBlockParallelTest(benchmark::State& state) { CheckBlockTest(state, 4); }
+
 BENCHMARK(DeserializeBlockTest, 130);
 BENCHMARK(DeserializeAndCheckBlockTest, 160);
+BENCHMARK(CheckBlockSerialTest, 160);
+BENCHMARK(CheckBlockParallelTest, 160);
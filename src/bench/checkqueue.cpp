@@ -5,7 +5,11 @@
 #include <bench/bench.h>
 #include <util/system.h>
 #include <checkqueue.h>
+#include <crypto/sha256.h>
+#include <key.h>
 #include <prevector.h>
+#include <primitives/transaction.h>
+#include <script/sigcache.h>
 #include <vector>
 #include <boost/thread/thread.hpp>
 #include <random.h>
@@ -59,3 +63,130 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.join_all();
 }
 BENCHMARK(CCheckQueueSpeedPrevectorJob, 1400);
+
+// Block-sized load of checks costing a few microseconds each, like a
+// signature check, queued one transaction at a time.
+static const size_t SCALING_TXS = 1000;
+static const size_t SCALING_INPUTS = 4;
+static const int SCALING_HASHES = 16;
+
+static void CCheckQueueScaling(benchmark::State& state, int threads)
+{
+    struct HashJob {
+        uint8_t data[32] = {};
+        bool operator()()
+        {
+            for (int i = 0; i < SCALING_HASHES; i++)
+                CSHA256().Write(data, sizeof(data)).Finalize(data);
+            return true;
+        }
+        void swap(HashJob& x) { std::swap(data, x.data); }
+    };
+    CCheckQueue<HashJob> queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    // The master thread verifies too
+    for (auto x = 0; x < threads - 1; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<HashJob> control(&queue);
+        for (size_t tx = 0; tx < SCALING_TXS; ++tx) {
+            std::vector<HashJob> vChecks(SCALING_INPUTS);
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void CCheckQueueScaling2(benchmark::State& state) { CCheckQueueScaling(state, 2); }
+static void CCheckQueueScaling4(benchmark::State& state) { CCheckQueueScaling(state, 4); }
+static void CCheckQueueScaling8(benchmark::State& state) { CCheckQueueScaling(state, 8); }
+static void CCheckQueueScaling16(benchmark::State& state) { CCheckQueueScaling(state, 16); }
+static void CCheckQueueScaling32(benchmark::State& state) { CCheckQueueScaling(state, 32); }
+
+BENCHMARK(CCheckQueueScaling2, 50);
+BENCHMARK(CCheckQueueScaling4, 100);
+BENCHMARK(CCheckQueueScaling8, 200);
+BENCHMARK(CCheckQueueScaling16, 300);
+BENCHMARK(CCheckQueueScaling32, 300);
+
+// Signature checks of a block whose signatures were all verified on entering
+// the mempool, so that each is a signature cache lookup, as many threads look
+// up entries at once.
+static const size_t SIGCACHE_SIGNATURES = 4000;
+
+namespace {
+struct CachedSignatures {
+    CKey key;
+    CPubKey pubkey;
+    std::vector<uint256> hashes;
+    std::vector<std::vector<unsigned char>> sigs;
+    const CTransaction tx{CMutableTransaction()};
+    PrecomputedTransactionData txdata{tx};
+
+    CachedSignatures()
+    {
+        key.MakeNewKey(true);
+        pubkey = key.GetPubKey();
+        FastRandomContext rng(true);
+        CachingTransactionSignatureChecker checker(&tx, 0, 0, true, txdata);
+        for (size_t i = 0; i < SIGCACHE_SIGNATURES; i++) {
+            hashes.push_back(rng.rand256());
+            sigs.emplace_back();
+            key.Sign(hashes.back(), sigs.back());
+            assert(checker.VerifySignature(sigs.back(), pubkey, hashes.back()));
+        }
+    }
+};
+} // namespace
+
+static void CCheckQueueSigCacheScaling(benchmark::State& state, int threads)
+{
+    struct SigCacheJob {
+        const CachedSignatures* sigs = nullptr;
+        size_t index = 0;
+        bool operator()()
+        {
+            CachingTransactionSignatureChecker checker(&sigs->tx, 0, 0, true, const_cast<PrecomputedTransactionData&>(sigs->txdata));
+            return checker.VerifySignature(sigs->sigs[index], sigs->pubkey, sigs->hashes[index]);
+        }
+        void swap(SigCacheJob& x)
+        {
+            std::swap(sigs, x.sigs);
+            std::swap(index, x.index);
+        }
+    };
+    const CachedSignatures sigs;
+    CCheckQueue<SigCacheJob> queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    // The master thread verifies too
+    for (auto x = 0; x < threads - 1; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<SigCacheJob> control(&queue);
+        for (size_t i = 0; i < SIGCACHE_SIGNATURES; i += SCALING_INPUTS) {
+            std::vector<SigCacheJob> vChecks(SCALING_INPUTS);
+            for (size_t n = 0; n < SCALING_INPUTS; n++) {
+                vChecks[n].sigs = &sigs;
+                vChecks[n].index = i + n;
+            }
+            control.Add(vChecks);
+        }
+        assert(control.Wait());
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void CCheckQueueSigCacheScaling2(benchmark::State& state) { CCheckQueueSigCacheScaling(state, 2); }
+static void CCheckQueueSigCacheScaling4(benchmark::State& state) { CCheckQueueSigCacheScaling(state, 4); }
+static void CCheckQueueSigCacheScaling8(benchmark::State& state) { CCheckQueueSigCacheScaling(state, 8); }
+static void CCheckQueueSigCacheScaling16(benchmark::State& state) { CCheckQueueSigCacheScaling(state, 16); }
+
+BENCHMARK(CCheckQueueSigCacheScaling2, 50);
+BENCHMARK(CCheckQueueSigCacheScaling4, 100);
+BENCHMARK(CCheckQueueSigCacheScaling8, 200);
+BENCHMARK(CCheckQueueSigCacheScaling16, 300);
@@ -131,4 +131,115 @@ static void MempoolEviction(benchmark::State& state)
     }
 }
 
+//! Chains leaving each root, which join again in the last transaction of a package
+static const int PACKAGE_CHAINS = 4;
+static const int PACKAGE_CHAIN_LENGTH = 5;
+
+static CTransactionRef MakePackageTx(const std::vector<COutPoint>& prevouts, int outputs, int tag)
+{
+    CMutableTransaction tx;
+    for (const COutPoint& prevout : prevouts) {
+        tx.vin.emplace_back(prevout);
+        tx.vin.back().scriptSig = CScript() << tag;
+    }
+    if (prevouts.empty()) {
+        tx.vin.emplace_back();
+        tx.vin.back().scriptSig = CScript() << tag;
+    }
+    tx.vout.resize(outputs);
+    for (CTxOut& out : tx.vout) {
+        out.scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        out.nValue = COIN;
+    }
+    return MakeTransactionRef(tx);
+}
+
+namespace {
+/** Deep CPFP packages, each hanging off a root transaction */
+struct Packages {
+    std::vector<CTransactionRef> roots;
+    //! All other transactions, parents before children
+    std::vector<CTransactionRef> descendants;
+    //! Spends of the last transaction of each package, not in the mempool
+    std::vector<CTransactionRef> tips;
+
+    explicit Packages(int count)
+    {
+        int tag = 0;
+        for (int p = 0; p < count; p++) {
+            roots.push_back(MakePackageTx({}, PACKAGE_CHAINS, ++tag));
+            std::vector<COutPoint> ends;
+            for (int c = 0; c < PACKAGE_CHAINS; c++) {
+                COutPoint prevout(roots.back()->GetHash(), c);
+                for (int n = 0; n < PACKAGE_CHAIN_LENGTH; n++) {
+                    descendants.push_back(MakePackageTx({prevout}, 1, ++tag));
+                    prevout = COutPoint(descendants.back()->GetHash(), 0);
+                }
+                ends.push_back(prevout);
+            }
+            descendants.push_back(MakePackageTx(ends, 1, ++tag));
+            tips.push_back(MakePackageTx({COutPoint(descendants.back()->GetHash(), 0)}, 1, ++tag));
+        }
+    }
+
+    void AddTo(CTxMemPool& pool) const EXCLUSIVE_LOCKS_REQUIRED(cs_main, pool.cs)
+    {
+        for (const CTransactionRef& tx : roots)
+            AddTx(tx, 1000, pool);
+        for (const CTransactionRef& tx : descendants)
+            AddTx(tx, 2000, pool);
+    }
+};
+} // namespace
+
+// Ancestor and descendant limit checks of transactions spending deep packages,
+// as done for every transaction accepted
+static void MempoolAncestorLimits(benchmark::State& state)
+{
+    const Packages packages(100);
+    CTxMemPool pool;
+    LOCK2(cs_main, pool.cs);
+    packages.AddTo(pool);
+
+    std::vector<CTxMemPoolEntry> entries;
+    for (const CTransactionRef& tx : packages.tips) {
+        entries.emplace_back(tx, 3000, 0, 1, false, 4, LockPoints());
+    }
+    const uint64_t limit_count = PACKAGE_CHAINS * PACKAGE_CHAIN_LENGTH + 3;
+    std::string err;
+    while (state.KeepRunning()) {
+        for (const CTxMemPoolEntry& entry : entries) {
+            CTxMemPool::setEntries ancestors;
+            bool ret = pool.CalculateMemPoolAncestors(entry, ancestors, limit_count, 101000, limit_count, 101000, err);
+            assert(ret);
+        }
+    }
+}
+
+// The roots of the packages confirmed in a block, which is then disconnected
+// again: the roots are added back to the mempool and their descendants
+// recounted, as on a reorg.
+static void MempoolReorgUpdate(benchmark::State& state)
+{
+    const Packages packages(100);
+    CTxMemPool pool;
+    LOCK2(cs_main, pool.cs);
+    packages.AddTo(pool);
+
+    std::vector<uint256> root_hashes;
+    for (const CTransactionRef& tx : packages.roots) {
+        root_hashes.push_back(tx->GetHash());
+    }
+    while (state.KeepRunning()) {
+        pool.removeForBlock(packages.roots, 1);
+        for (const CTransactionRef& tx : packages.roots) {
+            AddTx(tx, 1000, pool);
+        }
+        pool.UpdateTransactionsFromBlock(root_hashes);
+    }
+    assert(pool.size() == packages.roots.size() + packages.descendants.size());
+}
+
 BENCHMARK(MempoolEviction, 41000);
+BENCHMARK(MempoolAncestorLimits, 100);
+BENCHMARK(MempoolReorgUpdate, 50);
@@ -0,0 +1,125 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <policy/fees.h>
+#include <policy/policy.h>
+#include <random.h>
+#include <txmempool.h>
+
+#include <algorithm>
+#include <vector>
+
+//! Blocks of the history, and transactions entering the mempool per block
+static const int HISTORY_BLOCKS = 200;
+static const int HISTORY_BLOCK_TXS = 300;
+//! Transactions mined per block, the highest paying first, so that the mempool backs up
+static const int HISTORY_BLOCK_MINED = 250;
+//! Blocks after which unmined transactions leave the mempool
+static const int HISTORY_EXPIRY = 48;
+
+// The estimator fed a mempool and block history as the mempool feeds it,
+// with the estimates a wallet would ask for after every block.
+
+namespace {
+struct FeeHistory {
+    struct Block {
+        std::vector<size_t> added;
+        std::vector<const CTxMemPoolEntry*> mined;
+        std::vector<size_t> expired;
+    };
+
+    std::vector<CTxMemPoolEntry> entries;
+    std::vector<Block> blocks;
+
+    FeeHistory()
+    {
+        FastRandomContext rng(true);
+        LockPoints lp;
+        entries.reserve(HISTORY_BLOCKS * HISTORY_BLOCK_TXS);
+        for (int height = 0; height < HISTORY_BLOCKS; height++) {
+            for (int n = 0; n < HISTORY_BLOCK_TXS; n++) {
+                CMutableTransaction tx;
+                tx.vin.resize(1);
+                tx.vin[0].prevout.n = entries.size();
+                tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(100 + rng.randrange(100));
+                tx.vout.resize(1);
+                tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+                const CTransactionRef ptx = MakeTransactionRef(tx);
+                const CAmount fee = (1 + rng.randrange(200)) * GetVirtualTransactionSize(*ptx);
+                entries.emplace_back(ptx, fee, 0, height, false, 4, lp);
+            }
+        }
+
+        // Which transactions enter the mempool, are mined and expire at each height
+        std::vector<size_t> pending;
+        blocks.resize(HISTORY_BLOCKS);
+        for (int height = 0; height < HISTORY_BLOCKS; height++) {
+            Block& block = blocks[height];
+            for (int n = 0; n < HISTORY_BLOCK_TXS; n++) {
+                block.added.push_back(height * HISTORY_BLOCK_TXS + n);
+                pending.push_back(block.added.back());
+            }
+            std::sort(pending.begin(), pending.end(), [&](size_t a, size_t b) {
+                return CompareTxMemPoolEntryByAncestorFee()(entries[a], entries[b]);
+            });
+            const size_t mined = std::min<size_t>(HISTORY_BLOCK_MINED, pending.size());
+            for (size_t i = 0; i < mined; i++)
+                block.mined.push_back(&entries[pending[i]]);
+            pending.erase(pending.begin(), pending.begin() + mined);
+            for (auto it = pending.begin(); it != pending.end();) {
+                if (entries[*it].GetHeight() + HISTORY_EXPIRY <= (unsigned int)height) {
+                    block.expired.push_back(*it);
+                    it = pending.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+
+    void Replay(CBlockPolicyEstimator& estimator, bool estimate)
+    {
+        for (int height = 0; height < HISTORY_BLOCKS; height++) {
+            Block& block = blocks[height];
+            for (size_t tx : block.added)
+                estimator.processTransaction(entries[tx], true);
+            estimator.processBlock(height + 1, block.mined);
+            for (size_t tx : block.expired)
+                estimator.removeTx(entries[tx].GetTx().GetHash(), false);
+            if (estimate) {
+                for (int target : {2, 6, 12, 24, 48}) {
+                    FeeCalculation fee_calc;
+                    estimator.estimateSmartFee(target, &fee_calc, true);
+                }
+            }
+        }
+    }
+};
+} // namespace
+
+static void PolicyEstimatorReplay(benchmark::State& state)
+{
+    FeeHistory history;
+    while (state.KeepRunning()) {
+        CBlockPolicyEstimator estimator;
+        history.Replay(estimator, true);
+    }
+}
+
+static void PolicyEstimatorEstimate(benchmark::State& state)
+{
+    FeeHistory history;
+    CBlockPolicyEstimator estimator;
+    history.Replay(estimator, false);
+    while (state.KeepRunning()) {
+        for (int target = 1; target <= 48; target++) {
+            FeeCalculation fee_calc;
+            estimator.estimateSmartFee(target, &fee_calc, target % 2 == 0);
+        }
+    }
+}
+
+BENCHMARK(PolicyEstimatorReplay, 2);
+BENCHMARK(PolicyEstimatorEstimate, 100);
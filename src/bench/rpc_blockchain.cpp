@@ -8,26 +8,63 @@
 #include <validation.h>
 #include <streams.h>
 #include <consensus/validation.h>
+#include <jsonwriter.h>
 #include <rpc/blockchain.h>
 
 #include <univalue.h>
 
-static void BlockToJsonVerbose(benchmark::State& state) {
-    CDataStream stream(benchmark::data::block413567, SER_NETWORK, PROTOCOL_VERSION);
-    char a = '\0';
-    stream.write(&a, 1); // Prevent compaction
-
+namespace {
+struct TestBlockAndIndex {
     CBlock block;
-    stream >> block;
-
+    uint256 blockHash;
     CBlockIndex blockindex;
-    const uint256 blockHash = block.GetHash();
-    blockindex.phashBlock = &blockHash;
-    blockindex.nBits = 403014710;
 
+    TestBlockAndIndex()
+    {
+        CDataStream stream(benchmark::data::block413567, SER_NETWORK, PROTOCOL_VERSION);
+        char a = '\0';
+        stream.write(&a, 1); // Prevent compaction
+
+        stream >> block;
+
+        blockHash = block.GetHash();
+        blockindex.phashBlock = &blockHash;
+        blockindex.nBits = 403014710;
+    }
+};
+} // namespace
+
+static void BlockToJsonVerbose(benchmark::State& state) {
+    TestBlockAndIndex data;
+    while (state.KeepRunning()) {
+        (void)blockToJSON(data.block, &data.blockindex, &data.blockindex, /*verbose*/ true);
+    }
+}
+
+// The text of the reply, as built before it is sent: a UniValue written out,
+// or streamed out in chunks with no UniValue built.
+static void BlockToJsonVerboseWrite(benchmark::State& state) {
+    TestBlockAndIndex data;
+    while (state.KeepRunning()) {
+        std::string json = blockToJSON(data.block, &data.blockindex, &data.blockindex, /*verbose*/ true).write() + "\n";
+        assert(!json.empty());
+    }
+}
+
+static void BlockToJsonVerboseStream(benchmark::State& state) {
+    TestBlockAndIndex data;
     while (state.KeepRunning()) {
-        (void)blockToJSON(block, &blockindex, &blockindex, /*verbose*/ true);
+        size_t size = 0;
+        JSONStreamWriter writer([&](const char* chunk, size_t chunk_size) { size += chunk_size; });
+        writer.BeginObject();
+        blockToJSON(writer, data.block, &data.blockindex, &data.blockindex, /*verbose*/ true);
+        writer.EndObject();
+        writer.Raw("\n");
+        writer.Flush();
+        assert(size > 0);
     }
 }
 
 BENCHMARK(BlockToJsonVerbose, 10);
+BENCHMARK(BlockToJsonVerboseWrite, 10);
+BENCHMARK(BlockToJsonVerboseStream, 10);
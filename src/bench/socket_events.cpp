@@ -0,0 +1,155 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <compat.h>
+#include <netbase.h>
+#include <random.h>
+#include <sync.h>
+
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#ifdef USE_POLL
+#include <poll.h>
+#endif
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+//! Simulated peers, each connected over loopback TCP
+static const int SOCKET_EVENTS_PEERS = 200;
+
+// The socket handler waking up for one peer out of many which sent a message,
+// with the readiness sets generated from all peers on every wakeup as
+// GenerateSelectSet does, or with the sockets registered once with epoll.
+
+#if defined(USE_POLL) && !defined(WIN32)
+namespace {
+struct LoopbackPeers {
+    //! Our ends of the connections
+    std::vector<SOCKET> sockets;
+    //! The peers' ends
+    std::vector<SOCKET> remotes;
+    //! Stands in for the lock taken on each node's send queue
+    std::vector<std::unique_ptr<CCriticalSection>> locks;
+    FastRandomContext rng{true};
+
+    LoopbackPeers()
+    {
+        SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        assert(listener != INVALID_SOCKET);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        assert(bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+        assert(getsockname(listener, (struct sockaddr*)&addr, &len) == 0);
+        assert(listen(listener, SOCKET_EVENTS_PEERS) == 0);
+        for (int i = 0; i < SOCKET_EVENTS_PEERS; i++) {
+            SOCKET remote = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            assert(connect(remote, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+            remotes.push_back(remote);
+            sockets.push_back(accept(listener, nullptr, nullptr));
+            assert(sockets.back() != INVALID_SOCKET);
+            locks.emplace_back(new CCriticalSection);
+        }
+        CloseSocket(listener);
+    }
+
+    ~LoopbackPeers()
+    {
+        for (SOCKET& socket : sockets)
+            CloseSocket(socket);
+        for (SOCKET& socket : remotes)
+            CloseSocket(socket);
+    }
+
+    //! Have a random peer send a byte, and return our socket it arrives on
+    SOCKET Send()
+    {
+        const size_t peer = rng.randrange(remotes.size());
+        const char byte = 0;
+        assert(send(remotes[peer], &byte, 1, MSG_NOSIGNAL) == 1);
+        return sockets[peer];
+    }
+
+    static void Receive(SOCKET socket)
+    {
+        char byte;
+        assert(recv(socket, &byte, 1, MSG_DONTWAIT) == 1);
+    }
+};
+} // namespace
+
+static void SocketEventsPoll(benchmark::State& state)
+{
+    LoopbackPeers peers;
+    while (state.KeepRunning()) {
+        const SOCKET sent = peers.Send();
+
+        std::set<SOCKET> recv_select_set, error_select_set;
+        for (size_t i = 0; i < peers.sockets.size(); i++) {
+            {
+                LOCK(*peers.locks[i]);
+            }
+            recv_select_set.insert(peers.sockets[i]);
+            error_select_set.insert(peers.sockets[i]);
+        }
+        std::unordered_map<SOCKET, struct pollfd> pollfds;
+        for (SOCKET socket_id : recv_select_set) {
+            pollfds[socket_id].fd = socket_id;
+            pollfds[socket_id].events |= POLLIN;
+        }
+        for (SOCKET socket_id : error_select_set) {
+            pollfds[socket_id].fd = socket_id;
+            pollfds[socket_id].events |= POLLERR|POLLHUP;
+        }
+        std::vector<struct pollfd> vpollfds;
+        vpollfds.reserve(pollfds.size());
+        for (auto it : pollfds) {
+            vpollfds.push_back(std::move(it.second));
+        }
+        assert(poll(vpollfds.data(), vpollfds.size(), 1000) == 1);
+
+        std::set<SOCKET> recv_set;
+        for (const struct pollfd& pollfd_entry : vpollfds) {
+            if (pollfd_entry.revents & POLLIN) recv_set.insert(pollfd_entry.fd);
+        }
+        assert(recv_set.count(sent));
+        LoopbackPeers::Receive(sent);
+    }
+}
+
+BENCHMARK(SocketEventsPoll, 1000);
+#endif
+
+#ifdef USE_EPOLL
+static void SocketEventsEpoll(benchmark::State& state)
+{
+    LoopbackPeers peers;
+    const int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    assert(epoll_fd != -1);
+    for (SOCKET socket : peers.sockets) {
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        event.data.fd = socket;
+        assert(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket, &event) == 0);
+    }
+
+    while (state.KeepRunning()) {
+        const SOCKET sent = peers.Send();
+        struct epoll_event events[256];
+        assert(epoll_wait(epoll_fd, events, 256, 1000) == 1);
+        assert((SOCKET)events[0].data.fd == sent);
+        LoopbackPeers::Receive(sent);
+    }
+    close(epoll_fd);
+}
+
+BENCHMARK(SocketEventsEpoll, 1000);
+#endif
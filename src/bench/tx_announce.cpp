@@ -0,0 +1,115 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <net_processing.h>
+#include <primitives/transaction.h>
+#include <random.h>
+#include <script/script.h>
+#include <txmempool.h>
+#include <validation.h>
+
+#include <deque>
+#include <memory>
+#include <set>
+#include <vector>
+
+//! Peers, with as many outbound ones as are made by default
+static const int TX_ANNOUNCE_PEERS = 125;
+static const int TX_ANNOUNCE_OUTBOUND_PEERS = 8;
+//! Transactions relayed per second, 10000 a minute
+static const int TX_ANNOUNCE_PER_SECOND = 167;
+//! Transactions in the mempool, the oldest of which are mined as new ones arrive
+static const size_t TX_ANNOUNCE_MEMPOOL = 10000;
+//! As INVENTORY_BROADCAST_MAX
+static const size_t TX_ANNOUNCE_MAX = 35;
+
+// A second of relaying transactions to many peers, with their pending
+// announcements ordered in the ranking shared by all peers, or with an empty
+// ranking, so that each peer orders its own in the mempool.
+
+namespace {
+class AnnouncingNode
+{
+private:
+    CTxMemPool m_pool;
+    TxAnnouncementOrder m_order;
+    std::vector<std::set<uint256>> m_pending;
+    std::deque<CTransactionRef> m_txs;
+    FastRandomContext m_rng{true};
+    int64_t m_now{0};
+
+    //! Accept a second's worth of transactions, queueing them for all peers, and mine the oldest
+    void Receive()
+    {
+        LOCK2(cs_main, m_pool.cs);
+        for (int i = 0; i < TX_ANNOUNCE_PER_SECOND; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            // Some transactions spend the one before, so that there are chains to keep in order
+            if (!m_txs.empty() && m_rng.randrange(4) == 0) {
+                tx.vin[0].prevout = COutPoint(m_txs.back()->GetHash(), 0);
+            } else {
+                tx.vin[0].prevout = COutPoint(m_rng.rand256(), 0);
+            }
+            tx.vout.resize(1);
+            tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+            tx.vout[0].nValue = COIN;
+            CTransactionRef ref = MakeTransactionRef(tx);
+            LockPoints lp;
+            m_pool.addUnchecked(CTxMemPoolEntry(ref, 1000 + m_rng.randrange(100000), 0, 1, false, 4, lp));
+            m_order.Add(ref->GetHash(), m_now * 1000000);
+            for (std::set<uint256>& pending : m_pending)
+                pending.insert(ref->GetHash());
+            m_txs.push_back(std::move(ref));
+        }
+        while (m_txs.size() > TX_ANNOUNCE_MEMPOOL) {
+            m_pool.removeRecursive(*m_txs.front(), MemPoolRemovalReason::BLOCK);
+            m_txs.pop_front();
+        }
+    }
+
+public:
+    AnnouncingNode() : m_pending(TX_ANNOUNCE_PEERS) {}
+
+    void Second(bool ranked)
+    {
+        m_now++;
+        Receive();
+        const auto unranked = std::make_shared<const TxAnnouncementOrder::Ranking>();
+        for (int peer = 0; peer < TX_ANNOUNCE_PEERS; peer++) {
+            // Inbound peers share a trickle timer with a 5 second average, outbound ones have their own of half that
+            const bool trickle = peer < TX_ANNOUNCE_OUTBOUND_PEERS ? (m_now + peer) % 2 == 0 : m_now % 5 == 0;
+            if (!trickle) continue;
+            const std::shared_ptr<const TxAnnouncementOrder::Ranking> ranking = ranked ? m_order.GetRanking(m_pool, m_now * 1000000) : unranked;
+            // Every fourth peer has a fee filter
+            const CAmount min_fee = peer % 4 == 0 ? 200000 : 0;
+            const std::vector<TxMempoolInfo> announced = PopTxAnnouncements(m_pool, *ranking, m_pending[peer], TX_ANNOUNCE_MAX, [min_fee](const TxMempoolInfo& info) {
+                return info.feeRate.GetFeePerK() >= min_fee;
+            });
+            assert(announced.size() <= TX_ANNOUNCE_MAX);
+        }
+    }
+};
+} // namespace
+
+static void TxAnnounceRanked(benchmark::State& state)
+{
+    AnnouncingNode node;
+    while (state.KeepRunning()) {
+        node.Second(true);
+    }
+}
+
+static void TxAnnounceMempoolOrder(benchmark::State& state)
+{
+    AnnouncingNode node;
+    while (state.KeepRunning()) {
+        node.Second(false);
+    }
+}
+
+BENCHMARK(TxAnnounceRanked, 20);
+BENCHMARK(TxAnnounceMempoolOrder, 5);
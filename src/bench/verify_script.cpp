@@ -8,6 +8,7 @@
 #include <script/bitcoinconsensus.h>
 #endif
 #include <script/script.h>
+#include <script/sigcache.h>
 #include <script/standard.h>
 #include <streams.h>
 
@@ -49,8 +50,10 @@ static CMutableTransaction BuildSpendingTransaction(const CScript& scriptSig, co
 }
 
 // Microbenchmark for verification of a basic P2WPKH script. Can be easily
-// modified to measure performance of other types of scripts.
-static void VerifyScriptBench(benchmark::State& state)
+// modified to measure performance of other types of scripts. If cached, the
+// signature is checked once up front and from then on found in the signature
+// cache, as for a transaction of a block that was in the mempool.
+static void VerifyScriptP2WPKH(benchmark::State& state, bool cached)
 {
     const int flags = SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_P2SH;
     const int witnessversion = 0;
@@ -79,6 +82,25 @@ static void VerifyScriptBench(benchmark::State& state)
     witness.stack.back().push_back(static_cast<unsigned char>(SIGHASH_ALL));
     witness.stack.push_back(ToByteVector(pubkey));
 
+    if (cached) {
+        const CTransaction tx(txSpend);
+        PrecomputedTransactionData txdata(tx);
+        CachingTransactionSignatureChecker checker(&tx, 0, txCredit.vout[0].nValue, true, txdata);
+        while (state.KeepRunning()) {
+            ScriptError err;
+            bool success = VerifyScript(
+                tx.vin[0].scriptSig,
+                txCredit.vout[0].scriptPubKey,
+                &tx.vin[0].scriptWitness,
+                flags,
+                checker,
+                &err);
+            assert(err == SCRIPT_ERR_OK);
+            assert(success);
+        }
+        return;
+    }
+
     // Benchmark.
     while (state.KeepRunning()) {
         ScriptError err;
@@ -105,4 +127,8 @@ static void VerifyScriptBench(benchmark::State& state)
     }
 }
 
+static void VerifyScriptBench(benchmark::State& state) { VerifyScriptP2WPKH(state, false); }
+static void VerifyScriptCachedBench(benchmark::State& state) { VerifyScriptP2WPKH(state, true); }
+
 BENCHMARK(VerifyScriptBench, 6300);
+BENCHMARK(VerifyScriptCachedBench, 200000);
@@ -9,6 +9,7 @@
 #include <chainparams.h>
 #include <crypto/sha256.h>
 #include <crypto/siphash.h>
+#include <memusage.h>
 #include <random.h>
 #include <streams.h>
 #include <txmempool.h>
@@ -283,6 +284,12 @@ CBlockHeaderAndLengthShortTxIDs::CBlockHeaderAndLengthShortTxIDs(const CBlock& b
     codec_version(cv),
     txlens(shorttxids.size())
 {
+    if (codec_version == codec_version_t::v2) {
+        tx_context = CTxCompressionContext(block);
+        SetShortTxIDs(tx_context);
+        tx_context.AddInBlockParents(block);
+    }
+
     int32_t lastprefilledindex = -1;
     uint16_t index_offset = 0;
     auto prefilledit = prefilledtxn.cbegin();
@@ -293,11 +300,28 @@ CBlockHeaderAndLengthShortTxIDs::CBlockHeaderAndLengthShortTxIDs(const CBlock& b
             index_offset++;
         } else {
 	    const CTransactionRef& tx = block.vtx[i];
-            txlens[i - index_offset] = GetSerializeSize(CTxCompressor(*tx, codec_version), PROTOCOL_VERSION);
+            txlens[i - index_offset] = GetSerializeSize(CTxCompressor(*tx, codec_version, &tx_context, i), PROTOCOL_VERSION);
     	}
     }
 }
 
+void CBlockHeaderAndLengthShortTxIDs::SetShortTxIDs(CTxCompressionContext& ctx) const {
+    std::map<uint64_t, uint32_t> indexes;
+    int32_t lastprefilledindex = -1;
+    uint16_t index_offset = 0;
+    auto prefilledit = prefilledtxn.cbegin();
+    for (size_t i = 0; i < shorttxids.size(); i++) {
+        while (prefilledit != prefilledtxn.cend() &&
+                (uint32_t)(lastprefilledindex + prefilledit->index + 1) == i + index_offset) {
+            lastprefilledindex += prefilledit->index + 1;
+            prefilledit++;
+            index_offset++;
+        }
+        indexes.emplace(shorttxids[i], i + index_offset);
+    }
+    ctx.SetShortTxIDs(shorttxidk0, shorttxidk1, std::move(indexes));
+}
+
 template<typename F>
 ReadStatus CBlockHeaderAndLengthShortTxIDs::FillIndexOffsetMap(F& callback) const {
     if (txlens.size() != shorttxids.size())
@@ -375,12 +399,13 @@ struct FillIndexOffsetMapSerializer {
     VectorOutputStream& stream;
     const CBlock& block;
     codec_version_t codec_version;
+    const CTxCompressionContext& tx_context;
     void operator()(size_t offset, size_t index) {
         if (stream.pos() < offset)
             stream.skip_bytes(offset - stream.pos());
         assert(stream.pos() == offset);
 	const CTransactionRef& tx = block.vtx[index];
-	stream << CTxCompressor(*tx, codec_version);
+	stream << CTxCompressor(*tx, codec_version, &tx_context, index);
     }
 };
 
@@ -389,7 +414,7 @@ ChunkCodedBlock::ChunkCodedBlock(const CBlock& block, const CBlockHeaderAndLengt
     VectorOutputStream stream(&codedBlock, SER_NETWORK, PROTOCOL_VERSION);
 
     {
-        FillIndexOffsetMapSerializer ser{stream, block, headerAndIDs.codec_ver()};
+        FillIndexOffsetMapSerializer ser{stream, block, headerAndIDs.codec_ver(), headerAndIDs.tx_ctx()};
         auto const ret = headerAndIDs.FillIndexOffsetMap(ser);
         assert(ret == READ_STATUS_OK);
     }
@@ -425,6 +450,9 @@ ReadStatus PartiallyDownloadedChunkBlock::InitData(const CBlockHeaderAndLengthSh
         start = std::chrono::steady_clock::now();
 
     codec_version = comprblock.codec_version;
+    tx_context = comprblock.tx_context;
+    if (codec_version == codec_version_t::v2)
+        comprblock.SetShortTxIDs(tx_context);
 
     if (comprblock.txlens.size() != comprblock.shorttxids.size())
         return READ_STATUS_INVALID;
@@ -495,8 +523,9 @@ bool PartiallyDownloadedChunkBlock::SerializeTransaction(VectorOutputStream& str
     /* We're serializing txns in order to form the chunk-coded block in advance
      * of actually receiving it from the UDP peer. Hence, we must compress txns
      * with the same codec that is going to be used by tx peer. The codec has
-     * been advertised within the CBlockHeaderAndLengthShortTxIDs structure. */
-    stream << CTxCompressor(*tx, codec_version);
+     * been advertised within the CBlockHeaderAndLengthShortTxIDs structure,
+     * along with the block-level context used by codec v2. */
+    stream << CTxCompressor(*tx, codec_version, &tx_context, it->second);
 
     it++;
     if (it == index_offsets.end())
@@ -577,6 +606,12 @@ uint256& PartiallyDownloadedChunkBlock::GetBlockHash() const {
     return block_hash;
 }
 
+size_t PartiallyDownloadedChunkBlock::DynamicMemoryUsage() const {
+    return memusage::DynamicUsage(codedBlock) + memusage::MallocUsage(DIV_CEIL(chunksAvailable.capacity(), 8)) +
+        memusage::DynamicUsage(index_offsets) + memusage::DynamicUsage(txn_prefilled) +
+        memusage::DynamicUsage(txn_available);
+}
+
 bool PartiallyDownloadedChunkBlock::IsHeaderNull() const {
     return header.IsNull();
 }
@@ -632,6 +667,9 @@ ReadStatus PartiallyDownloadedChunkBlock::FinalizeBlock() {
     // time we spend here, but by calling GetHash() at that time, save the
     // hashing time we'll spend later to check the hash of each transaction.
     VectorInputStream stream(&codedBlock, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_CACHE);
+    // Txns are decoded in order, so those spent by later txns of the block
+    // are known by the time they are referred to
+    tx_context.SetBlockTxns(&block.vtx);
     for (auto it = index_offsets.cbegin(); it != index_offsets.cend(); it++) {
         if (block.vtx[it->second])
             continue;
@@ -639,7 +677,7 @@ ReadStatus PartiallyDownloadedChunkBlock::FinalizeBlock() {
             if (it->first < stream.pos()) // Last transaction was longer than expected
                 return READ_STATUS_FAILED; // Could be a shorttxid collision
             stream.seek(it->first);
-            stream >> REF(CTxCompressor(block.vtx[it->second], codec_version));
+            stream >> REF(CTxCompressor(block.vtx[it->second], codec_version, &tx_context, it->second));
         } catch (const std::ios_base::failure& e) {
             return READ_STATUS_FAILED; // Could be a shorttxid collision
         }
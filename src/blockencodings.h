@@ -125,6 +125,7 @@ private:
     void FillShortTxIDSelector() const;
 
     friend class PartiallyDownloadedBlock;
+    friend class CBlockHeaderAndLengthShortTxIDs;
 
     static const int SHORTTXIDS_LENGTH = 6;
 protected:
@@ -211,12 +212,16 @@ public:
 class CBlockHeaderAndLengthShortTxIDs : public CBlockHeaderAndShortTxIDs {
 private:
     codec_version_t codec_version; // Compression/decompression scheme's version
+    CTxCompressionContext tx_context; // Block-level context (v2 only)
     std::vector<uint32_t> txlens; // size by CTxCompressor
     friend class PartiallyDownloadedChunkBlock;
     int height = -1; // Block height - for OOOB storage of pre-BIP34 blocks
 public:
 
     codec_version_t codec_ver() const { return codec_version; }
+    const CTxCompressionContext& tx_ctx() const { return tx_context; }
+    // Lets a context look up the txns of this block by short id
+    void SetShortTxIDs(CTxCompressionContext& ctx) const;
 
     CBlockHeaderAndLengthShortTxIDs(const CBlock& block, codec_version_t const cv,
         bool fDeterministic = false);
@@ -253,6 +258,8 @@ public:
             for (size_t i = 0; i < txlens.size(); i++)
                 READWRITE(VARINT(txlens[i]));
         }
+        if (codec_version == codec_version_t::v2)
+            READWRITE(tx_context);
     }
 };
 
@@ -281,6 +288,7 @@ private:
 
     // this is initialized to what we read off the network in InitData()
     codec_version_t codec_version = codec_version_t::default_version;
+    CTxCompressionContext tx_context;
 
     // Things used in the iterative fill-from-mempool:
     std::map<size_t, size_t>::iterator fill_coding_index_offsets_it;
@@ -308,6 +316,9 @@ public:
 
     size_t GetMempoolCount() const { return mempool_count; }
 
+    // Heap memory held by the chunk-coded block and its txn index
+    size_t DynamicMemoryUsage() const;
+
     // Chunk-based methods are only callable if AreChunksAvailable()
     bool AreChunksAvailable() const;
     size_t GetChunkCount() const;
@@ -0,0 +1,136 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilemap.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+BlockFileMapping::~BlockFileMapping()
+{
+    if (m_data)
+        ::munmap(const_cast<uint8_t*>(m_data), m_size);
+    if (m_file != -1)
+        ::close(m_file);
+}
+
+bool BlockFileMapping::Open(const fs::path& path)
+{
+    assert(m_file == -1);
+    m_file = ::open(path.c_str(), O_RDONLY);
+    if (m_file == -1)
+        return false;
+
+    struct stat st;
+    if (::fstat(m_file, &st) != 0 || st.st_size <= 0)
+        return false;
+    m_size = st.st_size;
+
+    void* data = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_file, 0);
+    if (data == MAP_FAILED)
+        return false;
+    m_data = static_cast<const uint8_t*>(data);
+    // Until reads turn out to be sequential, don't read ahead more than needed
+    ::madvise(data, m_size, MADV_RANDOM);
+    return true;
+}
+
+Span<const uint8_t> BlockFileMapping::Get(size_t pos, size_t size)
+{
+    assert(pos <= m_size && size <= m_size - pos);
+
+    // A read picking up right where the previous one ended is taken as a scan
+    // through the file, e.g. by an index catching up or the backfill
+    // transmitter, and anything else as random access to single blocks.
+    const uint64_t next_pos = m_next_pos.exchange(pos + size);
+    const bool sequential = pos >= next_pos && pos - next_pos <= 8;
+    if (sequential != m_sequential.exchange(sequential))
+        ::madvise(const_cast<uint8_t*>(m_data), m_size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+
+    // Fault the whole block in at once rather than a page at a time
+    const size_t page_offset = pos % 4096;
+    ::madvise(const_cast<uint8_t*>(m_data) + pos - page_offset, size + page_offset, MADV_WILLNEED);
+
+    return Span<const uint8_t>(m_data + pos, size);
+}
+
+std::shared_ptr<BlockFileMapping> BlockFileMaps::GetMapping(const fs::path& path, size_t end)
+{
+    const std::string key = path.string();
+    {
+        LOCK(m_mutex);
+        if (m_limit == 0)
+            return nullptr;
+        auto it = m_by_path.find(key);
+        if (it != m_by_path.end()) {
+            m_mappings.splice(m_mappings.begin(), m_mappings, it->second);
+            if (end <= it->second->second->size())
+                return it->second->second;
+            // The file grew since it was mapped
+            m_mappings.erase(it->second);
+            m_by_path.erase(it);
+        }
+    }
+
+    // Mapping takes a few system calls, which don't need the lock
+    std::shared_ptr<BlockFileMapping> mapping = std::make_shared<BlockFileMapping>();
+    if (!mapping->Open(path) || end > mapping->size())
+        return nullptr;
+
+    LOCK(m_mutex);
+    auto it = m_by_path.find(key);
+    if (it != m_by_path.end()) {
+        // Another thread mapped the file meanwhile
+        m_mappings.erase(it->second);
+        m_by_path.erase(it);
+    }
+    m_mappings.emplace_front(key, mapping);
+    m_by_path.emplace(key, m_mappings.begin());
+    while (m_mappings.size() > m_limit) {
+        m_by_path.erase(m_mappings.back().first);
+        m_mappings.pop_back();
+    }
+    return mapping;
+}
+
+void BlockFileMaps::SetLimit(size_t limit)
+{
+    LOCK(m_mutex);
+    m_limit = limit;
+    while (m_mappings.size() > m_limit) {
+        m_by_path.erase(m_mappings.back().first);
+        m_mappings.pop_back();
+    }
+}
+
+bool BlockFileMaps::Read(const FlatFileSeq& seq, const FlatFilePos& pos, size_t size, MappedBlockData& data)
+{
+    std::shared_ptr<BlockFileMapping> mapping = GetMapping(seq.FileName(pos), (size_t)pos.nPos + size);
+    if (!mapping)
+        return false;
+    const Span<const uint8_t> span = mapping->Get(pos.nPos, size);
+    data = MappedBlockData(std::move(mapping), span);
+    return true;
+}
+
+void BlockFileMaps::Invalidate(const FlatFileSeq& seq, int file)
+{
+    const std::string key = seq.FileName(FlatFilePos(file, 0)).string();
+    LOCK(m_mutex);
+    auto it = m_by_path.find(key);
+    if (it != m_by_path.end()) {
+        m_mappings.erase(it->second);
+        m_by_path.erase(it);
+    }
+}
+
+void BlockFileMaps::Clear()
+{
+    LOCK(m_mutex);
+    m_by_path.clear();
+    m_mappings.clear();
+}
@@ -0,0 +1,122 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include <flatfile.h>
+#include <fs.h>
+#include <span.h>
+#include <sync.h>
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+//! Default for -blockfilemaps, bounded by the address space of 32-bit systems
+static const unsigned int DEFAULT_BLOCK_FILE_MAPS = sizeof(void*) >= 8 ? 64 : 4;
+
+/** A whole file mapped read-only, unmapped once no longer referenced */
+class BlockFileMapping
+{
+private:
+    int m_file = -1;
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+
+    //! Where a read following the last one sequentially would start
+    std::atomic<uint64_t> m_next_pos{0};
+    //! Whether the kernel was told reads are sequential, rather than random
+    std::atomic<bool> m_sequential{false};
+
+public:
+    BlockFileMapping() {}
+    ~BlockFileMapping();
+
+    BlockFileMapping(const BlockFileMapping&) = delete;
+    BlockFileMapping& operator=(const BlockFileMapping&) = delete;
+
+    /** Map all of a file as it is now */
+    bool Open(const fs::path& path);
+
+    size_t size() const { return m_size; }
+
+    /**
+     * Bytes [pos, pos + size) of the file, which have to be within the
+     * mapping. Read-ahead hints are switched to match whether reads follow
+     * one another through the file or jump around.
+     */
+    Span<const uint8_t> Get(size_t pos, size_t size);
+};
+
+/**
+ * Bytes of a block file, which stay mapped for as long as this is alive.
+ * The owner is a copy of the bytes instead when they couldn't be mapped.
+ */
+class MappedBlockData
+{
+private:
+    std::shared_ptr<const void> m_owner;
+    Span<const uint8_t> m_data;
+
+public:
+    MappedBlockData() {}
+    MappedBlockData(std::shared_ptr<const void> owner, Span<const uint8_t> data)
+        : m_owner(std::move(owner)), m_data(data) {}
+
+    const uint8_t* data() const { return m_data.data(); }
+    size_t size() const { return m_data.size(); }
+    Span<const uint8_t> span() const { return m_data; }
+    //! What keeps the bytes alive, to share them further
+    const std::shared_ptr<const void>& owner() const { return m_owner; }
+
+    //! The bytes from offset on, kept alive by the same owner
+    MappedBlockData subspan(size_t offset) const { return MappedBlockData(m_owner, m_data.subspan(offset)); }
+};
+
+/**
+ * Block files kept memory-mapped for reading, so that blocks are read and
+ * deserialized straight from the page cache, without a file being opened,
+ * seeked and read through stdio buffers for every block.
+ *
+ * The least recently used mappings are dropped beyond a limit, although
+ * readers may keep them alive a little longer. A mapping is replaced when a
+ * read goes past its end, as the last block file keeps being written to.
+ */
+class BlockFileMaps
+{
+private:
+    typedef std::list<std::pair<std::string, std::shared_ptr<BlockFileMapping>>> MappingList;
+
+    Mutex m_mutex;
+    size_t m_limit GUARDED_BY(m_mutex) = DEFAULT_BLOCK_FILE_MAPS;
+    //! Mappings, most recently used first
+    MappingList m_mappings GUARDED_BY(m_mutex);
+    std::unordered_map<std::string, MappingList::iterator> m_by_path GUARDED_BY(m_mutex);
+
+    std::shared_ptr<BlockFileMapping> GetMapping(const fs::path& path, size_t end);
+
+public:
+    /** Set the number of files kept mapped; 0 disables mapping altogether */
+    void SetLimit(size_t limit);
+
+    /**
+     * Get bytes [pos.nPos, pos.nPos + size) of a file of a sequence. Returns
+     * false if they can't be mapped, e.g. because mapping is disabled or the
+     * file is too short, in which case they have to be read the usual way.
+     */
+    bool Read(const FlatFileSeq& seq, const FlatFilePos& pos, size_t size, MappedBlockData& data);
+
+    /** Drop the mapping of a file about to be deleted */
+    void Invalidate(const FlatFileSeq& seq, int file);
+
+    /** Drop all mappings */
+    void Clear();
+};
+
+#endif // BITCOIN_BLOCKFILEMAP_H
@@ -0,0 +1,180 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockindexcache.h>
+
+#include <chain.h>
+#include <crypto/common.h>
+#include <util/system.h>
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+#include <thread>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint32_t BLOCK_INDEX_CACHE_MAGIC = 0x58444942; // "BIDX"
+static const uint32_t BLOCK_INDEX_CACHE_VERSION = 1;
+//! Magic, version, identifier and number of records
+static const size_t BLOCK_INDEX_CACHE_HEADER_SIZE = 24;
+//! Records written at once
+static const size_t BLOCK_INDEX_CACHE_WRITE_BATCH = 4096;
+//! Fewest records worth a thread of their own
+static const size_t BLOCK_INDEX_CACHE_MIN_RANGE = 8192;
+
+fs::path GetBlockIndexCachePath()
+{
+    return (gArgs.IsArgSet("-blocksdir") ? GetDataDir() / "blocks" : GetBlocksDir()) / "index.cache";
+}
+
+static void WriteRecord(unsigned char* p, const CBlockIndex& index, int32_t prev)
+{
+    memcpy(p, index.GetBlockHash().begin(), 32);
+    WriteLE32(p + 32, prev);
+    WriteLE32(p + 36, index.nHeight);
+    WriteLE32(p + 40, index.nFile);
+    WriteLE32(p + 44, index.nDataPos);
+    WriteLE32(p + 48, index.nUndoPos);
+    WriteLE32(p + 52, index.nVersion);
+    memcpy(p + 56, index.hashMerkleRoot.begin(), 32);
+    WriteLE32(p + 88, index.nTime);
+    WriteLE32(p + 92, index.nBits);
+    WriteLE32(p + 96, index.nNonce);
+    WriteLE32(p + 100, index.nStatus);
+    WriteLE32(p + 104, index.nTx);
+}
+
+bool WriteBlockIndexCacheFile(const fs::path& path, uint64_t id, const std::vector<const CBlockIndex*>& entries)
+{
+    const fs::path tmp_path = path.string() + ".new";
+    FILE* file = fsbridge::fopen(tmp_path, "wb");
+    if (!file)
+        return error("%s: unable to open %s", __func__, tmp_path.string());
+
+    std::unordered_map<const CBlockIndex*, int32_t> records;
+    records.reserve(entries.size());
+
+    std::vector<unsigned char> buffer(BLOCK_INDEX_CACHE_HEADER_SIZE);
+    WriteLE32(buffer.data(), BLOCK_INDEX_CACHE_MAGIC);
+    WriteLE32(buffer.data() + 4, BLOCK_INDEX_CACHE_VERSION);
+    WriteLE64(buffer.data() + 8, id);
+    WriteLE64(buffer.data() + 16, entries.size());
+    bool ok = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+
+    buffer.resize(BLOCK_INDEX_CACHE_WRITE_BATCH * BLOCK_INDEX_CACHE_RECORD_SIZE);
+    for (size_t begin = 0; ok && begin < entries.size(); begin += BLOCK_INDEX_CACHE_WRITE_BATCH) {
+        const size_t end = std::min(entries.size(), begin + BLOCK_INDEX_CACHE_WRITE_BATCH);
+        for (size_t n = begin; n < end; n++) {
+            const CBlockIndex* pindex = entries[n];
+            int32_t prev = -1;
+            if (pindex->pprev) {
+                auto it = records.find(pindex->pprev);
+                if (it == records.end()) {
+                    // Entries have to come after their parent
+                    ok = false;
+                    break;
+                }
+                prev = it->second;
+            }
+            records.emplace(pindex, n);
+            WriteRecord(buffer.data() + (n - begin) * BLOCK_INDEX_CACHE_RECORD_SIZE, *pindex, prev);
+        }
+        const size_t size = (end - begin) * BLOCK_INDEX_CACHE_RECORD_SIZE;
+        ok = ok && fwrite(buffer.data(), 1, size, file) == size;
+    }
+
+    ok = ok && FileCommit(file);
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || !RenameOver(tmp_path, path)) {
+        fs::remove(tmp_path);
+        return error("%s: unable to write %s", __func__, path.string());
+    }
+    return true;
+}
+
+BlockIndexCacheReader::~BlockIndexCacheReader()
+{
+    if (m_data)
+        ::munmap(const_cast<unsigned char*>(m_data), m_size);
+    if (m_file != -1)
+        ::close(m_file);
+}
+
+bool BlockIndexCacheReader::Open(const fs::path& path, uint64_t id, uint64_t count)
+{
+    assert(m_file == -1);
+    m_file = ::open(path.c_str(), O_RDONLY);
+    if (m_file == -1)
+        return false;
+
+    struct stat st;
+    if (::fstat(m_file, &st) != 0 || st.st_size < (off_t)BLOCK_INDEX_CACHE_HEADER_SIZE)
+        return false;
+    m_size = st.st_size;
+    if ((m_size - BLOCK_INDEX_CACHE_HEADER_SIZE) / BLOCK_INDEX_CACHE_RECORD_SIZE != count ||
+        (m_size - BLOCK_INDEX_CACHE_HEADER_SIZE) % BLOCK_INDEX_CACHE_RECORD_SIZE != 0)
+        return false;
+
+    void* data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_file, 0);
+    if (data == MAP_FAILED)
+        return false;
+    m_data = static_cast<const unsigned char*>(data);
+    // All of the file is going to be read, and soon
+    ::madvise(data, m_size, MADV_WILLNEED);
+
+    if (ReadLE32(m_data) != BLOCK_INDEX_CACHE_MAGIC || ReadLE32(m_data + 4) != BLOCK_INDEX_CACHE_VERSION ||
+        ReadLE64(m_data + 8) != id || ReadLE64(m_data + 16) != count)
+        return false;
+    m_count = count;
+    return true;
+}
+
+const unsigned char* BlockIndexCacheReader::Record(size_t n) const
+{
+    assert(n < m_count);
+    return m_data + BLOCK_INDEX_CACHE_HEADER_SIZE + n * BLOCK_INDEX_CACHE_RECORD_SIZE;
+}
+
+uint256 BlockIndexCacheReader::GetHash(size_t n) const
+{
+    uint256 hash;
+    memcpy(hash.begin(), Record(n), 32);
+    return hash;
+}
+
+void BlockIndexCacheReader::Read(size_t n, CBlockIndex& index, int32_t& prev) const
+{
+    const unsigned char* p = Record(n);
+    prev = ReadLE32(p + 32);
+    index.nHeight = ReadLE32(p + 36);
+    index.nFile = ReadLE32(p + 40);
+    index.nDataPos = ReadLE32(p + 44);
+    index.nUndoPos = ReadLE32(p + 48);
+    index.nVersion = ReadLE32(p + 52);
+    memcpy(index.hashMerkleRoot.begin(), p + 56, 32);
+    index.nTime = ReadLE32(p + 88);
+    index.nBits = ReadLE32(p + 92);
+    index.nNonce = ReadLE32(p + 96);
+    index.nStatus = ReadLE32(p + 100);
+    index.nTx = ReadLE32(p + 104);
+}
+
+void ForEachBlockIndexRange(size_t count, const std::function<void(size_t, size_t)>& func)
+{
+    const size_t ranges = std::max<size_t>(1, std::min<size_t>(GetNumCores(), count / BLOCK_INDEX_CACHE_MIN_RANGE));
+    std::vector<std::thread> threads;
+    threads.reserve(ranges - 1);
+    for (size_t range = 1; range < ranges; range++) {
+        threads.emplace_back(func, count * range / ranges, count * (range + 1) / ranges);
+    }
+    // The first range is left to the calling thread
+    func(0, count / ranges);
+    for (std::thread& thread : threads)
+        thread.join();
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKINDEXCACHE_H
+#define BITCOIN_BLOCKINDEXCACHE_H
+
+#include <fs.h>
+#include <uint256.h>
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class CBlockIndex;
+
+/**
+ * The block index cache is a flat copy of the block index database, written
+ * at clean shutdown so that the next startup maps it instead of iterating
+ * over and deserializing every entry of the database.
+ *
+ * The file holds a header followed by fixed-size records of the entries, in
+ * height order, each referring to its parent by record number. It is only
+ * valid while the block index database holds the same identifier, which is
+ * erased from the database as soon as the cache is loaded, so that a cache
+ * file is never used once the block index has been written to.
+ */
+
+//! Size of a record of the block index cache file
+static const size_t BLOCK_INDEX_CACHE_RECORD_SIZE = 108;
+
+//! Path of the block index cache file, next to the block index database
+fs::path GetBlockIndexCachePath();
+
+/**
+ * Write entries of the block index, sorted by height, to a cache file.
+ * The file is written next to path and renamed over it once synced.
+ */
+bool WriteBlockIndexCacheFile(const fs::path& path, uint64_t id, const std::vector<const CBlockIndex*>& entries);
+
+/** Read-only mapping of a block index cache file */
+class BlockIndexCacheReader
+{
+private:
+    int m_file = -1;
+    const unsigned char* m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_count = 0;
+
+    const unsigned char* Record(size_t n) const;
+
+public:
+    BlockIndexCacheReader() {}
+    ~BlockIndexCacheReader();
+
+    BlockIndexCacheReader(const BlockIndexCacheReader&) = delete;
+    BlockIndexCacheReader& operator=(const BlockIndexCacheReader&) = delete;
+
+    /** Map a cache file, checking it has the given identifier and number of entries */
+    bool Open(const fs::path& path, uint64_t id, uint64_t count);
+
+    size_t Count() const { return m_count; }
+
+    /**
+     * Fill the fields of a block index entry stored in the database from
+     * record n, along with the record number of its parent (-1 if none).
+     * Records are independent, so they can be read by any number of threads
+     * at once.
+     */
+    void Read(size_t n, CBlockIndex& index, int32_t& prev) const;
+
+    //! Hash of the block of record n
+    uint256 GetHash(size_t n) const;
+};
+
+/**
+ * Call func(begin, end) on ranges splitting [0, count) across as many
+ * threads as there are cores, and wait for them to finish.
+ */
+void ForEachBlockIndexRange(size_t count, const std::function<void(size_t, size_t)>& func);
+
+#endif // BITCOIN_BLOCKINDEXCACHE_H
@@ -84,6 +84,8 @@ public:
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
     const ChainTxData& TxData() const { return chainTxData; }
+    /** Trusted hashes of the UTXO set (hash_serialized_2), by block, for -loadutxosnapshot */
+    const std::map<uint256, uint256>& SnapshotHashes() const { return m_snapshot_hashes; }
 protected:
     CChainParams() {}
 
@@ -104,6 +106,7 @@ protected:
     bool m_is_test_chain;
     CCheckpointData checkpointData;
     ChainTxData chainTxData;
+    std::map<uint256, uint256> m_snapshot_hashes;
 };
 
 /**
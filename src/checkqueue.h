@@ -8,6 +8,9 @@
 #include <sync.h>
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -25,12 +28,40 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Each worker has its own deque of verifications. Batches pushed by the
+  * master are spread over the deques, so that workers start on them right
+  * away without contending on a single lock. A worker takes verifications
+  * from the back of its own deque, and steals from the front of the others
+  * once its own is empty. The master only steals.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! Verifications assigned to one worker
+    struct WorkerQueue {
+        //! Taken by the owner, by the master adding work, and by thieves
+        boost::mutex mutex;
+        std::deque<T> checks;
+    };
+
+    //! Maximum number of deques. Workers beyond it share deques with others.
+    static constexpr unsigned int MAX_WORKER_QUEUES = 64;
+
+    WorkerQueue queues[MAX_WORKER_QUEUES];
+
+    //! The number of running workers, each of which owns a deque (excluding the master).
+    std::atomic<unsigned int> nWorkers{0};
+
+    //! Number of deques that have ever been given work. It never shrinks, so
+    //! that checks left on the deques of workers that stopped are still taken.
+    std::atomic<unsigned int> nQueuesUsed{1};
+
+    //! Deque the next batch starts being spread on
+    std::atomic<unsigned int> nNextQueue{0};
+
+    //! Mutex for idle threads to wait on, when no verification is queued
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,87 +70,133 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
-
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! The number of workers (excluding the master) that are idle.
+    std::atomic<int> nIdle{0};
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of verifications sitting in the deques.
+    std::atomic<unsigned int> nQueued{0};
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk{true};
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo{0};
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! Number of deques new work is spread over
+    unsigned int QueueCount() const
+    {
+        const unsigned int nCount = nWorkers;
+        if (nCount > MAX_WORKER_QUEUES)
+            return MAX_WORKER_QUEUES;
+        return std::max(1U, nCount);
+    }
+
+    //! Move up to nMax verifications from the back (or front) of a deque to vChecks.
+    unsigned int TakeFrom(WorkerQueue& queue, std::vector<T>& vChecks, bool fBack)
+    {
+        boost::unique_lock<boost::mutex> lock(queue.mutex);
+        if (queue.checks.empty())
+            return 0;
+        // Leave half of a deque to thieves, but don't do batches larger than nBatchSize.
+        const unsigned int nNow = std::min<size_t>(nBatchSize, (queue.checks.size() + 1) / 2);
+        vChecks.resize(nNow);
+        for (unsigned int i = 0; i < nNow; i++) {
+            // Swap jobs from the deque to the local batch vector instead of copying.
+            if (fBack) {
+                vChecks[i].swap(queue.checks.back());
+                queue.checks.pop_back();
+            } else {
+                vChecks[i].swap(queue.checks.front());
+                queue.checks.pop_front();
+            }
+        }
+        nQueued -= nNow;
+        return nNow;
+    }
+
+    /**
+     * Take a batch of verifications: from the own deque nOwn first if any,
+     * then from the other deques that were ever given work, whether or not
+     * their workers are still running. Returns false if none were found.
+     */
+    bool Take(unsigned int nOwn, std::vector<T>& vChecks)
+    {
+        const unsigned int nCount = nQueuesUsed;
+        if (nOwn < nCount && TakeFrom(queues[nOwn], vChecks, true))
+            return true;
+        for (unsigned int i = 1; i <= nCount; i++) {
+            if (nQueued == 0)
+                return false;
+            if (TakeFrom(queues[(nOwn + i) % nCount], vChecks, false))
+                return true;
+        }
+        return false;
+    }
+
+    //! Counts a worker as running for as long as it exists, including when interrupted
+    class WorkerRegistration
+    {
+        std::atomic<unsigned int>& m_workers;
+
+    public:
+        const unsigned int nIndex;
+        explicit WorkerRegistration(std::atomic<unsigned int>& workers) : m_workers(workers), nIndex(workers++) {}
+        ~WorkerRegistration() { m_workers--; }
+    };
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        // Workers are stopped all together, so the ones started afterwards
+        // own deques from the first one on again
+        std::unique_ptr<WorkerRegistration> registration;
+        if (!fMaster)
+            registration.reset(new WorkerRegistration(nWorkers));
+        const unsigned int nOwn = fMaster ? MAX_WORKER_QUEUES : registration->nIndex % MAX_WORKER_QUEUES;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
+            if (!Take(nOwn, vChecks)) {
                 boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if (fMaster && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
+                if (fMaster) {
+                    while (nQueued == 0 && nTodo != 0)
+                        condMaster.wait(lock); // wait
+                    if (nTodo == 0) {
+                        // return the current status, and reset it for new work later
+                        return fAllOk.exchange(true);
                     }
+                } else {
+                    // Counted as idle before looking at nQueued, so that Add sees
+                    // either the increment or this thread sees the new checks
                     nIdle++;
-                    cond.wait(lock); // wait
+                    while (nQueued == 0)
+                        condWorker.wait(lock); // wait
                     nIdle--;
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                continue;
             }
-            // execute work
+            // execute work, unless a verification already failed
+            bool fOk = fAllOk;
             for (T& check : vChecks)
                 if (fOk)
                     fOk = check();
+            const unsigned int nNow = vChecks.size();
+            // Verifications are destroyed before they are accounted as completed
             vChecks.clear();
+            if (!fOk)
+                fAllOk = false;
+            if (nTodo.fetch_sub(nNow) == nNow) {
+                // We processed the last element; inform the master it can exit and return the result
+                boost::unique_lock<boost::mutex> lock(mutex);
+                condMaster.notify_one();
+            }
         } while (true);
     }
 
@@ -128,7 +205,7 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    explicit CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn) {}
+    explicit CCheckQueue(unsigned int nBatchSizeIn) : nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
@@ -136,6 +213,12 @@ public:
         Loop();
     }
 
+    //! Number of worker threads running Thread()
+    unsigned int WorkerCount() const
+    {
+        return nWorkers;
+    }
+
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
@@ -145,16 +228,37 @@ public:
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
+        // Counted before being queued, so that nTodo can't drop to 0 in between
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+
+        // Spread the batch over as many deques as there are workers, in
+        // consecutive slices, starting where the previous batch stopped.
+        const unsigned int nCount = QueueCount();
+        unsigned int nUsed = nQueuesUsed;
+        while (nUsed < nCount && !nQueuesUsed.compare_exchange_weak(nUsed, nCount)) {}
+        const unsigned int nSlices = std::min<size_t>(nCount, vChecks.size());
+        const size_t nSliceSize = (vChecks.size() + nSlices - 1) / nSlices;
+        unsigned int nQueue = nNextQueue.fetch_add(nSlices);
+        for (size_t nStart = 0; nStart < vChecks.size(); nStart += nSliceSize, nQueue++) {
+            const size_t nEnd = std::min(vChecks.size(), nStart + nSliceSize);
+            WorkerQueue& queue = queues[nQueue % nCount];
+            boost::unique_lock<boost::mutex> lock(queue.mutex);
+            for (size_t i = nStart; i < nEnd; i++) {
+                queue.checks.emplace_back();
+                vChecks[i].swap(queue.checks.back());
+            }
+            nQueued += nEnd - nStart;
+        }
+
+        if (nIdle > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (vChecks.size() == 1)
+                condWorker.notify_one();
+            else
+                condWorker.notify_all();
+        }
     }
 
     ~CCheckQueue()
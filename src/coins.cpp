@@ -9,7 +9,24 @@
 #include <random.h>
 #include <version.h>
 
+#include <algorithm>
+#include <vector>
+
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
+size_t CCoinsView::GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins, std::vector<bool> &found) const
+{
+    coins.clear();
+    coins.resize(outpoints.size());
+    found.assign(outpoints.size(), false);
+    size_t count = 0;
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        if (GetCoin(outpoints[i], coins[i])) {
+            found[i] = true;
+            count++;
+        }
+    }
+    return count;
+}
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
 bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
@@ -33,7 +50,9 @@ size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) :
+    CCoinsViewBacked(baseIn), cacheCoins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &m_cache_coins_memory_resource),
+    cachedCoinsUsage(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
@@ -86,6 +105,14 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
     cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
 }
 
+bool CCoinsViewCache::EmplaceCoinFromBase(const COutPoint& outpoint, Coin&& coin) {
+    assert(!coin.IsSpent());
+    std::pair<CCoinsMap::iterator, bool> inserted = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(coin)));
+    if (inserted.second)
+        cachedCoinsUsage += inserted.first->second.coin.DynamicMemoryUsage();
+    return inserted.second;
+}
+
 void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, bool check) {
     bool fCoinbase = tx.IsCoinBase();
     const uint256& txid = tx.GetHash();
@@ -206,9 +233,73 @@ bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
     cachedCoinsUsage = 0;
+    // Release the memory of the pool too, which is accounted for in DynamicMemoryUsage()
+    ReallocateCache();
     return fOk;
 }
 
+size_t CCoinsViewCache::SnapshotDirty(CCoinsMap& snapshot, size_t max_usage) {
+    if (DynamicMemoryUsage() <= max_usage) {
+        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+            if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
+                ++it;
+            } else if (it->second.coin.IsSpent()) {
+                // Spent coins are only kept around to be erased from the base
+                snapshot.emplace(it->first, std::move(it->second));
+                it = cacheCoins.erase(it);
+            } else {
+                snapshot.emplace(it->first, it->second);
+                it->second.flags = 0;
+                ++it;
+            }
+        }
+        return 0;
+    }
+    if (cacheCoins.empty())
+        return 0;
+
+    // Pool memory is not released as entries are erased, so the entries kept
+    // are moved to a new pool. Each is charged the average footprint of the
+    // current map. Modified coins are kept first, as they are the most recent.
+    const size_t entry_usage = memusage::DynamicUsage(cacheCoins) / cacheCoins.size();
+    size_t usage = 0;
+    std::vector<std::pair<COutPoint, CCoinsCacheEntry>> kept;
+    for (const bool dirty : {true, false}) {
+        for (auto& entry : cacheCoins) {
+            if (!!(entry.second.flags & CCoinsCacheEntry::DIRTY) != dirty)
+                continue;
+            bool keep = false;
+            if (!entry.second.coin.IsSpent()) {
+                const size_t coin_usage = entry_usage + entry.second.coin.DynamicMemoryUsage();
+                keep = usage + coin_usage <= max_usage;
+                if (keep)
+                    usage += coin_usage;
+            }
+            if (dirty && keep) {
+                snapshot.emplace(entry.first, entry.second);
+            } else if (dirty) {
+                snapshot.emplace(entry.first, std::move(entry.second));
+            }
+            if (keep) {
+                // The entry left behind stays dirty, so it isn't visited again
+                kept.emplace_back(entry.first, std::move(entry.second));
+                kept.back().second.flags = 0;
+            }
+        }
+    }
+
+    const size_t removed = cacheCoins.size() - kept.size();
+    cacheCoins.clear();
+    cachedCoinsUsage = 0;
+    ReallocateCache();
+    cacheCoins.reserve(kept.size());
+    for (auto& entry : kept) {
+        cachedCoinsUsage += entry.second.coin.DynamicMemoryUsage();
+        cacheCoins.emplace(entry.first, std::move(entry.second));
+    }
+    return removed;
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
@@ -246,6 +337,16 @@ bool CCoinsViewCache::HaveInputs(const CTransaction& tx) const
     return true;
 }
 
+void CCoinsViewCache::ReallocateCache()
+{
+    // Cache should be empty when we're calling this.
+    assert(cacheCoins.size() == 0);
+    cacheCoins.~CCoinsMap();
+    m_cache_coins_memory_resource.~CCoinsMapMemoryResource();
+    ::new (&m_cache_coins_memory_resource) CCoinsMapMemoryResource();
+    ::new (&cacheCoins) CCoinsMap(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &m_cache_coins_memory_resource);
+}
+
 static const size_t MIN_TRANSACTION_OUTPUT_WEIGHT = WITNESS_SCALE_FACTOR * ::GetSerializeSize(CTxOut(), PROTOCOL_VERSION);
 static const size_t MAX_OUTPUTS_PER_BLOCK = MAX_BLOCK_WEIGHT / MIN_TRANSACTION_OUTPUT_WEIGHT;
 
@@ -0,0 +1,144 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinsprefetch.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+class CCoinsPrefetchJob
+{
+public:
+    const CCoinsView& db;
+    const uint64_t flush_epoch;
+
+    //! Prevouts of the block that spend outputs of previous blocks
+    std::vector<COutPoint> inputs;
+    //! Prevouts that were not in the cache when the job was started
+    std::vector<COutPoint> outpoints;
+    std::vector<Coin> coins;
+    std::vector<char> found;
+
+    //! Index of the next outpoint to be claimed
+    std::atomic<size_t> next{0};
+    //! Number of outpoints read so far (guarded by the prefetcher mutex)
+    size_t done = 0;
+
+    CCoinsPrefetchJob(const CCoinsView& db_in, uint64_t flush_epoch_in) : db(db_in), flush_epoch(flush_epoch_in) {}
+};
+
+std::shared_ptr<CCoinsPrefetchJob> CCoinsPrefetcher::Prefetch(const CBlock& block, const CCoinsViewCache& cache, const CCoinsView& db)
+{
+    std::shared_ptr<CCoinsPrefetchJob> job = std::make_shared<CCoinsPrefetchJob>(db, m_flush_epoch.load());
+
+    // Outputs created within the block are never in the database
+    std::vector<uint256> txids;
+    txids.reserve(block.vtx.size());
+    for (const CTransactionRef& tx : block.vtx)
+        txids.push_back(tx->GetHash());
+    std::sort(txids.begin(), txids.end());
+
+    for (const CTransactionRef& tx : block.vtx) {
+        if (tx->IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (std::binary_search(txids.begin(), txids.end(), txin.prevout.hash))
+                continue;
+            job->inputs.push_back(txin.prevout);
+            if (!cache.HaveCoinInCache(txin.prevout))
+                job->outpoints.push_back(txin.prevout);
+        }
+    }
+    job->coins.resize(job->outpoints.size());
+    job->found.resize(job->outpoints.size());
+
+    if (!job->outpoints.empty()) {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        m_queue.push_back(job);
+        m_cond_worker.notify_all();
+    }
+    return job;
+}
+
+bool CCoinsPrefetcher::RunBatch(CCoinsPrefetchJob& job)
+{
+    const size_t begin = job.next.fetch_add(BATCH_SIZE);
+    if (begin >= job.outpoints.size())
+        return false;
+    const size_t end = std::min(begin + BATCH_SIZE, job.outpoints.size());
+
+    // The batch is read at once, sharing a database snapshot and buffers
+    const std::vector<COutPoint> outpoints(job.outpoints.begin() + begin, job.outpoints.begin() + end);
+    std::vector<Coin> coins;
+    std::vector<bool> found;
+    try {
+        job.db.GetCoins(outpoints, coins, found);
+        for (size_t i = begin; i < end; i++) {
+            job.found[i] = found[i - begin];
+            job.coins[i] = std::move(coins[i - begin]);
+        }
+    } catch (const std::runtime_error&) {
+        // Leave read errors to be handled when the coin is fetched by ConnectBlock
+    }
+
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    job.done += end - begin;
+    if (job.done == job.outpoints.size())
+        m_cond_master.notify_all();
+    return true;
+}
+
+void CCoinsPrefetcher::Thread()
+{
+    while (true) {
+        std::shared_ptr<CCoinsPrefetchJob> job;
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex);
+            while (m_queue.empty())
+                m_cond_worker.wait(lock);
+            job = m_queue.front();
+        }
+        if (!RunBatch(*job)) {
+            boost::unique_lock<boost::mutex> lock(m_mutex);
+            if (!m_queue.empty() && m_queue.front() == job)
+                m_queue.pop_front();
+        }
+    }
+}
+
+CoinsPrefetchStats CCoinsPrefetcher::Apply(const std::shared_ptr<CCoinsPrefetchJob>& job, CCoinsViewCache& cache)
+{
+    // Read the coins not claimed by a worker yet, then wait for the batches
+    // still in progress
+    while (RunBatch(*job)) {}
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        while (job->done < job->outpoints.size())
+            m_cond_master.wait(lock);
+        m_queue.erase(std::remove(m_queue.begin(), m_queue.end(), job), m_queue.end());
+    }
+
+    CoinsPrefetchStats stats;
+    stats.n_inputs = job->inputs.size();
+    stats.stale = job->flush_epoch != m_flush_epoch.load();
+    for (size_t i = 0; i < job->outpoints.size(); i++) {
+        if (!job->found[i])
+            continue;
+        stats.n_fetched++;
+        if (!stats.stale && cache.EmplaceCoinFromBase(job->outpoints[i], std::move(job->coins[i])))
+            stats.n_inserted++;
+    }
+    for (const COutPoint& prevout : job->inputs) {
+        if (cache.HaveCoinInCache(prevout))
+            stats.n_hits++;
+    }
+    return stats;
+}
+
+void CCoinsPrefetcher::Cancel(const std::shared_ptr<CCoinsPrefetchJob>& job)
+{
+    job->next = job->outpoints.size();
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    m_queue.erase(std::remove(m_queue.begin(), m_queue.end(), job), m_queue.end());
+}
@@ -0,0 +1,102 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSPREFETCH_H
+#define BITCOIN_COINSPREFETCH_H
+
+#include <coins.h>
+#include <primitives/block.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/** Set of coins of a block being read from the database by the prefetcher */
+class CCoinsPrefetchJob;
+
+/** Outcome of applying a prefetch job to a cache */
+struct CoinsPrefetchStats {
+    size_t n_inputs = 0;   //!< Inputs spending outputs of previous blocks
+    size_t n_fetched = 0;  //!< Coins read from the database by the job
+    size_t n_inserted = 0; //!< Coins inserted in the cache
+    size_t n_hits = 0;     //!< Inputs found in the cache once the job is applied
+    bool stale = false;    //!< The cache was flushed while the job ran, so nothing was inserted
+};
+
+/**
+ * Reads the coins spent by a block from the UTXO database ahead of
+ * ConnectBlock, using a pool of worker threads.
+ *
+ * A job is started (under cs_main) with the prevouts of a block that spend
+ * outputs of previous blocks and are not in the cache yet. Workers read the
+ * coins from the database concurrently, without touching the cache. Once the
+ * block is about to be connected, the job is applied (under cs_main again):
+ * the connecting thread joins the workers until all coins are read, then
+ * inserts them in the cache as non-dirty entries, unless the cache already has
+ * an entry for them.
+ *
+ * Coins read from the database may be outdated if the cache was flushed in the
+ * meantime, in which case the job is discarded. Otherwise, any change made to
+ * a coin since it was read lives in the cache, which takes precedence.
+ */
+class CCoinsPrefetcher
+{
+private:
+    //! Number of coins read by a worker at once
+    static const size_t BATCH_SIZE = 64;
+
+    boost::mutex m_mutex;
+    //! Worker threads block on this when out of work
+    boost::condition_variable m_cond_worker;
+    //! Threads applying a job block on this until it is completed
+    boost::condition_variable m_cond_master;
+    //! Jobs with coins not claimed by a worker yet, oldest first
+    std::deque<std::shared_ptr<CCoinsPrefetchJob>> m_queue;
+
+    //! Incremented whenever the cache is flushed to the database
+    std::atomic<uint64_t> m_flush_epoch{0};
+
+    /**
+     * @brief Claim and read a batch of coins of a job.
+     * @param (CCoinsPrefetchJob&) Job.
+     * @return (bool) Whether a batch was claimed, i.e. false once all
+     * coins of the job are claimed.
+     */
+    bool RunBatch(CCoinsPrefetchJob& job);
+
+public:
+    /**
+     * @brief Start prefetching the coins spent by a block.
+     * @param (const CBlock&) Block.
+     * @param (const CCoinsViewCache&) Cache the coins are meant for; coins
+     * it already has are not read.
+     * @param (const CCoinsView&) Database backing the cache, which must
+     * support concurrent reads.
+     * @return (std::shared_ptr<CCoinsPrefetchJob>) Job.
+     */
+    std::shared_ptr<CCoinsPrefetchJob> Prefetch(const CBlock& block, const CCoinsViewCache& cache, const CCoinsView& db);
+
+    /**
+     * @brief Wait for a job to complete and insert its coins in the cache.
+     * @param (const std::shared_ptr<CCoinsPrefetchJob>&) Job.
+     * @param (CCoinsViewCache&) Cache passed to Prefetch.
+     * @return (CoinsPrefetchStats) Statistics of the job.
+     */
+    CoinsPrefetchStats Apply(const std::shared_ptr<CCoinsPrefetchJob>& job, CCoinsViewCache& cache);
+
+    /** Stop reading the coins of a job that will not be applied */
+    void Cancel(const std::shared_ptr<CCoinsPrefetchJob>& job);
+
+    /** Invalidate the jobs started so far, as the cache was flushed */
+    void NotifyFlush() { m_flush_epoch++; }
+
+    /** Worker thread loop */
+    void Thread();
+};
+
+#endif
@@ -5,6 +5,8 @@
 
 #include <compressor.h>
 
+#include <crypto/siphash.h>
+#include <primitives/block.h>
 #include <streams.h>
 #include <hash.h>
 #include <pubkey.h>
@@ -13,7 +15,10 @@
 #include <serialize.h>
 #include <util/strencodings.h>
 
+#include <algorithm>
+#include <ios>
 #include <iostream>
+#include <set>
 
 /*
  * These check for scripts for which a special case with a shorter encoding is defined.
@@ -207,12 +212,268 @@ int32_t const nVersionThreshold = 15;
 uint32_t const PrevOutThreshold = 23;
 int const PrevOutVarInt = 24;
 int const SequenceMultiplier = 50;
+// v2 only: added to the tx header of transactions whose inputs carry
+// back-references into the block context
+uint8_t const TxHeaderContextFlag = 3 * (nVersionThreshold + 1);
+// v2 only: output script given by a back-reference into the block context
+uint8_t const TxOutContextCode = 101;
+
+namespace {
+// Counts occurrences of an item, remembering when it was first seen
+template <typename T>
+void CountItem(std::map<T, std::pair<uint32_t, uint32_t>>& counts, const T& item)
+{
+    auto const it = counts.emplace(item, std::make_pair(0, counts.size())).first;
+    it->second.first++;
+}
+
+// Returns the items seen more than once, most frequent first, so that the most
+// frequent ones get the shortest references
+template <typename T>
+std::vector<T> SelectRepeatedItems(const std::map<T, std::pair<uint32_t, uint32_t>>& counts)
+{
+    typedef typename std::map<T, std::pair<uint32_t, uint32_t>>::const_iterator CountIt;
+    std::vector<CountIt> repeated;
+    for (CountIt it = counts.begin(); it != counts.end(); it++) {
+        if (it->second.first > 1)
+            repeated.push_back(it);
+    }
+    std::sort(repeated.begin(), repeated.end(), [](CountIt const& a, CountIt const& b) {
+        if (a->second.first != b->second.first)
+            return a->second.first > b->second.first;
+        return a->second.second < b->second.second;
+    });
+    std::vector<T> ret;
+    ret.reserve(repeated.size());
+    for (CountIt const& it : repeated)
+        ret.push_back(it->first);
+    return ret;
+}
+
+template <typename T>
+void BuildItemRefs(const std::vector<T>& items, std::map<T, uint32_t>& refs)
+{
+    refs.clear();
+    for (size_t i = 0; i < items.size(); i++)
+        refs.emplace(items[i], i + 1);
+}
+
+template <typename T>
+uint32_t FindItemRef(const std::map<T, uint32_t>& refs, const T& item)
+{
+    auto const it = refs.find(item);
+    return it == refs.end() ? 0 : it->second;
+}
+
+template <typename T>
+const T& GetItem(const std::vector<T>& items, uint32_t const ref)
+{
+    if (ref == 0 || ref > items.size())
+        throw std::ios_base::failure("invalid compressed transaction. context reference out of range");
+    return items[ref - 1];
+}
+
+// Candidate keys of single-key spends: the last of exactly two pushes, in either
+// the witness or the scriptSig. Stripped keys leave out the prefix byte, which
+// is part of the scriptSig header.
+bool GetStrippedSpendPubKey(CTxIn const& in, uint256& strippedpubkey)
+{
+    valtype pubkey;
+    if (in.scriptWitness.stack.size() == 2) {
+        pubkey = in.scriptWitness.stack[1];
+    } else if (in.scriptWitness.IsNull()) {
+        std::pair<bool, std::vector<valtype>> const stack = encode_push_only(in.scriptSig);
+        if (!stack.first || stack.second.size() != 2)
+            return false;
+        pubkey = stack.second[1];
+    }
+    if (pubkey.size() != CPubKey::COMPRESSED_PUBLIC_KEY_SIZE && pubkey.size() != CPubKey::PUBLIC_KEY_SIZE)
+        return false;
+    memcpy(strippedpubkey.begin(), pubkey.data() + 1, 32);
+    return true;
+}
+
+// v2 only: prevout txids are given by a reference into the block context
+// (2 * ref), by their distance back to an earlier txn of the block
+// (2 * distance - 1), or in full (0)
+uint32_t GetPrevOutHashCode(CTxCompressionContext const& ctx, uint256 const& hash, uint32_t const tx_index)
+{
+    uint32_t const ref = ctx.FindPrevOutHash(hash);
+    if (ref)
+        return 2 * ref;
+    uint32_t const distance = ctx.FindInBlockTx(hash, tx_index);
+    return distance ? 2 * distance - 1 : 0;
+}
+
+bool IsSingleKeyScriptSigHeader(uint16_t const ScriptSigHeader)
+{
+    return ScriptSigHeader >= 6 && ScriptSigHeader < 38;
+}
+
+// The stripped signature and key of single-key templates. In v2, the key may be
+// replaced by a reference into the block context.
+template <typename Stream>
+void SerializeSingleKeyScriptSig(Stream& s, valtype const& SmallScriptSig, CTxCompressionContext const* ctx)
+{
+    if (!ctx) {
+        s << SmallScriptSig;
+        return;
+    }
+    assert(SmallScriptSig.size() >= 32);
+    uint32_t const PubKeyRef = ctx->FindPubKey(MakeSpan(SmallScriptSig).last(32));
+    s << VARINT(PubKeyRef);
+    if (PubKeyRef) {
+        s << valtype(SmallScriptSig.begin(), SmallScriptSig.end() - 32);
+    } else {
+        s << SmallScriptSig;
+    }
+}
+
+template <typename Stream>
+void UnserializeSingleKeyScriptSig(Stream& s, valtype& SmallScriptSig, CTxCompressionContext const* ctx)
+{
+    uint32_t PubKeyRef = 0;
+    if (ctx)
+        s >> VARINT(PubKeyRef);
+    s >> SmallScriptSig;
+    if (PubKeyRef) {
+        uint256 const& pubkey = ctx->GetPubKey(PubKeyRef);
+        SmallScriptSig.insert(SmallScriptSig.end(), pubkey.begin(), pubkey.end());
+    }
+}
+} // namespace
+
+CTxCompressionContext::CTxCompressionContext(const CBlock& block)
+{
+    std::map<uint256, std::pair<uint32_t, uint32_t>> prevout_hash_counts;
+    std::map<uint256, std::pair<uint32_t, uint32_t>> pubkey_counts;
+    std::map<CScript, std::pair<uint32_t, uint32_t>> script_counts;
+
+    for (const CTransactionRef& tx : block.vtx) {
+        for (const CTxIn& in : tx->vin) {
+            if (in.prevout.IsNull())
+                continue;
+            CountItem(prevout_hash_counts, in.prevout.hash);
+            uint256 strippedpubkey;
+            if (GetStrippedSpendPubKey(in, strippedpubkey))
+                CountItem(pubkey_counts, strippedpubkey);
+        }
+        for (const CTxOut& out : tx->vout)
+            CountItem(script_counts, out.scriptPubKey);
+    }
+
+    prevout_hashes = SelectRepeatedItems(prevout_hash_counts);
+    pubkeys = SelectRepeatedItems(pubkey_counts);
+    scripts = SelectRepeatedItems(script_counts);
+    BuildRefs();
+}
+
+void CTxCompressionContext::BuildRefs()
+{
+    BuildItemRefs(prevout_hashes, prevout_hash_refs);
+    BuildItemRefs(pubkeys, pubkey_refs);
+    BuildItemRefs(scripts, script_refs);
+}
+
+uint32_t CTxCompressionContext::FindPrevOutHash(const uint256& hash) const
+{
+    return FindItemRef(prevout_hash_refs, hash);
+}
+
+uint32_t CTxCompressionContext::FindPubKey(Span<unsigned char const> strippedpubkey) const
+{
+    assert(strippedpubkey.size() == 32);
+    uint256 key;
+    memcpy(key.begin(), strippedpubkey.data(), 32);
+    return FindItemRef(pubkey_refs, key);
+}
+
+uint32_t CTxCompressionContext::FindScript(const CScript& script) const
+{
+    return FindItemRef(script_refs, script);
+}
+
+const uint256& CTxCompressionContext::GetPrevOutHash(uint32_t const ref) const
+{
+    return GetItem(prevout_hashes, ref);
+}
+
+const uint256& CTxCompressionContext::GetPubKey(uint32_t const ref) const
+{
+    return GetItem(pubkeys, ref);
+}
+
+const CScript& CTxCompressionContext::GetScript(uint32_t const ref) const
+{
+    return GetItem(scripts, ref);
+}
+
+void CTxCompressionContext::SetShortTxIDs(uint64_t const k0, uint64_t const k1, std::map<uint64_t, uint32_t> indexes)
+{
+    shorttxidk0 = k0;
+    shorttxidk1 = k1;
+    shorttxid_indexes = std::move(indexes);
+    for (const InBlockParent& parent : in_block_parents)
+        shorttxid_indexes[parent.shorttxid] = parent.index;
+}
+
+void CTxCompressionContext::AddInBlockParents(const CBlock& block)
+{
+    std::map<uint256, uint32_t> txn_indexes;
+    for (uint32_t i = 0; i < block.vtx.size(); i++)
+        txn_indexes.emplace(block.vtx[i]->GetHash(), i);
+
+    std::set<uint32_t> parents;
+    for (uint32_t i = 0; i < block.vtx.size(); i++) {
+        for (const CTxIn& in : block.vtx[i]->vin) {
+            auto const it = txn_indexes.find(in.prevout.hash);
+            if (it == txn_indexes.end() || it->second >= i || FindPrevOutHash(in.prevout.hash))
+                continue;
+            if (FindInBlockTx(in.prevout.hash, i) != i - it->second)
+                parents.insert(it->second);
+        }
+    }
+
+    for (uint32_t const index : parents) {
+        // As computed by CBlockHeaderAndShortTxIDs::GetShortID
+        uint64_t const shorttxid = SipHashUint256(shorttxidk0, shorttxidk1, block.vtx[index]->GetHash()) & 0xffffffffffffL;
+        in_block_parents.push_back({index, shorttxid});
+        shorttxid_indexes[shorttxid] = index;
+    }
+}
+
+uint32_t CTxCompressionContext::FindInBlockTx(const uint256& hash, uint32_t const tx_index) const
+{
+    if (shorttxid_indexes.empty())
+        return 0;
+    // As computed by CBlockHeaderAndShortTxIDs::GetShortID
+    uint64_t const shorttxid = SipHashUint256(shorttxidk0, shorttxidk1, hash) & 0xffffffffffffL;
+    auto const it = shorttxid_indexes.find(shorttxid);
+    if (it == shorttxid_indexes.end() || it->second >= tx_index)
+        return 0;
+    return tx_index - it->second;
+}
+
+const uint256& CTxCompressionContext::GetInBlockTxHash(uint32_t const tx_index, uint32_t const distance) const
+{
+    if (!block_txns || distance == 0 || distance > tx_index || tx_index - distance >= block_txns->size())
+        throw std::ios_base::failure("invalid compressed transaction. in-block reference out of range");
+    const CTransactionRef& tx = (*block_txns)[tx_index - distance];
+    if (!tx)
+        throw std::ios_base::failure("invalid compressed transaction. in-block reference to a missing transaction");
+    return tx->GetHash();
+}
 
 template <typename Stream>
-void decompressTransaction(Stream& s, CMutableTransaction& tx)
+void decompressTransaction(Stream& s, CMutableTransaction& tx, CTxCompressionContext const* ctx, uint32_t const tx_index)
 {
     uint8_t TxHeader = 0;
     s >> TxHeader;
+    bool UseContext = false;
+    if (ctx && TxHeader >= TxHeaderContextFlag) {
+        UseContext = true;
+        TxHeader -= TxHeaderContextFlag;
+    }
     LockTimeCode lock_time_code;
     uint8_t tx_version_code;
     std::tie(lock_time_code, tx_version_code) = ParseTxHeader(TxHeader);
@@ -254,7 +515,15 @@ void decompressTransaction(Stream& s, CMutableTransaction& tx)
                 s >> VARINT(PrevOutPoint);
             }
             uint256 PrevOutHash;
-            s >> PrevOutHash;
+            uint32_t PrevOutHashCode = 0;
+            if (UseContext)
+                s >> VARINT(PrevOutHashCode);
+            if (!PrevOutHashCode)
+                s >> PrevOutHash;
+            else if (PrevOutHashCode % 2 == 0)
+                PrevOutHash = ctx->GetPrevOutHash(PrevOutHashCode / 2);
+            else
+                PrevOutHash = ctx->GetInBlockTxHash(tx_index, PrevOutHashCode / 2 + 1);
             txin.prevout.n = PrevOutPoint;
             txin.prevout.hash = PrevOutHash;
         }
@@ -314,7 +583,7 @@ void decompressTransaction(Stream& s, CMutableTransaction& tx)
         }
         case scriptSigTemplate::P2PKH: {
             valtype SmallScriptSig;
-            s >> SmallScriptSig;
+            UnserializeSingleKeyScriptSig(s, SmallScriptSig, UseContext ? ctx : nullptr);
             std::vector<valtype> scriptsigstack = PadSingleKeyStack(MakeSpan(SmallScriptSig),
                 TemplateCode / 2, TemplateType, sighashall);
             txin.scriptSig = decode_push_only(MakeSpan(scriptsigstack));
@@ -324,7 +593,7 @@ void decompressTransaction(Stream& s, CMutableTransaction& tx)
         case scriptSigTemplate::P2SH_P2WPKH:
         case scriptSigTemplate::P2SH_P2WSH_P2PKH: {
             valtype SmallScriptSig;
-            s >> SmallScriptSig;
+            UnserializeSingleKeyScriptSig(s, SmallScriptSig, UseContext ? ctx : nullptr);
             std::vector<valtype> scriptsigstack = PadSingleKeyStack(MakeSpan(SmallScriptSig),
                 TemplateCode / 2, TemplateType, sighashall);
 
@@ -391,6 +660,16 @@ void decompressTransaction(Stream& s, CMutableTransaction& tx)
         tx.vout.push_back(CTxOut());
         CTxOut& txout = tx.vout.back();
 
+        if (ctx && TxOutCode == TxOutContextCode) {
+            uint32_t ScriptRef;
+            s >> VARINT(ScriptRef);
+            txout.scriptPubKey = ctx->GetScript(ScriptRef);
+            uint64_t amount;
+            s >> VARINT(amount);
+            txout.nValue = DecompressAmount(amount);
+            continue;
+        }
+
         if (TxOutCode == 100) {
             uint64_t scriptlength;
             s >> VARINT(scriptlength);
@@ -419,11 +698,23 @@ void decompressTransaction(Stream& s, CMutableTransaction& tx)
 }
 
 template <typename Stream>
-void compressTransaction(Stream& s, CTransaction const& tx)
+void compressTransaction(Stream& s, CTransaction const& tx, CTxCompressionContext const* ctx, uint32_t const tx_index)
 {
+    std::vector<std::pair<uint16_t, valtype>> ScriptSigs;
+    ScriptSigs.reserve(tx.vin.size());
+    bool UseContext = false;
+    for (size_t i = 0; i < tx.vin.size(); i++) {
+        ScriptSigs.push_back(GenerateScriptSigHeader(i, tx.vin[i]));
+        if (ctx && !UseContext) {
+            UseContext = GetPrevOutHashCode(*ctx, tx.vin[i].prevout.hash, tx_index) ||
+                (IsSingleKeyScriptSigHeader(ScriptSigs.back().first) &&
+                 ctx->FindPubKey(MakeSpan(ScriptSigs.back().second).last(32)));
+        }
+    }
+
     uint8_t const TxHeader = GenerateTxHeader(tx.nLockTime, tx.nVersion);
 
-    s << TxHeader;
+    s << uint8_t(UseContext ? TxHeader + TxHeaderContextFlag : TxHeader);
     LockTimeCode lock_time_code;
     uint8_t tx_version_code;
     std::tie(lock_time_code, tx_version_code) = ParseTxHeader(TxHeader);
@@ -454,16 +745,19 @@ void compressTransaction(Stream& s, CTransaction const& tx)
             if (PrevOutCode == PrevOutVarInt) {
                 s << VARINT(tx.vin[i].prevout.n);
             }
-            s << tx.vin[i].prevout.hash;
+            uint32_t const PrevOutHashCode = UseContext ? GetPrevOutHashCode(*ctx, tx.vin[i].prevout.hash, tx_index) : 0;
+            if (UseContext)
+                s << VARINT(PrevOutHashCode);
+            if (!PrevOutHashCode)
+                s << tx.vin[i].prevout.hash;
         }
 
         if (SeqCode == SequenceCode::raw) {
             s << tx.vin[i].nSequence;
         }
 
-        uint16_t ScriptSigHeader;
-        valtype SmallScriptSig;
-        std::tie(ScriptSigHeader, SmallScriptSig) = GenerateScriptSigHeader(i, tx.vin[i]);
+        uint16_t const ScriptSigHeader = ScriptSigs[i].first;
+        valtype const& SmallScriptSig = ScriptSigs[i].second;
 
         s << VARINT(ScriptSigHeader);
         if (ScriptSigHeader < 4) {
@@ -475,6 +769,8 @@ void compressTransaction(Stream& s, CTransaction const& tx)
                 s << tx.vin[i].scriptSig;
                 s << tx.vin[i].scriptWitness.stack;
             }
+        } else if (IsSingleKeyScriptSigHeader(ScriptSigHeader)) {
+            SerializeSingleKeyScriptSig(s, SmallScriptSig, UseContext ? ctx : nullptr);
         } else {
             s << SmallScriptSig;
         }
@@ -482,6 +778,15 @@ void compressTransaction(Stream& s, CTransaction const& tx)
 
     for (size_t i = 0; i < tx.vout.size(); i++) {
         bool const last = i + 1 == tx.vout.size();
+        uint32_t const ScriptRef = ctx ? ctx->FindScript(tx.vout[i].scriptPubKey) : 0;
+        if (ScriptRef) {
+            s << uint8_t((last ? 1 : 0) + 2 * TxOutContextCode);
+            s << VARINT(ScriptRef);
+            uint64_t const amount = CompressAmount(tx.vout[i].nValue);
+            s << VARINT(amount);
+            continue;
+        }
+
         valtype txoutscriptdata;
         uint8_t TxPartHeader;
         std::tie(TxPartHeader, txoutscriptdata) = GenerateTxOutHeader(last, tx.vout[i].scriptPubKey);
@@ -502,12 +807,12 @@ void compressTransaction(Stream& s, CTransaction const& tx)
     }
 }
 
-template void compressTransaction<CDataStream>(CDataStream&, CTransaction const&);
-template void compressTransaction<VectorOutputStream>(VectorOutputStream&, CTransaction const&);
-template void compressTransaction<CVectorWriter>(CVectorWriter&, CTransaction const&);
-template void compressTransaction<CSizeComputer>(CSizeComputer&, CTransaction const&);
-template void decompressTransaction<CDataStream>(CDataStream&, CMutableTransaction&);
-template void decompressTransaction<VectorInputStream>(VectorInputStream&, CMutableTransaction&);
+template void compressTransaction<CDataStream>(CDataStream&, CTransaction const&, CTxCompressionContext const*, uint32_t);
+template void compressTransaction<VectorOutputStream>(VectorOutputStream&, CTransaction const&, CTxCompressionContext const*, uint32_t);
+template void compressTransaction<CVectorWriter>(CVectorWriter&, CTransaction const&, CTxCompressionContext const*, uint32_t);
+template void compressTransaction<CSizeComputer>(CSizeComputer&, CTransaction const&, CTxCompressionContext const*, uint32_t);
+template void decompressTransaction<CDataStream>(CDataStream&, CMutableTransaction&, CTxCompressionContext const*, uint32_t);
+template void decompressTransaction<VectorInputStream>(VectorInputStream&, CMutableTransaction&, CTxCompressionContext const*, uint32_t);
 
 uint8_t GenerateTxHeader(uint32_t const lock_time, uint32_t const version)
 {
@@ -13,6 +13,7 @@
 #include <span.h>
 #include <hash.h>
 #include <array>
+#include <map>
 #include <boost/variant.hpp>
 
 using valtype = std::vector<unsigned char>;
@@ -121,7 +122,7 @@ public:
     }
 };
 
-enum codec_version_t : std::uint8_t { none, v1, default_version = v1 };
+enum codec_version_t : std::uint8_t { none, v1, v2, default_version = v1 };
 
 /** wrapper for CTxOut that provides a more compact serialization */
 class CTxOutCompressor
@@ -212,17 +213,118 @@ std::pair<uint8_t, uint8_t> KNDecoder(uint16_t kncode);
 void PadAllPubkeys(valtype &strippedstack, std::vector<valtype>& paddedstack, uint8_t n);
 void PadScriptPubKey(uint8_t TxOutCode, CScript &scriptPubKey);
 
+class CBlock;
+
+/** Block-level context of the v2 codec.
+ *
+ *  Holds the prevout txids, the public keys of single-key spends and the
+ *  output scripts that appear more than once across the transactions of a
+ *  block. The v2 codec encodes each occurrence of these as a back-reference
+ *  into this table, which is sent once along with the block header.
+ *
+ *  Spends of an earlier transaction of the block are encoded as its distance
+ *  in the block instead. Receivers only know the short ids of the transactions
+ *  they miss, so the spent transaction is looked up by the short id of the
+ *  prevout's txid. The short ids of the header, computed over the wtxid, find
+ *  the spent transactions without witness; the others are sent along with the
+ *  table, with the short id of their txid. Either end encodes a transaction
+ *  the same way knowing only the table, the short ids and its index in the
+ *  block.
+ */
+class CTxCompressionContext
+{
+private:
+    std::vector<uint256> prevout_hashes;
+    std::vector<uint256> pubkeys; // stripped keys, ie without their prefix byte
+    std::vector<CScript> scripts;
+
+    // Reverse lookups, rebuilt upon deserialization
+    std::map<uint256, uint32_t> prevout_hash_refs;
+    std::map<uint256, uint32_t> pubkey_refs;
+    std::map<CScript, uint32_t> script_refs;
+
+    // Txns of the block spent by later ones that the short ids of the header
+    // do not find, with the short id of their txid
+    struct InBlockParent {
+        uint32_t index;
+        uint64_t shorttxid;
+
+        ADD_SERIALIZE_METHODS;
+
+        template <typename Stream, typename Operation>
+        inline void SerializationOp(Stream& s, Operation ser_action) {
+            READWRITE(VARINT(index));
+            uint32_t lsb = shorttxid & 0xffffffff;
+            uint16_t msb = (shorttxid >> 32) & 0xffff;
+            READWRITE(lsb);
+            READWRITE(msb);
+            if (ser_action.ForRead())
+                shorttxid = (uint64_t(msb) << 32) | uint64_t(lsb);
+        }
+    };
+    std::vector<InBlockParent> in_block_parents;
+
+    // Short ids of the non-prefilled txns of the block and of the parents
+    // above, and their index in it, set from the header on both ends
+    uint64_t shorttxidk0 = 0, shorttxidk1 = 0;
+    std::map<uint64_t, uint32_t> shorttxid_indexes;
+    // The txns of the block decoded so far, when decompressing
+    const std::vector<CTransactionRef>* block_txns = nullptr;
+
+    void BuildRefs();
+
+public:
+    CTxCompressionContext() {}
+    explicit CTxCompressionContext(const CBlock& block);
+
+    bool IsEmpty() const { return prevout_hashes.empty() && pubkeys.empty() && scripts.empty(); }
+    size_t Size() const { return prevout_hashes.size() + pubkeys.size() + scripts.size(); }
+
+    // The Find* methods return the 1-based reference of an entry, or 0 if it
+    // is not part of the context. The Get* methods throw on invalid references.
+    uint32_t FindPrevOutHash(const uint256& hash) const;
+    uint32_t FindPubKey(Span<unsigned char const> strippedpubkey) const;
+    uint32_t FindScript(const CScript& script) const;
+    const uint256& GetPrevOutHash(uint32_t ref) const;
+    const uint256& GetPubKey(uint32_t ref) const;
+    const CScript& GetScript(uint32_t ref) const;
+
+    void SetShortTxIDs(uint64_t k0, uint64_t k1, std::map<uint64_t, uint32_t> indexes);
+    // Adds the spent txns of the block that the short ids set above do not
+    // find, when encoding it
+    void AddInBlockParents(const CBlock& block);
+    void SetBlockTxns(const std::vector<CTransactionRef>* txns) { block_txns = txns; }
+    // Distance back from tx_index to the txn of the block with the given
+    // txid, or 0 if there is none before it
+    uint32_t FindInBlockTx(const uint256& hash, uint32_t tx_index) const;
+    const uint256& GetInBlockTxHash(uint32_t tx_index, uint32_t distance) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(prevout_hashes);
+        READWRITE(pubkeys);
+        READWRITE(scripts);
+        READWRITE(in_block_parents);
+        if (ser_action.ForRead())
+            BuildRefs();
+    }
+};
+
 template <typename Stream>
-void decompressTransaction(Stream& s, CMutableTransaction& tx);
+void decompressTransaction(Stream& s, CMutableTransaction& tx, CTxCompressionContext const* ctx = nullptr, uint32_t tx_index = 0);
 
 template <typename Stream>
-void compressTransaction(Stream& s, CTransaction const& tx);
+void compressTransaction(Stream& s, CTransaction const& tx, CTxCompressionContext const* ctx = nullptr, uint32_t tx_index = 0);
 
 struct CTxCompressor
 {
-    CTxCompressor(CTransactionRef& txin, codec_version_t v) : tx(&txin), codec_version(v) {}
-    CTxCompressor(CTransaction const& txin, codec_version_t v) : tx(&txin), codec_version(v) {}
-    CTxCompressor(CMutableTransaction &txin, codec_version_t v) : tx(&txin), codec_version(v) {}
+    // The context, and the index of the txn in its block, are only used by
+    // codec v2. Without a context, v2 compresses transactions exactly like v1.
+    CTxCompressor(CTransactionRef& txin, codec_version_t v, CTxCompressionContext const* ctx = nullptr, uint32_t index = 0) : tx(&txin), codec_version(v), context(ctx), tx_index(index) {}
+    CTxCompressor(CTransaction const& txin, codec_version_t v, CTxCompressionContext const* ctx = nullptr, uint32_t index = 0) : tx(&txin), codec_version(v), context(ctx), tx_index(index) {}
+    CTxCompressor(CMutableTransaction &txin, codec_version_t v, CTxCompressionContext const* ctx = nullptr, uint32_t index = 0) : tx(&txin), codec_version(v), context(ctx), tx_index(index) {}
 
     template<typename Stream>
     void Serialize(Stream& s) const {
@@ -237,12 +339,13 @@ struct CTxCompressor
                 throw std::runtime_error("cannot serialize CMutableTransaction");
             }
         }
-        else if (codec_version == codec_version_t::v1) {
+        else if (codec_version == codec_version_t::v1 || codec_version == codec_version_t::v2) {
+            CTxCompressionContext const* ctx = codec_version == codec_version_t::v2 ? context : nullptr;
             if (boost::get<CTransactionRef*>(&tx) != nullptr) {
-                compressTransaction(s, **boost::get<CTransactionRef*>(tx));
+                compressTransaction(s, **boost::get<CTransactionRef*>(tx), ctx, tx_index);
             }
             else if (boost::get<CTransaction const*>(&tx) != nullptr) {
-                compressTransaction(s, *boost::get<CTransaction const*>(tx));
+                compressTransaction(s, *boost::get<CTransaction const*>(tx), ctx, tx_index);
             }
             else {
                 throw std::runtime_error("cannot serialize CMutableTransaction");
@@ -266,14 +369,15 @@ struct CTxCompressor
                 throw std::runtime_error("cannot un-serialize into CTransaction");
            }
         }
-        else if (codec_version == codec_version_t::v1) {
+        else if (codec_version == codec_version_t::v1 || codec_version == codec_version_t::v2) {
+            CTxCompressionContext const* ctx = codec_version == codec_version_t::v2 ? context : nullptr;
             if (boost::get<CTransactionRef*>(&tx) != nullptr) {
                 CMutableTransaction local_tx;
-                decompressTransaction(s, local_tx);
+                decompressTransaction(s, local_tx, ctx, tx_index);
                 *boost::get<CTransactionRef*>(tx) = MakeTransactionRef(std::move(local_tx));
             }
             else if (boost::get<CMutableTransaction*>(&tx) != nullptr) {
-                decompressTransaction(s, *boost::get<CMutableTransaction*>(tx));
+                decompressTransaction(s, *boost::get<CMutableTransaction*>(tx), ctx, tx_index);
             }
             else {
                 throw std::runtime_error("cannot un-serialize into CTransaction");
@@ -286,6 +390,8 @@ struct CTxCompressor
 private:
     boost::variant<CMutableTransaction*, CTransaction const*, CTransactionRef*> tx;
     codec_version_t codec_version = codec_version_t::v1;
+    CTxCompressionContext const* context = nullptr;
+    uint32_t tx_index = 0;
 };
 
 #endif // BITCOIN_COMPRESSOR_H
@@ -137,7 +137,12 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& in
 
 int64_t GetTransactionSigOpCost(const CTransaction& tx, const CCoinsViewCache& inputs, int flags)
 {
-    int64_t nSigOps = GetLegacySigOpCount(tx) * WITNESS_SCALE_FACTOR;
+    return GetTransactionSigOpCost(tx, inputs, flags, GetLegacySigOpCount(tx));
+}
+
+int64_t GetTransactionSigOpCost(const CTransaction& tx, const CCoinsViewCache& inputs, int flags, unsigned int legacy_sigops)
+{
+    int64_t nSigOps = (int64_t)legacy_sigops * WITNESS_SCALE_FACTOR;
 
     if (tx.IsCoinBase())
         return nSigOps;
@@ -54,6 +54,12 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
  */
 int64_t GetTransactionSigOpCost(const CTransaction& tx, const CCoinsViewCache& inputs, int flags);
 
+/**
+ * Same as above, with the legacy sigop count of the transaction already known,
+ * e.g. from the context-free checks of its block
+ */
+int64_t GetTransactionSigOpCost(const CTransaction& tx, const CCoinsViewCache& inputs, int flags, unsigned int legacy_sigops);
+
 /**
  * Check if transaction is final and can be included in a block with the
  * specified height and time. Consensus critical.
@@ -15,6 +15,7 @@ class CBlock;
 class CBlockHeader;
 class CScript;
 class CTransaction;
+class JSONWriter;
 struct CMutableTransaction;
 class uint256;
 class UniValue;
@@ -44,7 +45,10 @@ std::string FormatScript(const CScript& script);
 std::string EncodeHexTx(const CTransaction& tx, const int serializeFlags = 0);
 std::string SighashToStr(unsigned char sighash_type);
 void ScriptPubKeyToUniv(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
+void ScriptPubKeyToUniv(const CScript& scriptPubKey, JSONWriter& out, bool fIncludeHex);
 void ScriptToUniv(const CScript& script, UniValue& out, bool include_address);
 void TxToUniv(const CTransaction& tx, const uint256& hashBlock, UniValue& entry, bool include_hex = true, int serialize_flags = 0);
+/** Write the members of the object TxToUniv fills in, e.g. to stream them out without building a UniValue */
+void TxToUniv(const CTransaction& tx, const uint256& hashBlock, JSONWriter& entry, bool include_hex = true, int serialize_flags = 0);
 
 #endif // BITCOIN_CORE_IO_H
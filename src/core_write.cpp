@@ -6,6 +6,7 @@
 
 #include <consensus/consensus.h>
 #include <consensus/validation.h>
+#include <jsonwriter.h>
 #include <key_io.h>
 #include <script/script.h>
 #include <script/standard.h>
@@ -149,88 +150,106 @@ void ScriptToUniv(const CScript& script, UniValue& out, bool include_address)
     }
 }
 
-void ScriptPubKeyToUniv(const CScript& scriptPubKey,
-                        UniValue& out, bool fIncludeHex)
+void ScriptPubKeyToUniv(const CScript& scriptPubKey, JSONWriter& out, bool fIncludeHex)
 {
     txnouttype type;
     std::vector<CTxDestination> addresses;
     int nRequired;
 
-    out.pushKV("asm", ScriptToAsmStr(scriptPubKey));
+    out.PushKV("asm", ScriptToAsmStr(scriptPubKey));
     if (fIncludeHex)
-        out.pushKV("hex", HexStr(scriptPubKey.begin(), scriptPubKey.end()));
+        out.PushKV("hex", HexStr(scriptPubKey.begin(), scriptPubKey.end()));
 
     if (!ExtractDestinations(scriptPubKey, type, addresses, nRequired) || type == TX_PUBKEY) {
-        out.pushKV("type", GetTxnOutputType(type));
+        out.PushKV("type", GetTxnOutputType(type));
         return;
     }
 
-    out.pushKV("reqSigs", nRequired);
-    out.pushKV("type", GetTxnOutputType(type));
+    out.PushKV("reqSigs", nRequired);
+    out.PushKV("type", GetTxnOutputType(type));
 
-    UniValue a(UniValue::VARR);
+    out.Key("addresses");
+    out.BeginArray();
     for (const CTxDestination& addr : addresses) {
-        a.push_back(EncodeDestination(addr));
+        out.String(EncodeDestination(addr));
     }
-    out.pushKV("addresses", a);
+    out.EndArray();
 }
 
-void TxToUniv(const CTransaction& tx, const uint256& hashBlock, UniValue& entry, bool include_hex, int serialize_flags)
+void ScriptPubKeyToUniv(const CScript& scriptPubKey,
+                        UniValue& out, bool fIncludeHex)
 {
-    entry.pushKV("txid", tx.GetHash().GetHex());
-    entry.pushKV("hash", tx.GetWitnessHash().GetHex());
-    entry.pushKV("version", tx.nVersion);
-    entry.pushKV("size", (int)::GetSerializeSize(tx, PROTOCOL_VERSION));
-    entry.pushKV("vsize", (GetTransactionWeight(tx) + WITNESS_SCALE_FACTOR - 1) / WITNESS_SCALE_FACTOR);
-    entry.pushKV("weight", GetTransactionWeight(tx));
-    entry.pushKV("locktime", (int64_t)tx.nLockTime);
-
-    UniValue vin(UniValue::VARR);
+    UniValueWriter writer(out);
+    ScriptPubKeyToUniv(scriptPubKey, writer, fIncludeHex);
+}
+
+void TxToUniv(const CTransaction& tx, const uint256& hashBlock, JSONWriter& entry, bool include_hex, int serialize_flags)
+{
+    entry.PushKV("txid", tx.GetHash().GetHex());
+    entry.PushKV("hash", tx.GetWitnessHash().GetHex());
+    entry.PushKV("version", tx.nVersion);
+    entry.PushKV("size", (int)::GetSerializeSize(tx, PROTOCOL_VERSION));
+    entry.PushKV("vsize", (GetTransactionWeight(tx) + WITNESS_SCALE_FACTOR - 1) / WITNESS_SCALE_FACTOR);
+    entry.PushKV("weight", GetTransactionWeight(tx));
+    entry.PushKV("locktime", (int64_t)tx.nLockTime);
+
+    entry.Key("vin");
+    entry.BeginArray();
     for (unsigned int i = 0; i < tx.vin.size(); i++) {
         const CTxIn& txin = tx.vin[i];
-        UniValue in(UniValue::VOBJ);
+        entry.BeginObject();
         if (tx.IsCoinBase())
-            in.pushKV("coinbase", HexStr(txin.scriptSig.begin(), txin.scriptSig.end()));
+            entry.PushKV("coinbase", HexStr(txin.scriptSig.begin(), txin.scriptSig.end()));
         else {
-            in.pushKV("txid", txin.prevout.hash.GetHex());
-            in.pushKV("vout", (int64_t)txin.prevout.n);
-            UniValue o(UniValue::VOBJ);
-            o.pushKV("asm", ScriptToAsmStr(txin.scriptSig, true));
-            o.pushKV("hex", HexStr(txin.scriptSig.begin(), txin.scriptSig.end()));
-            in.pushKV("scriptSig", o);
+            entry.PushKV("txid", txin.prevout.hash.GetHex());
+            entry.PushKV("vout", (int64_t)txin.prevout.n);
+            entry.Key("scriptSig");
+            entry.BeginObject();
+            entry.PushKV("asm", ScriptToAsmStr(txin.scriptSig, true));
+            entry.PushKV("hex", HexStr(txin.scriptSig.begin(), txin.scriptSig.end()));
+            entry.EndObject();
             if (!tx.vin[i].scriptWitness.IsNull()) {
-                UniValue txinwitness(UniValue::VARR);
+                entry.Key("txinwitness");
+                entry.BeginArray();
                 for (const auto& item : tx.vin[i].scriptWitness.stack) {
-                    txinwitness.push_back(HexStr(item.begin(), item.end()));
+                    entry.String(HexStr(item.begin(), item.end()));
                 }
-                in.pushKV("txinwitness", txinwitness);
+                entry.EndArray();
             }
         }
-        in.pushKV("sequence", (int64_t)txin.nSequence);
-        vin.push_back(in);
+        entry.PushKV("sequence", (int64_t)txin.nSequence);
+        entry.EndObject();
     }
-    entry.pushKV("vin", vin);
+    entry.EndArray();
 
-    UniValue vout(UniValue::VARR);
+    entry.Key("vout");
+    entry.BeginArray();
     for (unsigned int i = 0; i < tx.vout.size(); i++) {
         const CTxOut& txout = tx.vout[i];
 
-        UniValue out(UniValue::VOBJ);
+        entry.BeginObject();
 
-        out.pushKV("value", ValueFromAmount(txout.nValue));
-        out.pushKV("n", (int64_t)i);
+        entry.PushKV("value", ValueFromAmount(txout.nValue));
+        entry.PushKV("n", (int64_t)i);
 
-        UniValue o(UniValue::VOBJ);
-        ScriptPubKeyToUniv(txout.scriptPubKey, o, true);
-        out.pushKV("scriptPubKey", o);
-        vout.push_back(out);
+        entry.Key("scriptPubKey");
+        entry.BeginObject();
+        ScriptPubKeyToUniv(txout.scriptPubKey, entry, true);
+        entry.EndObject();
+        entry.EndObject();
     }
-    entry.pushKV("vout", vout);
+    entry.EndArray();
 
     if (!hashBlock.IsNull())
-        entry.pushKV("blockhash", hashBlock.GetHex());
+        entry.PushKV("blockhash", hashBlock.GetHex());
 
     if (include_hex) {
-        entry.pushKV("hex", EncodeHexTx(tx, serialize_flags)); // The hex-encoded transaction. Used the name "hex" to be consistent with the verbose output of "getrawtransaction".
+        entry.PushKV("hex", EncodeHexTx(tx, serialize_flags)); // The hex-encoded transaction. Used the name "hex" to be consistent with the verbose output of "getrawtransaction".
     }
 }
+
+void TxToUniv(const CTransaction& tx, const uint256& hashBlock, UniValue& entry, bool include_hex, int serialize_flags)
+{
+    UniValueWriter writer(entry);
+    TxToUniv(tx, hashBlock, writer, include_hex, serialize_flags);
+}
@@ -5,6 +5,7 @@
 #ifndef BITCOIN_CUCKOOCACHE_H
 #define BITCOIN_CUCKOOCACHE_H
 
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <cmath>
@@ -467,6 +468,10 @@ public:
     inline bool contains(const Element& e, const bool erase) const
     {
         std::array<uint32_t, 8> locs = compute_hashes(e);
+        // Load all the locations at once, rather than missing the CPU caches
+        // on one after another in a table much larger than them
+        for (const uint32_t loc : locs)
+            __builtin_prefetch(&table[loc], 0);
         for (const uint32_t loc : locs)
             if (table[loc] == e) {
                 if (erase)
@@ -5,6 +5,7 @@
 #include <dbwrapper.h>
 
 #include <memory>
+#include <numeric>
 #include <random.h>
 
 #include <leveldb/cache.h>
@@ -180,6 +181,36 @@ CDBWrapper::~CDBWrapper()
     options.env = nullptr;
 }
 
+void CDBWrapper::ReadManyRaw(const std::vector<leveldb::Slice>& keys, const std::function<void(size_t, std::string&)>& found) const
+{
+    // Neighbouring keys share blocks of the database files
+    std::vector<size_t> order(keys.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a].compare(keys[b]) < 0; });
+
+    const leveldb::Snapshot* snapshot = pdb->GetSnapshot();
+    leveldb::ReadOptions options = readoptions;
+    options.snapshot = snapshot;
+
+    std::string value;
+    value.reserve(DBWRAPPER_PREALLOC_VALUE_SIZE);
+    try {
+        for (size_t i : order) {
+            leveldb::Status status = pdb->Get(options, keys[i], &value);
+            if (status.ok()) {
+                found(i, value);
+            } else if (!status.IsNotFound()) {
+                LogPrintf("LevelDB read failure: %s\n", status.ToString());
+                dbwrapper_private::HandleError(status);
+            }
+        }
+    } catch (...) {
+        pdb->ReleaseSnapshot(snapshot);
+        throw;
+    }
+    pdb->ReleaseSnapshot(snapshot);
+}
+
 bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync)
 {
     const bool log_memory = LogAcceptCategory(BCLog::LEVELDB);
@@ -16,6 +16,8 @@
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+#include <functional>
+
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
 
@@ -212,6 +214,13 @@ private:
 
     std::vector<unsigned char> CreateObfuscateKey() const;
 
+    /**
+     * Look up serialized keys in key order, from a single snapshot of the
+     * database, calling found(i, value) for each key i present. The value
+     * buffer is reused by the next call.
+     */
+    void ReadManyRaw(const std::vector<leveldb::Slice>& keys, const std::function<void(size_t, std::string&)>& found) const;
+
 public:
     /**
      * @param[in] path        Location in the filesystem where leveldb data will be stored.
@@ -253,6 +262,50 @@ public:
         return true;
     }
 
+    /**
+     * Read the values of many keys at once, which is cheaper than as many
+     * calls to Read: keys are looked up in order from one snapshot, and
+     * buffers are shared by all of them.
+     *
+     * @param[out] values   values[i] is the value of keys[i] if found[i].
+     * @param[out] found    Whether each key was found, and its value read.
+     * @return The number of values read.
+     */
+    template <typename K, typename V>
+    size_t ReadMany(const std::vector<K>& keys, std::vector<V>& values, std::vector<bool>& found) const
+    {
+        CDataStream ssKeys(SER_DISK, CLIENT_VERSION);
+        std::vector<size_t> offsets;
+        offsets.reserve(keys.size() + 1);
+        for (const K& key : keys) {
+            offsets.push_back(ssKeys.size());
+            ssKeys << key;
+        }
+        offsets.push_back(ssKeys.size());
+        std::vector<leveldb::Slice> slKeys;
+        slKeys.reserve(keys.size());
+        for (size_t i = 0; i < keys.size(); i++)
+            slKeys.emplace_back(ssKeys.data() + offsets[i], offsets[i + 1] - offsets[i]);
+
+        values.clear();
+        values.resize(keys.size());
+        found.assign(keys.size(), false);
+        size_t count = 0;
+        ReadManyRaw(slKeys, [&](size_t i, std::string& strValue) {
+            if (!obfuscate_key.empty()) {
+                for (size_t j = 0; j < strValue.size(); j++)
+                    strValue[j] ^= obfuscate_key[j % obfuscate_key.size()];
+            }
+            try {
+                SpanReader(SER_DISK, CLIENT_VERSION, Span<const unsigned char>((const unsigned char*)strValue.data(), strValue.size())) >> values[i];
+                found[i] = true;
+                count++;
+            } catch (const std::exception&) {
+            }
+        });
+        return count;
+    }
+
     template <typename K, typename V>
     bool Write(const K& key, const V& value, bool fSync = false)
     {
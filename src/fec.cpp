@@ -7,7 +7,10 @@
 #include <consensus/consensus.h> // for MAX_BLOCK_SERIALIZED_SIZE
 #include <blockencodings.h> // for MAX_CHUNK_CODED_BLOCK_SIZE_FACTOR
 #include <util/system.h>
+#include <tinyformat.h>
+#include <memusage.h>
 
+#include <cmath>
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -51,6 +54,11 @@ BlockChunkRecvdTracker& BlockChunkRecvdTracker::operator=(BlockChunkRecvdTracker
     return *this;
 }
 
+size_t BlockChunkRecvdTracker::DynamicMemoryUsage() const {
+    return memusage::MallocUsage(DIV_CEIL(data_chunk_recvd_flags.capacity(), 8)) +
+        memusage::MallocUsage(fec_chunks_recvd.bucket_count() * sizeof(uint32_t));
+}
+
 namespace {
 
 template <typename T>
@@ -269,6 +277,13 @@ bool FECDecoder::HasChunk(uint32_t chunk_id) {
     return decodeComplete || chunk_tracker.CheckPresent(chunk_id);
 }
 
+size_t FECDecoder::DynamicMemoryUsage() const {
+    // The wirehair decoder holds about as much as the object while it solves
+    // for the missing chunks
+    return chunk_tracker.DynamicMemoryUsage() + memusage::DynamicUsage(chunk_ids) +
+        memusage::DynamicUsage(cm256_map) + (wirehair_decoder ? obj_size : 0);
+}
+
 bool FECDecoder::DecodeReady() const {
     return decodeComplete;
 }
@@ -474,6 +489,90 @@ bool BuildFECChunks(const std::vector<unsigned char>& data, std::pair<std::uniqu
     return enc.PrefillChunks();
 }
 
+static double FECDecoderFailureProb(size_t data_chunks, size_t chunks_recvd) {
+    if (chunks_recvd < data_chunks)
+        return 1;
+    if (CHUNK_COUNT_USES_CM256(data_chunks))
+        return 0; // MDS (also covers repetition coding of single-chunk objects)
+    return std::pow(WIREHAIR_EXTRA_CHUNK_FAIL_PROB, chunks_recvd - data_chunks + 1);
+}
+
+double FECDecodeFailureProb(size_t data_chunks, size_t n_chunks, double loss_rate) {
+    assert(data_chunks > 0);
+    assert(loss_rate >= 0 && loss_rate < 1);
+
+    if (n_chunks < data_chunks)
+        return 1;
+
+    if (loss_rate == 0)
+        return FECDecoderFailureProb(data_chunks, n_chunks);
+
+    // The number of chunks received out of n_chunks is binomially distributed
+    const double log_loss = std::log(loss_rate);
+    const double log_success = std::log1p(-loss_rate);
+    const double log_n_fact = std::lgamma(n_chunks + 1.0);
+    double fail_prob = 0;
+    for (size_t recvd = 0; recvd <= n_chunks; recvd++) {
+        const double decoder_fail_prob = FECDecoderFailureProb(data_chunks, recvd);
+        if (decoder_fail_prob == 0)
+            break; // decoder failure is non-increasing on the chunks received
+        const double log_pmf = log_n_fact - std::lgamma(recvd + 1.0) - std::lgamma(n_chunks - recvd + 1.0) +
+            recvd * log_success + (n_chunks - recvd) * log_loss;
+        fail_prob += decoder_fail_prob * std::exp(log_pmf);
+    }
+    return std::min(fail_prob, 1.0);
+}
+
+FECOverheadPolicy FECOverheadPolicy::LossModel(double loss_rate, double target_fail_prob) {
+    assert(loss_rate >= 0 && loss_rate < 1);
+    assert(target_fail_prob > 0 && target_fail_prob < 1);
+    FECOverheadPolicy policy(0, 0);
+    policy.loss_rate        = loss_rate;
+    policy.target_fail_prob = target_fail_prob;
+    return policy;
+}
+
+size_t FECOverheadPolicy::GetOverhead(size_t data_chunks) const {
+    if (!IsLossModel())
+        return base_overhead + (overhead * data_chunks);
+
+    assert(data_chunks > 0);
+
+    /* cm256 only offers 0xff - data_chunks distinct recovery chunk ids (see
+     * FECEncoder::BuildChunk), so sending more chunks than that only repeats
+     * chunks. Repetition-coded (single-chunk) objects have no such limit. */
+    const size_t max_chunks = (data_chunks > 1 && CHUNK_COUNT_USES_CM256(data_chunks)) ?
+        (0xff - data_chunks) : FEC_CHUNK_COUNT_MAX;
+
+    if (FECDecodeFailureProb(data_chunks, data_chunks, loss_rate) <= target_fail_prob)
+        return 0;
+
+    /* The failure probability is non-increasing on the number of chunks
+     * sent. Find an upper bound by exponential search, then the minimum
+     * number of chunks meeting the target by binary search. */
+    size_t lo = data_chunks, hi = data_chunks;
+    for (size_t step = 1; ; step *= 2) {
+        hi = std::min(data_chunks + step, max_chunks);
+        if (hi == max_chunks || FECDecodeFailureProb(data_chunks, hi, loss_rate) <= target_fail_prob)
+            break;
+        lo = hi;
+    }
+    while (hi - lo > 1) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (FECDecodeFailureProb(data_chunks, mid, loss_rate) <= target_fail_prob)
+            hi = mid;
+        else
+            lo = mid;
+    }
+    return hi - data_chunks;
+}
+
+std::string FECOverheadPolicy::ToString() const {
+    if (!IsLossModel())
+        return strprintf("fixed (%u + %.2f%% chunks)", base_overhead, 100 * overhead);
+    return strprintf("loss model (loss rate %g, target decode failure %g)", loss_rate, target_fail_prob);
+}
+
 class FECInit
 {
 public:
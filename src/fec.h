@@ -8,6 +8,7 @@
 #include <assert.h>
 #include <memory>
 #include <stdint.h>
+#include <string>
 #include <vector>
 #include <fs.h>
 
@@ -61,6 +62,8 @@ public:
         if (chunk_id < data_chunk_recvd_flags.size()) return data_chunk_recvd_flags[chunk_id];
         return fec_chunks_recvd.find_fast(chunk_id);
     }
+
+    size_t DynamicMemoryUsage() const;
 };
 
 class FECDecoder;
@@ -146,8 +149,53 @@ public:
     const void* GetDataPtr(uint32_t chunk_id); // Only valid until called again
     size_t GetChunkCount() const { return chunk_count; }
     size_t GetChunksRcvd() const { return chunks_recvd; }
+    size_t GetStorageSize() const { return owns_file ? chunk_count * FEC_CHUNK_SIZE : 0; } // Size of the file backing the chunks
+    size_t DynamicMemoryUsage() const; // Heap memory, besides the file backing the chunks
 };
 
 bool BuildFECChunks(const std::vector<unsigned char>& data, std::pair<std::unique_ptr<FECChunkType[]>, std::vector<uint32_t>>& fec_chunks);
 
+/**
+ * Probability that a receiver fails to decode an object of `data_chunks`
+ * chunks after `n_chunks` FEC chunks are sent through a link that erases each
+ * chunk independently with probability `loss_rate`.
+ *
+ * The decoder model depends on the coding scheme picked for the object size:
+ * repetition and cm256 are MDS (any `data_chunks` chunks suffice), whereas
+ * wirehair fails on N + j received chunks with probability
+ * WIREHAIR_EXTRA_CHUNK_FAIL_PROB^(j + 1), i.e. N + 0.02 chunks on average.
+ */
+static const double WIREHAIR_EXTRA_CHUNK_FAIL_PROB = 0.02;
+double FECDecodeFailureProb(size_t data_chunks, size_t n_chunks, double loss_rate);
+
+/**
+ * Number of overhead (recovery) chunks to send on top of the data chunks of a
+ * FEC-coded object.
+ *
+ * The fixed policy sends `base_overhead + overhead * data_chunks` recovery
+ * chunks regardless of the object size. The loss-model policy sends the
+ * minimum number of recovery chunks such that FECDecodeFailureProb() does not
+ * exceed `target_fail_prob` under the configured `loss_rate`.
+ */
+class FECOverheadPolicy {
+private:
+    size_t base_overhead;
+    double overhead;
+    double loss_rate = -1; // < 0 when using the fixed policy
+    double target_fail_prob = 0;
+
+public:
+    FECOverheadPolicy() : base_overhead(60), overhead(0.05) {}
+    FECOverheadPolicy(size_t base_overhead_in, double overhead_in) :
+        base_overhead(base_overhead_in), overhead(overhead_in) {}
+    static FECOverheadPolicy LossModel(double loss_rate, double target_fail_prob);
+
+    bool IsLossModel() const { return loss_rate >= 0; }
+    double GetLossRate() const { return loss_rate; }
+    double GetTargetFailProb() const { return target_fail_prob; }
+
+    size_t GetOverhead(size_t data_chunks) const;
+    std::string ToString() const;
+};
+
 #endif
@@ -7,6 +7,7 @@
 #include <chainparams.h>
 #include <crypto/hmac_sha256.h>
 #include <httpserver.h>
+#include <jsonwriter.h>
 #include <key_io.h>
 #include <rpc/protocol.h>
 #include <rpc/server.h>
@@ -84,6 +85,28 @@ static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const Uni
     req->WriteReply(nStatus, strReply);
 }
 
+bool WriteJSONReply(HTTPRequest* req, int nStatus, const std::function<void(JSONWriter&)>& write)
+{
+    req->WriteHeader("Content-Type", "application/json");
+    req->StartReply(nStatus);
+    JSONStreamWriter writer([req](const char* data, size_t size) { req->WriteReplyChunk(data, size); });
+    try {
+        write(writer);
+        writer.Raw("\n");
+    } catch (const UniValue& objError) {
+        LogPrintf("%s: Reply cut short: %s\n", __func__, find_value(objError, "message").getValStr());
+        req->AbortReply();
+        return false;
+    } catch (const std::exception& e) {
+        LogPrintf("%s: Reply cut short: %s\n", __func__, e.what());
+        req->AbortReply();
+        return false;
+    }
+    writer.Flush();
+    req->EndReply();
+    return true;
+}
+
 //This function checks username and password against -rpcauth
 //entries from config file.
 static bool multiUserAuthorized(std::string strUserPass)
@@ -188,9 +211,23 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         // singleton request
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
+            jreq.result_writer = std::make_shared<std::function<void(JSONWriter&)>>();
 
             UniValue result = tableRPC.execute(jreq);
 
+            // Stream the result out if the method left it to be written
+            const std::function<void(JSONWriter&)> write_result = std::move(*jreq.result_writer);
+            if (write_result) {
+                return WriteJSONReply(req, HTTP_OK, [&](JSONWriter& reply) {
+                    reply.BeginObject();
+                    reply.Key("result");
+                    write_result(reply);
+                    reply.PushKV("error", NullUniValue);
+                    reply.PushKV("id", jreq.id);
+                    reply.EndObject();
+                });
+            }
+
             // Send reply
             strReply = JSONRPCReply(result, NullUniValue, jreq.id);
 
@@ -5,9 +5,13 @@
 #ifndef BITCOIN_HTTPRPC_H
 #define BITCOIN_HTTPRPC_H
 
+#include <functional>
 #include <string>
 #include <map>
 
+class HTTPRequest;
+class JSONWriter;
+
 /** Start HTTP RPC subsystem.
  * Precondition; HTTP and RPC has been started.
  */
@@ -20,6 +24,14 @@ void InterruptHTTPRPC();
  */
 void StopHTTPRPC();
 
+/**
+ * Send a JSON reply, followed by a newline, in chunks as write produces it
+ * rather than building it up first. Returns false if write failed partway,
+ * in which case the connection is closed without ending the body, as the
+ * status has been sent already, so the client sees that it is incomplete.
+ */
+bool WriteJSONReply(HTTPRequest* req, int nStatus, const std::function<void(JSONWriter&)>& write);
+
 /** Start HTTP REST subsystem.
  * Precondition; HTTP and RPC has been started.
  */
@@ -59,6 +59,7 @@ class HTTPRequest
 private:
     struct evhttp_request* req;
     bool replySent;
+    bool replyStarted;
 
 public:
     explicit HTTPRequest(struct evhttp_request* req);
@@ -114,6 +115,37 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a reply sent in chunks as its body is produced, for bodies too
+     * large to be built up front. Send the body with WriteReplyChunk and
+     * finish with EndReply, instead of calling WriteReply.
+     *
+     * @note Write all headers before calling this. The status can't be
+     * changed afterwards, so check for errors beforehand.
+     */
+    void StartReply(int nStatus);
+
+    /** Send the next part of the body of a reply begun with StartReply */
+    void WriteReplyChunk(const char* data, size_t size);
+
+    /**
+     * Finish a reply begun with StartReply.
+     *
+     * @note As with WriteReply, do not call any other HTTPRequest methods
+     * after calling this.
+     */
+    void EndReply();
+
+    /**
+     * Give up on a reply begun with StartReply, e.g. as producing the rest
+     * of its body failed, by closing the connection rather than ending the
+     * body, so that the client doesn't take what it got to be the whole.
+     *
+     * @note As with EndReply, do not call any other HTTPRequest methods
+     * after calling this.
+     */
+    void AbortReply();
 };
 
 /** Event handler closure.
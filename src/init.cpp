@@ -12,6 +12,7 @@
 #include <addrman.h>
 #include <amount.h>
 #include <banman.h>
+#include <blockfilemap.h>
 #include <blockfilter.h>
 #include <chain.h>
 #include <chainparams.h>
@@ -24,11 +25,13 @@
 #include <index/txindex.h>
 #include <interfaces/chain.h>
 #include <key.h>
+#include <metrics.h>
 #include <miner.h>
 #include <net.h>
 #include <net_permissions.h>
 #include <net_processing.h>
 #include <netbase.h>
+#include <node/utxo_snapshot.h>
 #include <policy/feerate.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
@@ -44,6 +47,7 @@
 #include <timedata.h>
 #include <torcontrol.h>
 #include <txdb.h>
+#include <txprevalidation.h>
 #include <txmempool.h>
 #include <udpapi.h>
 #include <ui_interface.h>
@@ -81,6 +85,7 @@
 static bool fFeeEstimatesInitialized = false;
 static const bool DEFAULT_PROXYRANDOMIZE = true;
 static const bool DEFAULT_REST_ENABLE = false;
+static const bool DEFAULT_METRICS_ENABLE = false;
 static const bool DEFAULT_STOPAFTERBLOCKIMPORT = false;
 
 // Dump addresses to banlist.dat every 15 minutes (900s)
@@ -189,6 +194,7 @@ void Shutdown(InitInterfaces& interfaces)
 
     StopHTTPRPC();
     StopREST();
+    StopHTTPMetrics();
     StopRPC();
     StopHTTPServer();
     for (const auto& client : interfaces.chain_clients) {
@@ -201,6 +207,7 @@ void Shutdown(InitInterfaces& interfaces)
     // using the other before destroying them.
     if (peerLogic) UnregisterValidationInterface(peerLogic.get());
     if (g_connman) g_connman->Stop();
+    if (g_block_template_cache) UnregisterValidationInterface(g_block_template_cache.get());
 
     StopTorControl();
 
@@ -214,6 +221,7 @@ void Shutdown(InitInterfaces& interfaces)
     peerLogic.reset();
     g_connman.reset();
     g_banman.reset();
+    g_block_template_cache.reset();
 
     if (::mempool.IsLoaded() && gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
         DumpMempool(::mempool);
@@ -264,6 +272,7 @@ void Shutdown(InitInterfaces& interfaces)
         LOCK(cs_main);
         if (g_chainstate && g_chainstate->CanFlushToDisk()) {
             g_chainstate->ForceFlushStateToDisk();
+            WriteBlockIndexCache();
             g_chainstate->ResetCoinsViews();
         }
         pblocktree.reset();
@@ -368,6 +377,8 @@ void SetupServerArgs()
     gArgs.AddArg("-alertnotify=<cmd>", "Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
 #endif
     gArgs.AddArg("-assumevalid=<hex>", strprintf("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: %s, testnet: %s)", defaultChainParams->GetConsensus().defaultAssumeValid.GetHex(), testnetChainParams->GetConsensus().defaultAssumeValid.GetHex()), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-backgroundflush", strprintf("Write the UTXO cache to disk on a background thread, keeping unmodified coins cached, unless the UTXO set has to be on disk right away (default: %u)", DEFAULT_BACKGROUND_FLUSH), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-blockfilemaps=<n>", strprintf("Number of block files kept memory-mapped for reading blocks, 0 to read them through buffered file I/O (default: %u)", DEFAULT_BLOCK_FILE_MAPS), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blocksdir=<dir>", "Specify directory to hold blocks subdirectory for *.dat files (default: <datadir>)", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
 #if HAVE_SYSTEM
     gArgs.AddArg("-blocknotify=<cmd>", "Execute command when the best block changes (%s in cmd is replaced by block hash)", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
@@ -382,6 +393,8 @@ void SetupServerArgs()
     gArgs.AddArg("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-includeconf=<file>", "Specify additional configuration file, relative to the -datadir path (only useable from configuration file, not command line)", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-loadblock=<file>", "Imports blocks from external blk000??.dat file on startup", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-loadutxosnapshot=<file>", "Bootstrap an empty chainstate from a UTXO snapshot written by dumptxoutset, instead of validating the blocks up to it. Requires -prune", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-loadutxosnapshothash=<hex>", "Trusted hash of the UTXO snapshot loaded with -loadutxosnapshot (hash_serialized_2 from gettxoutsetinfo on a trusted node at the same block). A snapshot is refused unless its hash matches this one, or the one built in for its block", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-maxmempool=<n>", strprintf("Keep the transaction memory pool below <n> megabytes (default: %u)", DEFAULT_MAX_MEMPOOL_SIZE), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-maxorphantx=<n>", strprintf("Keep at most <n> unconnectable transactions in memory (default: %u)", DEFAULT_MAX_ORPHAN_TRANSACTIONS), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-mempoolexpiry=<n>", strprintf("Do not keep transactions in the mempool longer than <n> hours (default: %u)", DEFAULT_MEMPOOL_EXPIRY), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
@@ -390,6 +403,7 @@ void SetupServerArgs()
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-persistmempool", strprintf("Whether to save the mempool on shutdown and load on restart (default: %u)", DEFAULT_PERSIST_MEMPOOL), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-pid=<file>", strprintf("Specify pid file. Relative paths will be prefixed by a net-specific datadir location. (default: %s)", BITCOIN_PID_FILENAME), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-prefetchthreads=<n>", strprintf("Set the number of threads reading the coins spent by blocks ahead of their connection (0 to %d, default: %d)", MAX_COINS_PREFETCH_THREADS, DEFAULT_COINS_PREFETCH_THREADS), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-prune=<n>", strprintf("Reduce storage requirements by enabling pruning (deleting) of old blocks. This allows the pruneblockchain RPC to be called to delete specific blocks, and enables automatic pruning of old blocks if a target size in MiB is provided. This mode is incompatible with -txindex and -rescan. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, 1 = allow manual pruning via RPC, >=%u = automatically prune block files to stay under the specified target size in MiB)", MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
@@ -401,6 +415,7 @@ void SetupServerArgs()
     hidden_args.emplace_back("-sysperms");
 #endif
 
+    gArgs.AddArg("-txprevalidationthreads=<n>", strprintf("Set the number of threads checking the scripts of transactions received from peers ahead of their acceptance to the mempool (0 to %d, default: %d)", MAX_TX_PREVALIDATION_THREADS, DEFAULT_TX_PREVALIDATION_THREADS), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-txindex", strprintf("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)", DEFAULT_TXINDEX), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blockfilterindex=<type>",
                  strprintf("Maintain an index of compact filters by block (default: %s, values: %s).", DEFAULT_BLOCKFILTERINDEX, ListBlockFilterTypes()) +
@@ -442,7 +457,9 @@ void SetupServerArgs()
     gArgs.AddArg("-udpport=<port>,<group>[,<bw>]", "Accepts UDP connections on <port> (default: bw=1024 =1024Mbps)", ArgsManager::ALLOW_ANY, OptionsCategory::CONNECTION);
 
     gArgs.AddArg("-udpmulticast=<if>,<dst_ip>:<port>,<src_ip>,<trusted>[,<label>]", "Listen to multicast-addressed UDP messages sent by <src_ip> towards <dst_ip>:<port> using interface <if>. Set <trusted> to 1 if sender is a trusted node. An optional <label> may be defined for the multicast group in order to facilitate inspection of logs.", ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
-    gArgs.AddArg("-udpmulticasttx=<if>,<ip/host>:<port>,<bw>,<txn_per_sec>[,<ttl>,<depth>,<offset>,<dscp>,<interleave>]", "Transmit multicast-addressed messages to <ip/host>:<port> through interface <if> with bandwidth <bw> in bps and TTL <ttl> (3 by default). If <txn_per_sec> is non-zero, send this number of mempool txns per second in addition to FEC-coded blocks. Iteratively transmit the past <depth> blocks with FEC coding. If <depth> is set to 0, iterate over the full chain. Start by transmitting a block height with offset <offset> relative to the bottom of the specified depth. Optionally define a DSCP for marking IP packets. Send <interleave> FEC-coded blocks in parallel while interleaving their FEC chunks. If <interleave> is set to 1, do not interleave the blocks and instead send only one FEC-coded block a time. If <interleave> is set to 0, completely disable the transmission of FEC-coded blocks.", ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
+    gArgs.AddArg("-udpmulticasttx=<if>,<ip/host>:<port>,<bw>,<txn_per_sec>[,<ttl>,<depth>,<offset>,<dscp>,<interleave>,<fec_loss>,<fec_fail>]", "Transmit multicast-addressed messages to <ip/host>:<port> through interface <if> with bandwidth <bw> in bps and TTL <ttl> (3 by default). If <txn_per_sec> is non-zero, send this number of mempool txns per second in addition to FEC-coded blocks. Iteratively transmit the past <depth> blocks with FEC coding. If <depth> is set to 0, iterate over the full chain. Start by transmitting a block height with offset <offset> relative to the bottom of the specified depth. Optionally define a DSCP for marking IP packets. Send <interleave> FEC-coded blocks in parallel while interleaving their FEC chunks. If <interleave> is set to 1, do not interleave the blocks and instead send only one FEC-coded block a time. If <interleave> is set to 0, completely disable the transmission of FEC-coded blocks. Optionally size the FEC overhead of each block header and body for a link that loses a fraction <fec_loss> of the packets, such that receivers fail to decode with probability of at most <fec_fail>. Otherwise, send 60 overhead chunks plus 5% of the chunks of each object.", ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
+    gArgs.AddArg("-udpblockcodec=<version>", strprintf("Compress the transactions of FEC-coded blocks sent over UDP with codec <version>. Version 1 compresses each transaction independently, whereas version 2 additionally back-references txids, public keys and output scripts repeated across the block. Receivers must support the chosen version. (default: %u)", DEFAULT_UDP_BLOCK_CODEC), ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
+    gArgs.AddArg("-udpblockbudget=<n>", strprintf("Keep the memory and disk usage of blocks being received over UDP below <n> MiB by evicting or dropping incomplete backfill (non-tip) blocks, least complete first. Set <n> to 0 for no limit. (default: %u)", DEFAULT_UDP_BLOCK_BUDGET), ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
     gArgs.AddArg("-udpmulticastloginterval=<interval>", "Change periodicity of multicast bit rate logs that are activated by option debug=udpmulticast. Set <interval> in seconds.", ArgsManager::ALLOW_ANY, OptionsCategory::UDP);
 #ifdef USE_UPNP
 #if USE_UPNP
@@ -541,6 +558,7 @@ void SetupServerArgs()
     gArgs.AddArg("-blockmintxfee=<amt>", strprintf("Set lowest fee rate (in %s/kB) for transactions to be included in block creation. (default: %s)", CURRENCY_UNIT, FormatMoney(DEFAULT_BLOCK_MIN_TX_FEE)), ArgsManager::ALLOW_ANY, OptionsCategory::BLOCK_CREATION);
     gArgs.AddArg("-blockversion=<n>", "Override block version to test forking scenarios", ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::BLOCK_CREATION);
 
+    gArgs.AddArg("-metrics", strprintf("Serve UDP/FEC relay metrics in the Prometheus text format on the /metrics path of the RPC server (default: %u)", DEFAULT_METRICS_ENABLE), ArgsManager::ALLOW_ANY, OptionsCategory::RPC);
     gArgs.AddArg("-rest", strprintf("Accept public REST requests (default: %u)", DEFAULT_REST_ENABLE), ArgsManager::ALLOW_ANY, OptionsCategory::RPC);
     gArgs.AddArg("-rpcallowip=<ip>", "Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times", ArgsManager::ALLOW_ANY, OptionsCategory::RPC);
     gArgs.AddArg("-rpcauth=<userpw>", "Username and HMAC-SHA-256 hashed password for JSON-RPC connections. The field <userpw> comes in the format: <USERNAME>:<SALT>$<HASH>. A canonical python script is included in share/rpcauth. The client then connects normally using the rpcuser=<USERNAME>/rpcpassword=<PASSWORD> pair of arguments. This option can be specified multiple times", ArgsManager::ALLOW_ANY, OptionsCategory::RPC);
@@ -779,6 +797,7 @@ static bool AppInitServers()
     if (!StartHTTPRPC())
         return false;
     if (gArgs.GetBoolArg("-rest", DEFAULT_REST_ENABLE)) StartREST();
+    if (gArgs.GetBoolArg("-metrics", DEFAULT_METRICS_ENABLE)) StartHTTPMetrics();
     StartHTTPServer();
     return true;
 }
@@ -1041,6 +1060,8 @@ bool AppInitParameterInteraction()
         mempool.setSanityCheck(1.0 / ratio);
     }
     fCheckBlockIndex = gArgs.GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
+    fBackgroundFlush = gArgs.GetBoolArg("-backgroundflush", DEFAULT_BACKGROUND_FLUSH);
+    g_block_file_maps.SetLimit(std::max<int64_t>(0, gArgs.GetArg("-blockfilemaps", DEFAULT_BLOCK_FILE_MAPS)));
     fCheckpointsEnabled = gArgs.GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
 
     hashAssumeValid = uint256S(gArgs.GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
@@ -1087,6 +1108,8 @@ bool AppInitParameterInteraction()
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    nCoinsPrefetchThreads = std::max<int64_t>(0, std::min<int64_t>(gArgs.GetArg("-prefetchthreads", DEFAULT_COINS_PREFETCH_THREADS), MAX_COINS_PREFETCH_THREADS));
+
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
     int64_t nPruneArg = gArgs.GetArg("-prune", 0);
     if (nPruneArg < 0) {
@@ -1105,6 +1128,11 @@ bool AppInitParameterInteraction()
         fPruneMode = true;
     }
 
+    // Blocks below a UTXO snapshot are never downloaded, as with pruned blocks
+    if (gArgs.IsArgSet("-loadutxosnapshot") && !fPruneMode) {
+        return InitError(_("Loading a UTXO snapshot requires -prune.").translated);
+    }
+
     nConnectTimeout = gArgs.GetArg("-timeout", DEFAULT_CONNECT_TIMEOUT);
     if (nConnectTimeout <= 0) {
         nConnectTimeout = DEFAULT_CONNECT_TIMEOUT;
@@ -1277,8 +1305,20 @@ bool AppInitMain(InitInterfaces& interfaces)
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread([i]() { return ThreadScriptCheck(i); });
+        // Context-free block checks are spread over as many threads
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread([i]() { return ThreadBlockCheck(i); });
     }
 
+    LogPrintf("Using %u threads for coins prefetching\n", nCoinsPrefetchThreads);
+    for (int i = 0; i < nCoinsPrefetchThreads; i++)
+        threadGroup.create_thread([i]() { return ThreadCoinsPrefetch(i); });
+
+    const int tx_prevalidation_threads = std::max<int64_t>(0, std::min<int64_t>(gArgs.GetArg("-txprevalidationthreads", DEFAULT_TX_PREVALIDATION_THREADS), MAX_TX_PREVALIDATION_THREADS));
+    LogPrintf("Using %u threads for transaction pre-validation\n", tx_prevalidation_threads);
+    for (int i = 0; i < tx_prevalidation_threads; i++)
+        threadGroup.create_thread([i]() { return ThreadTxPreValidation(i); });
+
     // Start the lightweight task scheduler thread
     CScheduler::Function serviceLoop = std::bind(&CScheduler::serviceQueue, &scheduler);
     threadGroup.create_thread(std::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
@@ -1337,6 +1377,10 @@ bool AppInitMain(InitInterfaces& interfaces)
     peerLogic.reset(new PeerLogicValidation(g_connman.get(), g_banman.get(), scheduler, gArgs.GetBoolArg("-enablebip61", DEFAULT_ENABLE_BIP61)));
     RegisterValidationInterface(peerLogic.get());
 
+    assert(!g_block_template_cache);
+    g_block_template_cache = MakeUnique<BlockTemplateCache>(chainparams, scheduler);
+    RegisterValidationInterface(g_block_template_cache.get());
+
     // sanitize comments per BIP-0014, format user agent and check total size
     std::vector<std::string> uacomments;
     for (const std::string& cmt : gArgs.GetArgs("-uacomment")) {
@@ -1568,6 +1612,19 @@ bool AppInitMain(InitInterfaces& interfaces)
                 ::ChainstateActive().InitCoinsCache();
                 assert(::ChainstateActive().CanFlushToDisk());
 
+                if (gArgs.IsArgSet("-loadutxosnapshot") && !fReset && !fReindexChainState) {
+                    if (::ChainstateActive().CoinsDB().GetBestBlock().IsNull()) {
+                        uiInterface.InitMessage(_("Loading UTXO snapshot...").translated);
+                        std::string error;
+                        if (!LoadUTXOSnapshot(AbsPathForConfigVal(gArgs.GetArg("-loadutxosnapshot", "")),
+                                uint256S(gArgs.GetArg("-loadutxosnapshothash", "")), chainparams, error)) {
+                            return InitError(strprintf(_("Unable to load the UTXO snapshot: %s").translated, error));
+                        }
+                    } else {
+                        LogPrintf("The chainstate is not empty, ignoring -loadutxosnapshot\n");
+                    }
+                }
+
                 is_coinsview_empty = fReset || fReindexChainState ||
                     ::ChainstateActive().CoinsTip().GetBestBlock().IsNull();
                 if (!is_coinsview_empty) {
@@ -0,0 +1,175 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <jsonwriter.h>
+
+#include <assert.h>
+
+JSONStreamWriter::JSONStreamWriter(Sink sink, size_t chunk_size)
+    : m_sink(std::move(sink)), m_chunk_size(chunk_size)
+{
+    m_buf.reserve(m_chunk_size + 1024);
+}
+
+void JSONStreamWriter::AppendEscaped(const std::string& str)
+{
+    static const char hex[] = "0123456789abcdef";
+    m_buf += '"';
+    // Escapes as UniValue does: quotes, backslashes and control characters
+    for (const char c : str) {
+        const unsigned char ch = c;
+        if (ch >= 0x20 && ch != '"' && ch != '\\' && ch != 0x7f) {
+            m_buf += c;
+            continue;
+        }
+        m_buf += '\\';
+        switch (ch) {
+        case '"': m_buf += '"'; break;
+        case '\\': m_buf += '\\'; break;
+        case '\b': m_buf += 'b'; break;
+        case '\t': m_buf += 't'; break;
+        case '\n': m_buf += 'n'; break;
+        case '\f': m_buf += 'f'; break;
+        case '\r': m_buf += 'r'; break;
+        default:
+            m_buf += "u00";
+            m_buf += hex[ch >> 4];
+            m_buf += hex[ch & 0xf];
+        }
+    }
+    m_buf += '"';
+}
+
+void JSONStreamWriter::BeginObject()
+{
+    Separate();
+    m_buf += '{';
+    m_comma = false;
+}
+
+void JSONStreamWriter::EndObject()
+{
+    m_buf += '}';
+    Written();
+}
+
+void JSONStreamWriter::BeginArray()
+{
+    Separate();
+    m_buf += '[';
+    m_comma = false;
+}
+
+void JSONStreamWriter::EndArray()
+{
+    m_buf += ']';
+    Written();
+}
+
+void JSONStreamWriter::Key(const std::string& key)
+{
+    Separate();
+    AppendEscaped(key);
+    m_buf += ':';
+    m_comma = false;
+}
+
+void JSONStreamWriter::String(const std::string& str)
+{
+    Separate();
+    AppendEscaped(str);
+    Written();
+}
+
+void JSONStreamWriter::Int(int64_t n)
+{
+    Separate();
+    m_buf += std::to_string(n);
+    Written();
+}
+
+void JSONStreamWriter::UInt(uint64_t n)
+{
+    Separate();
+    m_buf += std::to_string(n);
+    Written();
+}
+
+void JSONStreamWriter::Bool(bool b)
+{
+    Separate();
+    m_buf += b ? "true" : "false";
+    Written();
+}
+
+void JSONStreamWriter::Value(const UniValue& value)
+{
+    Separate();
+    switch (value.getType()) {
+    case UniValue::VSTR:
+        AppendEscaped(value.get_str());
+        break;
+    case UniValue::VNUM:
+        m_buf += value.getValStr();
+        break;
+    default:
+        m_buf += value.write();
+    }
+    Written();
+}
+
+void JSONStreamWriter::Flush()
+{
+    if (m_buf.empty()) return;
+    m_sink(m_buf.data(), m_buf.size());
+    m_buf.clear();
+}
+
+void UniValueWriter::Add(UniValue value)
+{
+    if (m_open.empty()) {
+        if (m_root.isObject()) {
+            m_root.pushKV(m_key, value);
+        } else if (m_root.isArray()) {
+            m_root.push_back(value);
+        } else {
+            m_root = std::move(value);
+        }
+        return;
+    }
+    UniValue& parent = m_open.back().second;
+    if (parent.isObject()) {
+        parent.__pushKV(m_key, value);
+    } else {
+        parent.push_back(value);
+    }
+}
+
+void UniValueWriter::BeginObject()
+{
+    m_open.emplace_back(std::move(m_key), UniValue(UniValue::VOBJ));
+}
+
+void UniValueWriter::EndObject()
+{
+    assert(!m_open.empty() && m_open.back().second.isObject());
+    std::pair<std::string, UniValue> obj = std::move(m_open.back());
+    m_open.pop_back();
+    m_key = std::move(obj.first);
+    Add(std::move(obj.second));
+}
+
+void UniValueWriter::BeginArray()
+{
+    m_open.emplace_back(std::move(m_key), UniValue(UniValue::VARR));
+}
+
+void UniValueWriter::EndArray()
+{
+    assert(!m_open.empty() && m_open.back().second.isArray());
+    std::pair<std::string, UniValue> arr = std::move(m_open.back());
+    m_open.pop_back();
+    m_key = std::move(arr.first);
+    Add(std::move(arr.second));
+}
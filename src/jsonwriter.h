@@ -0,0 +1,137 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_JSONWRITER_H
+#define BITCOIN_JSONWRITER_H
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <univalue.h>
+
+/** Bytes of text a JSONStreamWriter gathers before handing them on */
+static const size_t DEFAULT_JSON_CHUNK_SIZE = 64 * 1024;
+
+/**
+ * Receives a JSON document a token at a time, as it is produced, so that the
+ * same code can build it up into a UniValue or write it out as text without
+ * building a tree first. Every value in an object follows its Key().
+ */
+class JSONWriter
+{
+public:
+    virtual ~JSONWriter() {}
+
+    virtual void BeginObject() = 0;
+    virtual void EndObject() = 0;
+    virtual void BeginArray() = 0;
+    virtual void EndArray() = 0;
+    virtual void Key(const std::string& key) = 0;
+
+    virtual void String(const std::string& str) = 0;
+    virtual void Int(int64_t n) = 0;
+    virtual void UInt(uint64_t n) = 0;
+    virtual void Bool(bool b) = 0;
+    //! A value held as a UniValue already, e.g. an amount or a small object
+    virtual void Value(const UniValue& value) = 0;
+
+    //! Members of objects, with the overloads of UniValue::pushKV
+    void PushKV(const std::string& key, const std::string& str) { Key(key); String(str); }
+    void PushKV(const std::string& key, const char* str) { Key(key); String(str); }
+    void PushKV(const std::string& key, int64_t n) { Key(key); Int(n); }
+    void PushKV(const std::string& key, uint64_t n) { Key(key); UInt(n); }
+    void PushKV(const std::string& key, int n) { Key(key); Int(n); }
+    void PushKV(const std::string& key, unsigned int n) { Key(key); UInt(n); }
+    void PushKV(const std::string& key, bool b) { Key(key); Bool(b); }
+    void PushKV(const std::string& key, double d) { Key(key); Value(UniValue(d)); }
+    void PushKV(const std::string& key, const UniValue& value) { Key(key); Value(value); }
+};
+
+/**
+ * Writes JSON as text, in the compact form of UniValue::write(), handing it
+ * to a sink in chunks of about chunk_size bytes. Whatever is left is handed
+ * on by Flush().
+ */
+class JSONStreamWriter final : public JSONWriter
+{
+public:
+    typedef std::function<void(const char* data, size_t size)> Sink;
+
+private:
+    const Sink m_sink;
+    const size_t m_chunk_size;
+    std::string m_buf;
+    //! Whether the next key or value follows another one in its container
+    bool m_comma = false;
+
+    void Separate()
+    {
+        if (m_comma) m_buf += ',';
+    }
+    void Written()
+    {
+        m_comma = true;
+        if (m_buf.size() >= m_chunk_size) Flush();
+    }
+    void AppendEscaped(const std::string& str);
+
+public:
+    explicit JSONStreamWriter(Sink sink, size_t chunk_size = DEFAULT_JSON_CHUNK_SIZE);
+
+    void BeginObject() override;
+    void EndObject() override;
+    void BeginArray() override;
+    void EndArray() override;
+    void Key(const std::string& key) override;
+
+    void String(const std::string& str) override;
+    void Int(int64_t n) override;
+    void UInt(uint64_t n) override;
+    void Bool(bool b) override;
+    void Value(const UniValue& value) override;
+
+    //! Text outside of the document, e.g. a trailing newline
+    void Raw(const std::string& text) { m_buf += text; }
+
+    //! Hand what is gathered to the sink
+    void Flush();
+};
+
+/**
+ * Builds JSON up into a UniValue. If the root is an object or an array, what
+ * is written goes into it, alongside what it holds already; otherwise the
+ * root becomes the value written. Keys are taken to be unique within the
+ * objects begun here, which aren't searched for them as UniValue::pushKV does.
+ */
+class UniValueWriter final : public JSONWriter
+{
+private:
+    UniValue& m_root;
+    //! Containers begun and not ended yet, innermost last, with their keys
+    std::vector<std::pair<std::string, UniValue>> m_open;
+    std::string m_key;
+
+    void Add(UniValue value);
+
+public:
+    explicit UniValueWriter(UniValue& root) : m_root(root) {}
+
+    void BeginObject() override;
+    void EndObject() override;
+    void BeginArray() override;
+    void EndArray() override;
+    void Key(const std::string& key) override { m_key = key; }
+
+    void String(const std::string& str) override { Add(UniValue(str)); }
+    void Int(int64_t n) override { Add(UniValue(n)); }
+    void UInt(uint64_t n) override { Add(UniValue(n)); }
+    void Bool(bool b) override { Add(UniValue(b)); }
+    void Value(const UniValue& value) override { Add(value); }
+};
+
+#endif // BITCOIN_JSONWRITER_H
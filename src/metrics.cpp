@@ -0,0 +1,203 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <metrics.h>
+
+#include <httpserver.h>
+#include <rpc/protocol.h>
+#include <tinyformat.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <mutex>
+
+namespace metrics {
+
+const std::vector<double> LATENCY_BUCKETS{0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60};
+
+namespace {
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<const Metric*> metrics; // in registration order
+};
+
+Registry& GetRegistry()
+{
+    // Constructed on first use, as metrics register during static initialization
+    static Registry registry;
+    return registry;
+}
+
+/* Threads are assigned shards round-robin, on their first metric update */
+size_t ThreadShard()
+{
+    static std::atomic<size_t> next_shard{0};
+    static thread_local size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % N_SHARDS;
+    return shard;
+}
+
+/* Shortest representation that parses back to the same value */
+std::string FormatValue(double value)
+{
+    std::string str;
+    for (int precision = 15; precision <= 17; precision++) {
+        str = strprintf("%.*g", precision, value);
+        if (std::strtod(str.c_str(), nullptr) == value)
+            break;
+    }
+    return str;
+}
+
+} // namespace
+
+Metric::Metric(const std::string& name, const std::string& help, const std::string& labels) :
+    m_name(name), m_help(help), m_labels(labels)
+{
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.metrics.push_back(this);
+}
+
+Metric::~Metric()
+{
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.metrics.erase(std::remove(registry.metrics.begin(), registry.metrics.end(), this), registry.metrics.end());
+}
+
+std::string Metric::SampleName(const std::string& suffix, const std::string& extra_labels) const
+{
+    std::string labels = m_labels;
+    if (!labels.empty() && !extra_labels.empty())
+        labels += ",";
+    labels += extra_labels;
+    return m_name + suffix + (labels.empty() ? "" : "{" + labels + "}");
+}
+
+void Counter::Inc(uint64_t n)
+{
+    m_shards[ThreadShard()].value.fetch_add(n, std::memory_order_relaxed);
+}
+
+uint64_t Counter::Value() const
+{
+    uint64_t value = 0;
+    for (const Shard& shard : m_shards)
+        value += shard.value.load(std::memory_order_relaxed);
+    return value;
+}
+
+void Counter::RenderSamples(std::string& out) const
+{
+    out += strprintf("%s %u\n", SampleName(), Value());
+}
+
+double Gauge::Value() const
+{
+    return m_callback ? m_callback() : m_value.load(std::memory_order_relaxed);
+}
+
+void Gauge::RenderSamples(std::string& out) const
+{
+    out += SampleName() + " " + FormatValue(Value()) + "\n";
+}
+
+Histogram::Histogram(const std::string& name, const std::string& help, const std::vector<double>& bounds,
+                     const std::string& labels) :
+    Metric(name, help, labels), m_bounds(bounds)
+{
+    assert(m_bounds.size() <= MAX_HISTOGRAM_BUCKETS);
+    assert(std::is_sorted(m_bounds.begin(), m_bounds.end()));
+}
+
+void Histogram::Observe(double value)
+{
+    // Count only on the first bucket that fits, and accumulate on rendering
+    const size_t bucket = std::lower_bound(m_bounds.begin(), m_bounds.end(), value) - m_bounds.begin();
+    Shard& shard = m_shards[ThreadShard()];
+    shard.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    double sum = shard.sum.load(std::memory_order_relaxed);
+    while (!shard.sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {}
+}
+
+uint64_t Histogram::Count() const
+{
+    uint64_t count = 0;
+    for (const Shard& shard : m_shards)
+        for (const std::atomic<uint64_t>& bucket_count : shard.counts)
+            count += bucket_count.load(std::memory_order_relaxed);
+    return count;
+}
+
+double Histogram::Sum() const
+{
+    double sum = 0;
+    for (const Shard& shard : m_shards)
+        sum += shard.sum.load(std::memory_order_relaxed);
+    return sum;
+}
+
+void Histogram::RenderSamples(std::string& out) const
+{
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i <= m_bounds.size(); i++) {
+        for (const Shard& shard : m_shards)
+            cumulative += shard.counts[i].load(std::memory_order_relaxed);
+        const std::string le = (i == m_bounds.size()) ? "+Inf" : FormatValue(m_bounds[i]);
+        out += strprintf("%s %u\n", SampleName("_bucket", "le=\"" + le + "\""), cumulative);
+    }
+    out += SampleName("_sum") + " " + FormatValue(Sum()) + "\n";
+    out += strprintf("%s %u\n", SampleName("_count"), cumulative);
+}
+
+std::string RenderAll()
+{
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    // Metrics of the same family (i.e. different labels) are grouped together
+    // under a single HELP and TYPE header
+    std::vector<const Metric*> sorted(registry.metrics);
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Metric* a, const Metric* b) {
+        return a->GetName() < b->GetName();
+    });
+
+    std::string out;
+    const Metric* prev = nullptr;
+    for (const Metric* metric : sorted) {
+        if (!prev || prev->GetName() != metric->GetName()) {
+            out += strprintf("# HELP %s %s\n", metric->GetName(), metric->GetHelp());
+            out += strprintf("# TYPE %s %s\n", metric->GetName(), metric->GetType());
+        }
+        metric->RenderSamples(out);
+        prev = metric;
+    }
+    return out;
+}
+
+} // namespace metrics
+
+static bool HTTPReq_Metrics(HTTPRequest* req, const std::string&)
+{
+    if (req->GetRequestMethod() != HTTPRequest::GET) {
+        req->WriteReply(HTTP_BAD_METHOD, "Only GET is supported\n");
+        return false;
+    }
+    const std::string body = metrics::RenderAll();
+    req->WriteHeader("Content-Type", "text/plain; version=0.0.4");
+    req->WriteReply(HTTP_OK, body);
+    return true;
+}
+
+void StartHTTPMetrics()
+{
+    RegisterHTTPHandler("/metrics", true, HTTPReq_Metrics);
+}
+
+void StopHTTPMetrics()
+{
+    UnregisterHTTPHandler("/metrics", true);
+}
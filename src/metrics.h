@@ -0,0 +1,156 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_METRICS_H
+#define BITCOIN_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Registry of counters, gauges and histograms exported in the Prometheus text
+ * exposition format
+ *
+ * Metrics are meant to be instrumented from hot paths (e.g. the UDP read and
+ * write threads) and scraped periodically from the HTTP server. Counters and
+ * histograms are sharded into cache-line-aligned atomic cells, with each thread
+ * updating the cells of its own shard, so that updates are wait-free and do not
+ * contend across threads. Scrapes read all shards and sum them up, without
+ * resetting anything, so any number of scrapers can poll concurrently.
+ *
+ * Metric objects register themselves on construction and must outlive the
+ * registry users, so they should be defined with static storage duration.
+ */
+namespace metrics {
+
+static const size_t N_SHARDS = 16;
+static const size_t MAX_HISTOGRAM_BUCKETS = 16;
+
+/** Default bucket upper bounds (in seconds) for latency histograms */
+extern const std::vector<double> LATENCY_BUCKETS;
+
+class Metric
+{
+private:
+    const std::string m_name;
+    const std::string m_help;
+    const std::string m_labels;
+
+protected:
+    /**
+     * @brief Append the samples of this metric to a Prometheus exposition.
+     * @param (std::string&) Output string.
+     * @return Void.
+     */
+    virtual void RenderSamples(std::string& out) const = 0;
+
+    /**
+     * @brief Format the name of a sample with the labels of this metric.
+     * @param (const std::string&) Name suffix (e.g. "_bucket").
+     * @param (const std::string&) Additional labels (e.g. le="0.1").
+     * @return (std::string) Sample name.
+     */
+    std::string SampleName(const std::string& suffix = "", const std::string& extra_labels = "") const;
+
+public:
+    /**
+     * @brief Construct and register the metric.
+     * @param (const std::string&) Metric family name.
+     * @param (const std::string&) Help text, shared by the family.
+     * @param (const std::string&) Optional labels, e.g. buffer="0", which
+     * distinguish metrics of the same family.
+     */
+    Metric(const std::string& name, const std::string& help, const std::string& labels = "");
+    virtual ~Metric();
+
+    Metric(const Metric&) = delete;
+    Metric& operator=(const Metric&) = delete;
+
+    const std::string& GetName() const { return m_name; }
+    const std::string& GetHelp() const { return m_help; }
+    virtual const char* GetType() const = 0;
+
+    friend std::string RenderAll();
+};
+
+/** Monotonically increasing counter */
+class Counter : public Metric
+{
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Shard, N_SHARDS> m_shards;
+
+    void RenderSamples(std::string& out) const override;
+
+public:
+    using Metric::Metric;
+    const char* GetType() const override { return "counter"; }
+
+    void Inc(uint64_t n = 1);
+    uint64_t Value() const;
+};
+
+/** Value that can go up and down, or be read from a callback on each scrape */
+class Gauge : public Metric
+{
+private:
+    std::atomic<int64_t> m_value{0};
+    const std::function<double()> m_callback;
+
+    void RenderSamples(std::string& out) const override;
+
+public:
+    Gauge(const std::string& name, const std::string& help, const std::string& labels = "") :
+        Metric(name, help, labels) {}
+    Gauge(const std::string& name, const std::string& help, std::function<double()> callback) :
+        Metric(name, help), m_callback(std::move(callback)) {}
+    const char* GetType() const override { return "gauge"; }
+
+    void Set(int64_t value) { m_value.store(value, std::memory_order_relaxed); }
+    void Inc(int64_t n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    void Dec(int64_t n = 1) { m_value.fetch_sub(n, std::memory_order_relaxed); }
+    double Value() const;
+};
+
+/** Distribution of observed values over cumulative buckets */
+class Histogram : public Metric
+{
+private:
+    const std::vector<double> m_bounds; //!< Bucket upper bounds, ascending
+    struct alignas(64) Shard {
+        std::array<std::atomic<uint64_t>, MAX_HISTOGRAM_BUCKETS + 1> counts{}; //!< Last one is +Inf
+        std::atomic<double> sum{0};
+    };
+    std::array<Shard, N_SHARDS> m_shards;
+
+    void RenderSamples(std::string& out) const override;
+
+public:
+    Histogram(const std::string& name, const std::string& help, const std::vector<double>& bounds = LATENCY_BUCKETS,
+              const std::string& labels = "");
+    const char* GetType() const override { return "histogram"; }
+
+    void Observe(double value);
+    uint64_t Count() const;
+    double Sum() const;
+};
+
+/**
+ * @brief Render all registered metrics in the Prometheus text format.
+ * @return (std::string) Exposition text.
+ */
+std::string RenderAll();
+
+} // namespace metrics
+
+/** Serve the metrics registry on the /metrics path of the HTTP server */
+void StartHTTPMetrics();
+void StopHTTPMetrics();
+
+#endif
@@ -17,6 +17,7 @@
 #include <policy/policy.h>
 #include <pow.h>
 #include <primitives/transaction.h>
+#include <scheduler.h>
 #include <script/standard.h>
 #include <timedata.h>
 #include <util/moneystr.h>
@@ -47,11 +48,16 @@ BlockAssembler::Options::Options() {
     nBlockMaxWeight = DEFAULT_BLOCK_MAX_WEIGHT;
 }
 
+static size_t ClampBlockMaxWeight(size_t nBlockMaxWeight)
+{
+    // Limit weight to between 4K and MAX_BLOCK_WEIGHT-4K for sanity:
+    return std::max<size_t>(4000, std::min<size_t>(MAX_BLOCK_WEIGHT - 4000, nBlockMaxWeight));
+}
+
 BlockAssembler::BlockAssembler(const CChainParams& params, const Options& options) : chainparams(params)
 {
     blockMinFeeRate = options.blockMinFeeRate;
-    // Limit weight to between 4K and MAX_BLOCK_WEIGHT-4K for sanity:
-    nBlockMaxWeight = std::max<size_t>(4000, std::min<size_t>(MAX_BLOCK_WEIGHT - 4000, options.nBlockMaxWeight));
+    nBlockMaxWeight = ClampBlockMaxWeight(options.nBlockMaxWeight);
 }
 
 static BlockAssembler::Options DefaultOptions()
@@ -88,7 +94,7 @@ void BlockAssembler::resetBlock()
 Optional<int64_t> BlockAssembler::m_last_block_num_txs{nullopt};
 Optional<int64_t> BlockAssembler::m_last_block_weight{nullopt};
 
-std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
+std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, const std::vector<CTransactionRef>& seedTxs)
 {
     int64_t nTimeStart = GetTimeMicros();
 
@@ -134,9 +140,13 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     // transaction (which in most cases can be a no-op).
     fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus());
 
+    // mapModifiedTx will store sorted packages after they are modified
+    // because some of their txs are already in the block
+    indexed_modified_transaction_set mapModifiedTx;
     int nPackagesSelected = 0;
     int nDescendantsUpdated = 0;
-    addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+    addSeedTxs(seedTxs, mapModifiedTx, nDescendantsUpdated);
+    addPackageTxs(mapModifiedTx, nPackagesSelected, nDescendantsUpdated);
 
     int64_t nTime1 = GetTimeMicros();
 
@@ -175,6 +185,33 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     return std::move(pblocktemplate);
 }
 
+void BlockAssembler::addSeedTxs(const std::vector<CTransactionRef>& txs, indexed_modified_transaction_set& mapModifiedTx, int& nDescendantsUpdated)
+{
+    CTxMemPool::setEntries added;
+    for (const CTransactionRef& tx : txs) {
+        CTxMemPool::txiter it = mempool.mapTx.find(tx->GetHash());
+        if (it == mempool.mapTx.end()) {
+            continue;
+        }
+        // The transactions are in a valid order, so one whose parent was
+        // skipped is skipped as well
+        bool fParentsInBlock = true;
+        for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(it)) {
+            fParentsInBlock &= inBlock.count(parent) > 0;
+        }
+        if (!fParentsInBlock || it->GetModifiedFee() < blockMinFeeRate.GetFee(it->GetTxSize())) {
+            continue;
+        }
+        if (!TestPackage(it->GetTxSize(), it->GetSigOpCost()) || !TestPackageTransactions({it})) {
+            continue;
+        }
+        AddToBlock(it);
+        added.insert(it);
+    }
+    // Packages of their descendants are scored without them from now on
+    nDescendantsUpdated += UpdatePackagesForAdded(added, mapModifiedTx);
+}
+
 void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
 {
     for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
@@ -295,18 +332,11 @@ void BlockAssembler::SortForBlock(const CTxMemPool::setEntries& package, std::ve
 // Each time through the loop, we compare the best transaction in
 // mapModifiedTxs with the next transaction in the mempool to decide what
 // transaction package to work on next.
-void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated)
+void BlockAssembler::addPackageTxs(indexed_modified_transaction_set &mapModifiedTx, int &nPackagesSelected, int &nDescendantsUpdated)
 {
-    // mapModifiedTx will store sorted packages after they are modified
-    // because some of their txs are already in the block
-    indexed_modified_transaction_set mapModifiedTx;
     // Keep track of entries that failed inclusion, to avoid duplicate work
     CTxMemPool::setEntries failedTx;
 
-    // Start by adding all descendants of previously added txs to mapModifiedTx
-    // and modifying them for their already included ancestors
-    UpdatePackagesForAdded(inBlock, mapModifiedTx);
-
     CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
     CTxMemPool::txiter iter;
 
@@ -425,6 +455,219 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
     }
 }
 
+std::unique_ptr<BlockTemplateCache> g_block_template_cache;
+
+BlockTemplateCache::BlockTemplateCache(const CChainParams& params, CScheduler& scheduler, const BlockAssembler::Options& options)
+    : m_params(params), m_scheduler(scheduler), m_options(options) {}
+
+BlockTemplateCache::BlockTemplateCache(const CChainParams& params, CScheduler& scheduler)
+    : BlockTemplateCache(params, scheduler, DefaultOptions()) {}
+
+void BlockTemplateCache::Rebuild(const CBlockIndex* tip)
+{
+    // On a new tip, what is left of the template is likely still what pays
+    // most, so only the room left in it is selected for
+    std::vector<CTransactionRef> seed;
+    if (m_template && m_tip != tip) {
+        seed.assign(m_template->block.vtx.begin() + 1, m_template->block.vtx.end());
+    }
+
+    m_transactions_updated = mempool.GetTransactionsUpdated();
+    std::unique_ptr<CBlockTemplate> block_template = BlockAssembler(m_params, m_options).CreateNewBlock(CScript() << OP_TRUE, seed);
+    m_template = std::move(block_template);
+    m_tip = tip;
+    m_stale = false;
+    m_coinbase_dirty = false;
+    m_rebuild_time = GetTime();
+
+    m_txids.clear();
+    m_weight = 4000;
+    m_sigops_cost = 400;
+    m_fees = -m_template->vTxFees[0];
+    m_min_feerate = CFeeRate(MAX_MONEY);
+    for (size_t i = 1; i < m_template->block.vtx.size(); i++) {
+        const CTxMemPool::txiter it = mempool.mapTx.find(m_template->block.vtx[i]->GetHash());
+        assert(it != mempool.mapTx.end());
+        m_txids.insert(it->GetTx().GetHash());
+        m_weight += it->GetTxWeight();
+        m_sigops_cost += it->GetSigOpCost();
+        m_min_feerate = std::min(m_min_feerate, CFeeRate(it->GetModifiedFee(), it->GetTxSize()));
+    }
+}
+
+void BlockTemplateCache::RebuildStale()
+{
+    LOCK2(cs_main, mempool.cs);
+    LOCK(m_mutex);
+    m_rebuild_scheduled = false;
+    if (m_stale && m_template) {
+        TryRebuild(::ChainActive().Tip());
+    }
+}
+
+void BlockTemplateCache::TryRebuild(const CBlockIndex* tip)
+{
+    try {
+        Rebuild(tip);
+    } catch (const std::runtime_error& e) {
+        // Assembled again when next asked for, so that the error is reported then
+        LogPrintf("%s: %s\n", __func__, e.what());
+        m_template.reset();
+        m_txids.clear();
+    }
+}
+
+void BlockTemplateCache::MarkStale()
+{
+    m_stale = true;
+    if (m_rebuild_scheduled) return;
+    m_rebuild_scheduled = true;
+    const int64_t delay = std::max<int64_t>(0, m_rebuild_time + BLOCK_TEMPLATE_REBUILD_INTERVAL - GetTime());
+    m_scheduler.scheduleFromNow(std::bind(&BlockTemplateCache::RebuildStale, this), delay * 1000);
+}
+
+CBlockTemplate& BlockTemplateCache::Modify()
+{
+    // No one can get another reference without m_mutex
+    if (m_template.use_count() > 1) {
+        m_template = std::make_shared<CBlockTemplate>(*m_template);
+    }
+    return *m_template;
+}
+
+void BlockTemplateCache::UpdateCoinbase(CBlockTemplate& block_template)
+{
+    CBlock& block = block_template.block;
+    CMutableTransaction coinbase(*block.vtx[0]);
+    // Drop the witness commitment, which is made again
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = m_fees + GetBlockSubsidy(m_tip->nHeight + 1, m_params.GetConsensus());
+    block.vtx[0] = MakeTransactionRef(std::move(coinbase));
+    block_template.vchCoinbaseCommitment = GenerateCoinbaseCommitment(block, m_tip, m_params.GetConsensus());
+    block_template.vTxFees[0] = -m_fees;
+}
+
+void BlockTemplateCache::TransactionAddedToMempool(const CTransactionRef& tx)
+{
+    LOCK(mempool.cs);
+    LOCK(m_mutex);
+    if (!m_template || m_txids.count(tx->GetHash())) return;
+    // Gone again already, in which case its removal is yet to be notified
+    const CTxMemPool::txiter it = mempool.mapTx.find(tx->GetHash());
+    if (it == mempool.mapTx.end()) return;
+
+    // Only a transaction whose unconfirmed parents are all in the template can
+    // be appended to it. As the mempool is looked at as it is now, rather than
+    // as of the notification, anything it spends which has left the mempool
+    // since is confirmed, as otherwise it would have left as well.
+    bool parents_in_template = true;
+    for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(it)) {
+        parents_in_template &= m_txids.count(parent->GetTx().GetHash()) > 0;
+    }
+    const int height = m_tip->nHeight + 1;
+    const int64_t lock_time_cutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                                     ? m_tip->GetMedianTimePast()
+                                     : m_template->block.GetBlockTime();
+    if (parents_in_template &&
+        m_weight + it->GetTxWeight() < ClampBlockMaxWeight(m_options.nBlockMaxWeight) &&
+        m_sigops_cost + it->GetSigOpCost() < MAX_BLOCK_SIGOPS_COST &&
+        it->GetModifiedFee() >= m_options.blockMinFeeRate.GetFee(it->GetTxSize()) &&
+        IsFinalTx(*tx, height, lock_time_cutoff) &&
+        (!tx->HasWitness() || IsWitnessEnabled(m_tip, m_params.GetConsensus()))) {
+        CBlockTemplate& block_template = Modify();
+        block_template.block.vtx.push_back(tx);
+        block_template.vTxFees.push_back(it->GetFee());
+        block_template.vTxSigOpsCost.push_back(it->GetSigOpCost());
+        m_txids.insert(tx->GetHash());
+        m_weight += it->GetTxWeight();
+        m_sigops_cost += it->GetSigOpCost();
+        m_fees += it->GetFee();
+        m_min_feerate = std::min(m_min_feerate, CFeeRate(it->GetModifiedFee(), it->GetTxSize()));
+        // Made once for however many transactions arrive before the template is asked for
+        m_coinbase_dirty = true;
+    } else {
+        // Its package may be worth more than something in the template, or fit into the room left
+        const CFeeRate package_feerate(it->GetModFeesWithAncestors(), it->GetSizeWithAncestors());
+        const bool package_fits = m_weight + WITNESS_SCALE_FACTOR * it->GetSizeWithAncestors() < ClampBlockMaxWeight(m_options.nBlockMaxWeight);
+        if (package_feerate >= m_options.blockMinFeeRate && (package_fits || package_feerate > m_min_feerate)) {
+            MarkStale();
+        }
+    }
+}
+
+void BlockTemplateCache::TransactionRemovedFromMempool(const CTransactionRef& tx)
+{
+    LOCK(m_mutex);
+    if (!m_template || !m_txids.count(tx->GetHash())) return;
+
+    // Whatever in the template spends it is leaving the mempool as well, and
+    // can't stay in the template until that is notified
+    CBlockTemplate& block_template = Modify();
+    std::vector<CTransactionRef>& vtx = block_template.block.vtx;
+    std::unordered_set<uint256, SaltedTxidHasher> removed{tx->GetHash()};
+    size_t kept = 1;
+    for (size_t i = 1; i < vtx.size(); i++) {
+        bool remove = removed.count(vtx[i]->GetHash()) > 0;
+        for (const CTxIn& txin : vtx[i]->vin) {
+            remove |= removed.count(txin.prevout.hash) > 0;
+        }
+        if (remove) {
+            removed.insert(vtx[i]->GetHash());
+            m_txids.erase(vtx[i]->GetHash());
+            m_weight -= GetTransactionWeight(*vtx[i]);
+            m_sigops_cost -= block_template.vTxSigOpsCost[i];
+            m_fees -= block_template.vTxFees[i];
+            continue;
+        }
+        vtx[kept] = std::move(vtx[i]);
+        block_template.vTxFees[kept] = block_template.vTxFees[i];
+        block_template.vTxSigOpsCost[kept] = block_template.vTxSigOpsCost[i];
+        kept++;
+    }
+    vtx.resize(kept);
+    block_template.vTxFees.resize(kept);
+    block_template.vTxSigOpsCost.resize(kept);
+    m_coinbase_dirty = true;
+    // Something else may fit now
+    MarkStale();
+}
+
+void BlockTemplateCache::UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload)
+{
+    if (fInitialDownload) return;
+    LOCK2(cs_main, mempool.cs);
+    LOCK(m_mutex);
+    // Unless no one asked for a template yet, or one was asked for since
+    if (m_template && m_tip != ::ChainActive().Tip()) {
+        TryRebuild(::ChainActive().Tip());
+    }
+}
+
+std::shared_ptr<const CBlockTemplate> BlockTemplateCache::Get(const CBlockIndex*& tip, unsigned int& transactions_updated)
+{
+    LOCK2(cs_main, mempool.cs);
+    LOCK(m_mutex);
+    // Also if a rebuild is due, but didn't happen yet
+    if (!m_template || m_tip != ::ChainActive().Tip() || (m_stale && GetTime() >= m_rebuild_time + BLOCK_TEMPLATE_REBUILD_INTERVAL)) {
+        Rebuild(::ChainActive().Tip());
+    }
+    if (m_coinbase_dirty) {
+        UpdateCoinbase(Modify());
+        m_coinbase_dirty = false;
+    }
+    tip = m_tip;
+    transactions_updated = m_transactions_updated;
+    return m_template;
+}
+
+void BlockTemplateCache::Invalidate()
+{
+    LOCK(m_mutex);
+    if (m_template) {
+        MarkStale();
+    }
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
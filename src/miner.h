@@ -8,22 +8,28 @@
 
 #include <optional.h>
 #include <primitives/block.h>
+#include <sync.h>
 #include <txmempool.h>
 #include <validation.h>
+#include <validationinterface.h>
 
 #include <memory>
 #include <stdint.h>
+#include <unordered_set>
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 
 class CBlockIndex;
 class CChainParams;
+class CScheduler;
 class CScript;
 
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Least time between selecting the transactions of the maintained block template again, in seconds */
+static const int64_t BLOCK_TEMPLATE_REBUILD_INTERVAL = 5;
 
 struct CBlockTemplate
 {
@@ -158,8 +164,12 @@ public:
     explicit BlockAssembler(const CChainParams& params);
     BlockAssembler(const CChainParams& params, const Options& options);
 
-    /** Construct a new block template with coinbase to scriptPubKeyIn */
-    std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn);
+    /**
+     * Construct a new block template with coinbase to scriptPubKeyIn. Those of
+     * seedTxs still in the mempool, in that order, are added to the block
+     * before the transactions are selected to fill the rest of it.
+     */
+    std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, const std::vector<CTransactionRef>& seedTxs = {});
 
     static Optional<int64_t> m_last_block_num_txs;
     static Optional<int64_t> m_last_block_weight;
@@ -172,10 +182,14 @@ private:
     void AddToBlock(CTxMemPool::txiter iter);
 
     // Methods for how to add transactions to a block.
-    /** Add transactions based on feerate including unconfirmed ancestors
+    /** Add those of the given transactions which are in the mempool, fit, and have all their unconfirmed parents in the block already,
+      * and their descendants to mapModifiedTx with ancestor state updated for them. Increments nDescendantsUpdated. */
+    void addSeedTxs(const std::vector<CTransactionRef>& txs, indexed_modified_transaction_set& mapModifiedTx, int& nDescendantsUpdated) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
+    /** Add transactions based on feerate including unconfirmed ancestors,
+      * starting from the packages in mapModifiedTx modified for the txs in the block already
       * Increments nPackagesSelected / nDescendantsUpdated with corresponding
       * statistics from the package selection (for logging statistics). */
-    void addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
+    void addPackageTxs(indexed_modified_transaction_set &mapModifiedTx, int &nPackagesSelected, int &nDescendantsUpdated) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
 
     // helper functions for addPackageTxs()
     /** Remove confirmed (inBlock) entries from given set */
@@ -198,6 +212,87 @@ private:
     int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
 };
 
+/**
+ * A block template kept up to date as transactions enter and leave the
+ * mempool and the tip changes, so that getblocktemplate returns a copy of it
+ * instead of assembling a block with cs_main and mempool.cs held.
+ *
+ * A transaction entering the mempool is appended to the template if its
+ * unconfirmed parents are all in it and it fits; one leaving the mempool is
+ * taken out along with what spends it. Transactions are selected again at
+ * most every BLOCK_TEMPLATE_REBUILD_INTERVAL, and only when that could
+ * improve the template: after transactions left it, or when one which
+ * didn't fit pays more than what is in it. On a new tip, the transactions
+ * of the template which are still in the mempool are kept, and only the
+ * room left is selected for.
+ *
+ * Nothing is maintained until a template is first asked for.
+ */
+class BlockTemplateCache final : public CValidationInterface
+{
+private:
+    const CChainParams& m_params;
+    CScheduler& m_scheduler;
+    const BlockAssembler::Options m_options;
+
+    Mutex m_mutex;
+    //! The template, which is copied before being changed if it is shared
+    std::shared_ptr<CBlockTemplate> m_template GUARDED_BY(m_mutex);
+    //! The block it builds on
+    const CBlockIndex* m_tip GUARDED_BY(m_mutex){nullptr};
+    //! mempool.GetTransactionsUpdated() when the transactions were last selected
+    unsigned int m_transactions_updated GUARDED_BY(m_mutex){0};
+    //! Transactions in the template, other than the coinbase
+    std::unordered_set<uint256, SaltedTxidHasher> m_txids GUARDED_BY(m_mutex);
+    //! Weight and sigop cost of the template, including what is reserved for the coinbase, and fees of its transactions
+    uint64_t m_weight GUARDED_BY(m_mutex){0};
+    int64_t m_sigops_cost GUARDED_BY(m_mutex){0};
+    CAmount m_fees GUARDED_BY(m_mutex){0};
+    //! Lowest feerate of a transaction in the template
+    CFeeRate m_min_feerate GUARDED_BY(m_mutex);
+    //! Whether transactions were added or removed since the coinbase value and witness commitment were made
+    bool m_coinbase_dirty GUARDED_BY(m_mutex){false};
+    //! Whether selecting transactions again could improve the template, whether that is scheduled, and when they were last selected
+    bool m_stale GUARDED_BY(m_mutex){false};
+    bool m_rebuild_scheduled GUARDED_BY(m_mutex){false};
+    int64_t m_rebuild_time GUARDED_BY(m_mutex){0};
+
+    /** Assemble the template for tip, keeping its transactions which are still in the mempool if the tip changed */
+    void Rebuild(const CBlockIndex* tip) EXCLUSIVE_LOCKS_REQUIRED(cs_main, mempool.cs, m_mutex);
+    /** Rebuild in the background, dropping the template if that fails */
+    void TryRebuild(const CBlockIndex* tip) EXCLUSIVE_LOCKS_REQUIRED(cs_main, mempool.cs, m_mutex);
+    /** Rebuild the template if it is stale, for a scheduled rebuild */
+    void RebuildStale();
+    /** Have the template rebuilt once the interval since the last rebuild passed */
+    void MarkStale() EXCLUSIVE_LOCKS_REQUIRED(m_mutex);
+    /** The template, to be changed, copied first if anyone else has it */
+    CBlockTemplate& Modify() EXCLUSIVE_LOCKS_REQUIRED(m_mutex);
+    /** Update the coinbase value and witness commitment for the transactions of the template, for Get() to hand it out */
+    void UpdateCoinbase(CBlockTemplate& block_template) EXCLUSIVE_LOCKS_REQUIRED(m_mutex);
+
+protected:
+    void TransactionAddedToMempool(const CTransactionRef& tx) override;
+    void TransactionRemovedFromMempool(const CTransactionRef& tx) override;
+    void UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload) override;
+
+public:
+    BlockTemplateCache(const CChainParams& params, CScheduler& scheduler);
+    BlockTemplateCache(const CChainParams& params, CScheduler& scheduler, const BlockAssembler::Options& options);
+
+    /**
+     * The template for the current tip, with a coinbase paying to OP_TRUE,
+     * assembled first if there isn't one yet. Sets tip to the block it builds
+     * on, and transactions_updated to mempool.GetTransactionsUpdated() as of
+     * when its transactions were selected.
+     */
+    std::shared_ptr<const CBlockTemplate> Get(const CBlockIndex*& tip, unsigned int& transactions_updated);
+
+    /** Have the transactions selected again, for changes which aren't notified, such as prioritised fees */
+    void Invalidate();
+};
+
+extern std::unique_ptr<BlockTemplateCache> g_block_template_cache;
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
@@ -27,12 +27,18 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #endif
 
 #ifdef USE_POLL
 #include <poll.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -77,8 +83,24 @@ enum BindFlags {
 // The sleep time needs to be small to avoid new sockets stalling
 static const uint64_t SELECT_TIMEOUT_MILLISECONDS = 50;
 
+// Most buffers passed to one send call, a header and a payload for each message
+static const size_t SEND_MAX_BUFFERS = 64;
+
+// Bytes of free receive buffers kept for reuse, across all peers
+static const size_t RECV_BUFFER_POOL_BYTES = 32 * 1024 * 1024;
+
+// Most bytes of a payload received straight into its buffer per recv call
+static const unsigned int RECV_WINDOW_SIZE = 256 * 1024;
+
+#ifdef USE_EPOLL
+// Most socket events handled per wakeup of the socket handler
+static const int EPOLL_MAX_EVENTS = 256;
+#endif
+
 const std::string NET_MESSAGE_COMMAND_OTHER = "*other*";
 
+CNetRecvBufferPool g_net_recv_buffers(RECV_BUFFER_POOL_BYTES);
+
 static const uint64_t RANDOMIZER_ID_NETGROUP = 0x6c0edd8036ef4036ULL; // SHA256("netgroup")[0:8]
 static const uint64_t RANDOMIZER_ID_LOCALHOSTNONCE = 0xd93e69e2bbfa5735ULL; // SHA256("localhostnonce")[0:8]
 //
@@ -613,6 +635,34 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
     return true;
 }
 
+size_t CNode::TakeCompleteMsgs(std::list<CNetMessage>& msgs)
+{
+    size_t nSize = 0;
+    auto it(vRecvMsg.begin());
+    for (; it != vRecvMsg.end(); ++it) {
+        if (!it->complete())
+            break;
+        nSize += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+    }
+    msgs.splice(msgs.end(), vRecvMsg, vRecvMsg.begin(), it);
+    return nSize;
+}
+
+char* CNode::GetReceiveWindow(unsigned int min_size, unsigned int& size)
+{
+    LOCK(cs_vRecv);
+    if (vRecvMsg.empty())
+        return nullptr;
+    CNetMessage& msg = vRecvMsg.back();
+    if (!msg.in_data || msg.complete() || msg.hdr.nMessageSize > MAX_PROTOCOL_MESSAGE_LENGTH)
+        return nullptr;
+    const unsigned int nRemaining = msg.hdr.nMessageSize - msg.nDataPos;
+    if (nRemaining < min_size)
+        return nullptr;
+    size = std::min(nRemaining, RECV_WINDOW_SIZE);
+    return msg.DataWindow(size);
+}
+
 void CNode::SetSendVersion(int nVersionIn)
 {
     // Send version may only be changed in the version message, and
@@ -676,18 +726,100 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
-    }
-
+    char* dst = DataWindow(nCopy);
     hasher.Write((const unsigned char*)pch, nCopy);
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    // Bytes received through DataWindow() are in place already
+    if (pch != dst)
+        memcpy(dst, pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
 }
 
+char* CNetMessage::DataWindow(unsigned int size)
+{
+    assert(in_data && nDataPos + size <= hdr.nMessageSize);
+    if (vRecv.size() < nDataPos + size) {
+        if (vRecv.capacity() < nDataPos + size)
+            GrowData(nDataPos + size);
+        // Within the capacity just made sure of, so never reallocates
+        vRecv.resize(nDataPos + size);
+    }
+    return &vRecv[nDataPos];
+}
+
+void CNetMessage::GrowData(unsigned int size)
+{
+    // Room for at most RECV_WINDOW_SIZE bytes past those about to be written,
+    // rounded up to the size class of the pooled buffer, rather than for the
+    // size given in the header, so that a peer can't have megabytes allocated
+    // by sending headers alone. What was received so far is moved over.
+    CSerializeData buffer = g_net_recv_buffers.Get(std::min(hdr.nMessageSize, size + RECV_WINDOW_SIZE));
+    buffer.assign(vRecv.data(), vRecv.data() + vRecv.size());
+    vRecv.swap_data(buffer);
+    if (buffer.capacity() > 0)
+        g_net_recv_buffers.Put(std::move(buffer));
+}
+
+CNetMessage::~CNetMessage()
+{
+    CSerializeData buffer;
+    vRecv.swap_data(buffer);
+    if (buffer.capacity() > 0)
+        g_net_recv_buffers.Put(std::move(buffer));
+}
+
+int CNetRecvBufferPool::SizeClass(size_t size)
+{
+    for (int bits = MIN_CLASS_BITS; bits <= MAX_CLASS_BITS; bits++) {
+        if (size <= (size_t{1} << bits))
+            return bits - MIN_CLASS_BITS;
+    }
+    return -1;
+}
+
+CSerializeData CNetRecvBufferPool::Get(size_t size)
+{
+    CSerializeData buffer;
+    const int size_class = SizeClass(size);
+    if (size_class < 0) {
+        buffer.reserve(size);
+        return buffer;
+    }
+    {
+        LOCK(m_mutex);
+        std::vector<CSerializeData>& free = m_free[size_class];
+        if (!free.empty()) {
+            buffer.swap(free.back());
+            free.pop_back();
+            m_kept_bytes -= buffer.capacity();
+            return buffer;
+        }
+    }
+    buffer.reserve(size_t{1} << (size_class + MIN_CLASS_BITS));
+    return buffer;
+}
+
+void CNetRecvBufferPool::Put(CSerializeData buffer)
+{
+    const int size_class = SizeClass(buffer.capacity());
+    if (size_class < 0 || buffer.capacity() != (size_t{1} << (size_class + MIN_CLASS_BITS)))
+        return;
+    // Not wiped, as it only held what a peer sent
+    buffer.clear();
+    LOCK(m_mutex);
+    if (m_kept_bytes + buffer.capacity() > m_max_kept_bytes)
+        return;
+    m_kept_bytes += buffer.capacity();
+    m_free[size_class].push_back(std::move(buffer));
+}
+
+size_t CNetRecvBufferPool::KeptBytes()
+{
+    LOCK(m_mutex);
+    return m_kept_bytes;
+}
+
 const uint256& CNetMessage::GetMessageHash() const
 {
     assert(complete());
@@ -696,33 +828,93 @@ const uint256& CNetMessage::GetMessageHash() const
     return data_hash;
 }
 
+std::shared_ptr<const CSharedNetPayload> MakeSharedNetPayload(std::vector<unsigned char>&& data)
+{
+    std::shared_ptr<const std::vector<unsigned char>> owner = std::make_shared<const std::vector<unsigned char>>(std::move(data));
+    return MakeSharedNetPayload(owner, Span<const unsigned char>(owner->data(), owner->size()));
+}
+
+std::shared_ptr<const CSharedNetPayload> MakeSharedNetPayload(std::shared_ptr<const void> owner, Span<const unsigned char> data)
+{
+    std::shared_ptr<CSharedNetPayload> payload = std::make_shared<CSharedNetPayload>();
+    payload->owner = std::move(owner);
+    payload->data = data;
+    payload->hash = Hash(data.begin(), data.end());
+    return payload;
+}
+
 size_t CConnman::SocketSendData(CNode *pnode) const EXCLUSIVE_LOCKS_REQUIRED(pnode->cs_vSend)
 {
     auto it = pnode->vSendMsg.begin();
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = 0;
+        // Gather the headers and payloads of as many queued messages as fit
+        // into one call, starting with what is left of the first one
+        struct {
+            const unsigned char* data;
+            size_t size;
+        } buffers[SEND_MAX_BUFFERS];
+        size_t nBuffers = 0;
+        size_t nToSend = 0;
+        size_t nOffset = pnode->nSendOffset;
+        for (auto msg = it; msg != pnode->vSendMsg.end() && nBuffers + 2 <= SEND_MAX_BUFFERS; ++msg) {
+            assert(msg->size() > nOffset);
+            if (nOffset < sizeof(msg->header)) {
+                buffers[nBuffers++] = {msg->header + nOffset, sizeof(msg->header) - nOffset};
+                nOffset = 0;
+            } else {
+                nOffset -= sizeof(msg->header);
+            }
+            const size_t nPayloadSize = msg->payload.size();
+            if (nPayloadSize > nOffset)
+                buffers[nBuffers++] = {msg->payload.data() + nOffset, nPayloadSize - nOffset};
+            nOffset = 0;
+        }
+#ifdef WIN32
+        // No scatter-gather sends, so send one buffer at a time
+        nBuffers = 1;
+#endif
+        for (size_t i = 0; i < nBuffers; i++)
+            nToSend += buffers[i].size;
+
+        ssize_t nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifdef WIN32
+            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(buffers[0].data), buffers[0].size, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+            struct iovec iov[SEND_MAX_BUFFERS];
+            for (size_t i = 0; i < nBuffers; i++) {
+                iov[i].iov_base = const_cast<unsigned char*>(buffers[i].data);
+                iov[i].iov_len = buffers[i].size;
+            }
+            struct msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = nBuffers;
+            nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            for (size_t nLeft = nBytes; nLeft > 0;) {
+                const size_t nRemaining = it->size() - pnode->nSendOffset;
+                if (nLeft < nRemaining) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRemaining;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= it->size();
                 pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            if ((size_t)nBytes < nToSend) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -745,9 +937,51 @@ size_t CConnman::SocketSendData(CNode *pnode) const EXCLUSIVE_LOCKS_REQUIRED(pno
         assert(pnode->nSendSize == 0);
     }
     pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
+    UpdateSendInterest(pnode);
     return nSentSize;
 }
 
+void CConnman::UpdateSendInterest(CNode* pnode) const
+{
+#ifdef USE_EPOLL
+    const bool send = !pnode->vSendMsg.empty();
+    if (!pnode->m_epoll_registered || send == pnode->m_epoll_send)
+        return;
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket == INVALID_SOCKET)
+        return;
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (send ? (uint32_t)EPOLLOUT : 0u);
+    event.data.ptr = pnode;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, pnode->hSocket, &event) == 0)
+        pnode->m_epoll_send = send;
+#endif
+}
+
+void CConnman::RegisterNodeSocket(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    if (m_epoll_fd == -1)
+        return;
+    LOCK(pnode->cs_vSend);
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket == INVALID_SOCKET)
+        return;
+    // Messages pushed before registration, like our version, may be waiting
+    const bool send = !pnode->vSendMsg.empty();
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (send ? (uint32_t)EPOLLOUT : 0u);
+    event.data.ptr = pnode;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+        LogPrintf("socket epoll_ctl error %s\n", NetworkErrorString(WSAGetLastError()));
+        pnode->CloseSocketDisconnect();
+        return;
+    }
+    pnode->m_epoll_registered = true;
+    pnode->m_epoll_send = send;
+#endif
+}
+
 struct NodeEvictionCandidate
 {
     NodeId id;
@@ -1003,6 +1237,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        RegisterNodeSocket(pnode);
     }
 }
 
@@ -1029,6 +1264,9 @@ void CConnman::DisconnectNodes()
             {
                 // remove from vNodes
                 vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+#ifdef USE_EPOLL
+                m_epoll_pending.erase(pnode);
+#endif
 
                 // release outbound grant (if any)
                 pnode->grantOutbound.Release();
@@ -1279,8 +1517,92 @@ void CConnman::SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_s
 }
 #endif
 
+bool CConnman::ServiceNodeSocket(CNode* pnode, bool fRecv, bool fSend, bool& more_to_read)
+{
+    more_to_read = false;
+
+    //
+    // Receive
+    //
+    if (fRecv)
+    {
+        // typical socket buffer is 8K-64K
+        char pchBuf[0x10000];
+        // The rest of a large payload is received straight into its buffer instead
+        unsigned int nWindow = 0;
+        char* pchWindow = pnode->GetReceiveWindow(sizeof(pchBuf), nWindow);
+        char* pchRecv = pchWindow ? pchWindow : pchBuf;
+        const unsigned int nRecvSize = pchWindow ? nWindow : sizeof(pchBuf);
+        int nBytes = 0;
+        {
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                return false;
+            nBytes = recv(pnode->hSocket, pchRecv, nRecvSize, MSG_DONTWAIT);
+        }
+        if (nBytes > 0)
+        {
+            more_to_read = nBytes == (int)nRecvSize;
+            bool notify = false;
+            if (!pnode->ReceiveMsgBytes(pchRecv, nBytes, notify))
+                pnode->CloseSocketDisconnect();
+            RecordBytesRecv(nBytes);
+            if (notify) {
+                std::list<CNetMessage> msgs;
+                size_t nSizeAdded = pnode->TakeCompleteMsgs(msgs);
+                {
+                    LOCK(pnode->cs_vProcessMsg);
+                    pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), msgs);
+                    pnode->nProcessQueueSize += nSizeAdded;
+                    pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+                }
+                WakeMessageHandler();
+            }
+        }
+        else if (nBytes == 0)
+        {
+            // socket closed gracefully
+            if (!pnode->fDisconnect) {
+                LogPrint(BCLog::NET, "socket closed\n");
+            }
+            pnode->CloseSocketDisconnect();
+        }
+        else if (nBytes < 0)
+        {
+            // error
+            int nErr = WSAGetLastError();
+            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+            {
+                if (!pnode->fDisconnect)
+                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+                pnode->CloseSocketDisconnect();
+            }
+        }
+    }
+
+    //
+    // Send
+    //
+    if (fSend)
+    {
+        LOCK(pnode->cs_vSend);
+        size_t nBytes = SocketSendData(pnode);
+        if (nBytes) {
+            RecordBytesSent(nBytes);
+        }
+    }
+    return true;
+}
+
 void CConnman::SocketHandler()
 {
+#ifdef USE_EPOLL
+    if (m_epoll_fd != -1) {
+        SocketHandlerEpoll();
+        return;
+    }
+#endif
+
     std::set<SOCKET> recv_set, send_set, error_set;
     SocketEvents(recv_set, send_set, error_set);
 
@@ -1312,9 +1634,6 @@ void CConnman::SocketHandler()
         if (interruptNet)
             return;
 
-        //
-        // Receive
-        //
         bool recvSet = false;
         bool sendSet = false;
         bool errorSet = false;
@@ -1326,81 +1645,145 @@ void CConnman::SocketHandler()
             sendSet = send_set.count(pnode->hSocket) > 0;
             errorSet = error_set.count(pnode->hSocket) > 0;
         }
-        if (recvSet || errorSet)
+        bool more_to_read;
+        if (!ServiceNodeSocket(pnode, recvSet || errorSet, sendSet, more_to_read))
+            continue;
+
+        InactivityCheck(pnode);
+    }
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodesCopy)
+            pnode->Release();
+    }
+}
+
+#ifdef USE_EPOLL
+/**
+ * Sockets stay registered with the epoll set from connection to disconnection,
+ * so a wakeup costs in proportion to the sockets that are ready rather than to
+ * all peers. Node sockets are edge-triggered: a node which may have more to
+ * read than one receive took is kept in m_epoll_pending until a receive comes
+ * up short. Those that can't be read yet, because their processing queue is
+ * full or their send queue has to drain first, are looked at again on the
+ * next wakeup, at the latest after SELECT_TIMEOUT_MILLISECONDS like before.
+ * Write readiness is only asked for while a node has data queued, see
+ * UpdateSendInterest.
+ */
+void CConnman::SocketHandlerEpoll()
+{
+    bool readable_now = false;
+    for (const CNode* pnode : m_epoll_pending) {
+        if (!pnode->fPauseRecv && !pnode->m_epoll_send) {
+            readable_now = true;
+            break;
+        }
+    }
+
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    int count = epoll_wait(m_epoll_fd, events, EPOLL_MAX_EVENTS, readable_now ? 0 : SELECT_TIMEOUT_MILLISECONDS);
+
+    if (interruptNet) return;
+
+    if (count < 0) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+            if (!interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS)))
+                return;
+        }
+        count = 0;
+    }
+
+    // Events of each node to service, with none for those only pending a read
+    std::unordered_map<CNode*, uint32_t> ready;
+    for (int i = 0; i < count; i++) {
+        const ListenSocket* listen_socket = nullptr;
+        for (const ListenSocket& hListenSocket : vhListenSocket) {
+            if (events[i].data.ptr == &hListenSocket)
+                listen_socket = &hListenSocket;
+        }
+        if (listen_socket) {
+            //
+            // Accept new connections
+            //
+            AcceptConnection(*listen_socket);
+            continue;
+        }
+        CNode* pnode = static_cast<CNode*>(events[i].data.ptr);
+        ready[pnode] |= events[i].events;
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+            pnode->m_epoll_readable = true;
+            m_epoll_pending.insert(pnode);
+        }
+        if (events[i].events & (EPOLLRDHUP | EPOLLHUP))
+            pnode->m_epoll_hangup = true;
+    }
+    for (CNode* pnode : m_epoll_pending) {
+        ready.emplace(pnode, 0);
+    }
+
+    {
+        LOCK(cs_vNodes);
+        for (const auto& entry : ready)
+            entry.first->AddRef();
+    }
+    for (const auto& entry : ready)
+    {
+        if (interruptNet)
+            break;
+
+        CNode* pnode = entry.first;
+        // As with SocketEvents, a node's send queue is drained before reading
+        // more from it, unless the socket reported an error
+        const bool error = entry.second & (EPOLLERR | EPOLLHUP);
+        const bool recv = error || (pnode->m_epoll_readable && !pnode->fPauseRecv && !pnode->m_epoll_send);
+        bool more_to_read = false;
+        const bool serviced = ServiceNodeSocket(pnode, recv, entry.second & EPOLLOUT, more_to_read);
+        // A short read usually means the socket was drained, but the end of
+        // the stream may have come in along with the data. No further edge
+        // is reported for it, so it is read on the next pass.
+        if (recv && !more_to_read && pnode->m_epoll_hangup && !pnode->fDisconnect)
+            more_to_read = true;
+        if (!serviced || (recv && !more_to_read)) {
+            pnode->m_epoll_readable = false;
+            m_epoll_pending.erase(pnode);
+        }
+    }
+    {
+        LOCK(cs_vNodes);
+        for (const auto& entry : ready)
+            entry.first->Release();
+    }
+
+    // Timeouts only have a resolution of seconds
+    const int64_t nTime = GetSystemTimeInSeconds();
+    if (nTime != m_last_inactivity_check) {
+        m_last_inactivity_check = nTime;
+        std::vector<CNode*> vNodesCopy;
+        {
+            LOCK(cs_vNodes);
+            vNodesCopy = vNodes;
+            for (CNode* pnode : vNodesCopy)
+                pnode->AddRef();
+        }
+        for (CNode* pnode : vNodesCopy)
         {
-            // typical socket buffer is 8K-64K
-            char pchBuf[0x10000];
-            int nBytes = 0;
             {
                 LOCK(pnode->cs_hSocket);
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-            }
-            if (nBytes > 0)
-            {
-                bool notify = false;
-                if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
-                    pnode->CloseSocketDisconnect();
-                RecordBytesRecv(nBytes);
-                if (notify) {
-                    size_t nSizeAdded = 0;
-                    auto it(pnode->vRecvMsg.begin());
-                    for (; it != pnode->vRecvMsg.end(); ++it) {
-                        if (!it->complete())
-                            break;
-                        nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
-                    }
-                    {
-                        LOCK(pnode->cs_vProcessMsg);
-                        pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
-                        pnode->nProcessQueueSize += nSizeAdded;
-                        pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
-                    }
-                    WakeMessageHandler();
-                }
-            }
-            else if (nBytes == 0)
-            {
-                // socket closed gracefully
-                if (!pnode->fDisconnect) {
-                    LogPrint(BCLog::NET, "socket closed\n");
-                }
-                pnode->CloseSocketDisconnect();
-            }
-            else if (nBytes < 0)
-            {
-                // error
-                int nErr = WSAGetLastError();
-                if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                {
-                    if (!pnode->fDisconnect)
-                        LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                    pnode->CloseSocketDisconnect();
-                }
             }
+            InactivityCheck(pnode);
         }
-
-        //
-        // Send
-        //
-        if (sendSet)
         {
-            LOCK(pnode->cs_vSend);
-            size_t nBytes = SocketSendData(pnode);
-            if (nBytes) {
-                RecordBytesSent(nBytes);
-            }
+            LOCK(cs_vNodes);
+            for (CNode* pnode : vNodesCopy)
+                pnode->Release();
         }
-
-        InactivityCheck(pnode);
-    }
-    {
-        LOCK(cs_vNodes);
-        for (CNode* pnode : vNodesCopy)
-            pnode->Release();
     }
 }
+#endif
 
 void CConnman::ThreadSocketHandler()
 {
@@ -1972,6 +2355,7 @@ void CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        RegisterNodeSocket(pnode);
     }
 }
 
@@ -2278,6 +2662,25 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         fMsgProcWake = false;
     }
 
+#ifdef USE_EPOLL
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll_fd == -1) {
+        LogPrintf("epoll_create1 failed with error %s, falling back to poll\n", NetworkErrorString(WSAGetLastError()));
+    }
+    for (ListenSocket& hListenSocket : vhListenSocket) {
+        if (m_epoll_fd == -1)
+            break;
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = &hListenSocket;
+        if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0) {
+            LogPrintf("epoll_ctl failed with error %s, falling back to poll\n", NetworkErrorString(WSAGetLastError()));
+            close(m_epoll_fd);
+            m_epoll_fd = -1;
+        }
+    }
+#endif
+
     // Send and receive from sockets, accept connections
     threadSocketHandler = std::thread(&TraceThread<std::function<void()> >, "net", std::function<void()>(std::bind(&CConnman::ThreadSocketHandler, this)));
 
@@ -2385,6 +2788,13 @@ void CConnman::Stop()
     vNodes.clear();
     vNodesDisconnected.clear();
     vhListenSocket.clear();
+#ifdef USE_EPOLL
+    m_epoll_pending.clear();
+    if (m_epoll_fd != -1) {
+        close(m_epoll_fd);
+        m_epoll_fd = -1;
+    }
+#endif
     semOutbound.reset();
     semAddnode.reset();
 }
@@ -2692,17 +3102,31 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
 
 void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 {
-    size_t nMessageSize = msg.data.size();
+    CQueuedNetMsg queued;
+    uint256 hash;
+    if (msg.shared) {
+        // Serialized and hashed once for all peers it is sent to
+        queued.owner = msg.shared->owner;
+        queued.payload = msg.shared->data;
+        hash = msg.shared->hash;
+    } else {
+        std::shared_ptr<const std::vector<unsigned char>> data = std::make_shared<const std::vector<unsigned char>>(std::move(msg.data));
+        queued.payload = Span<const unsigned char>(data->data(), data->size());
+        queued.owner = std::move(data);
+        hash = Hash(queued.payload.begin(), queued.payload.end());
+    }
+    size_t nMessageSize = queued.payload.size();
     size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
     LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->GetId());
 
     std::vector<unsigned char> serializedHeader;
     serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
-    uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
     CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
 
     CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
+    assert(serializedHeader.size() == sizeof(queued.header));
+    memcpy(queued.header, serializedHeader.data(), sizeof(queued.header));
 
     size_t nBytesSent = 0;
     {
@@ -2715,9 +3139,7 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+        pnode->vSendMsg.push_back(std::move(queued));
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
@@ -19,6 +19,7 @@
 #include <policy/feerate.h>
 #include <protocol.h>
 #include <random.h>
+#include <span.h>
 #include <streams.h>
 #include <sync.h>
 #include <uint256.h>
@@ -29,6 +30,7 @@
 #include <stdint.h>
 #include <thread>
 #include <memory>
+#include <unordered_set>
 #include <condition_variable>
 
 #ifndef WIN32
@@ -39,6 +41,7 @@
 class CScheduler;
 class CNode;
 class BanMan;
+class CTxPreValidationJob;
 
 /** Default for -whitelistrelay. */
 static const bool DEFAULT_WHITELISTRELAY = true;
@@ -103,6 +106,25 @@ struct AddedNodeInfo
 class CNodeStats;
 class CClientUIInterface;
 
+/**
+ * A serialized message payload which doesn't change once made, so that it can
+ * be queued to any number of peers without being serialized, hashed or copied
+ * again, e.g. a block announced to all of them. The bytes are kept alive by
+ * owner, which may be the payload itself or e.g. a mapping of a block file.
+ */
+struct CSharedNetPayload
+{
+    std::shared_ptr<const void> owner;
+    Span<const unsigned char> data;
+    //! Double SHA256 of data, of which the message checksum is the start
+    uint256 hash;
+};
+
+/** Make a shared payload of serialized bytes */
+std::shared_ptr<const CSharedNetPayload> MakeSharedNetPayload(std::vector<unsigned char>&& data);
+/** Make a shared payload of bytes kept alive by owner, without copying them */
+std::shared_ptr<const CSharedNetPayload> MakeSharedNetPayload(std::shared_ptr<const void> owner, Span<const unsigned char> data);
+
 struct CSerializedNetMsg
 {
     CSerializedNetMsg() = default;
@@ -114,6 +136,18 @@ struct CSerializedNetMsg
 
     std::vector<unsigned char> data;
     std::string command;
+    //! If set, the payload, in place of data
+    std::shared_ptr<const CSharedNetPayload> shared;
+};
+
+/** A message queued for sending to a peer: its header, then its payload, which may be shared with other peers' queues */
+struct CQueuedNetMsg
+{
+    unsigned char header[CMessageHeader::HEADER_SIZE];
+    std::shared_ptr<const void> owner;
+    Span<const unsigned char> payload;
+
+    size_t size() const { return sizeof(header) + payload.size(); }
 };
 
 
@@ -356,6 +390,17 @@ private:
     void SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
     void SocketHandler();
     void ThreadSocketHandler();
+    /**
+     * Receive from and send to the socket of a node, depending on what it was
+     * found ready for. Returns false if the socket was closed already.
+     * more_to_read is set if a receive filled the whole buffer.
+     */
+    bool ServiceNodeSocket(CNode* pnode, bool fRecv, bool fSend, bool& more_to_read);
+#ifdef USE_EPOLL
+    void SocketHandlerEpoll();
+#endif
+    /** Register the socket of a node just added to vNodes with the epoll set, if any */
+    void RegisterNodeSocket(CNode* pnode);
     void ThreadDNSAddressSeed();
 
     uint64_t CalculateKeyedNetGroup(const CAddress& ad) const;
@@ -374,6 +419,8 @@ private:
     NodeId GetNewNodeId();
 
     size_t SocketSendData(CNode *pnode) const;
+    /** Watch the socket of a node for write readiness exactly while vSendMsg is non-empty */
+    void UpdateSendInterest(CNode* pnode) const EXCLUSIVE_LOCKS_REQUIRED(pnode->cs_vSend);
     void DumpAddresses();
 
     // Network stats
@@ -416,6 +463,14 @@ private:
     std::vector<CNode*> vNodes GUARDED_BY(cs_vNodes);
     std::list<CNode*> vNodesDisconnected;
     mutable CCriticalSection cs_vNodes;
+#ifdef USE_EPOLL
+    //! Persistent registrations of the listening and node sockets, or -1 to use SocketEvents
+    int m_epoll_fd{-1};
+    //! Nodes whose socket may still hold unread data (socket handler thread only)
+    std::unordered_set<CNode*> m_epoll_pending;
+    //! When InactivityCheck last ran over all nodes (socket handler thread only)
+    int64_t m_last_inactivity_check{0};
+#endif
     std::atomic<NodeId> nLastNodeId{0};
     unsigned int nPrevNodeCount{0};
 
@@ -610,10 +665,53 @@ public:
 
 
 
+/**
+ * Buffers for the payloads of received messages, kept once a message is
+ * processed to receive later ones into, rather than freed and allocated
+ * again, which for block-sized payloads means wiping megabytes on every free
+ * and growing through repeated reallocations. Buffers come in power-of-two
+ * size classes from 4 KiB up to MAX_PROTOCOL_MESSAGE_LENGTH, and the bytes
+ * kept are bounded.
+ */
+class CNetRecvBufferPool
+{
+public:
+    static const int MIN_CLASS_BITS = 12;
+    static const int MAX_CLASS_BITS = 22;
+
+private:
+    const size_t m_max_kept_bytes;
+
+    Mutex m_mutex;
+    //! Free buffers of each size class, all empty with a capacity of exactly their class
+    std::vector<CSerializeData> m_free[MAX_CLASS_BITS - MIN_CLASS_BITS + 1] GUARDED_BY(m_mutex);
+    size_t m_kept_bytes GUARDED_BY(m_mutex) = 0;
+
+public:
+    explicit CNetRecvBufferPool(size_t max_kept_bytes) : m_max_kept_bytes(max_kept_bytes) {}
+
+    /** Size class of a buffer of at least size bytes, or -1 if larger than all */
+    static int SizeClass(size_t size);
+
+    /** An empty buffer with room for at least size bytes, reused if possible */
+    CSerializeData Get(size_t size);
+
+    /** Hand a buffer back to be reused, or freed if there are enough */
+    void Put(CSerializeData buffer);
+
+    size_t KeptBytes();
+};
+
+/** Receive buffers shared by all peers */
+extern CNetRecvBufferPool g_net_recv_buffers;
+
 class CNetMessage {
 private:
     mutable CHash256 hasher;
     mutable uint256 data_hash;
+
+    //! Move vRecv into a pooled buffer with room for size bytes of the payload and up to a window more
+    void GrowData(unsigned int size);
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
@@ -634,6 +732,11 @@ public:
         nTime = 0;
     }
 
+    ~CNetMessage();
+
+    CNetMessage(CNetMessage&&) = default;
+    CNetMessage& operator=(CNetMessage&&) = default;
+
     bool complete() const
     {
         if (!in_data)
@@ -651,6 +754,13 @@ public:
 
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
+
+    /**
+     * Where up to size more bytes of the payload can be received directly,
+     * to be passed to readData() from there once received, which then
+     * doesn't copy them. Only for a payload with at least size bytes left.
+     */
+    char* DataWindow(unsigned int size);
 };
 
 
@@ -665,7 +775,7 @@ public:
     size_t nSendSize{0}; // total size of all vSendMsg entries
     size_t nSendOffset{0}; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes GUARDED_BY(cs_vSend){0};
-    std::deque<std::vector<unsigned char>> vSendMsg GUARDED_BY(cs_vSend);
+    std::deque<CQueuedNetMsg> vSendMsg GUARDED_BY(cs_vSend);
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -718,6 +828,14 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv{false};
     std::atomic_bool fPauseSend{false};
+    //! Whether the socket is in the epoll set of the socket handler
+    bool m_epoll_registered GUARDED_BY(cs_vSend){false};
+    //! Whether the epoll registration includes write readiness, i.e. vSendMsg is non-empty
+    std::atomic_bool m_epoll_send{false};
+    //! Whether unread data may be waiting on the socket (socket handler thread only)
+    bool m_epoll_readable{false};
+    //! Whether the peer was reported to have closed its end, so that reads go on until the end of the stream is seen (socket handler thread only)
+    bool m_epoll_hangup{false};
 
 protected:
     mapMsgCmdSize mapSendBytesPerMsgCmd;
@@ -794,6 +912,8 @@ public:
     std::atomic<bool> fPingQueued{false};
 
     std::set<uint256> orphan_work_set;
+    //! Transactions received, to be accepted once pre-validated, oldest first
+    std::deque<std::shared_ptr<CTxPreValidationJob>> m_prevalidating_txs;
 
     CNode(NodeId id, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn, SOCKET hSocketIn, const CAddress &addrIn, uint64_t nKeyedNetGroupIn, uint64_t nLocalHostNonceIn, const CAddress &addrBindIn, const std::string &addrNameIn = "", bool fInboundIn = false, bool block_relay_only = false);
     ~CNode();
@@ -854,6 +974,20 @@ public:
 
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete);
 
+    /**
+     * Where to receive the next bytes from the socket straight into, without
+     * going through an intermediate buffer, when the message being received
+     * has at least min_size bytes of payload left. The bytes received there
+     * are then passed to ReceiveMsgBytes() as usual.
+     * @param[in]  min_size  The least payload left to be worth it.
+     * @param[out] size      How many bytes can be received there.
+     * @return Where to receive them, or nullptr if not worth it.
+     */
+    char* GetReceiveWindow(unsigned int min_size, unsigned int& size);
+
+    /** Move the messages received in full, oldest first, to the end of msgs. Returns their size, headers included. */
+    size_t TakeCompleteMsgs(std::list<CNetMessage>& msgs);
+
     void SetRecvVersion(int nVersionIn)
     {
         nRecvVersion = nVersionIn;
@@ -9,6 +9,7 @@
 #include <banman.h>
 #include <arith_uint256.h>
 #include <blockencodings.h>
+#include <blockfilemap.h>
 #include <chainparams.h>
 #include <consensus/validation.h>
 #include <hash.h>
@@ -25,11 +26,14 @@
 #include <scheduler.h>
 #include <tinyformat.h>
 #include <txmempool.h>
+#include <txprevalidation.h>
 #include <util/system.h>
 #include <util/strencodings.h>
 #include <util/validation.h>
 
+#include <map>
 #include <memory>
+#include <tuple>
 #include <typeinfo>
 
 #if defined(NDEBUG)
@@ -80,6 +84,14 @@ static_assert(INBOUND_PEER_TX_DELAY >= MAX_GETDATA_RANDOM_DELAY,
 "To preserve security, MAX_GETDATA_RANDOM_DELAY should not exceed INBOUND_PEER_DELAY");
 /** Limit to avoid sending big packets. Not used in processing incoming GETDATA for compatibility */
 static const unsigned int MAX_GETDATA_SZ = 1000;
+/** Maximum number of transactions of a peer being pre-validated, beyond which its messages other than blocks wait */
+static constexpr size_t MAX_PEER_PREVALIDATING_TXS = 100;
+
+/** Whether a message carries a block, which is handled ahead of transactions being pre-validated */
+static bool IsBlockMessage(const std::string& command)
+{
+    return command == NetMsgType::BLOCK || command == NetMsgType::CMPCTBLOCK || command == NetMsgType::BLOCKTXN;
+}
 
 
 struct COrphanTx {
@@ -176,6 +188,8 @@ namespace {
     MapRelay mapRelay GUARDED_BY(cs_main);
     /** Expiration-time ordered list of (expire time, relay map entry) pairs. */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration GUARDED_BY(cs_main);
+    /** Order of the transactions relayed, shared by all peers' announcements */
+    TxAnnouncementOrder g_tx_announcement_order;
 
     struct IteratorComparator
     {
@@ -1150,6 +1164,45 @@ static std::shared_ptr<const CBlock> most_recent_block GUARDED_BY(cs_most_recent
 static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_block GUARDED_BY(cs_most_recent_block);
 static uint256 most_recent_block_hash GUARDED_BY(cs_most_recent_block);
 static bool fWitnessesPresentInMostRecentCompactBlock GUARDED_BY(cs_most_recent_block);
+//! Payloads of the block, compact block and blocktxn messages about the most recent block, by command,
+//! serialization flags and requested transactions, serialized once and shared by all peers they are sent to
+static std::map<std::tuple<std::string, int, std::vector<uint16_t>>, std::shared_ptr<const CSharedNetPayload>> most_recent_block_payloads GUARDED_BY(cs_most_recent_block);
+//! Bytes of the blocktxn payloads in most_recent_block_payloads, and of the requested transactions they are keyed on
+static size_t most_recent_blocktxn_bytes GUARDED_BY(cs_most_recent_block){0};
+
+/**
+ * Most bytes of blocktxn payloads kept in most_recent_block_payloads; any
+ * responses beyond it are serialized per peer. Those are keyed on the
+ * transactions peers ask for, so they are bounded by size rather than
+ * number, as a few peers could otherwise pin many block-sized responses.
+ */
+static const size_t MAX_RECENT_BLOCKTXN_BYTES = MAX_BLOCK_SERIALIZED_SIZE;
+
+/**
+ * The payload of a message about the most recent block, serialized the first
+ * time it is asked for and shared from then on. Returns null if block_hash is
+ * no longer the most recent block. Blocktxn payloads are only serialized to
+ * be shared while the budget for them allows.
+ */
+template <typename T>
+static std::shared_ptr<const CSharedNetPayload> GetRecentBlockPayload(const uint256& block_hash, const std::string& command, int flags, const T& object, const std::vector<uint16_t>& indexes = {})
+{
+    LOCK(cs_most_recent_block);
+    if (block_hash != most_recent_block_hash)
+        return nullptr;
+    auto key = std::make_tuple(command, flags, indexes);
+    auto it = most_recent_block_payloads.find(key);
+    if (it != most_recent_block_payloads.end())
+        return it->second;
+    if (!indexes.empty() && most_recent_blocktxn_bytes >= MAX_RECENT_BLOCKTXN_BYTES)
+        return nullptr;
+    // Serialization of these doesn't depend on the protocol version, only on the flags
+    std::shared_ptr<const CSharedNetPayload> payload = CNetMsgMaker(PROTOCOL_VERSION).SerializeShared(flags, object);
+    if (!indexes.empty())
+        most_recent_blocktxn_bytes += payload->data.size() + indexes.size() * sizeof(uint16_t);
+    most_recent_block_payloads.emplace(std::move(key), payload);
+    return payload;
+}
 
 /**
  * Maintain state about the best-seen block and fast-announce a compact block
@@ -1175,12 +1228,15 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         most_recent_block = pblock;
         most_recent_compact_block = pcmpctblock;
         fWitnessesPresentInMostRecentCompactBlock = fWitnessEnabled;
+        most_recent_block_payloads.clear();
+        most_recent_blocktxn_bytes = 0;
     }
+    // Serialized once for all peers it is announced to
+    const std::shared_ptr<const CSharedNetPayload> cmpctblock_payload = GetRecentBlockPayload(hashBlock, NetMsgType::CMPCTBLOCK, 0, *pcmpctblock);
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
+    connman->ForEachNode([this, &pcmpctblock, &cmpctblock_payload, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
         AssertLockHeld(cs_main);
 
-        // TODO: Avoid the repeated-serialization here
         if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
             return;
         ProcessBlockAvailability(pnode->GetId());
@@ -1192,7 +1248,11 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
 
             LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
                     hashBlock.ToString(), pnode->GetId());
-            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            if (cmpctblock_payload) {
+                connman->PushMessage(pnode, CNetMsgMaker::MakeShared(NetMsgType::CMPCTBLOCK, cmpctblock_payload));
+            } else {
+                connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            }
             state.pindexBestHeaderSent = pindex;
         }
     });
@@ -1312,6 +1372,7 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 
 void RelayTransaction(const uint256& txid, const CConnman& connman)
 {
+    g_tx_announcement_order.Add(txid, GetTimeMicros());
     CInv inv(MSG_TX, txid);
     connman.ForEachNode([&inv](CNode* pnode)
     {
@@ -1431,11 +1492,12 @@ void static ProcessGetBlockData(CNode* pfrom, const CChainParams& chainparams, c
         } else if (inv.type == MSG_WITNESS_BLOCK) {
             // Fast-path: in this case it is possible to serve the block directly from disk,
             // as the network format matches the format on disk
-            std::vector<uint8_t> block_data;
+            MappedBlockData block_data;
             if (!ReadRawBlockFromDisk(block_data, pindex, chainparams.MessageStart())) {
                 assert(!"cannot load block from disk");
             }
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, MakeSpan(block_data)));
+            // The bytes are queued as they are, without being copied out of the mapping
+            connman->PushMessage(pfrom, CNetMsgMaker::MakeShared(NetMsgType::BLOCK, MakeSharedNetPayload(block_data.owner(), block_data.span())));
             // Don't set pblock as we've sent the block
         } else {
             // Send block from disk
@@ -1444,11 +1506,22 @@ void static ProcessGetBlockData(CNode* pfrom, const CChainParams& chainparams, c
                 assert(!"cannot load block from disk");
             pblock = pblockRead;
         }
+        // Messages about the most recent block are serialized once for all peers
+        auto push_block = [&](int nSendFlags) {
+            std::shared_ptr<const CSharedNetPayload> payload;
+            if (pblock == a_recent_block)
+                payload = GetRecentBlockPayload(pblock->GetHash(), NetMsgType::BLOCK, nSendFlags, *pblock);
+            if (payload) {
+                connman->PushMessage(pfrom, CNetMsgMaker::MakeShared(NetMsgType::BLOCK, std::move(payload)));
+            } else {
+                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
+            }
+        };
         if (pblock) {
             if (inv.type == MSG_BLOCK)
-                connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock));
+                push_block(SERIALIZE_TRANSACTION_NO_WITNESS);
             else if (inv.type == MSG_WITNESS_BLOCK)
-                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
+                push_block(0);
             else if (inv.type == MSG_FILTERED_BLOCK)
             {
                 bool sendMerkleBlock = false;
@@ -1485,13 +1558,18 @@ void static ProcessGetBlockData(CNode* pfrom, const CChainParams& chainparams, c
                 int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
                 if (CanDirectFetch(consensusParams) && pindex->nHeight >= ::ChainActive().Height() - MAX_CMPCTBLOCK_DEPTH) {
                     if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == pindex->GetBlockHash()) {
-                        connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
+                        std::shared_ptr<const CSharedNetPayload> payload = GetRecentBlockPayload(pindex->GetBlockHash(), NetMsgType::CMPCTBLOCK, nSendFlags, *a_recent_compact_block);
+                        if (payload) {
+                            connman->PushMessage(pfrom, CNetMsgMaker::MakeShared(NetMsgType::CMPCTBLOCK, std::move(payload)));
+                        } else {
+                            connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
+                        }
                     } else {
                         CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness);
                         connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
                     }
                 } else {
-                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
+                    push_block(nSendFlags);
                 }
             }
         }
@@ -1612,7 +1690,13 @@ inline void static SendBlockTransactions(const CBlock& block, const BlockTransac
     LOCK(cs_main);
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
     int nSendFlags = State(pfrom->GetId())->fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
-    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCKTXN, resp));
+    // Peers missing the same transactions of the most recent block share a response
+    std::shared_ptr<const CSharedNetPayload> payload = GetRecentBlockPayload(req.blockhash, NetMsgType::BLOCKTXN, nSendFlags, resp, req.indexes);
+    if (payload) {
+        connman->PushMessage(pfrom, CNetMsgMaker::MakeShared(NetMsgType::BLOCKTXN, std::move(payload)));
+    } else {
+        connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCKTXN, resp));
+    }
 }
 
 bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::vector<CBlockHeader>& headers, const CChainParams& chainparams, bool via_compact_block)
@@ -1860,6 +1944,155 @@ void static ProcessOrphanTx(CConnman* connman, std::set<uint256>& orphan_work_se
     }
 }
 
+/**
+ * Accept a transaction received from a peer to the mempool, relaying it and
+ * any orphans it unlocks, or handle its rejection.
+ */
+static void ProcessTransaction(CNode* pfrom, const CTransactionRef& ptx, CConnman* connman, bool enable_bip61, const CValidationState* prevalidation_failure = nullptr)
+{
+    const CTransaction& tx = *ptx;
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    const std::string strCommand = NetMsgType::TX;
+    CInv inv(MSG_TX, tx.GetHash());
+
+    LOCK2(cs_main, g_cs_orphans);
+
+    bool fMissingInputs = false;
+    CValidationState state;
+
+    CNodeState* nodestate = State(pfrom->GetId());
+    nodestate->m_tx_download.m_tx_announced.erase(inv.hash);
+    nodestate->m_tx_download.m_tx_in_flight.erase(inv.hash);
+    EraseTxRequest(inv.hash);
+
+    std::list<CTransactionRef> lRemovedTxn;
+
+    // Rejected as its scripts failed already, which AcceptToMemoryPool would
+    // find again, and recorded as a reject as AcceptToMemoryPool's failure is
+    if (prevalidation_failure) {
+        state = *prevalidation_failure;
+    }
+
+    if (!prevalidation_failure && !AlreadyHave(inv) &&
+        AcceptToMemoryPool(mempool, state, ptx, &fMissingInputs, &lRemovedTxn, false /* bypass_limits */, 0 /* nAbsurdFee */)) {
+        mempool.check(&::ChainstateActive().CoinsTip());
+        RelayTransaction(tx.GetHash(), *connman);
+        for (unsigned int i = 0; i < tx.vout.size(); i++) {
+            auto it_by_prev = mapOrphanTransactionsByPrev.find(COutPoint(inv.hash, i));
+            if (it_by_prev != mapOrphanTransactionsByPrev.end()) {
+                for (const auto& elem : it_by_prev->second) {
+                    pfrom->orphan_work_set.insert(elem->first);
+                }
+            }
+        }
+
+        pfrom->nLastTXTime = GetTime();
+
+        LogPrint(BCLog::MEMPOOL, "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
+            pfrom->GetId(),
+            tx.GetHash().ToString(),
+            mempool.size(), mempool.DynamicMemoryUsage() / 1000);
+
+        // Recursively process any orphan transactions that depended on this one
+        ProcessOrphanTx(connman, pfrom->orphan_work_set, lRemovedTxn);
+    }
+    else if (fMissingInputs)
+    {
+        bool fRejectedParents = false; // It may be the case that the orphans parents have all been rejected
+        for (const CTxIn& txin : tx.vin) {
+            if (recentRejects->contains(txin.prevout.hash)) {
+                fRejectedParents = true;
+                break;
+            }
+        }
+        if (!fRejectedParents) {
+            uint32_t nFetchFlags = GetFetchFlags(pfrom);
+            const auto current_time = GetTime<std::chrono::microseconds>();
+
+            for (const CTxIn& txin : tx.vin) {
+                CInv _inv(MSG_TX | nFetchFlags, txin.prevout.hash);
+                pfrom->AddInventoryKnown(_inv);
+                if (!AlreadyHave(_inv)) RequestTx(State(pfrom->GetId()), _inv.hash, current_time);
+            }
+            AddOrphanTx(ptx, pfrom->GetId());
+
+            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded (see CVE-2012-3789)
+            unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, gArgs.GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+            if (nEvicted > 0) {
+                LogPrint(BCLog::MEMPOOL, "mapOrphan overflow, removed %u tx\n", nEvicted);
+            }
+        } else {
+            LogPrint(BCLog::MEMPOOL, "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
+            // We will continue to reject this tx since it has rejected
+            // parents so avoid re-requesting it from other peers.
+            recentRejects->insert(tx.GetHash());
+        }
+    } else {
+        assert(IsTransactionReason(state.GetReason()));
+        if (!tx.HasWitness() && state.GetReason() != ValidationInvalidReason::TX_WITNESS_MUTATED) {
+            // Do not use rejection cache for witness transactions or
+            // witness-stripped transactions, as they can have been malleated.
+            // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
+            assert(recentRejects);
+            recentRejects->insert(tx.GetHash());
+            if (RecursiveDynamicUsage(*ptx) < 100000) {
+                AddToCompactExtraTransactions(ptx);
+            }
+        } else if (tx.HasWitness() && RecursiveDynamicUsage(*ptx) < 100000) {
+            AddToCompactExtraTransactions(ptx);
+        }
+
+        if (pfrom->HasPermission(PF_FORCERELAY)) {
+            // Always relay transactions received from whitelisted peers, even
+            // if they were already in the mempool or rejected from it due
+            // to policy, allowing the node to function as a gateway for
+            // nodes hidden behind it.
+            //
+            // Never relay transactions that might result in being
+            // disconnected (or banned).
+            if (state.IsInvalid() && TxRelayMayResultInDisconnect(state)) {
+                LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s)\n", tx.GetHash().ToString(), pfrom->GetId(), FormatStateMessage(state));
+            } else {
+                LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->GetId());
+                RelayTransaction(tx.GetHash(), *connman);
+            }
+        }
+    }
+
+    for (const CTransactionRef& removedTx : lRemovedTxn)
+        AddToCompactExtraTransactions(removedTx);
+
+    // If a tx has been detected by recentRejects, we will have reached
+    // this point and the tx will have been ignored. Because we haven't run
+    // the tx through AcceptToMemoryPool, we won't have computed a DoS
+    // score for it or determined exactly why we consider it invalid.
+    //
+    // This means we won't penalize any peer subsequently relaying a DoSy
+    // tx (even if we penalized the first peer who gave it to us) because
+    // we have to account for recentRejects showing false positives. In
+    // other words, we shouldn't penalize a peer if we aren't *sure* they
+    // submitted a DoSy tx.
+    //
+    // Note that recentRejects doesn't just record DoSy or invalid
+    // transactions, but any tx not accepted by the mempool, which may be
+    // due to node policy (vs. consensus). So we can't blanket penalize a
+    // peer simply for relaying a tx that our recentRejects has caught,
+    // regardless of false positives.
+
+    if (state.IsInvalid())
+    {
+        LogPrint(BCLog::MEMPOOLREJ, "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
+            pfrom->GetId(),
+            FormatStateMessage(state));
+        if (enable_bip61 && state.GetRejectCode() > 0 && state.GetRejectCode() < REJECT_INTERNAL) { // Never send AcceptToMemoryPool's internal codes over P2P
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::REJECT, strCommand, (unsigned char)state.GetRejectCode(),
+                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash));
+        }
+        MaybePunishNode(pfrom->GetId(), state, /*via_compact_block*/ false);
+    }
+}
+
 bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman* connman, const std::atomic<bool>& interruptMsgProc, bool enable_bip61)
 {
     LogPrint(BCLog::NET, "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->GetId());
@@ -2500,141 +2733,32 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
 
         CTransactionRef ptx;
         vRecv >> ptx;
-        const CTransaction& tx = *ptx;
 
-        CInv inv(MSG_TX, tx.GetHash());
+        CInv inv(MSG_TX, ptx->GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        LOCK2(cs_main, g_cs_orphans);
-
-        bool fMissingInputs = false;
-        CValidationState state;
-
-        CNodeState* nodestate = State(pfrom->GetId());
-        nodestate->m_tx_download.m_tx_announced.erase(inv.hash);
-        nodestate->m_tx_download.m_tx_in_flight.erase(inv.hash);
-        EraseTxRequest(inv.hash);
-
-        std::list<CTransactionRef> lRemovedTxn;
-
-        if (!AlreadyHave(inv) &&
-            AcceptToMemoryPool(mempool, state, ptx, &fMissingInputs, &lRemovedTxn, false /* bypass_limits */, 0 /* nAbsurdFee */)) {
-            mempool.check(&::ChainstateActive().CoinsTip());
-            RelayTransaction(tx.GetHash(), *connman);
-            for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                auto it_by_prev = mapOrphanTransactionsByPrev.find(COutPoint(inv.hash, i));
-                if (it_by_prev != mapOrphanTransactionsByPrev.end()) {
-                    for (const auto& elem : it_by_prev->second) {
-                        pfrom->orphan_work_set.insert(elem->first);
-                    }
-                }
-            }
-
-            pfrom->nLastTXTime = GetTime();
-
-            LogPrint(BCLog::MEMPOOL, "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
-                pfrom->GetId(),
-                tx.GetHash().ToString(),
-                mempool.size(), mempool.DynamicMemoryUsage() / 1000);
-
-            // Recursively process any orphan transactions that depended on this one
-            ProcessOrphanTx(connman, pfrom->orphan_work_set, lRemovedTxn);
-        }
-        else if (fMissingInputs)
+        // Its scripts are checked by the pre-validation threads meanwhile, unless
+        // they are busy or it fails cheaper checks. Transactions are accepted in
+        // the order received either way, and other messages of the peer wait for
+        // them (see ProcessMessages).
+        std::shared_ptr<CTxPreValidationJob> job;
         {
-            bool fRejectedParents = false; // It may be the case that the orphans parents have all been rejected
-            for (const CTxIn& txin : tx.vin) {
-                if (recentRejects->contains(txin.prevout.hash)) {
-                    fRejectedParents = true;
-                    break;
-                }
-            }
-            if (!fRejectedParents) {
-                uint32_t nFetchFlags = GetFetchFlags(pfrom);
-                const auto current_time = GetTime<std::chrono::microseconds>();
-
-                for (const CTxIn& txin : tx.vin) {
-                    CInv _inv(MSG_TX | nFetchFlags, txin.prevout.hash);
-                    pfrom->AddInventoryKnown(_inv);
-                    if (!AlreadyHave(_inv)) RequestTx(State(pfrom->GetId()), _inv.hash, current_time);
-                }
-                AddOrphanTx(ptx, pfrom->GetId());
-
-                // DoS prevention: do not allow mapOrphanTransactions to grow unbounded (see CVE-2012-3789)
-                unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, gArgs.GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
-                if (nEvicted > 0) {
-                    LogPrint(BCLog::MEMPOOL, "mapOrphan overflow, removed %u tx\n", nEvicted);
-                }
+            LOCK(cs_main);
+            std::vector<CTxOut> spent_outputs;
+            if (!AlreadyHave(inv) && PrepareTxPreValidation(*ptx, spent_outputs)) {
+                job = std::make_shared<CTxPreValidationJob>(ptx, std::move(spent_outputs));
             } else {
-                LogPrint(BCLog::MEMPOOL, "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
-                // We will continue to reject this tx since it has rejected
-                // parents so avoid re-requesting it from other peers.
-                recentRejects->insert(tx.GetHash());
-            }
-        } else {
-            assert(IsTransactionReason(state.GetReason()));
-            if (!tx.HasWitness() && state.GetReason() != ValidationInvalidReason::TX_WITNESS_MUTATED) {
-                // Do not use rejection cache for witness transactions or
-                // witness-stripped transactions, as they can have been malleated.
-                // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
-                assert(recentRejects);
-                recentRejects->insert(tx.GetHash());
-                if (RecursiveDynamicUsage(*ptx) < 100000) {
-                    AddToCompactExtraTransactions(ptx);
-                }
-            } else if (tx.HasWitness() && RecursiveDynamicUsage(*ptx) < 100000) {
-                AddToCompactExtraTransactions(ptx);
-            }
-
-            if (pfrom->HasPermission(PF_FORCERELAY)) {
-                // Always relay transactions received from whitelisted peers, even
-                // if they were already in the mempool or rejected from it due
-                // to policy, allowing the node to function as a gateway for
-                // nodes hidden behind it.
-                //
-                // Never relay transactions that might result in being
-                // disconnected (or banned).
-                if (state.IsInvalid() && TxRelayMayResultInDisconnect(state)) {
-                    LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s)\n", tx.GetHash().ToString(), pfrom->GetId(), FormatStateMessage(state));
-                } else {
-                    LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->GetId());
-                    RelayTransaction(tx.GetHash(), *connman);
-                }
+                job = std::make_shared<CTxPreValidationJob>(ptx);
             }
         }
-
-        for (const CTransactionRef& removedTx : lRemovedTxn)
-            AddToCompactExtraTransactions(removedTx);
-
-        // If a tx has been detected by recentRejects, we will have reached
-        // this point and the tx will have been ignored. Because we haven't run
-        // the tx through AcceptToMemoryPool, we won't have computed a DoS
-        // score for it or determined exactly why we consider it invalid.
-        //
-        // This means we won't penalize any peer subsequently relaying a DoSy
-        // tx (even if we penalized the first peer who gave it to us) because
-        // we have to account for recentRejects showing false positives. In
-        // other words, we shouldn't penalize a peer if we aren't *sure* they
-        // submitted a DoSy tx.
-        //
-        // Note that recentRejects doesn't just record DoSy or invalid
-        // transactions, but any tx not accepted by the mempool, which may be
-        // due to node policy (vs. consensus). So we can't blanket penalize a
-        // peer simply for relaying a tx that our recentRejects has caught,
-        // regardless of false positives.
-
-        if (state.IsInvalid())
-        {
-            LogPrint(BCLog::MEMPOOLREJ, "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
-                pfrom->GetId(),
-                FormatStateMessage(state));
-            if (enable_bip61 && state.GetRejectCode() > 0 && state.GetRejectCode() < REJECT_INTERNAL) { // Never send AcceptToMemoryPool's internal codes over P2P
-                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::REJECT, strCommand, (unsigned char)state.GetRejectCode(),
-                                   state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash));
-            }
-            MaybePunishNode(pfrom->GetId(), state, /*via_compact_block*/ false);
+        if (!job->IsDone()) {
+            g_tx_prevalidator.Submit(job, [connman] { connman->WakeMessageHandler(); });
         }
+        if (job->IsDone() && pfrom->m_prevalidating_txs.empty()) {
+            ProcessTransaction(pfrom, ptx, connman, enable_bip61, job->state.IsValid() ? nullptr : &job->state);
+            return true;
+        }
+        pfrom->m_prevalidating_txs.push_back(std::move(job));
         return true;
     }
 
@@ -3302,6 +3426,14 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
         }
     }
 
+    // Transactions are accepted once pre-validated, in the order received
+    if (!pfrom->m_prevalidating_txs.empty() && pfrom->m_prevalidating_txs.front()->IsDone()) {
+        const std::shared_ptr<CTxPreValidationJob> job = std::move(pfrom->m_prevalidating_txs.front());
+        pfrom->m_prevalidating_txs.pop_front();
+        ProcessTransaction(pfrom, job->tx, connman, m_enable_bip61, job->state.IsValid() ? nullptr : &job->state);
+    }
+    const bool txs_ready = !pfrom->m_prevalidating_txs.empty() && pfrom->m_prevalidating_txs.front()->IsDone();
+
     if (pfrom->fDisconnect)
         return false;
 
@@ -3312,18 +3444,32 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
 
     // Don't bother if send buffer is too full to respond anyway
     if (pfrom->fPauseSend)
-        return false;
+        return txs_ready;
 
     std::list<CNetMessage> msgs;
     {
         LOCK(pfrom->cs_vProcessMsg);
         if (pfrom->vProcessMsg.empty())
-            return false;
+            return txs_ready;
+        // Only more transactions are taken while some are being pre-validated,
+        // so that other messages are handled after the transactions before them.
+        // Blocks don't wait for transactions, and are taken past those queued
+        // after them, but not past anything else.
+        auto next = pfrom->vProcessMsg.begin();
+        if (!pfrom->m_prevalidating_txs.empty()) {
+            while (next != pfrom->vProcessMsg.end() && next->hdr.GetCommand() == NetMsgType::TX)
+                ++next;
+            if (next == pfrom->vProcessMsg.end() || !IsBlockMessage(next->hdr.GetCommand())) {
+                next = pfrom->vProcessMsg.begin();
+                if (pfrom->m_prevalidating_txs.size() >= MAX_PEER_PREVALIDATING_TXS || next->hdr.GetCommand() != NetMsgType::TX)
+                    return txs_ready;
+            }
+        }
         // Just take one message
-        msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
+        msgs.splice(msgs.begin(), pfrom->vProcessMsg, next);
         pfrom->nProcessQueueSize -= msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
         pfrom->fPauseRecv = pfrom->nProcessQueueSize > connman->GetReceiveFloodSize();
-        fMoreWork = !pfrom->vProcessMsg.empty();
+        fMoreWork = !pfrom->vProcessMsg.empty() || txs_ready;
     }
     CNetMessage& msg(msgs.front());
 
@@ -3538,6 +3684,100 @@ public:
 };
 }
 
+void TxAnnouncementOrder::Add(const uint256& txid, int64_t now)
+{
+    LOCK(m_mutex);
+    m_queued.emplace_back(now, txid);
+    m_queue_changed = true;
+}
+
+std::shared_ptr<const TxAnnouncementOrder::Ranking> TxAnnouncementOrder::GetRanking(const CTxMemPool& pool, int64_t now)
+{
+    std::vector<uint256> txids;
+    {
+        LOCK(m_mutex);
+        const unsigned int mempool_updates = pool.GetTransactionsUpdated();
+        if (now < m_ranking_time + RANKING_INTERVAL || (!m_queue_changed && mempool_updates == m_ranking_mempool_updates)) {
+            return m_ranking;
+        }
+        while (!m_queued.empty() && m_queued.front().first < now - RELAY_WINDOW) {
+            m_queued.pop_front();
+        }
+        txids.reserve(m_queued.size());
+        for (const auto& queued : m_queued) {
+            txids.push_back(queued.second);
+        }
+        m_queue_changed = false;
+        m_ranking_time = now;
+        m_ranking_mempool_updates = mempool_updates;
+    }
+
+    // The mempool is locked once for all transactions, without m_mutex held
+    std::vector<TxMempoolInfo> infos = pool.infoSorted(txids);
+    std::shared_ptr<Ranking> ranking = std::make_shared<Ranking>();
+    ranking->reserve(infos.size());
+    for (size_t rank = 0; rank < infos.size(); rank++) {
+        const uint256 txid = infos[rank].tx->GetHash();
+        ranking->emplace(txid, Entry{rank, std::move(infos[rank])});
+    }
+
+    LOCK(m_mutex);
+    // Unless another thread started computing a more recent one meanwhile
+    if (m_ranking_time == now) m_ranking = ranking;
+    return ranking;
+}
+
+std::vector<TxMempoolInfo> PopTxAnnouncements(CTxMemPool& pool, const TxAnnouncementOrder::Ranking& ranking, std::set<uint256>& pending, size_t max_count, const std::function<bool(const TxMempoolInfo&)>& filter)
+{
+    std::vector<std::pair<const TxAnnouncementOrder::Entry*, std::set<uint256>::iterator>> ranked;
+    std::vector<std::set<uint256>::iterator> unranked;
+    ranked.reserve(pending.size());
+    for (std::set<uint256>::iterator it = pending.begin(); it != pending.end(); it++) {
+        auto entry = ranking.find(*it);
+        if (entry != ranking.end()) {
+            ranked.emplace_back(&entry->second, it);
+        } else {
+            unranked.push_back(it);
+        }
+    }
+
+    std::vector<TxMempoolInfo> ret;
+    // A heap is used so that not all items need sorting if only a few are being sent.
+    auto compare_rank = [](const std::pair<const TxAnnouncementOrder::Entry*, std::set<uint256>::iterator>& a,
+                           const std::pair<const TxAnnouncementOrder::Entry*, std::set<uint256>::iterator>& b) {
+        return a.first->rank > b.first->rank;
+    };
+    std::make_heap(ranked.begin(), ranked.end(), compare_rank);
+    while (!ranked.empty() && ret.size() < max_count) {
+        std::pop_heap(ranked.begin(), ranked.end(), compare_rank);
+        const TxMempoolInfo& info = ranked.back().first->info;
+        pending.erase(ranked.back().second);
+        ranked.pop_back();
+        // Not in the mempool anymore? don't bother sending it.
+        if (!pool.exists(info.tx->GetHash()) || !filter(info)) {
+            continue;
+        }
+        ret.push_back(info);
+    }
+    if (!ranked.empty()) return ret;
+
+    // Those queued since the ranking was computed can only follow the ranked ones, and are few
+    CompareInvMempoolOrder compareInvMempoolOrder(&pool);
+    std::make_heap(unranked.begin(), unranked.end(), compareInvMempoolOrder);
+    while (!unranked.empty() && ret.size() < max_count) {
+        std::pop_heap(unranked.begin(), unranked.end(), compareInvMempoolOrder);
+        const uint256 hash = *unranked.back();
+        pending.erase(unranked.back());
+        unranked.pop_back();
+        TxMempoolInfo info = pool.info(hash);
+        if (!info.tx || !filter(info)) {
+            continue;
+        }
+        ret.push_back(std::move(info));
+    }
+    return ret;
+}
+
 bool PeerLogicValidation::SendMessages(CNode* pto)
 {
     const Consensus::Params& consensusParams = Params().GetConsensus();
@@ -3858,49 +4098,33 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
 
                 // Determine transactions to relay
                 if (fSendTrickle) {
-                    // Produce a vector with all candidates for sending
-                    std::vector<std::set<uint256>::iterator> vInvTx;
-                    vInvTx.reserve(pto->m_tx_relay->setInventoryTxToSend.size());
-                    for (std::set<uint256>::iterator it = pto->m_tx_relay->setInventoryTxToSend.begin(); it != pto->m_tx_relay->setInventoryTxToSend.end(); it++) {
-                        vInvTx.push_back(it);
-                    }
                     CAmount filterrate = 0;
                     {
                         LOCK(pto->m_tx_relay->cs_feeFilter);
                         filterrate = pto->m_tx_relay->minFeeFilter;
                     }
-                    // Topologically and fee-rate sort the inventory we send for privacy and priority reasons.
-                    // A heap is used so that not all items need sorting if only a few are being sent.
-                    CompareInvMempoolOrder compareInvMempoolOrder(&mempool);
-                    std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
+                    // Topologically and fee-rate sort the inventory we send for privacy and priority reasons,
+                    // in the order shared by all peers.
+                    const std::shared_ptr<const TxAnnouncementOrder::Ranking> ranking = g_tx_announcement_order.GetRanking(mempool, nNow);
                     // No reason to drain out at many times the network's capacity,
                     // especially since we have many peers and some will draw much shorter delays.
-                    unsigned int nRelayedTransactions = 0;
                     LOCK(pto->m_tx_relay->cs_filter);
-                    while (!vInvTx.empty() && nRelayedTransactions < INVENTORY_BROADCAST_MAX) {
-                        // Fetch the top element from the heap
-                        std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
-                        std::set<uint256>::iterator it = vInvTx.back();
-                        vInvTx.pop_back();
-                        uint256 hash = *it;
-                        // Remove it from the to-be-sent set
-                        pto->m_tx_relay->setInventoryTxToSend.erase(it);
+                    std::vector<TxMempoolInfo> vInvTx = PopTxAnnouncements(mempool, *ranking, pto->m_tx_relay->setInventoryTxToSend, INVENTORY_BROADCAST_MAX, [&](const TxMempoolInfo& txinfo) {
+                        AssertLockHeld(pto->m_tx_relay->cs_tx_inventory);
+                        AssertLockHeld(pto->m_tx_relay->cs_filter);
                         // Check if not in the filter already
-                        if (pto->m_tx_relay->filterInventoryKnown.contains(hash)) {
-                            continue;
-                        }
-                        // Not in the mempool anymore? don't bother sending it.
-                        auto txinfo = mempool.info(hash);
-                        if (!txinfo.tx) {
-                            continue;
+                        if (pto->m_tx_relay->filterInventoryKnown.contains(txinfo.tx->GetHash())) {
+                            return false;
                         }
                         if (filterrate && txinfo.feeRate.GetFeePerK() < filterrate) {
-                            continue;
+                            return false;
                         }
-                        if (pto->m_tx_relay->pfilter && !pto->m_tx_relay->pfilter->IsRelevantAndUpdate(*txinfo.tx)) continue;
+                        return !pto->m_tx_relay->pfilter || pto->m_tx_relay->pfilter->IsRelevantAndUpdate(*txinfo.tx);
+                    });
+                    for (TxMempoolInfo& txinfo : vInvTx) {
+                        const uint256 hash = txinfo.tx->GetHash();
                         // Send
                         vInv.push_back(CInv(MSG_TX, hash));
-                        nRelayedTransactions++;
                         {
                             // Expire old relay messages
                             while (!vRelayExpiration.empty() && vRelayExpiration.front().first < nNow)
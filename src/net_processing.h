@@ -10,6 +10,14 @@
 #include <validationinterface.h>
 #include <consensus/params.h>
 #include <sync.h>
+#include <txmempool.h>
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <vector>
 
 extern CCriticalSection cs_main;
 
@@ -93,4 +101,57 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 /** Relay transaction to every node */
 void RelayTransaction(const uint256&, const CConnman& connman);
 
+/**
+ * The order transactions queued for announcement to peers are announced in:
+ * parents before children, then by ancestor feerate, as CompareDepthAndScore
+ * orders them. It is computed with the mempool locked once per interval and
+ * shared by all peers, whose trickle ticks then order their own pending
+ * announcements by comparing ranks, and check fee filters against cached
+ * feerates, rather than looking up both sides of every comparison in the
+ * mempool.
+ */
+class TxAnnouncementOrder
+{
+public:
+    struct Entry {
+        //! Position in the order
+        size_t rank;
+        TxMempoolInfo info;
+    };
+    typedef std::unordered_map<uint256, Entry, SaltedTxidHasher> Ranking;
+
+    /** Queue a transaction to be ranked, as it is being announced at time now (in microseconds) */
+    void Add(const uint256& txid, int64_t now);
+
+    /**
+     * The ranking of the transactions queued in the last RELAY_WINDOW which
+     * are still in the mempool, computed again first if it is more than
+     * RANKING_INTERVAL old and anything changed meanwhile.
+     */
+    std::shared_ptr<const Ranking> GetRanking(const CTxMemPool& pool, int64_t now);
+
+    //! How long transactions stay queued for ranking (in microseconds), as long as they are kept in mapRelay
+    static constexpr int64_t RELAY_WINDOW = 15 * 60 * 1000000LL;
+    //! How long a ranking is used for (in microseconds) before transactions queued or mempool changes since are taken into account
+    static constexpr int64_t RANKING_INTERVAL = 1000000;
+
+private:
+    Mutex m_mutex;
+    //! Transactions queued, oldest first, with when they were
+    std::deque<std::pair<int64_t, uint256>> m_queued GUARDED_BY(m_mutex);
+    //! Whether anything was queued since the ranking was computed
+    bool m_queue_changed GUARDED_BY(m_mutex){false};
+    std::shared_ptr<const Ranking> m_ranking GUARDED_BY(m_mutex){std::make_shared<const Ranking>()};
+    int64_t m_ranking_time GUARDED_BY(m_mutex){0};
+    unsigned int m_ranking_mempool_updates GUARDED_BY(m_mutex){0};
+};
+
+/**
+ * Remove up to max_count transactions from a peer's pending announcements,
+ * in the order of ranking, and return those still in the mempool which pass
+ * filter. Pending transactions which aren't ranked yet, having been queued
+ * since it was computed, follow the ranked ones in the mempool's order.
+ */
+std::vector<TxMempoolInfo> PopTxAnnouncements(CTxMemPool& pool, const TxAnnouncementOrder::Ranking& ranking, std::set<uint256>& pending, size_t max_count, const std::function<bool(const TxMempoolInfo&)>& filter);
+
 #endif // BITCOIN_NET_PROCESSING_H
@@ -29,6 +29,24 @@ public:
         return Make(0, std::move(sCommand), std::forward<Args>(args)...);
     }
 
+    /** A message with a payload serialized beforehand, which it shares with other messages */
+    static CSerializedNetMsg MakeShared(std::string sCommand, std::shared_ptr<const CSharedNetPayload> payload)
+    {
+        CSerializedNetMsg msg;
+        msg.command = std::move(sCommand);
+        msg.shared = std::move(payload);
+        return msg;
+    }
+
+    /** Serialize a payload once, to be sent to any number of peers */
+    template <typename... Args>
+    std::shared_ptr<const CSharedNetPayload> SerializeShared(int nFlags, Args&&... args) const
+    {
+        std::vector<unsigned char> data;
+        CVectorWriter{ SER_NETWORK, nFlags | nVersion, data, 0, std::forward<Args>(args)... };
+        return MakeSharedNetPayload(std::move(data));
+    }
+
 private:
     const int nVersion;
 };
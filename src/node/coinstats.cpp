@@ -37,41 +37,56 @@ static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash,
     ss << VARINT(0u);
 }
 
+CCoinsStatsAccumulator::CCoinsStatsAccumulator(const uint256& hashBlock) : m_ss(SER_GETHASH, PROTOCOL_VERSION)
+{
+    m_stats.hashBlock = hashBlock;
+    m_ss << hashBlock;
+}
+
+void CCoinsStatsAccumulator::Add(const COutPoint& key, Coin coin)
+{
+    if (!m_outputs.empty() && key.hash != m_prevkey) {
+        ApplyStats(m_stats, m_ss, m_prevkey, m_outputs);
+        m_outputs.clear();
+    }
+    m_prevkey = key.hash;
+    m_outputs[key.n] = std::move(coin);
+}
+
+CCoinsStats CCoinsStatsAccumulator::Finalize()
+{
+    if (!m_outputs.empty()) {
+        ApplyStats(m_stats, m_ss, m_prevkey, m_outputs);
+        m_outputs.clear();
+    }
+    m_stats.hashSerialized = m_ss.GetHash();
+    return m_stats;
+}
+
 //! Calculate statistics about the unspent transaction output set
 bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
 {
     std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
     assert(pcursor);
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = LookupBlockIndex(stats.hashBlock)->nHeight;
-    }
-    ss << stats.hashBlock;
-    uint256 prevkey;
-    std::map<uint32_t, Coin> outputs;
+    const uint256 hashBlock = pcursor->GetBestBlock();
+    CCoinsStatsAccumulator accumulator(hashBlock);
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         COutPoint key;
         Coin coin;
         if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-            if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
-                outputs.clear();
-            }
-            prevkey = key.hash;
-            outputs[key.n] = std::move(coin);
+            accumulator.Add(key, std::move(coin));
         } else {
             return error("%s: unable to read value", __func__);
         }
         pcursor->Next();
     }
-    if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
+    stats = accumulator.Finalize();
+    {
+        LOCK(cs_main);
+        stats.nHeight = LookupBlockIndex(hashBlock)->nHeight;
     }
-    stats.hashSerialized = ss.GetHash();
     stats.nDiskSize = view->EstimateSize();
     return true;
 }
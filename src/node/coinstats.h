@@ -7,11 +7,12 @@
 #define BITCOIN_NODE_COINSTATS_H
 
 #include <amount.h>
+#include <coins.h>
+#include <hash.h>
 #include <uint256.h>
 
 #include <cstdint>
-
-class CCoinsView;
+#include <map>
 
 struct CCoinsStats
 {
@@ -27,6 +28,28 @@ struct CCoinsStats
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
 };
 
+/**
+ * Computes statistics about an unspent transaction output set incrementally,
+ * from its coins given in database order (i.e. grouped by transaction).
+ */
+class CCoinsStatsAccumulator
+{
+private:
+    CCoinsStats m_stats;
+    CHashWriter m_ss;
+    uint256 m_prevkey;
+    std::map<uint32_t, Coin> m_outputs;
+
+public:
+    //! Start the statistics of the set of coins at hashBlock
+    explicit CCoinsStatsAccumulator(const uint256& hashBlock);
+
+    void Add(const COutPoint& key, Coin coin);
+
+    //! Statistics of the coins added so far, including hashSerialized
+    CCoinsStats Finalize();
+};
+
 //! Calculate statistics about the unspent transaction output set
 bool GetUTXOStats(CCoinsView* view, CCoinsStats& stats);
 
@@ -0,0 +1,458 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <node/utxo_snapshot.h>
+
+#include <chain.h>
+#include <chainparams.h>
+#include <coins.h>
+#include <consensus/validation.h>
+#include <node/coinstats.h>
+#include <shutdown.h>
+#include <streams.h>
+#include <txdb.h>
+#include <util/system.h>
+#include <util/threadnames.h>
+#include <util/time.h>
+#include <util/validation.h>
+#include <validation.h>
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <map>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+//! Number of headers accepted at once while loading a snapshot
+static const size_t SNAPSHOT_HEADERS_BATCH = 2000;
+//! Maximum number of threads deserializing the chunks of a snapshot
+static const int MAX_SNAPSHOT_PARSE_THREADS = 4;
+
+namespace {
+
+typedef std::vector<std::pair<COutPoint, Coin>> CoinsChunk;
+
+//! A chunk of coins as stored in a snapshot, along with its position in it
+struct RawChunk {
+    uint64_t seq;
+    std::vector<unsigned char> data;
+};
+
+/**
+ * Chunks handed over, in order, from one thread loading a snapshot to threads
+ * processing them.
+ */
+template <typename T>
+class ChunkQueue
+{
+private:
+    //! Chunks queued ahead of the consumers, bounding memory usage
+    static const size_t MAX_CHUNKS = 16;
+
+    boost::mutex m_mutex;
+    boost::condition_variable m_cond;
+    std::deque<std::shared_ptr<const T>> m_chunks;
+    bool m_closed = false;
+
+public:
+    //! Queue a chunk, waiting for room. Returns false if the consumers gave up.
+    bool Push(std::shared_ptr<const T> chunk)
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        while (!m_closed && m_chunks.size() >= MAX_CHUNKS)
+            m_cond.wait(lock);
+        if (m_closed)
+            return false;
+        m_chunks.push_back(std::move(chunk));
+        m_cond.notify_all();
+        return true;
+    }
+
+    //! Take the next chunk, waiting for one. Returns nullptr once closed and empty.
+    std::shared_ptr<const T> Pop()
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        while (!m_closed && m_chunks.empty())
+            m_cond.wait(lock);
+        if (m_chunks.empty())
+            return nullptr;
+        std::shared_ptr<const T> chunk = std::move(m_chunks.front());
+        m_chunks.pop_front();
+        m_cond.notify_all();
+        return chunk;
+    }
+
+    //! Close the queue, by the producer once all chunks are queued, or by a consumer giving up
+    void Close()
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        m_closed = true;
+        m_cond.notify_all();
+    }
+};
+
+/**
+ * Chunks of coins deserialized by several threads, put back in the order of
+ * the snapshot for a single consumer.
+ */
+class OrderedChunkQueue
+{
+private:
+    //! Chunks deserialized ahead of the consumer, bounding memory usage
+    static const uint64_t MAX_CHUNKS = 16;
+
+    boost::mutex m_mutex;
+    boost::condition_variable m_cond;
+    std::map<uint64_t, std::shared_ptr<const CoinsChunk>> m_chunks;
+    //! Position of the next chunk for the consumer
+    uint64_t m_next = 0;
+    bool m_closed = false;
+
+public:
+    /**
+     * Queue the chunk at position seq, waiting until it is among the next
+     * MAX_CHUNKS ones. The chunk at the next position never waits, so that
+     * the consumer always gets to make progress. Returns false if the
+     * consumer gave up.
+     */
+    bool Push(uint64_t seq, std::shared_ptr<const CoinsChunk> chunk)
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        while (!m_closed && seq >= m_next + MAX_CHUNKS)
+            m_cond.wait(lock);
+        if (m_closed)
+            return false;
+        m_chunks.emplace(seq, std::move(chunk));
+        m_cond.notify_all();
+        return true;
+    }
+
+    //! Take the next chunk in order, waiting for it. Returns nullptr once closed without it.
+    std::shared_ptr<const CoinsChunk> Pop()
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        while (!m_closed && (m_chunks.empty() || m_chunks.begin()->first != m_next))
+            m_cond.wait(lock);
+        if (m_chunks.empty() || m_chunks.begin()->first != m_next)
+            return nullptr;
+        std::shared_ptr<const CoinsChunk> chunk = std::move(m_chunks.begin()->second);
+        m_chunks.erase(m_chunks.begin());
+        m_next++;
+        m_cond.notify_all();
+        return chunk;
+    }
+
+    //! Close the queue, once all chunks are queued, or by the consumer giving up
+    void Close()
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        m_closed = true;
+        m_cond.notify_all();
+    }
+};
+
+} // namespace
+
+bool WriteSnapshotCoins(CAutoFile& file, CCoinsViewCursor& cursor, CCoinsStats& stats)
+{
+    CCoinsStatsAccumulator accumulator(cursor.GetBestBlock());
+    CoinsChunk chunk;
+    chunk.reserve(SNAPSHOT_CHUNK_COINS);
+    std::vector<unsigned char> data;
+    // Chunks are written as byte vectors, which can be deserialized apart
+    // from the file they are read from
+    auto write_chunk = [&] {
+        data.clear();
+        CVectorWriter(file.GetType(), file.GetVersion(), data, 0, chunk);
+        file << data;
+        chunk.clear();
+    };
+    while (cursor.Valid()) {
+        if (ShutdownRequested())
+            return false;
+        COutPoint key;
+        Coin coin;
+        if (!cursor.GetKey(key) || !cursor.GetValue(coin))
+            return error("%s: unable to read value", __func__);
+        accumulator.Add(key, coin);
+        chunk.emplace_back(key, std::move(coin));
+        if (chunk.size() == SNAPSHOT_CHUNK_COINS)
+            write_chunk();
+        cursor.Next();
+    }
+    if (!chunk.empty())
+        write_chunk();
+    // An empty chunk ends the coins
+    data.clear();
+    file << data;
+
+    stats = accumulator.Finalize();
+    file << stats.nTransactionOutputs;
+    file << stats.hashSerialized;
+    return true;
+}
+
+bool LoadSnapshotCoins(CAutoFile& file, CCoinsViewDB& db, const uint256& base_blockhash, CCoinsStats& stats, std::string& error)
+{
+    ChunkQueue<RawChunk> parse_queue;
+    OrderedChunkQueue hash_queue;
+    ChunkQueue<CoinsChunk> write_queue;
+
+    boost::mutex parse_mutex;
+    std::string parse_error;
+    int parsers_running = std::max(1, std::min(GetNumCores() - 1, MAX_SNAPSHOT_PARSE_THREADS));
+    std::vector<std::thread> parsers;
+    for (int i = parsers_running; i > 0; i--) {
+        parsers.emplace_back([&] {
+            util::ThreadRename("loadutxoparse");
+            while (std::shared_ptr<const RawChunk> raw = parse_queue.Pop()) {
+                std::shared_ptr<CoinsChunk> chunk = std::make_shared<CoinsChunk>();
+                try {
+                    SpanReader reader(file.GetType(), file.GetVersion(), Span<const unsigned char>(raw->data.data(), raw->data.size()));
+                    reader >> *chunk;
+                    if (chunk->empty() || !reader.empty())
+                        throw std::ios_base::failure("malformed chunk");
+                } catch (const std::exception& e) {
+                    boost::unique_lock<boost::mutex> lock(parse_mutex);
+                    if (parse_error.empty())
+                        parse_error = strprintf("Unable to read the coins of the snapshot: %s", e.what());
+                    parse_queue.Close();
+                    hash_queue.Close();
+                    break;
+                }
+                if (!hash_queue.Push(raw->seq, chunk))
+                    break;
+            }
+            // The last parser out lets the hasher know no more chunks come
+            boost::unique_lock<boost::mutex> lock(parse_mutex);
+            if (--parsers_running == 0)
+                hash_queue.Close();
+        });
+    }
+
+    CCoinsStatsAccumulator accumulator(base_blockhash);
+    std::thread hasher([&] {
+        util::ThreadRename("loadutxohash");
+        while (std::shared_ptr<const CoinsChunk> chunk = hash_queue.Pop()) {
+            for (const auto& coin : *chunk)
+                accumulator.Add(coin.first, coin.second);
+            if (!write_queue.Push(chunk))
+                break;
+        }
+        // Chunks left over can't be written in order anymore
+        hash_queue.Close();
+        parse_queue.Close();
+        write_queue.Close();
+    });
+
+    bool write_ok = true;
+    std::thread writer([&] {
+        util::ThreadRename("loadutxowrite");
+        try {
+            while (std::shared_ptr<const CoinsChunk> chunk = write_queue.Pop()) {
+                if (!db.LoadCoins(*chunk)) {
+                    write_ok = false;
+                    break;
+                }
+            }
+        } catch (const std::exception& e) {
+            LogPrintf("Error writing to coin database: %s\n", e.what());
+            write_ok = false;
+        }
+        if (!write_ok) {
+            write_queue.Close();
+            hash_queue.Close();
+            parse_queue.Close();
+        }
+    });
+
+    const int64_t start = GetTimeMillis();
+    uint64_t chunks_read = 0;
+    uint64_t coins_count = 0;
+    uint256 hash_serialized;
+    bool read_ok = false;
+    try {
+        while (true) {
+            std::shared_ptr<RawChunk> raw = std::make_shared<RawChunk>();
+            raw->seq = chunks_read;
+            file >> raw->data;
+            if (raw->data.empty()) {
+                file >> coins_count;
+                file >> hash_serialized;
+                read_ok = true;
+                break;
+            }
+            chunks_read++;
+            if (!parse_queue.Push(raw))
+                break;
+            if (ShutdownRequested()) {
+                error = "Shutdown requested";
+                break;
+            }
+            if (chunks_read % 100 == 0) {
+                LogPrintf("Read %u chunks of coins from the UTXO snapshot (%.1f MiB/s)\n", chunks_read,
+                          ftell(file.Get()) * (1000.0 / 1048576.0) / std::max<int64_t>(GetTimeMillis() - start, 1));
+            }
+        }
+    } catch (const std::exception& e) {
+        error = strprintf("Unable to read the coins of the snapshot: %s", e.what());
+    }
+
+    parse_queue.Close();
+    for (std::thread& parser : parsers)
+        parser.join();
+    hasher.join();
+    writer.join();
+
+    if (!write_ok) {
+        error = "Unable to write to the coin database";
+        return false;
+    }
+    if (!parse_error.empty()) {
+        error = parse_error;
+        return false;
+    }
+    if (!read_ok)
+        return false;
+
+    stats = accumulator.Finalize();
+    if (stats.nTransactionOutputs != coins_count) {
+        error = strprintf("The snapshot should have %u coins, but %u were read", coins_count, stats.nTransactionOutputs);
+        return false;
+    }
+    if (stats.hashSerialized != hash_serialized) {
+        error = strprintf("The snapshot hash is %s, but its coins hash to %s", hash_serialized.GetHex(), stats.hashSerialized.GetHex());
+        return false;
+    }
+    return true;
+}
+
+bool DumpUTXOSnapshot(CAutoFile& file, SnapshotMetadata& metadata, CCoinsStats& stats, std::string& error)
+{
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    std::vector<const CBlockIndex*> headers;
+    {
+        // Flushing under cs_main makes sure no other flush writes to the
+        // database until the cursor is created
+        LOCK(cs_main);
+        ::ChainstateActive().ForceFlushStateToDisk();
+        pcursor.reset(::ChainstateActive().CoinsDB().Cursor());
+
+        const CBlockIndex* pindex = LookupBlockIndex(pcursor->GetBestBlock());
+        if (!pindex || pindex->nHeight == 0) {
+            error = "The UTXO set is not at a block after the genesis block";
+            return false;
+        }
+        metadata.base_blockhash = pindex->GetBlockHash();
+        metadata.base_height = pindex->nHeight;
+        metadata.base_chain_tx = pindex->nChainTx;
+
+        // Block index entries are never deleted, and their headers don't change
+        headers.resize(pindex->nHeight);
+        for (; pindex->pprev; pindex = pindex->pprev)
+            headers[pindex->nHeight - 1] = pindex;
+    }
+
+    file << metadata;
+    for (const CBlockIndex* pindex : headers)
+        file << pindex->GetBlockHeader();
+    if (!WriteSnapshotCoins(file, *pcursor, stats)) {
+        error = "Unable to read the UTXO set";
+        return false;
+    }
+    return true;
+}
+
+bool LoadUTXOSnapshot(const fs::path& path, const uint256& expected_hash, const CChainParams& chainparams, std::string& error)
+{
+    AssertLockHeld(cs_main);
+    CChainState& chainstate = ::ChainstateActive();
+    CCoinsViewDB& db = chainstate.CoinsDB();
+    assert(db.GetBestBlock().IsNull());
+
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        error = strprintf("Unable to open %s", path.string());
+        return false;
+    }
+
+    const int64_t start = GetTimeMillis();
+    uint256 trusted_hash = expected_hash;
+    SnapshotMetadata metadata;
+    CBlockIndex* pindex = nullptr;
+    try {
+        file >> metadata;
+        if (metadata.nMagic != SnapshotMetadata::MAGIC || metadata.nVersion != SnapshotMetadata::VERSION) {
+            error = strprintf("%s is not a UTXO snapshot of a supported version", path.string());
+            return false;
+        }
+        if (metadata.base_height <= 0 || metadata.base_chain_tx == 0 || metadata.base_chain_tx > std::numeric_limits<unsigned int>::max()) {
+            error = "Invalid snapshot metadata";
+            return false;
+        }
+        if (trusted_hash.IsNull()) {
+            const auto it = chainparams.SnapshotHashes().find(metadata.base_blockhash);
+            if (it == chainparams.SnapshotHashes().end()) {
+                error = strprintf("No trusted hash for a snapshot at block %s: set -loadutxosnapshothash to the hash_serialized_2 of a trusted node at that block", metadata.base_blockhash.ToString());
+                return false;
+            }
+            trusted_hash = it->second;
+        }
+        LogPrintf("Loading UTXO snapshot %s at block %s (height %d)\n", path.string(), metadata.base_blockhash.ToString(), metadata.base_height);
+
+        std::vector<CBlockHeader> headers;
+        for (int height = 1; height <= metadata.base_height; height += headers.size()) {
+            headers.resize(std::min<size_t>(SNAPSHOT_HEADERS_BATCH, metadata.base_height - height + 1));
+            for (CBlockHeader& header : headers)
+                file >> header;
+            CValidationState state;
+            if (!chainstate.AcceptSnapshotHeaders(headers, state, chainparams, &pindex)) {
+                error = strprintf("Invalid block header in the snapshot: %s", FormatStateMessage(state));
+                return false;
+            }
+        }
+    } catch (const std::exception& e) {
+        error = strprintf("Unable to read the snapshot headers: %s", e.what());
+        return false;
+    }
+    if (!pindex || pindex->GetBlockHash() != metadata.base_blockhash || pindex->nHeight != metadata.base_height) {
+        error = "The snapshot headers don't lead to its base block";
+        return false;
+    }
+
+    // Coins of an interrupted load have to go, and so do coins of a failed one
+    CCoinsStats stats;
+    if (!db.WipeCoins()) {
+        error = "Unable to write to the coin database";
+        return false;
+    }
+    if (!LoadSnapshotCoins(file, db, metadata.base_blockhash, stats, error) ||
+        stats.hashSerialized != trusted_hash) {
+        if (error.empty())
+            error = strprintf("The snapshot hash is %s, but %s was expected", stats.hashSerialized.GetHex(), trusted_hash.GetHex());
+        db.WipeCoins();
+        return false;
+    }
+
+    if (!chainstate.ActivateSnapshotBase(pindex, metadata.base_chain_tx)) {
+        error = "Unable to write to the block index database";
+        return false;
+    }
+    // Only now does the coins database become usable
+    CCoinsMap no_coins;
+    if (!db.BatchWrite(no_coins, metadata.base_blockhash)) {
+        error = "Unable to write to the coin database";
+        return false;
+    }
+
+    LogPrintf("Loaded UTXO snapshot: %u coins, hash %s, in %.2fs\n", stats.nTransactionOutputs,
+              stats.hashSerialized.ToString(), (GetTimeMillis() - start) * 0.001);
+    return true;
+}
@@ -0,0 +1,101 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NODE_UTXO_SNAPSHOT_H
+#define BITCOIN_NODE_UTXO_SNAPSHOT_H
+
+#include <fs.h>
+#include <serialize.h>
+#include <uint256.h>
+
+#include <stdint.h>
+#include <string>
+
+class CAutoFile;
+class CChainParams;
+class CCoinsViewCursor;
+class CCoinsViewDB;
+struct CCoinsStats;
+
+//! Number of coins per chunk of a UTXO snapshot file
+static const size_t SNAPSHOT_CHUNK_COINS = 16384;
+
+/**
+ * Metadata at the start of a UTXO snapshot file.
+ *
+ * A snapshot file holds, in this order:
+ * - this metadata;
+ * - the headers of the blocks after the genesis block, up to the base block;
+ * - the coins of the UTXO set at the base block, in database order, as
+ *   chunks of up to SNAPSHOT_CHUNK_COINS coins, each serialized in a byte
+ *   vector of its own, ended by an empty vector;
+ * - the number of coins, and the hash of the UTXO set as computed by
+ *   GetUTXOStats (hash_serialized_2 in gettxoutsetinfo).
+ */
+class SnapshotMetadata
+{
+public:
+    static const uint32_t MAGIC = 0x4f585455; // "UTXO"
+    static const uint32_t VERSION = 2;
+
+    uint32_t nMagic = MAGIC;
+    uint32_t nVersion = VERSION;
+    //! Block the UTXO set is at
+    uint256 base_blockhash;
+    int base_height = 0;
+    //! Number of transactions in the chain up to the base block
+    uint64_t base_chain_tx = 0;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nMagic);
+        READWRITE(nVersion);
+        READWRITE(base_blockhash);
+        READWRITE(base_height);
+        READWRITE(base_chain_tx);
+    }
+};
+
+/**
+ * Write the coins of a cursor to a snapshot file, from the chunks to the hash.
+ * @param[out] stats  Statistics of the coins written, including hashSerialized.
+ */
+bool WriteSnapshotCoins(CAutoFile& file, CCoinsViewCursor& cursor, CCoinsStats& stats);
+
+/**
+ * Read the coins of a snapshot file, from the chunks to the hash, into a coins
+ * database without coins, leaving its best block untouched.
+ *
+ * Chunks are read by the calling thread and deserialized by several threads,
+ * then hashed and written to the database in order, each on a thread of its
+ * own, so that loading goes at the speed of the slowest stage.
+ *
+ * @param[out] stats  Statistics of the coins read, checked against the end of the file.
+ * @param[out] error  Reason of a failure.
+ */
+bool LoadSnapshotCoins(CAutoFile& file, CCoinsViewDB& db, const uint256& base_blockhash, CCoinsStats& stats, std::string& error);
+
+/**
+ * Write a snapshot of the UTXO set at the tip of the active chainstate, once
+ * flushed to the coins database, to a file.
+ */
+bool DumpUTXOSnapshot(CAutoFile& file, SnapshotMetadata& metadata, CCoinsStats& stats, std::string& error);
+
+/**
+ * Load a snapshot file into the active chainstate, whose coins database must
+ * have no best block yet. Its headers are added to the block index, its coins
+ * are loaded and checked against its hash and a trusted one, and the base
+ * block becomes the best block of the coins database.
+ *
+ * The trusted hash is expected_hash if not null, or else the one of the chain
+ * parameters for the base block. A snapshot without a trusted hash is refused,
+ * as the hash it carries only guards against corruption.
+ *
+ * Called during startup, with cs_main held.
+ */
+bool LoadUTXOSnapshot(const fs::path& path, const uint256& expected_hash, const CChainParams& chainparams, std::string& error);
+
+#endif // BITCOIN_NODE_UTXO_SNAPSHOT_H
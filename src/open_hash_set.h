@@ -115,6 +115,7 @@ public:
     }
 
     size_type size() const { return m_count; }
+    size_type bucket_count() const { return m_table.size(); }
 };
 
 #endif // BITCOIN_OPEN_HASH_SET_H
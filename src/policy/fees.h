@@ -11,6 +11,7 @@
 #include <random.h>
 #include <sync.h>
 
+#include <atomic>
 #include <map>
 #include <memory>
 #include <string>
@@ -254,16 +255,52 @@ private:
     /** Process a transaction confirmed in a block*/
     bool processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry* entry) EXCLUSIVE_LOCKS_REQUIRED(m_cs_fee_estimator);
 
-    /** Helper for estimateSmartFee */
-    double estimateCombinedFee(unsigned int confTarget, double successThreshold, bool checkShorterHorizon, EstimationResult *result) const EXCLUSIVE_LOCKS_REQUIRED(m_cs_fee_estimator);
-    /** Helper for estimateSmartFee */
-    double estimateConservativeFee(unsigned int doubleTarget, EstimationResult *result) const EXCLUSIVE_LOCKS_REQUIRED(m_cs_fee_estimator);
-    /** Number of blocks of data recorded while fee estimates have been running */
-    unsigned int BlockSpan() const EXCLUSIVE_LOCKS_REQUIRED(m_cs_fee_estimator);
-    /** Number of blocks of recorded fee estimate data represented in saved data file */
-    unsigned int HistoricalBlockSpan() const EXCLUSIVE_LOCKS_REQUIRED(m_cs_fee_estimator);
-    /** Calculation of highest target that reasonable estimate can be provided for */
-    unsigned int MaxUsableEstimate() const EXCLUSIVE_LOCKS_REQUIRED(m_cs_fee_estimator);
+    /**
+     * A copy of the data estimates are calculated from, which doesn't change
+     * once made. Estimates are calculated from the latest one without
+     * m_cs_fee_estimator, so that they neither hold up nor wait for the
+     * mempool and block connection updating the data.
+     */
+    struct Snapshot
+    {
+        std::vector<double> buckets;
+        std::map<double, unsigned int> bucketMap;
+        std::unique_ptr<const TxConfirmStats> feeStats;
+        std::unique_ptr<const TxConfirmStats> shortStats;
+        std::unique_ptr<const TxConfirmStats> longStats;
+        unsigned int nBestSeenHeight;
+        unsigned int firstRecordedHeight;
+        unsigned int historicalFirst;
+        unsigned int historicalBest;
+
+        ~Snapshot();
+
+        /** Helper for estimateSmartFee */
+        double estimateCombinedFee(unsigned int confTarget, double successThreshold, bool checkShorterHorizon, EstimationResult *result) const;
+        /** Helper for estimateSmartFee */
+        double estimateConservativeFee(unsigned int doubleTarget, EstimationResult *result) const;
+        /** Number of blocks of data recorded while fee estimates have been running */
+        unsigned int BlockSpan() const;
+        /** Number of blocks of recorded fee estimate data represented in saved data file */
+        unsigned int HistoricalBlockSpan() const;
+        /** Calculation of highest target that reasonable estimate can be provided for */
+        unsigned int MaxUsableEstimate() const;
+    };
+
+    mutable Mutex m_snapshot_mutex;
+    mutable std::shared_ptr<const Snapshot> m_snapshot GUARDED_BY(m_snapshot_mutex);
+    /**
+     * Whether the data changed in a way estimates can tell since m_snapshot
+     * was made. Transactions entering the mempool only count towards
+     * estimates once a block is in, so this is only set by blocks and by
+     * transactions leaving the mempool a block or more after entering it.
+     */
+    mutable std::atomic<bool> m_snapshot_stale{true};
+
+    /** Replace m_snapshot with a copy of the data as it is now */
+    std::shared_ptr<const Snapshot> PublishSnapshot() const EXCLUSIVE_LOCKS_REQUIRED(m_cs_fee_estimator);
+    /** The latest snapshot, made first if the data changed since */
+    std::shared_ptr<const Snapshot> GetSnapshot() const;
 };
 
 class FeeFilterRounder
@@ -77,6 +77,8 @@ public:
 
     // memory only
     mutable bool fChecked;
+    //! Legacy sigop count of each transaction, recorded along with fChecked
+    mutable std::vector<unsigned int> vTxLegacySigOps;
 
     CBlock()
     {
@@ -102,6 +104,7 @@ public:
         CBlockHeader::SetNull();
         vtx.clear();
         fChecked = false;
+        vTxLegacySigOps.clear();
     }
 
     CBlockHeader GetBlockHeader() const
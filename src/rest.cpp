@@ -7,8 +7,10 @@
 #include <chain.h>
 #include <chainparams.h>
 #include <core_io.h>
+#include <httprpc.h>
 #include <httpserver.h>
 #include <index/txindex.h>
+#include <jsonwriter.h>
 #include <primitives/block.h>
 #include <primitives/transaction.h>
 #include <rpc/blockchain.h>
@@ -243,11 +245,11 @@ static bool rest_block(HTTPRequest* req,
     }
 
     case RetFormat::JSON: {
-        UniValue objBlock = blockToJSON(block, tip, pblockindex, showTxDetails);
-        std::string strJSON = objBlock.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
-        return true;
+        return WriteJSONReply(req, HTTP_OK, [&](JSONWriter& objBlock) {
+            objBlock.BeginObject();
+            blockToJSON(objBlock, block, tip, pblockindex, showTxDetails);
+            objBlock.EndObject();
+        });
     }
 
     default: {
@@ -323,12 +325,11 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
 
     switch (rf) {
     case RetFormat::JSON: {
-        UniValue mempoolObject = MempoolToJSON(::mempool, true);
-
-        std::string strJSON = mempoolObject.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
-        return true;
+        return WriteJSONReply(req, HTTP_OK, [](JSONWriter& mempoolObject) {
+            mempoolObject.BeginObject();
+            MempoolToJSON(mempoolObject, ::mempool);
+            mempoolObject.EndObject();
+        });
     }
     default: {
         return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
@@ -378,12 +379,11 @@ static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
     }
 
     case RetFormat::JSON: {
-        UniValue objTx(UniValue::VOBJ);
-        TxToUniv(*tx, hashBlock, objTx);
-        std::string strJSON = objTx.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
-        return true;
+        return WriteJSONReply(req, HTTP_OK, [&](JSONWriter& objTx) {
+            objTx.BeginObject();
+            TxToUniv(*tx, hashBlock, objTx);
+            objTx.EndObject();
+        });
     }
 
     default: {
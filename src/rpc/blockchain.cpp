@@ -11,10 +11,12 @@
 #include <chainparams.h>
 #include <coins.h>
 #include <node/coinstats.h>
+#include <node/utxo_snapshot.h>
 #include <consensus/validation.h>
 #include <core_io.h>
 #include <hash.h>
 #include <index/blockfilterindex.h>
+#include <jsonwriter.h>
 #include <policy/feerate.h>
 #include <policy/policy.h>
 #include <policy/rbf.h>
@@ -122,48 +124,55 @@ UniValue blockheaderToJSON(const CBlockIndex* tip, const CBlockIndex* blockindex
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* tip, const CBlockIndex* blockindex, bool txDetails)
+void blockToJSON(JSONWriter& result, const CBlock& block, const CBlockIndex* tip, const CBlockIndex* blockindex, bool txDetails)
 {
     // Serialize passed information without accessing chain state of the active chain!
     AssertLockNotHeld(cs_main); // For performance reasons
 
-    UniValue result(UniValue::VOBJ);
-    result.pushKV("hash", blockindex->GetBlockHash().GetHex());
+    result.PushKV("hash", blockindex->GetBlockHash().GetHex());
     const CBlockIndex* pnext;
     int confirmations = ComputeNextBlockAndDepth(tip, blockindex, pnext);
-    result.pushKV("confirmations", confirmations);
-    result.pushKV("strippedsize", (int)::GetSerializeSize(block, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS));
-    result.pushKV("size", (int)::GetSerializeSize(block, PROTOCOL_VERSION));
-    result.pushKV("weight", (int)::GetBlockWeight(block));
-    result.pushKV("height", blockindex->nHeight);
-    result.pushKV("version", block.nVersion);
-    result.pushKV("versionHex", strprintf("%08x", block.nVersion));
-    result.pushKV("merkleroot", block.hashMerkleRoot.GetHex());
-    UniValue txs(UniValue::VARR);
+    result.PushKV("confirmations", confirmations);
+    result.PushKV("strippedsize", (int)::GetSerializeSize(block, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS));
+    result.PushKV("size", (int)::GetSerializeSize(block, PROTOCOL_VERSION));
+    result.PushKV("weight", (int)::GetBlockWeight(block));
+    result.PushKV("height", blockindex->nHeight);
+    result.PushKV("version", block.nVersion);
+    result.PushKV("versionHex", strprintf("%08x", block.nVersion));
+    result.PushKV("merkleroot", block.hashMerkleRoot.GetHex());
+    result.Key("tx");
+    result.BeginArray();
     for(const auto& tx : block.vtx)
     {
         if(txDetails)
         {
-            UniValue objTx(UniValue::VOBJ);
-            TxToUniv(*tx, uint256(), objTx, true, RPCSerializationFlags());
-            txs.push_back(objTx);
+            result.BeginObject();
+            TxToUniv(*tx, uint256(), result, true, RPCSerializationFlags());
+            result.EndObject();
         }
         else
-            txs.push_back(tx->GetHash().GetHex());
+            result.String(tx->GetHash().GetHex());
     }
-    result.pushKV("tx", txs);
-    result.pushKV("time", block.GetBlockTime());
-    result.pushKV("mediantime", (int64_t)blockindex->GetMedianTimePast());
-    result.pushKV("nonce", (uint64_t)block.nNonce);
-    result.pushKV("bits", strprintf("%08x", block.nBits));
-    result.pushKV("difficulty", GetDifficulty(blockindex));
-    result.pushKV("chainwork", blockindex->nChainWork.GetHex());
-    result.pushKV("nTx", (uint64_t)blockindex->nTx);
+    result.EndArray();
+    result.PushKV("time", block.GetBlockTime());
+    result.PushKV("mediantime", (int64_t)blockindex->GetMedianTimePast());
+    result.PushKV("nonce", (uint64_t)block.nNonce);
+    result.PushKV("bits", strprintf("%08x", block.nBits));
+    result.PushKV("difficulty", GetDifficulty(blockindex));
+    result.PushKV("chainwork", blockindex->nChainWork.GetHex());
+    result.PushKV("nTx", (uint64_t)blockindex->nTx);
 
     if (blockindex->pprev)
-        result.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
+        result.PushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
     if (pnext)
-        result.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
+        result.PushKV("nextblockhash", pnext->GetBlockHash().GetHex());
+}
+
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* tip, const CBlockIndex* blockindex, bool txDetails)
+{
+    UniValue result(UniValue::VOBJ);
+    UniValueWriter writer(result);
+    blockToJSON(writer, block, tip, blockindex, txDetails);
     return result;
 }
 
@@ -405,31 +414,32 @@ static std::string EntryDescriptionString()
            "    \"bip125-replaceable\" : true|false,  (boolean) Whether this transaction could be replaced due to BIP125 (replace-by-fee)\n";
 }
 
-static void entryToJSON(const CTxMemPool& pool, UniValue& info, const CTxMemPoolEntry& e) EXCLUSIVE_LOCKS_REQUIRED(pool.cs)
+static void entryToJSON(const CTxMemPool& pool, JSONWriter& info, const CTxMemPoolEntry& e) EXCLUSIVE_LOCKS_REQUIRED(pool.cs)
 {
     AssertLockHeld(pool.cs);
 
-    UniValue fees(UniValue::VOBJ);
-    fees.pushKV("base", ValueFromAmount(e.GetFee()));
-    fees.pushKV("modified", ValueFromAmount(e.GetModifiedFee()));
-    fees.pushKV("ancestor", ValueFromAmount(e.GetModFeesWithAncestors()));
-    fees.pushKV("descendant", ValueFromAmount(e.GetModFeesWithDescendants()));
-    info.pushKV("fees", fees);
-
-    info.pushKV("vsize", (int)e.GetTxSize());
-    if (IsDeprecatedRPCEnabled("size")) info.pushKV("size", (int)e.GetTxSize());
-    info.pushKV("weight", (int)e.GetTxWeight());
-    info.pushKV("fee", ValueFromAmount(e.GetFee()));
-    info.pushKV("modifiedfee", ValueFromAmount(e.GetModifiedFee()));
-    info.pushKV("time", e.GetTime());
-    info.pushKV("height", (int)e.GetHeight());
-    info.pushKV("descendantcount", e.GetCountWithDescendants());
-    info.pushKV("descendantsize", e.GetSizeWithDescendants());
-    info.pushKV("descendantfees", e.GetModFeesWithDescendants());
-    info.pushKV("ancestorcount", e.GetCountWithAncestors());
-    info.pushKV("ancestorsize", e.GetSizeWithAncestors());
-    info.pushKV("ancestorfees", e.GetModFeesWithAncestors());
-    info.pushKV("wtxid", mempool.vTxHashes[e.vTxHashesIdx].ToString());
+    info.Key("fees");
+    info.BeginObject();
+    info.PushKV("base", ValueFromAmount(e.GetFee()));
+    info.PushKV("modified", ValueFromAmount(e.GetModifiedFee()));
+    info.PushKV("ancestor", ValueFromAmount(e.GetModFeesWithAncestors()));
+    info.PushKV("descendant", ValueFromAmount(e.GetModFeesWithDescendants()));
+    info.EndObject();
+
+    info.PushKV("vsize", (int)e.GetTxSize());
+    if (IsDeprecatedRPCEnabled("size")) info.PushKV("size", (int)e.GetTxSize());
+    info.PushKV("weight", (int)e.GetTxWeight());
+    info.PushKV("fee", ValueFromAmount(e.GetFee()));
+    info.PushKV("modifiedfee", ValueFromAmount(e.GetModifiedFee()));
+    info.PushKV("time", e.GetTime());
+    info.PushKV("height", (int)e.GetHeight());
+    info.PushKV("descendantcount", e.GetCountWithDescendants());
+    info.PushKV("descendantsize", e.GetSizeWithDescendants());
+    info.PushKV("descendantfees", e.GetModFeesWithDescendants());
+    info.PushKV("ancestorcount", e.GetCountWithAncestors());
+    info.PushKV("ancestorsize", e.GetSizeWithAncestors());
+    info.PushKV("ancestorfees", e.GetModFeesWithAncestors());
+    info.PushKV("wtxid", mempool.vTxHashes[e.vTxHashesIdx].ToString());
     const CTransaction& tx = e.GetTx();
     std::set<std::string> setDepends;
     for (const CTxIn& txin : tx.vin)
@@ -438,22 +448,22 @@ static void entryToJSON(const CTxMemPool& pool, UniValue& info, const CTxMemPool
             setDepends.insert(txin.prevout.hash.ToString());
     }
 
-    UniValue depends(UniValue::VARR);
+    info.Key("depends");
+    info.BeginArray();
     for (const std::string& dep : setDepends)
     {
-        depends.push_back(dep);
+        info.String(dep);
     }
+    info.EndArray();
 
-    info.pushKV("depends", depends);
-
-    UniValue spent(UniValue::VARR);
+    info.Key("spentby");
+    info.BeginArray();
     const CTxMemPool::txiter& it = pool.mapTx.find(tx.GetHash());
     const CTxMemPool::setEntries& setChildren = pool.GetMemPoolChildren(it);
     for (CTxMemPool::txiter childiter : setChildren) {
-        spent.push_back(childiter->GetTx().GetHash().ToString());
+        info.String(childiter->GetTx().GetHash().ToString());
     }
-
-    info.pushKV("spentby", spent);
+    info.EndArray();
 
     // Add opt-in RBF status
     bool rbfStatus = false;
@@ -464,23 +474,34 @@ static void entryToJSON(const CTxMemPool& pool, UniValue& info, const CTxMemPool
         rbfStatus = true;
     }
 
-    info.pushKV("bip125-replaceable", rbfStatus);
+    info.PushKV("bip125-replaceable", rbfStatus);
+}
+
+static void entryToJSON(const CTxMemPool& pool, UniValue& info, const CTxMemPoolEntry& e) EXCLUSIVE_LOCKS_REQUIRED(pool.cs)
+{
+    UniValueWriter writer(info);
+    entryToJSON(pool, writer, e);
+}
+
+void MempoolToJSON(JSONWriter& o, const CTxMemPool& pool)
+{
+    LOCK(pool.cs);
+    for (const CTxMemPoolEntry& e : pool.mapTx) {
+        o.Key(e.GetTx().GetHash().ToString());
+        o.BeginObject();
+        entryToJSON(pool, o, e);
+        o.EndObject();
+    }
 }
 
 UniValue MempoolToJSON(const CTxMemPool& pool, bool verbose)
 {
     if (verbose) {
-        LOCK(pool.cs);
-        UniValue o(UniValue::VOBJ);
-        for (const CTxMemPoolEntry& e : pool.mapTx) {
-            const uint256& hash = e.GetTx().GetHash();
-            UniValue info(UniValue::VOBJ);
-            entryToJSON(pool, info, e);
-            // Mempool has unique entries so there is no advantage in using
-            // UniValue::pushKV, which checks if the key already exists in O(N).
-            // UniValue::__pushKV is used instead which currently is O(1).
-            o.__pushKV(hash.ToString(), info);
-        }
+        UniValue o;
+        UniValueWriter writer(o);
+        writer.BeginObject();
+        MempoolToJSON(writer, pool);
+        writer.EndObject();
         return o;
     } else {
         std::vector<uint256> vtxid;
@@ -524,6 +545,14 @@ static UniValue getrawmempool(const JSONRPCRequest& request)
     if (!request.params[0].isNull())
         fVerbose = request.params[0].get_bool();
 
+    if (fVerbose && request.StreamResult([](JSONWriter& result) {
+            result.BeginObject();
+            MempoolToJSON(result, ::mempool);
+            result.EndObject();
+        })) {
+        return NullUniValue;
+    }
+
     return MempoolToJSON(::mempool, fVerbose);
 }
 
@@ -910,7 +939,20 @@ static UniValue getblock(const JSONRPCRequest& request)
         return strHex;
     }
 
-    return blockToJSON(block, tip, pblockindex, verbosity >= 2);
+    if (verbosity >= 2) {
+        // Verbose blocks run to hundreds of megabytes as a UniValue
+        auto pblock = std::make_shared<const CBlock>(std::move(block));
+        if (request.StreamResult([pblock, tip, pblockindex](JSONWriter& result) {
+                result.BeginObject();
+                blockToJSON(result, *pblock, tip, pblockindex, true);
+                result.EndObject();
+            })) {
+            return NullUniValue;
+        }
+        return blockToJSON(*pblock, tip, pblockindex, true);
+    }
+
+    return blockToJSON(block, tip, pblockindex, false);
 }
 
 float blockMetrics(const CBlock& block)
@@ -2239,6 +2281,66 @@ static UniValue savemempool(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
+static UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+            RPCHelpMan{"dumptxoutset",
+                "\nWrites the UTXO set at the tip of the chain to a snapshot file, along with the block headers up to it.\n"
+                "A new node can be bootstrapped from it with -loadutxosnapshot.\n"
+                "Note this call may take some time.\n",
+                {
+                    {"path", RPCArg::Type::STR, RPCArg::Optional::NO, "Path of the snapshot file. If relative, will be prefixed by datadir."},
+                },
+                RPCResult{
+            "{\n"
+            "  \"coins_written\": n,       (numeric) The number of coins written to the snapshot\n"
+            "  \"base_hash\": \"hex\",     (string) The hash of the block the UTXO set is at\n"
+            "  \"base_height\": n,         (numeric) The height of the block the UTXO set is at\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash, as in gettxoutsetinfo\n"
+            "  \"path\": \"path\"          (string) The absolute path of the snapshot file\n"
+            "}\n"
+                },
+                RPCExamples{
+                    HelpExampleCli("dumptxoutset", "utxo.dat")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+                },
+            }.Check(request);
+
+    const fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    // Write to a temporary path, so that a complete file is never mistaken for a partial one
+    const fs::path temppath = fs::absolute(request.params[0].get_str() + ".incomplete", GetDataDir());
+    if (fs::exists(path)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+    }
+
+    CAutoFile file(fsbridge::fopen(temppath, "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to open " + temppath.string());
+    }
+
+    SnapshotMetadata metadata;
+    CCoinsStats stats;
+    std::string error;
+    try {
+        if (!DumpUTXOSnapshot(file, metadata, stats, error) || !FileCommit(file.Get())) {
+            throw std::runtime_error(error.empty() ? "Unable to write to the file" : error);
+        }
+    } catch (const std::exception& e) {
+        file.fclose();
+        fs::remove(temppath);
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+    file.fclose();
+    fs::rename(temppath, path);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("coins_written", (int64_t)stats.nTransactionOutputs);
+    ret.pushKV("base_hash", metadata.base_blockhash.GetHex());
+    ret.pushKV("base_height", metadata.base_height);
+    ret.pushKV("hash_serialized_2", stats.hashSerialized.GetHex());
+    ret.pushKV("path", path.string());
+    return ret;
+}
+
 //! Search for a given set of pubkey scripts
 bool FindScriptPubKey(std::atomic<int>& scan_progress, const std::atomic<bool>& should_abort, int64_t& count, CCoinsViewCursor* cursor, const std::set<CScript>& needles, std::map<COutPoint, Coin>& out_results) {
     scan_progress = 0;
@@ -2546,6 +2648,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        {"height"} },
     { "blockchain",         "savemempool",            &savemempool,            {} },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           {"path"} },
     { "blockchain",         "verifychain",            &verifychain,            {"checklevel","nblocks"} },
 
     { "blockchain",         "preciousblock",          &preciousblock,          {"blockhash"} },
@@ -247,6 +247,7 @@ static UniValue prioritisetransaction(const JSONRPCRequest& request)
     }
 
     mempool.PrioritiseTransaction(hash, nAmount);
+    if (g_block_template_cache) g_block_template_cache->Invalidate();
     return true;
 }
 
@@ -487,30 +488,14 @@ static UniValue getblocktemplate(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "getblocktemplate must be called with the segwit rule set (call with {\"rules\": [\"segwit\"]})");
     }
 
-    // Update block
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static std::unique_ptr<CBlockTemplate> pblocktemplate;
-    if (pindexPrev != ::ChainActive().Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
-    {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = nullptr;
-
-        // Store the pindexBest used before CreateNewBlock, to avoid races
-        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrevNew = ::ChainActive().Tip();
-        nStart = GetTime();
-
-        // Create new block
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy);
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
-    }
+    // Copy the block template maintained in the background, made if there is none for the tip yet
+    if (!g_block_template_cache)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block templates are not available");
+    const CBlockIndex* pindexPrev = nullptr;
+    std::shared_ptr<const CBlockTemplate> cached_template = g_block_template_cache->Get(pindexPrev, nTransactionsUpdatedLast);
+    if (!cached_template)
+        throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+    std::unique_ptr<CBlockTemplate> pblocktemplate = MakeUnique<CBlockTemplate>(*cached_template);
     assert(pindexPrev);
     CBlock* pblock = &pblocktemplate->block; // pointer for convenience
     const Consensus::Params& consensusParams = Params().GetConsensus();
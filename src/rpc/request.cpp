@@ -182,3 +182,10 @@ void JSONRPCRequest::parse(const UniValue& valRequest)
     else
         throw JSONRPCError(RPC_INVALID_REQUEST, "Params must be an array or object");
 }
+
+bool JSONRPCRequest::StreamResult(std::function<void(JSONWriter&)> write) const
+{
+    if (!result_writer) return false;
+    *result_writer = std::move(write);
+    return true;
+}
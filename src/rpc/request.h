@@ -6,10 +6,14 @@
 #ifndef BITCOIN_RPC_REQUEST_H
 #define BITCOIN_RPC_REQUEST_H
 
+#include <functional>
+#include <memory>
 #include <string>
 
 #include <univalue.h>
 
+class JSONWriter;
+
 UniValue JSONRPCRequestObj(const std::string& strMethod, const UniValue& params, const UniValue& id);
 UniValue JSONRPCReplyObj(const UniValue& result, const UniValue& error, const UniValue& id);
 std::string JSONRPCReply(const UniValue& result, const UniValue& error, const UniValue& id);
@@ -34,9 +38,21 @@ public:
     std::string URI;
     std::string authUser;
     std::string peerAddr;
+    //! Set by servers able to stream results out; see StreamResult()
+    std::shared_ptr<std::function<void(JSONWriter&)>> result_writer;
 
     JSONRPCRequest() : id(NullUniValue), params(NullUniValue), fHelp(false) {}
     void parse(const UniValue& valRequest);
+
+    /**
+     * Have the result written by write as the reply is sent, instead of
+     * returned, if the server supports it. Returns whether it will be, in
+     * which case the method returns a null result. Call once everything that
+     * could fail has been checked, as errors can't be sent once the reply has
+     * started; write runs after the method returns, so it can't rely on locks
+     * the method holds.
+     */
+    bool StreamResult(std::function<void(JSONWriter&)> write) const;
 };
 
 #endif // BITCOIN_RPC_REQUEST_H
@@ -8,6 +8,7 @@
 #include <rpc/util.h>
 
 #include <hash.h>
+#include <jsonwriter.h>
 #include <util/strencodings.h>
 #include <udpapi.h>
 #include <netbase.h>
@@ -188,6 +189,14 @@ UniValue getudpmulticastinfo(const JSONRPCRequest& request) {
         }
     }.Check(request);
 
+    if (request.StreamResult([](JSONWriter& result) {
+            result.BeginObject();
+            UdpMulticastRxInfoToJson(result);
+            result.EndObject();
+        })) {
+        return NullUniValue;
+    }
+
     return UdpMulticastRxInfoToJson();
 }
 
@@ -283,8 +292,12 @@ UniValue gettxwindowinfo(const JSONRPCRequest& request) {
                  "When the physical and logical indexes are specified:\n"
                  "{\n"
                  "  height : {       (json object) Height of a block in the window\n"
-                 "    \"index\" : n  (numeric) Index of next chunk to be transmitted from this block\n"
-                 "    \"total\" : n  (numeric) Total number of chunks from this block\n"
+                 "    \"index\" : n            (numeric) Index of next chunk to be transmitted from this block\n"
+                 "    \"total\" : n            (numeric) Total number of chunks from this block\n"
+                 "    \"header_chunks\" : n    (numeric) Number of data chunks of the block header\n"
+                 "    \"header_overhead\" : n  (numeric) Number of overhead chunks of the block header\n"
+                 "    \"body_chunks\" : n      (numeric) Number of data chunks of the block body\n"
+                 "    \"body_overhead\" : n    (numeric) Number of overhead chunks of the block body\n"
                  "  }\n"
                  "  ...\n"
                  "}\n"
@@ -410,6 +423,38 @@ UniValue getfechitratio(const JSONRPCRequest& request) {
     return FecHitRatioToJson();
 }
 
+UniValue getpartialblockusage(const JSONRPCRequest& request) {
+    RPCHelpMan{"getpartialblockusage",
+        "\nGet the memory and disk usage of the blocks currently being received over UDP.\n"
+        "\nWhen the usage would exceed the budget set by -udpblockbudget, backfill blocks\n"
+        "are evicted, starting from the least complete, or new backfill blocks are\n"
+        "dropped if less complete than all others. The chunks of an evicted or dropped\n"
+        "block are then ignored for 10 minutes. Blocks from the tip of the chain are\n"
+        "always accepted.\n",
+        {
+        },
+        RPCResults{
+             RPCResult{
+                 "{\n"
+                 "  \"budget\"  : n  (numeric) Maximum usage in bytes (0 if unlimited)\n"
+                 "  \"usage\"   : n  (numeric) Current memory and disk usage in bytes\n"
+                 "  \"memory\"  : n  (numeric) Heap memory used by the partially decoded blocks in bytes\n"
+                 "  \"disk\"    : n  (numeric) Size of the files storing the FEC chunks received so far in bytes\n"
+                 "  \"n_blks\"  : n  (numeric) Number of partial blocks\n"
+                 "  \"evicted\" : n  (numeric) Number of partial blocks evicted to stay within the budget\n"
+                 "  \"dropped\" : n  (numeric) Number of new FEC objects dropped to stay within the budget\n"
+                 "}\n"
+             }
+        },
+        RPCExamples{
+            HelpExampleCli("getpartialblockusage", "")
+            + HelpExampleRpc("getpartialblockusage", "")
+        }
+    }.Check(request);
+
+    return PartialBlockUsageToJSON();
+}
+
 UniValue txblock(const JSONRPCRequest& request)
 {
     RPCHelpMan{"txblock",
@@ -442,6 +487,7 @@ static const CRPCCommand commands[] =
     { "udpnetwork",         "gettxntxinfo",           &gettxntxinfo,           {} },
     { "udpnetwork",         "gettxqueueinfo",         &gettxqueueinfo,         {} },
     { "udpnetwork",         "getfechitratio",         &getfechitratio,         {} },
+    { "udpnetwork",         "getpartialblockusage",   &getpartialblockusage,   {} },
     { "udpnetwork",         "txblock",                &txblock,                {"height"} }
 };
 
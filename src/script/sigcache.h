@@ -6,10 +6,15 @@
 #ifndef BITCOIN_SCRIPT_SIGCACHE_H
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
+#include <cuckoocache.h>
 #include <script/interpreter.h>
 
+#include <array>
 #include <vector>
 
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
 // DoS prevention: limit cache size to 32MB (over 1000000 entries on 64-bit
 // systems). Due to how we count cache size, actual memory usage is slightly
 // more (~32.25 MB)
@@ -40,6 +45,60 @@ public:
     }
 };
 
+/**
+ * A CuckooCache::cache split into shards, each with its own lock, so that
+ * the script verification threads looking up entries of a block at once
+ * don't all take the same lock and keep bouncing its cache line between them.
+ * Lookups only share the lock of their shard, and erase as CuckooCache does,
+ * by flagging entries to be collected by later inserts.
+ *
+ * The shard of an element is picked by the low bits of its last hash, which
+ * hardly matter to where the hash puts it within the shard.
+ */
+template <typename Element, typename Hash, uint32_t Shards = 32>
+class ShardedCuckooCache
+{
+private:
+    static_assert((Shards & (Shards - 1)) == 0, "Shards must be a power of two");
+
+    struct alignas(64) Shard
+    {
+        boost::shared_mutex mutex;
+        CuckooCache::cache<Element, Hash> cache;
+    };
+
+    const Hash hash_function{};
+    std::array<Shard, Shards> shards;
+
+    Shard& GetShard(const Element& e) { return shards[hash_function.template operator()<7>(e) & (Shards - 1)]; }
+
+public:
+    /** Set up the shards to take bytes between them. Returns the elements storable. */
+    uint32_t setup_bytes(size_t bytes)
+    {
+        uint32_t elements = 0;
+        for (Shard& shard : shards) {
+            boost::unique_lock<boost::shared_mutex> lock(shard.mutex);
+            elements += shard.cache.setup_bytes(bytes / Shards);
+        }
+        return elements;
+    }
+
+    void insert(Element e)
+    {
+        Shard& shard = GetShard(e);
+        boost::unique_lock<boost::shared_mutex> lock(shard.mutex);
+        shard.cache.insert(std::move(e));
+    }
+
+    bool contains(const Element& e, const bool erase)
+    {
+        Shard& shard = GetShard(e);
+        boost::shared_lock<boost::shared_mutex> lock(shard.mutex);
+        return shard.cache.contains(e, erase);
+    }
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
@@ -668,6 +668,168 @@ BOOST_AUTO_TEST_CASE(RealFECedBlockRoundTripTest)
 }
 */
 
+static CBlock ReadBlock413567() {
+    CBlock block;
+    CDataStream stream((const char*)blockencodings_tests::block413567,
+            (const char*)&blockencodings_tests::block413567[sizeof(blockencodings_tests::block413567)],
+            SER_NETWORK, PROTOCOL_VERSION);
+    stream >> block;
+    return block;
+}
+
+static size_t ChunkCodedSize(const CBlock& block, codec_version_t codec_version) {
+    CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, codec_version);
+    ChunkCodedBlock fecBlock(block, headerAndIDs);
+    return GetSerializeSize(headerAndIDs, PROTOCOL_VERSION) + fecBlock.GetCodedBlock().size();
+}
+
+// Receives a chunk-coded block, with the txns of the mempool prefilled and the
+// other chunks copied over from the sender's
+static void TestChunkCodedBlockWithMempool(const CBlock& block, CTxMemPool& pool, codec_version_t codec_version) {
+    CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, codec_version);
+    const std::vector<unsigned char> coded_block = ChunkCodedBlock(block, headerAndIDs).GetCodedBlock();
+
+    std::vector<unsigned char> header_data;
+    VectorOutputStream header_out(&header_data, SER_NETWORK, PROTOCOL_VERSION);
+    header_out << headerAndIDs;
+    CBlockHeaderAndLengthShortTxIDs shortIDs;
+    VectorInputStream header_in(&header_data, SER_NETWORK, PROTOCOL_VERSION);
+    header_in >> shortIDs;
+
+    PartiallyDownloadedChunkBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs, extra_txn) == READ_STATUS_OK);
+    size_t firstChunkProcessed;
+    while (!partialBlock.IsIterativeFillDone())
+        BOOST_CHECK(partialBlock.DoIterativeFill(firstChunkProcessed) == READ_STATUS_OK);
+
+    if (!partialBlock.IsBlockAvailable()) {
+        for (size_t i = 0; i < partialBlock.GetChunkCount(); i++) {
+            if (partialBlock.IsChunkAvailable(i)) {
+                BOOST_CHECK(!memcmp(partialBlock.GetChunk(i), &coded_block[i * FEC_CHUNK_SIZE], FEC_CHUNK_SIZE));
+            } else {
+                memcpy(partialBlock.GetChunk(i), &coded_block[i * FEC_CHUNK_SIZE], FEC_CHUNK_SIZE);
+                partialBlock.MarkChunkAvailable(i);
+            }
+        }
+    }
+
+    BOOST_REQUIRE(partialBlock.IsBlockAvailable());
+    BOOST_CHECK(partialBlock.FinalizeBlock() == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), partialBlock.GetBlock()->GetHash().ToString());
+    bool mutated;
+    BOOST_CHECK_EQUAL(block.hashMerkleRoot.ToString(), BlockMerkleRoot(*partialBlock.GetBlock(), &mutated).ToString());
+    BOOST_CHECK(!mutated);
+}
+
+BOOST_AUTO_TEST_CASE(CodecV2ChunkCodedBlockRoundTripTest)
+{
+    const CBlock block(ReadBlock413567());
+
+    // The block-level context must pay for itself, header included
+    BOOST_CHECK(ChunkCodedSize(block, codec_version_t::v2) < ChunkCodedSize(block, codec_version_t::v1));
+
+    std::mt19937_64 g(0xdeadbeef);
+    std::vector<CTransactionRef> vtx2(block.vtx.begin() + 1, block.vtx.end());
+    std::shuffle(vtx2.begin(), vtx2.end(), g);
+
+    // Txns prefilled from the mempool must be encoded exactly like the sender
+    // did, given only the context received along with the header. This
+    // includes the spends of earlier txns of the block, whether these are in
+    // the mempool or not.
+    TestMemPoolEntryHelper entry;
+    for (const size_t n_mempool : {(size_t)0, vtx2.size() / 2, vtx2.size() - 1, vtx2.size()}) {
+        CTxMemPool pool;
+        for (size_t i = 0; i < n_mempool; i++)
+            pool.addUnchecked(entry.FromTx(vtx2[i]));
+        TestChunkCodedBlockWithMempool(block, pool, codec_version_t::v2);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(CodecV2InBlockSpendTest)
+{
+    // Parents, with and without witness, each followed by a child spending it
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << OP_1 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 42;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    for (bool witness : {false, true}) {
+        CMutableTransaction parent;
+        parent.vin.resize(1);
+        parent.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+        if (witness)
+            parent.vin[0].scriptWitness.stack.push_back(std::vector<unsigned char>(10, 0x01));
+        parent.vout.resize(1);
+        parent.vout[0].nValue = 1000;
+        parent.vout[0].scriptPubKey = CScript() << OP_0 << ToByteVector(InsecureRand256());
+        block.vtx.push_back(MakeTransactionRef(parent));
+
+        CMutableTransaction child;
+        child.vin.resize(1);
+        child.vin[0].prevout = COutPoint(parent.GetHash(), 0);
+        child.vout.resize(1);
+        child.vout[0].nValue = 900;
+        child.vout[0].scriptPubKey = CScript() << OP_0 << ToByteVector(InsecureRand256());
+        block.vtx.push_back(MakeTransactionRef(child));
+    }
+    block.nBits = 0x207fffff;
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+
+    const CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, codec_version_t::v2);
+    const CTxCompressionContext& ctx = headerAndIDs.tx_ctx();
+    BOOST_CHECK(ctx.IsEmpty());
+    BOOST_CHECK_EQUAL(ctx.FindInBlockTx(block.vtx[1]->GetHash(), 2), 1U);
+    BOOST_CHECK_EQUAL(ctx.FindInBlockTx(block.vtx[1]->GetHash(), 1), 0U);
+    // The short id of a witness txn in the header is that of its wtxid, so
+    // the one of its txid is sent along with the context
+    BOOST_CHECK_EQUAL(ctx.FindInBlockTx(block.vtx[3]->GetHash(), 4), 1U);
+    BOOST_CHECK_EQUAL(ctx.FindInBlockTx(block.vtx[3]->GetHash(), 3), 0U);
+    CTxCompressionContext header_ctx = CTxCompressionContext(block);
+    headerAndIDs.SetShortTxIDs(header_ctx);
+    BOOST_CHECK_EQUAL(header_ctx.FindInBlockTx(block.vtx[1]->GetHash(), 2), 1U);
+    BOOST_CHECK_EQUAL(header_ctx.FindInBlockTx(block.vtx[3]->GetHash(), 4), 0U);
+    BOOST_CHECK(GetSerializeSize(ctx, PROTOCOL_VERSION) > GetSerializeSize(header_ctx, PROTOCOL_VERSION));
+    {
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << headerAndIDs;
+        CBlockHeaderAndLengthShortTxIDs received;
+        stream >> received;
+        CTxCompressionContext received_ctx = received.tx_ctx();
+        received.SetShortTxIDs(received_ctx);
+        BOOST_CHECK_EQUAL(received_ctx.FindInBlockTx(block.vtx[1]->GetHash(), 2), 1U);
+        BOOST_CHECK_EQUAL(received_ctx.FindInBlockTx(block.vtx[3]->GetHash(), 4), 1U);
+    }
+
+    // The txid spent is replaced by a one-byte distance
+    const CTransaction& child = *block.vtx[2];
+    BOOST_CHECK_EQUAL(GetSerializeSize(CTxCompressor(child, codec_version_t::v2, &ctx, 2), PROTOCOL_VERSION) + 32 - 1,
+                      GetSerializeSize(CTxCompressor(child, codec_version_t::v1), PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(GetSerializeSize(CTxCompressor(*block.vtx[4], codec_version_t::v2, &ctx, 4), PROTOCOL_VERSION) + 32 - 1,
+                      GetSerializeSize(CTxCompressor(*block.vtx[4], codec_version_t::v1), PROTOCOL_VERSION));
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << CTxCompressor(child, codec_version_t::v2, &ctx, 2);
+    CTxCompressionContext receiver_ctx = ctx;
+    CTransactionRef decoded;
+    {
+        // Decoding needs the txn spent
+        CDataStream copy(stream);
+        BOOST_CHECK_THROW(copy >> REF(CTxCompressor(decoded, codec_version_t::v2, &receiver_ctx, 2)), std::ios_base::failure);
+        std::vector<CTransactionRef> txns(block.vtx.size());
+        receiver_ctx.SetBlockTxns(&txns);
+        copy = stream;
+        BOOST_CHECK_THROW(copy >> REF(CTxCompressor(decoded, codec_version_t::v2, &receiver_ctx, 2)), std::ios_base::failure);
+    }
+    receiver_ctx.SetBlockTxns(&block.vtx);
+    stream >> REF(CTxCompressor(decoded, codec_version_t::v2, &receiver_ctx, 2));
+    BOOST_CHECK(decoded->GetWitnessHash() == child.GetWitnessHash());
+
+    CTxMemPool pool;
+    TestChunkCodedBlockWithMempool(block, pool, codec_version_t::v2);
+}
+
 BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest) {
     BlockTransactionsRequest req1;
     req1.blockhash = InsecureRand256();
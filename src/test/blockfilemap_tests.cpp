@@ -0,0 +1,79 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilemap.h>
+#include <clientversion.h>
+#include <flatfile.h>
+#include <streams.h>
+#include <test/setup_common.h>
+#include <util/system.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilemap_tests, BasicTestingSetup)
+
+//! Append bytes (n + file) & 0xff at positions n to a file of the sequence
+static void AppendBytes(const FlatFileSeq& seq, int file, size_t count)
+{
+    FILE* f = fsbridge::fopen(seq.FileName(FlatFilePos(file, 0)), "ab");
+    BOOST_REQUIRE(f);
+    const long start = ftell(f);
+    for (size_t n = start; n < start + count; n++)
+        fputc((n + file) & 0xff, f);
+    fclose(f);
+}
+
+BOOST_AUTO_TEST_CASE(block_file_maps)
+{
+    FlatFileSeq seq(GetDataDir(), "blk", 1 << 20);
+    for (int file = 0; file < 6; file++)
+        AppendBytes(seq, file, 10000);
+
+    BlockFileMaps maps;
+    maps.SetLimit(3);
+    MappedBlockData kept;
+    for (int round = 0; round < 3; round++) {
+        for (int file = 0; file < 6; file++) {
+            MappedBlockData data;
+            BOOST_REQUIRE(maps.Read(seq, FlatFilePos(file, 100), 50, data));
+            BOOST_CHECK_EQUAL(data.size(), 50U);
+            BOOST_CHECK_EQUAL(data.data()[0], (100 + file) & 0xff);
+            if (file == 0)
+                kept = data.subspan(10);
+        }
+    }
+    // Bytes stay readable after their mapping left the LRU
+    BOOST_CHECK_EQUAL(kept.size(), 40U);
+    BOOST_CHECK_EQUAL(kept.data()[0], 110);
+
+    // Reads past the end of a file fail, until the file grows
+    MappedBlockData data;
+    BOOST_CHECK(!maps.Read(seq, FlatFilePos(0, 9990), 50, data));
+    AppendBytes(seq, 0, 100);
+    BOOST_REQUIRE(maps.Read(seq, FlatFilePos(0, 9990), 50, data));
+    BOOST_CHECK_EQUAL(data.data()[49], (10039) & 0xff);
+
+    maps.Invalidate(seq, 0);
+    BOOST_REQUIRE(maps.Read(seq, FlatFilePos(0, 0), 1, data));
+    BOOST_CHECK(!maps.Read(seq, FlatFilePos(7, 0), 1, data));
+
+    // Mapping can be disabled
+    maps.SetLimit(0);
+    BOOST_CHECK(!maps.Read(seq, FlatFilePos(1, 0), 1, data));
+}
+
+BOOST_AUTO_TEST_CASE(span_reader)
+{
+    const std::vector<unsigned char> bytes{1, 2, 3, 4, 5};
+    SpanReader reader(SER_DISK, CLIENT_VERSION, Span<const unsigned char>(bytes.data(), bytes.size()));
+    uint32_t a;
+    uint8_t b;
+    reader >> a >> b;
+    BOOST_CHECK_EQUAL(a, 0x04030201U);
+    BOOST_CHECK_EQUAL(b, 5);
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK_THROW(reader >> b, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
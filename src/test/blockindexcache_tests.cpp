@@ -0,0 +1,126 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockindexcache.h>
+#include <chain.h>
+#include <test/setup_common.h>
+#include <util/system.h>
+
+#include <atomic>
+#include <memory>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockindexcache_tests, BasicTestingSetup)
+
+//! A chain of block index entries with a fork, sorted by height
+static std::vector<std::unique_ptr<CBlockIndex>> MakeEntries(std::vector<uint256>& hashes)
+{
+    std::vector<std::unique_ptr<CBlockIndex>> entries;
+    hashes.resize(100);
+    for (int n = 0; n < 100; n++) {
+        hashes[n] = InsecureRand256();
+        entries.emplace_back(new CBlockIndex());
+        CBlockIndex& index = *entries.back();
+        index.phashBlock = &hashes[n];
+        // Entry 51 forks from entry 49
+        index.pprev = n == 0 ? nullptr : entries[n == 51 ? 49 : n - 1].get();
+        index.nHeight = index.pprev ? index.pprev->nHeight + 1 : 0;
+        index.nFile = n / 10;
+        index.nDataPos = InsecureRand32();
+        index.nUndoPos = InsecureRand32();
+        index.nVersion = InsecureRand32();
+        index.hashMerkleRoot = InsecureRand256();
+        index.nTime = InsecureRand32();
+        index.nBits = InsecureRand32();
+        index.nNonce = InsecureRand32();
+        index.nStatus = BLOCK_VALID_SCRIPTS | BLOCK_HAVE_DATA;
+        index.nTx = InsecureRand32();
+    }
+    return entries;
+}
+
+BOOST_AUTO_TEST_CASE(cache_file_roundtrip)
+{
+    std::vector<uint256> hashes;
+    std::vector<std::unique_ptr<CBlockIndex>> entries = MakeEntries(hashes);
+    std::vector<const CBlockIndex*> sorted;
+    for (const auto& entry : entries)
+        sorted.push_back(entry.get());
+
+    const fs::path path = GetDataDir() / "index.cache";
+    BOOST_REQUIRE(WriteBlockIndexCacheFile(path, 42, sorted));
+
+    // The identifier and number of entries recorded in the database have to match
+    {
+        BlockIndexCacheReader reader;
+        BOOST_CHECK(!reader.Open(path, 43, sorted.size()));
+    }
+    {
+        BlockIndexCacheReader reader;
+        BOOST_CHECK(!reader.Open(path, 42, sorted.size() - 1));
+    }
+    {
+        BlockIndexCacheReader reader;
+        BOOST_CHECK(!reader.Open(GetDataDir() / "missing.cache", 42, sorted.size()));
+    }
+
+    BlockIndexCacheReader reader;
+    BOOST_REQUIRE(reader.Open(path, 42, sorted.size()));
+    BOOST_REQUIRE_EQUAL(reader.Count(), sorted.size());
+    for (size_t n = 0; n < sorted.size(); n++) {
+        const CBlockIndex& expected = *sorted[n];
+        CBlockIndex index;
+        int32_t prev;
+        reader.Read(n, index, prev);
+        BOOST_CHECK(reader.GetHash(n) == expected.GetBlockHash());
+        BOOST_CHECK_EQUAL(prev, n == 0 ? -1 : n == 51 ? 49 : (int32_t)n - 1);
+        BOOST_CHECK_EQUAL(index.nHeight, expected.nHeight);
+        BOOST_CHECK_EQUAL(index.nFile, expected.nFile);
+        BOOST_CHECK_EQUAL(index.nDataPos, expected.nDataPos);
+        BOOST_CHECK_EQUAL(index.nUndoPos, expected.nUndoPos);
+        BOOST_CHECK_EQUAL(index.nVersion, expected.nVersion);
+        BOOST_CHECK(index.hashMerkleRoot == expected.hashMerkleRoot);
+        BOOST_CHECK_EQUAL(index.nTime, expected.nTime);
+        BOOST_CHECK_EQUAL(index.nBits, expected.nBits);
+        BOOST_CHECK_EQUAL(index.nNonce, expected.nNonce);
+        BOOST_CHECK_EQUAL(index.nStatus, expected.nStatus);
+        BOOST_CHECK_EQUAL(index.nTx, expected.nTx);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(cache_file_parents_first)
+{
+    std::vector<uint256> hashes;
+    std::vector<std::unique_ptr<CBlockIndex>> entries = MakeEntries(hashes);
+    std::vector<const CBlockIndex*> sorted;
+    for (const auto& entry : entries)
+        sorted.push_back(entry.get());
+    std::swap(sorted[10], sorted[11]);
+
+    const fs::path path = GetDataDir() / "index.cache";
+    BOOST_CHECK(!WriteBlockIndexCacheFile(path, 42, sorted));
+    BOOST_CHECK(!fs::exists(path));
+}
+
+BOOST_AUTO_TEST_CASE(ranges_cover_everything)
+{
+    for (size_t count : {0, 1, 1000, 100000}) {
+        std::vector<std::atomic<int>> calls(count);
+        std::atomic<bool> in_bounds{true};
+        ForEachBlockIndexRange(count, [&](size_t begin, size_t end) {
+            if (begin > end || end > count) {
+                in_bounds = false;
+                return;
+            }
+            for (size_t n = begin; n < end; n++)
+                calls[n]++;
+        });
+        BOOST_CHECK(in_bounds);
+        for (size_t n = 0; n < count; n++)
+            BOOST_CHECK_EQUAL(calls[n], 1);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -302,6 +302,70 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_UniqueCheck)
 }
 
 
+// Test that workers stopped and started again own the deques of the workers
+// before them, rather than counting on from where those left off
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Restart)
+{
+    auto queue = MakeUnique<Correct_Queue>(QUEUE_BATCH_SIZE);
+    for (int round = 0; round < 3; round++) {
+        boost::thread_group tg;
+        for (auto x = 0; x < nScriptCheckThreads; ++x) {
+           tg.create_thread([&]{queue->Thread();});
+        }
+        FakeCheckCheckCompletion::n_calls = 0;
+        {
+            CCheckQueueControl<FakeCheckCheckCompletion> control(queue.get());
+            std::vector<FakeCheckCheckCompletion> vChecks(1000);
+            control.Add(vChecks);
+            BOOST_REQUIRE(control.Wait());
+        }
+        BOOST_REQUIRE_EQUAL(FakeCheckCheckCompletion::n_calls, 1000U);
+        // Workers register as they start
+        while (queue->WorkerCount() < (unsigned int)nScriptCheckThreads)
+            MilliSleep(1);
+        BOOST_CHECK_EQUAL(queue->WorkerCount(), (unsigned int)nScriptCheckThreads);
+        tg.interrupt_all();
+        tg.join_all();
+        BOOST_CHECK_EQUAL(queue->WorkerCount(), 0U);
+    }
+}
+
+// Test that checks queued for workers that are interrupted before taking them
+// are still done, by the workers left or the master, rather than being lost
+// on deques no one looks at anymore
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Interrupted_Workers)
+{
+    auto queue = MakeUnique<Correct_Queue>(QUEUE_BATCH_SIZE);
+    // Whether the workers stop before or after the batch is spread is up to
+    // the scheduler, so this is tried many times
+    for (int round = 0; round < 200; round++) {
+        boost::thread_group tg;
+        std::vector<boost::thread*> threads;
+        for (auto x = 0; x < nScriptCheckThreads; ++x) {
+           threads.push_back(tg.create_thread([&]{queue->Thread();}));
+        }
+        while (queue->WorkerCount() < (unsigned int)nScriptCheckThreads)
+            MilliSleep(1);
+        // Every other round, one worker is left running
+        const size_t interrupted = round % 2 ? threads.size() : threads.size() - 1;
+        FakeCheckCheckCompletion::n_calls = 0;
+        {
+            CCheckQueueControl<FakeCheckCheckCompletion> control(queue.get());
+            std::vector<FakeCheckCheckCompletion> vChecks(1000);
+            // The batch is spread over the deques of all workers, most of
+            // which stop before taking anything from them
+            for (size_t i = 0; i < interrupted; i++)
+                threads[i]->interrupt();
+            control.Add(vChecks);
+            BOOST_REQUIRE(control.Wait());
+        }
+        BOOST_REQUIRE_EQUAL(FakeCheckCheckCompletion::n_calls, 1000U);
+        tg.interrupt_all();
+        tg.join_all();
+        BOOST_CHECK_EQUAL(queue->WorkerCount(), 0U);
+    }
+}
+
 // Test that blocks which might allocate lots of memory free their memory aggressively.
 //
 // This test attempts to catch a pathological case where by lazily freeing
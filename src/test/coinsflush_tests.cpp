@@ -0,0 +1,151 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <boost/test/unit_test.hpp>
+#include <coins.h>
+#include <test/setup_common.h>
+#include <txdb.h>
+
+#include <atomic>
+#include <vector>
+
+BOOST_FIXTURE_TEST_SUITE(coinsflush_tests, BasicTestingSetup)
+
+static Coin MakeCoin(CAmount value)
+{
+    return Coin(CTxOut(value, CScript() << OP_TRUE), 1, false);
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_dirty)
+{
+    CCoinsViewDB db("snapshot_dirty", 1 << 20, true, false);
+    const COutPoint clean(InsecureRand256(), 0), spent(InsecureRand256(), 1), added(InsecureRand256(), 2);
+    {
+        CCoinsViewCache writer(&db);
+        writer.AddCoin(clean, MakeCoin(1), false);
+        writer.AddCoin(spent, MakeCoin(2), false);
+        writer.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(writer.Flush());
+    }
+
+    CCoinsViewCache cache(&db);
+    BOOST_CHECK(cache.HaveCoin(clean));
+    BOOST_CHECK(cache.SpendCoin(spent));
+    cache.AddCoin(added, MakeCoin(3), false);
+
+    CCoinsMap snapshot;
+    BOOST_CHECK_EQUAL(cache.SnapshotDirty(snapshot), 0U);
+    BOOST_CHECK_EQUAL(snapshot.size(), 2U);
+    BOOST_CHECK(snapshot.at(spent).coin.IsSpent());
+    BOOST_CHECK(snapshot.at(spent).flags & CCoinsCacheEntry::DIRTY);
+    BOOST_CHECK_EQUAL(snapshot.at(added).coin.out.nValue, 3);
+    BOOST_CHECK(snapshot.at(added).flags & CCoinsCacheEntry::DIRTY);
+
+    // Unspent coins stay cached, and are no longer modified
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 2U);
+    BOOST_CHECK(cache.HaveCoinInCache(clean));
+    BOOST_CHECK(!cache.HaveCoinInCache(spent));
+    cache.Uncache(added);
+    BOOST_CHECK(!cache.HaveCoinInCache(added));
+
+    // Nothing is left to be written
+    CCoinsMap empty;
+    cache.SnapshotDirty(empty);
+    BOOST_CHECK(empty.empty());
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_dirty_evict)
+{
+    CCoinsView base;
+    CCoinsViewCache cache(&base);
+    std::vector<COutPoint> clean, dirty;
+    for (uint32_t i = 0; i < 20000; i++) {
+        clean.emplace_back(InsecureRand256(), i);
+        cache.EmplaceCoinFromBase(clean.back(), MakeCoin(1));
+    }
+    for (uint32_t i = 0; i < 1000; i++) {
+        dirty.emplace_back(InsecureRand256(), i);
+        cache.AddCoin(dirty.back(), MakeCoin(2), false);
+    }
+
+    const size_t max_usage = cache.DynamicMemoryUsage() / 4;
+    CCoinsMap snapshot;
+    const size_t evicted = cache.SnapshotDirty(snapshot, max_usage);
+    BOOST_CHECK_EQUAL(snapshot.size(), dirty.size());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize() + evicted, clean.size() + dirty.size());
+    BOOST_CHECK(evicted > clean.size() / 2);
+    // Up to a pool chunk
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= max_usage + CCoinsMapMemoryResource::DEFAULT_CHUNK_SIZE_BYTES);
+
+    // Modified coins are evicted last
+    for (const COutPoint& outpoint : dirty) {
+        BOOST_CHECK(cache.HaveCoinInCache(outpoint));
+        BOOST_CHECK(snapshot.at(outpoint).flags & CCoinsCacheEntry::DIRTY);
+    }
+
+    // Everything can be evicted, but the coins are still written
+    CCoinsMap none;
+    cache.AddCoin(COutPoint(InsecureRand256(), 0), MakeCoin(3), false);
+    cache.SnapshotDirty(none, 0);
+    BOOST_CHECK_EQUAL(none.size(), 1U);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+
+    // including from an empty cache
+    cache.SnapshotDirty(none, 0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(background_flush)
+{
+    CCoinsViewDB db("background_flush", 1 << 20, true, false);
+    CCoinsViewBackgroundFlush flushview(&db, db);
+    CCoinsViewCache cache(&flushview);
+
+    std::vector<COutPoint> outpoints;
+    for (uint32_t i = 0; i < 1000; i++) {
+        outpoints.emplace_back(InsecureRand256(), i);
+        cache.AddCoin(outpoints.back(), MakeCoin(i + 1), false);
+    }
+    const uint256 first_block = InsecureRand256();
+    cache.SetBestBlock(first_block);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(db.GetBestBlock() == first_block);
+
+    // Spend half the coins, and write the changes in the background
+    for (size_t i = 0; i < outpoints.size(); i += 2)
+        BOOST_CHECK(cache.SpendCoin(outpoints[i]));
+    const uint256 second_block = InsecureRand256();
+    cache.SetBestBlock(second_block);
+    CCoinsMap snapshot;
+    cache.SnapshotDirty(snapshot);
+    // Told from the writer thread once the coins are in the database
+    std::atomic<bool> written{false};
+    BOOST_CHECK(flushview.StartWrite(std::move(snapshot), second_block, [&] { written = db.GetBestBlock() == second_block; }));
+
+    // The flush view has the new state, whether or not it is written yet
+    BOOST_CHECK(flushview.GetBestBlock() == second_block);
+    for (size_t i = 0; i < outpoints.size(); i++)
+        BOOST_CHECK_EQUAL(flushview.HaveCoin(outpoints[i]), i % 2 == 1);
+
+    BOOST_CHECK(flushview.Wait());
+    BOOST_CHECK(written);
+    BOOST_CHECK(!flushview.IsWriting());
+    BOOST_CHECK_EQUAL(flushview.DynamicMemoryUsage(), 0U);
+    BOOST_CHECK(db.GetBestBlock() == second_block);
+    for (size_t i = 0; i < outpoints.size(); i++)
+        BOOST_CHECK_EQUAL(db.HaveCoin(outpoints[i]), i % 2 == 1);
+
+    // A regular flush goes through once the background write is done
+    BOOST_CHECK(cache.SpendCoin(outpoints[1]));
+    CCoinsMap pending;
+    cache.SnapshotDirty(pending);
+    BOOST_CHECK(flushview.StartWrite(std::move(pending), second_block));
+    BOOST_CHECK(cache.SpendCoin(outpoints[3]));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!db.HaveCoin(outpoints[1]));
+    BOOST_CHECK(!db.HaveCoin(outpoints[3]));
+    BOOST_CHECK(db.HaveCoin(outpoints[5]));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
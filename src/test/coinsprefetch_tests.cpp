@@ -0,0 +1,126 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <boost/test/unit_test.hpp>
+#include <coinsprefetch.h>
+#include <test/setup_common.h>
+#include <txdb.h>
+
+#include <boost/thread/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinsprefetch_tests, BasicTestingSetup)
+
+static CTransactionRef SpendTx(const std::vector<COutPoint>& prevouts)
+{
+    CMutableTransaction tx;
+    for (const COutPoint& prevout : prevouts)
+        tx.vin.emplace_back(prevout);
+    tx.vout.emplace_back(1000, CScript() << OP_TRUE);
+    return MakeTransactionRef(tx);
+}
+
+/* Write n coins to the database, and return their outpoints */
+static std::vector<COutPoint> PopulateDB(CCoinsViewDB& db, size_t n)
+{
+    std::vector<COutPoint> outpoints;
+    CCoinsViewCache writer(&db);
+    for (size_t i = 0; i < n; i++) {
+        outpoints.emplace_back(InsecureRand256(), i % 3);
+        writer.AddCoin(outpoints.back(), Coin(CTxOut(i + 1, CScript() << OP_TRUE), 1, false), false);
+    }
+    writer.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(writer.Flush());
+    return outpoints;
+}
+
+static CBlock BuildBlock(const std::vector<COutPoint>& prevouts)
+{
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.emplace_back();
+    coinbase.vout.emplace_back(50, CScript() << OP_TRUE);
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    for (const COutPoint& prevout : prevouts)
+        block.vtx.push_back(SpendTx({prevout}));
+    // Spend an output created within the block
+    block.vtx.push_back(SpendTx({COutPoint(block.vtx.back()->GetHash(), 0)}));
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(prefetch_apply)
+{
+    CCoinsViewDB db("prefetch_apply", 1 << 20, true, false);
+    const std::vector<COutPoint> outpoints = PopulateDB(db, 100);
+    CCoinsViewCache cache(&db);
+    // Already cached coins are not read again
+    BOOST_CHECK(cache.HaveCoin(outpoints[0]));
+    // Coins modified in the cache are not overwritten
+    cache.SpendCoin(outpoints[1]);
+
+    // A missing coin is not inserted
+    std::vector<COutPoint> prevouts(outpoints);
+    prevouts.emplace_back(InsecureRand256(), 0);
+    const CBlock block = BuildBlock(prevouts);
+
+    CCoinsPrefetcher prefetcher;
+    std::shared_ptr<CCoinsPrefetchJob> job = prefetcher.Prefetch(block, cache, db);
+    const CoinsPrefetchStats stats = prefetcher.Apply(job, cache);
+    BOOST_CHECK_EQUAL(stats.n_inputs, 101U);
+    BOOST_CHECK_EQUAL(stats.n_fetched, 99U);
+    BOOST_CHECK_EQUAL(stats.n_inserted, 98U);
+    BOOST_CHECK_EQUAL(stats.n_hits, 99U);
+    BOOST_CHECK(!stats.stale);
+
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoints[1]));
+    for (size_t i = 2; i < outpoints.size(); i++) {
+        BOOST_CHECK(cache.HaveCoinInCache(outpoints[i]));
+        BOOST_CHECK_EQUAL(cache.AccessCoin(outpoints[i]).out.nValue, (CAmount)i + 1);
+    }
+
+    // The prefetched coins are not dirty, so they can be uncached
+    cache.Uncache(outpoints[2]);
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoints[2]));
+}
+
+BOOST_AUTO_TEST_CASE(prefetch_stale)
+{
+    CCoinsViewDB db("prefetch_stale", 1 << 20, true, false);
+    const std::vector<COutPoint> outpoints = PopulateDB(db, 10);
+    CCoinsViewCache cache(&db);
+
+    CCoinsPrefetcher prefetcher;
+    std::shared_ptr<CCoinsPrefetchJob> job = prefetcher.Prefetch(BuildBlock(outpoints), cache, db);
+    prefetcher.NotifyFlush();
+    const CoinsPrefetchStats stats = prefetcher.Apply(job, cache);
+    BOOST_CHECK(stats.stale);
+    BOOST_CHECK_EQUAL(stats.n_inserted, 0U);
+    BOOST_CHECK_EQUAL(stats.n_hits, 0U);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(prefetch_workers)
+{
+    CCoinsViewDB db("prefetch_workers", 1 << 20, true, false);
+    const std::vector<COutPoint> outpoints = PopulateDB(db, 1000);
+    CCoinsViewCache cache(&db);
+
+    CCoinsPrefetcher prefetcher;
+    boost::thread_group workers;
+    for (int i = 0; i < 4; i++)
+        workers.create_thread([&prefetcher] { prefetcher.Thread(); });
+
+    // A cancelled job does not prevent the following ones from completing
+    std::shared_ptr<CCoinsPrefetchJob> cancelled = prefetcher.Prefetch(BuildBlock(outpoints), cache, db);
+    prefetcher.Cancel(cancelled);
+
+    std::shared_ptr<CCoinsPrefetchJob> job = prefetcher.Prefetch(BuildBlock(outpoints), cache, db);
+    const CoinsPrefetchStats stats = prefetcher.Apply(job, cache);
+    BOOST_CHECK_EQUAL(stats.n_inserted, 1000U);
+    BOOST_CHECK_EQUAL(stats.n_hits, 1000U);
+
+    workers.interrupt_all();
+    workers.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 
 #include <compressor.h>
 #include <key_io.h>
+#include <primitives/block.h>
 #include <streams.h>
 #include <util/system.h>
 #include <util/strencodings.h>
@@ -305,13 +306,13 @@ BOOST_AUTO_TEST_CASE(parse_scriptsig_header)
 }
 
 namespace {
-bool round_trip_compress_transaction(CMutableTransaction& tx)
+bool round_trip_compress_transaction(CMutableTransaction& tx, codec_version_t codec_version = codec_version_t::v1, CTxCompressionContext const* ctx = nullptr)
 {
     CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
-    stream << CTxCompressor(CTransaction(tx), codec_version_t::v1);
+    stream << CTxCompressor(CTransaction(tx), codec_version, ctx);
 
     CMutableTransaction ret;
-    stream >> CTxCompressor(ret, codec_version_t::v1);
+    stream >> CTxCompressor(ret, codec_version, ctx);
 
     stream << tx;
     CSerializeData original;
@@ -489,6 +490,57 @@ BOOST_AUTO_TEST_CASE(compress_transaction_with_scripts)
     round_trip_compress_transaction(outputm);
 }
 
+BOOST_AUTO_TEST_CASE(compress_transaction_with_context)
+{
+    const KeyData keys;
+    const uint256 prevout_hash = InsecureRand256();
+    const CScript p2pkh = CScript() << OP_DUP << OP_HASH160 << ToByteVector(keys.pubkey1C.GetID()) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    // Two txns spending outputs of the same tx with the same key, and paying
+    // to the same script
+    CBlock block;
+    for (uint32_t n = 0; n < 2; n++) {
+        CMutableTransaction tx;
+        tx.nVersion = 1;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(prevout_hash, n);
+        std::vector<unsigned char> sig;
+        BOOST_CHECK(keys.key0C.Sign(InsecureRand256(), sig));
+        sig.push_back(SIGHASH_ALL);
+        tx.vin[0].scriptSig = CScript() << sig << ToByteVector(keys.pubkey0C);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 1000 + n;
+        tx.vout[0].scriptPubKey = p2pkh;
+        block.vtx.push_back(MakeTransactionRef(tx));
+    }
+
+    const CTxCompressionContext ctx(block);
+    BOOST_CHECK_EQUAL(ctx.Size(), 3U);
+    BOOST_CHECK_EQUAL(ctx.FindPrevOutHash(prevout_hash), 1U);
+    BOOST_CHECK_EQUAL(ctx.FindScript(p2pkh), 1U);
+    BOOST_CHECK_EQUAL(ctx.FindPubKey(MakeSpan(keys.pubkey0C).subspan(1)), 1U);
+    BOOST_CHECK(ctx.GetPubKey(1) == uint256(std::vector<unsigned char>(keys.pubkey0C.begin() + 1, keys.pubkey0C.end())));
+    BOOST_CHECK_THROW(ctx.GetScript(2), std::ios_base::failure);
+
+    // The context survives serialization
+    CDataStream ctx_stream(SER_NETWORK, PROTOCOL_VERSION);
+    ctx_stream << ctx;
+    CTxCompressionContext ctx2;
+    ctx_stream >> ctx2;
+    BOOST_CHECK_EQUAL(ctx2.FindPubKey(MakeSpan(keys.pubkey0C).subspan(1)), 1U);
+
+    for (const CTransactionRef& tx : block.vtx) {
+        CMutableTransaction mtx(*tx);
+        BOOST_CHECK(round_trip_compress_transaction(mtx, codec_version_t::v2, &ctx2));
+        // Back-references replace the 32-byte txid and key and the 21-byte script
+        BOOST_CHECK_EQUAL(GetSerializeSize(CTxCompressor(*tx, codec_version_t::v2, &ctx), PROTOCOL_VERSION) + 32 + 32 + 21 - 4,
+                          GetSerializeSize(CTxCompressor(*tx, codec_version_t::v1), PROTOCOL_VERSION));
+        // v2 without any context is v1
+        BOOST_CHECK_EQUAL(GetSerializeSize(CTxCompressor(*tx, codec_version_t::v2), PROTOCOL_VERSION),
+                          GetSerializeSize(CTxCompressor(*tx, codec_version_t::v1), PROTOCOL_VERSION));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(kn_coding)
 {
     BOOST_CHECK(KNCoder(0, 0) == 3);
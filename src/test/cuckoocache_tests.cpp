@@ -112,6 +112,17 @@ BOOST_AUTO_TEST_CASE(cuckoocache_hit_rate_ok)
     }
 }
 
+/** Check that spreading elements over shards keeps the hit rate up */
+BOOST_AUTO_TEST_CASE(cuckoocache_sharded_hit_rate_ok)
+{
+    double HitRateThresh = 0.98;
+    size_t megabytes = 4;
+    for (double load = 0.1; load < 2; load *= 2) {
+        double hits = test_cache<ShardedCuckooCache<uint256, SignatureCacheHasher>>(megabytes, load);
+        BOOST_CHECK(normalize_hit_rate(hits, load) > HitRateThresh);
+    }
+}
+
 
 /** This helper checks that erased elements are preferentially inserted onto and
  * that the hit rate of "fresher" keys is reasonable*/
@@ -178,6 +189,12 @@ BOOST_AUTO_TEST_CASE(cuckoocache_erase_ok)
     test_cache_erase<CuckooCache::cache<uint256, SignatureCacheHasher>>(megabytes);
 }
 
+BOOST_AUTO_TEST_CASE(cuckoocache_sharded_erase_ok)
+{
+    size_t megabytes = 4;
+    test_cache_erase<ShardedCuckooCache<uint256, SignatureCacheHasher>>(megabytes);
+}
+
 template <typename Cache>
 static void test_cache_erase_parallel(size_t megabytes)
 {
@@ -267,6 +284,12 @@ BOOST_AUTO_TEST_CASE(cuckoocache_erase_parallel_ok)
     test_cache_erase_parallel<CuckooCache::cache<uint256, SignatureCacheHasher>>(megabytes);
 }
 
+BOOST_AUTO_TEST_CASE(cuckoocache_sharded_erase_parallel_ok)
+{
+    size_t megabytes = 4;
+    test_cache_erase_parallel<ShardedCuckooCache<uint256, SignatureCacheHasher>>(megabytes);
+}
+
 
 template <typename Cache>
 static void test_cache_generations()
@@ -7,6 +7,7 @@
 #include <test/setup_common.h>
 #include <util/memory.h>
 
+#include <map>
 #include <memory>
 
 #include <boost/test/unit_test.hpp>
@@ -79,6 +80,41 @@ BOOST_AUTO_TEST_CASE(dbwrapper_batch)
     }
 }
 
+// Test batched reads of many keys
+BOOST_AUTO_TEST_CASE(dbwrapper_readmany)
+{
+    for (const bool obfuscate : {false, true}) {
+        fs::path ph = GetDataDir() / (obfuscate ? "dbwrapper_readmany_obfuscate_true" : "dbwrapper_readmany_obfuscate_false");
+        CDBWrapper dbw(ph, (1 << 20), true, false, obfuscate);
+
+        // Every other key is present; a few values don't deserialize as uint256
+        std::vector<uint32_t> keys;
+        std::map<uint32_t, uint256> values;
+        CDBBatch batch(dbw);
+        for (uint32_t i = 0; i < 2000; i++) {
+            keys.push_back(InsecureRand32());
+            if (i % 2 == 0) {
+                values[keys.back()] = InsecureRand256();
+                batch.Write(keys.back(), values[keys.back()]);
+            } else if (i % 101 == 0) {
+                batch.Write(keys.back(), uint8_t(1));
+            }
+        }
+        BOOST_CHECK(dbw.WriteBatch(batch));
+
+        std::vector<uint256> res;
+        std::vector<bool> found;
+        BOOST_CHECK_EQUAL(dbw.ReadMany(keys, res, found), values.size());
+        BOOST_REQUIRE_EQUAL(res.size(), keys.size());
+        BOOST_REQUIRE_EQUAL(found.size(), keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            auto it = values.find(keys[i]);
+            BOOST_CHECK_EQUAL(found[i], it != values.end());
+            if (found[i]) BOOST_CHECK_EQUAL(res[i].ToString(), it->second.ToString());
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(dbwrapper_iterator)
 {
     // Perform tests both obfuscated and non-obfuscated.
@@ -0,0 +1,82 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <boost/test/unit_test.hpp>
+#include <fec.h>
+#include <test/setup_common.h>
+
+BOOST_FIXTURE_TEST_SUITE(fec_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(test_fixed_overhead_policy)
+{
+    // Default policy: 60 chunks plus 5% of the object's chunks
+    FECOverheadPolicy policy;
+    BOOST_CHECK(!policy.IsLossModel());
+    BOOST_CHECK_EQUAL(policy.GetOverhead(1), 60U);
+    BOOST_CHECK_EQUAL(policy.GetOverhead(100), 65U);
+    BOOST_CHECK_EQUAL(policy.GetOverhead(2000), 160U);
+
+    FECOverheadPolicy custom(10, 0.5);
+    BOOST_CHECK_EQUAL(custom.GetOverhead(100), 60U);
+}
+
+BOOST_AUTO_TEST_CASE(test_decode_failure_prob)
+{
+    // Sending fewer chunks than the object size never decodes
+    BOOST_CHECK_EQUAL(FECDecodeFailureProb(10, 9, 0), 1.0);
+    BOOST_CHECK_EQUAL(FECDecodeFailureProb(100, 99, 0.1), 1.0);
+
+    // cm256 (and repetition) is MDS
+    BOOST_CHECK_EQUAL(FECDecodeFailureProb(1, 1, 0), 0.0);
+    BOOST_CHECK_EQUAL(FECDecodeFailureProb(CM256_MAX_CHUNKS, CM256_MAX_CHUNKS, 0), 0.0);
+
+    // A single chunk sent twice is lost twice with probability p^2
+    BOOST_CHECK_CLOSE(FECDecodeFailureProb(1, 2, 0.1), 0.01, 1e-6);
+
+    // wirehair needs N + 0.02 chunks on average
+    BOOST_CHECK_CLOSE(FECDecodeFailureProb(1000, 1000, 0), WIREHAIR_EXTRA_CHUNK_FAIL_PROB, 1e-6);
+    BOOST_CHECK_CLOSE(FECDecodeFailureProb(1000, 1001, 0), WIREHAIR_EXTRA_CHUNK_FAIL_PROB * WIREHAIR_EXTRA_CHUNK_FAIL_PROB, 1e-6);
+
+    // Non-increasing on the number of chunks sent
+    double last = 1;
+    for (size_t n = 100; n < 200; n++) {
+        const double fail_prob = FECDecodeFailureProb(100, n, 0.1);
+        BOOST_CHECK(fail_prob <= last);
+        last = fail_prob;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_loss_model_overhead_policy)
+{
+    const double target = 1e-6;
+
+    // No loss: MDS objects need no overhead, wirehair only a few chunks
+    const FECOverheadPolicy lossless = FECOverheadPolicy::LossModel(0, target);
+    BOOST_CHECK(lossless.IsLossModel());
+    BOOST_CHECK_EQUAL(lossless.GetOverhead(1), 0U);
+    BOOST_CHECK_EQUAL(lossless.GetOverhead(CM256_MAX_CHUNKS), 0U);
+    BOOST_CHECK_EQUAL(lossless.GetOverhead(CM256_MAX_CHUNKS + 1), 3U); // 0.02^4 <= 1e-6 < 0.02^3
+
+    // The overhead is the minimum meeting the target
+    const double loss_rate = 0.01;
+    const FECOverheadPolicy policy = FECOverheadPolicy::LossModel(loss_rate, target);
+    for (size_t n_chunks : {1, 3, 27, 28, 500, 2000}) {
+        const size_t overhead = policy.GetOverhead(n_chunks);
+        BOOST_CHECK(FECDecodeFailureProb(n_chunks, n_chunks + overhead, loss_rate) <= target);
+        BOOST_CHECK(overhead == 0 || FECDecodeFailureProb(n_chunks, n_chunks + overhead - 1, loss_rate) > target);
+    }
+
+    // Small objects are much less protected than by the fixed policy
+    BOOST_CHECK(policy.GetOverhead(3) < FECOverheadPolicy().GetOverhead(3));
+
+    // More loss requires more overhead
+    const FECOverheadPolicy lossy = FECOverheadPolicy::LossModel(0.1, target);
+    BOOST_CHECK(lossy.GetOverhead(2000) > policy.GetOverhead(2000));
+
+    // cm256 cannot send more than 0xff - N distinct chunks
+    const FECOverheadPolicy very_lossy = FECOverheadPolicy::LossModel(0.9, 1e-9);
+    BOOST_CHECK_EQUAL(very_lossy.GetOverhead(CM256_MAX_CHUNKS), 0xffU - 2 * CM256_MAX_CHUNKS);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
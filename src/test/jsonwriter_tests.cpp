@@ -0,0 +1,264 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <core_io.h>
+#include <jsonwriter.h>
+#include <primitives/block.h>
+#include <rpc/blockchain.h>
+#include <rpc/server.h>
+#include <test/setup_common.h>
+#include <txmempool.h>
+#include <util/rbf.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <univalue.h>
+
+#include <limits>
+
+BOOST_FIXTURE_TEST_SUITE(jsonwriter_tests, TestingSetup)
+
+//! Everything written, and the sizes of the chunks it came in
+struct StreamedText {
+    std::string text;
+    std::vector<size_t> chunks;
+
+    JSONStreamWriter::Sink Sink()
+    {
+        return [this](const char* data, size_t size) {
+            text.append(data, size);
+            chunks.push_back(size);
+        };
+    }
+};
+
+static void WriteDocument(JSONWriter& w)
+{
+    w.BeginObject();
+    w.PushKV("str", std::string("quote\" backslash\\ controls\b\f\n\r\t\x01\x1f\x7f utf8 \xc3\xa9"));
+    w.PushKV("int", -5);
+    w.PushKV("uint", std::numeric_limits<uint64_t>::max());
+    w.PushKV("int64", std::numeric_limits<int64_t>::min());
+    w.PushKV("true", true);
+    w.PushKV("false", false);
+    w.PushKV("double", 0.1);
+    w.PushKV("amount", ValueFromAmount(-123456789));
+    w.PushKV("null", NullUniValue);
+    w.Key("empty object");
+    w.BeginObject();
+    w.EndObject();
+    w.Key("empty array");
+    w.BeginArray();
+    w.EndArray();
+    w.Key("nested");
+    w.BeginArray();
+    w.String("a");
+    w.BeginObject();
+    w.PushKV("b", 1);
+    w.Key("c");
+    w.BeginArray();
+    w.Int(2);
+    w.UInt(3);
+    w.EndArray();
+    w.EndObject();
+    w.BeginArray();
+    w.EndArray();
+    w.Bool(true);
+    w.EndArray();
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("k", "v");
+    obj.pushKV("a", UniValue(UniValue::VARR));
+    w.PushKV("univalue", obj);
+    w.EndObject();
+}
+
+BOOST_AUTO_TEST_CASE(stream_matches_univalue)
+{
+    UniValue built;
+    UniValueWriter builder(built);
+    WriteDocument(builder);
+    BOOST_CHECK(built.isObject());
+
+    StreamedText streamed;
+    JSONStreamWriter writer(streamed.Sink());
+    WriteDocument(writer);
+    writer.Flush();
+
+    BOOST_CHECK_EQUAL(streamed.text, built.write());
+    UniValue parsed;
+    BOOST_CHECK(parsed.read(streamed.text));
+    BOOST_CHECK_EQUAL(parsed.write(), built.write());
+    BOOST_CHECK_EQUAL(parsed["str"].get_str(), std::string("quote\" backslash\\ controls\b\f\n\r\t\x01\x1f\x7f utf8 \xc3\xa9"));
+}
+
+BOOST_AUTO_TEST_CASE(stream_chunks)
+{
+    StreamedText whole;
+    JSONStreamWriter whole_writer(whole.Sink());
+    WriteDocument(whole_writer);
+    // Nothing is handed on until the end, as it is under a chunk
+    BOOST_CHECK(whole.chunks.empty());
+    whole_writer.Raw("\n");
+    whole_writer.Flush();
+    BOOST_CHECK_EQUAL(whole.chunks.size(), 1U);
+    whole_writer.Flush();
+    BOOST_CHECK_EQUAL(whole.chunks.size(), 1U);
+
+    StreamedText chunked;
+    JSONStreamWriter chunked_writer(chunked.Sink(), 16);
+    WriteDocument(chunked_writer);
+    chunked_writer.Raw("\n");
+    chunked_writer.Flush();
+    BOOST_CHECK_EQUAL(chunked.text, whole.text);
+    BOOST_CHECK(chunked.chunks.size() > 5);
+    for (size_t i = 0; i + 1 < chunked.chunks.size(); i++) {
+        BOOST_CHECK(chunked.chunks[i] >= 16);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(univalue_writer_root)
+{
+    // Members go into an object given as the root, after those in it
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("first", 1);
+    UniValueWriter obj_writer(obj);
+    obj_writer.PushKV("second", 2);
+    obj_writer.Key("third");
+    obj_writer.BeginArray();
+    obj_writer.String("x");
+    obj_writer.EndArray();
+    BOOST_CHECK_EQUAL(obj.write(), "{\"first\":1,\"second\":2,\"third\":[\"x\"]}");
+
+    UniValue arr(UniValue::VARR);
+    UniValueWriter arr_writer(arr);
+    arr_writer.Int(1);
+    arr_writer.BeginObject();
+    arr_writer.EndObject();
+    BOOST_CHECK_EQUAL(arr.write(), "[1,{}]");
+
+    UniValue str;
+    UniValueWriter str_writer(str);
+    str_writer.String("s");
+    BOOST_CHECK_EQUAL(str.write(), "\"s\"");
+}
+
+static CBlock BuildBlock()
+{
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50 * COIN;
+    coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+    CMutableTransaction spend;
+    spend.vin.resize(2);
+    spend.vin[0].prevout = COutPoint(InsecureRand256(), 3);
+    spend.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 0x30);
+    spend.vin[1].prevout = COutPoint(InsecureRand256(), 0);
+    spend.vin[1].scriptWitness.stack.push_back(std::vector<unsigned char>(71, 0x30));
+    spend.vin[1].scriptWitness.stack.push_back(std::vector<unsigned char>(33, 0x02));
+    spend.vout.resize(2);
+    spend.vout[0].nValue = 12345;
+    spend.vout[0].scriptPubKey = CScript() << OP_0 << std::vector<unsigned char>(20, 0x01);
+    spend.vout[1].nValue = 0;
+    spend.vout[1].scriptPubKey = CScript() << OP_RETURN << std::vector<unsigned char>(10, 0x0a);
+
+    CBlock block;
+    block.nVersion = 0x20000000;
+    block.nBits = 0x207fffff;
+    block.nTime = 1500000000;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    block.vtx.push_back(MakeTransactionRef(spend));
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(block_and_tx_stream_matches_univalue)
+{
+    const CBlock block = BuildBlock();
+    const uint256 hash = block.GetHash();
+    CBlockIndex blockindex(block);
+    blockindex.phashBlock = &hash;
+
+    for (bool tx_details : {false, true}) {
+        StreamedText streamed;
+        JSONStreamWriter writer(streamed.Sink(), 100);
+        writer.BeginObject();
+        blockToJSON(writer, block, &blockindex, &blockindex, tx_details);
+        writer.EndObject();
+        writer.Flush();
+        BOOST_CHECK_EQUAL(streamed.text, blockToJSON(block, &blockindex, &blockindex, tx_details).write());
+    }
+
+    const CTransaction& tx = *block.vtx[1];
+    StreamedText streamed;
+    JSONStreamWriter writer(streamed.Sink());
+    writer.BeginObject();
+    TxToUniv(tx, hash, writer);
+    writer.EndObject();
+    writer.Flush();
+    UniValue entry(UniValue::VOBJ);
+    TxToUniv(tx, hash, entry);
+    BOOST_CHECK_EQUAL(streamed.text, entry.write());
+    BOOST_CHECK_EQUAL(entry["vin"][1]["txinwitness"].size(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(mempool_stream_matches_univalue)
+{
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction parent;
+    parent.vin.resize(1);
+    parent.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+    parent.vin[0].nSequence = MAX_BIP125_RBF_SEQUENCE;
+    parent.vout.resize(2);
+    parent.vout[0].nValue = parent.vout[1].nValue = 5 * COIN;
+    CMutableTransaction child;
+    child.vin.resize(2);
+    child.vin[0].prevout = COutPoint(parent.GetHash(), 0);
+    child.vin[1].prevout = COutPoint(parent.GetHash(), 1);
+    child.vout.resize(1);
+    child.vout[0].nValue = 9 * COIN;
+    {
+        LOCK2(cs_main, ::mempool.cs);
+        ::mempool.addUnchecked(entry.Fee(10000).FromTx(parent));
+        ::mempool.addUnchecked(entry.Fee(20000).FromTx(child));
+    }
+
+    const std::string expected = MempoolToJSON(::mempool, true).write();
+    BOOST_CHECK(expected.find(child.GetHash().ToString()) != std::string::npos);
+
+    StreamedText streamed;
+    JSONStreamWriter writer(streamed.Sink(), 64);
+    writer.BeginObject();
+    MempoolToJSON(writer, ::mempool);
+    writer.EndObject();
+    writer.Flush();
+    BOOST_CHECK_EQUAL(streamed.text, expected);
+
+    // Servers that can stream the result are handed a writer instead
+    JSONRPCRequest request;
+    request.strMethod = "getrawmempool";
+    request.params = UniValue(UniValue::VARR);
+    request.params.push_back(UniValue(true));
+    request.result_writer = std::make_shared<std::function<void(JSONWriter&)>>();
+    if (RPCIsInWarmup(nullptr)) SetRPCWarmupFinished();
+    BOOST_CHECK(tableRPC.execute(request).isNull());
+    BOOST_REQUIRE(*request.result_writer);
+    StreamedText rpc_streamed;
+    JSONStreamWriter rpc_writer(rpc_streamed.Sink());
+    (*request.result_writer)(rpc_writer);
+    rpc_writer.Flush();
+    BOOST_CHECK_EQUAL(rpc_streamed.text, expected);
+
+    // and others the result as before
+    request.result_writer.reset();
+    BOOST_CHECK_EQUAL(tableRPC.execute(request).write(), expected);
+
+    LOCK(::mempool.cs);
+    ::mempool.clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -751,4 +751,85 @@ BOOST_AUTO_TEST_CASE(MempoolAncestryTests)
     BOOST_CHECK_EQUAL(descendants, 6ULL);
 }
 
+
+//! Check that two pools hold the same transactions with the same ancestor and descendant state
+static void CheckSameGraph(const CTxMemPool& pool, const CTxMemPool& expected) EXCLUSIVE_LOCKS_REQUIRED(pool.cs, expected.cs)
+{
+    BOOST_CHECK_EQUAL(pool.size(), expected.size());
+    for (const CTxMemPoolEntry& e : expected.mapTx) {
+        auto it = pool.mapTx.find(e.GetTx().GetHash());
+        BOOST_REQUIRE(it != pool.mapTx.end());
+        BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), e.GetCountWithAncestors());
+        BOOST_CHECK_EQUAL(it->GetSizeWithAncestors(), e.GetSizeWithAncestors());
+        BOOST_CHECK_EQUAL(it->GetModFeesWithAncestors(), e.GetModFeesWithAncestors());
+        BOOST_CHECK_EQUAL(it->GetSigOpCostWithAncestors(), e.GetSigOpCostWithAncestors());
+        BOOST_CHECK_EQUAL(it->GetCountWithDescendants(), e.GetCountWithDescendants());
+        BOOST_CHECK_EQUAL(it->GetSizeWithDescendants(), e.GetSizeWithDescendants());
+        BOOST_CHECK_EQUAL(it->GetModFeesWithDescendants(), e.GetModFeesWithDescendants());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MempoolReorgUpdateTest)
+{
+    TestMemPoolEntryHelper entry;
+
+    // [b1] <- [b2] were in a block being disconnected, while their
+    // descendants stayed in the mempool:
+    //
+    // [b1].0 <- [b2].0 <- [c2] <- [c3]
+    // [b1].1 <- [c1].0 <-/
+    // [b1].2 <-----------/
+    CTransactionRef b1 = make_tx(/* output_values */ {10 * COIN, 10 * COIN, 10 * COIN});
+    CTransactionRef b2 = make_tx(/* output_values */ {9 * COIN}, /* inputs */ {b1});
+    CTransactionRef c1 = make_tx(/* output_values */ {9 * COIN}, /* inputs */ {b1}, /* input_indices */ {1});
+    CTransactionRef c2 = make_tx(/* output_values */ {25 * COIN}, /* inputs */ {b2, c1, b1}, /* input_indices */ {0, 0, 2});
+    CTransactionRef c3 = make_tx(/* output_values */ {24 * COIN}, /* inputs */ {c2});
+    const std::vector<std::pair<CTransactionRef, CAmount>> in_order{{b1, 1000}, {b2, 2000}, {c1, 3000}, {c2, 4000}, {c3, 5000}};
+
+    CTxMemPool pool, expected;
+    LOCK2(cs_main, pool.cs);
+    LOCK(expected.cs);
+    for (const auto& tx : in_order) {
+        expected.addUnchecked(entry.Fee(tx.second).FromTx(tx.first));
+    }
+
+    // The descendants are accepted first, the disconnected transactions added
+    // back afterwards as if they had no children
+    for (size_t i = 2; i < in_order.size(); i++) {
+        pool.addUnchecked(entry.Fee(in_order[i].second).FromTx(in_order[i].first));
+    }
+    for (size_t i = 0; i < 2; i++) {
+        pool.addUnchecked(entry.Fee(in_order[i].second).FromTx(in_order[i].first));
+    }
+    pool.UpdateTransactionsFromBlock({b1->GetHash(), b2->GetHash()});
+    CheckSameGraph(pool, expected);
+
+    size_t ancestors, descendants;
+    pool.GetTransactionAncestry(b1->GetHash(), ancestors, descendants);
+    BOOST_CHECK_EQUAL(ancestors, 1ULL);
+    BOOST_CHECK_EQUAL(descendants, 5ULL);
+    pool.GetTransactionAncestry(c3->GetHash(), ancestors, descendants);
+    BOOST_CHECK_EQUAL(ancestors, 5ULL);
+    // The most descendants of any of its ancestors without parents, b1
+    BOOST_CHECK_EQUAL(descendants, 5ULL);
+
+    // Confirming b1 again leaves everything else in place
+    pool.removeForBlock({b1}, 1);
+    expected.removeForBlock({b1}, 1);
+    CheckSameGraph(pool, expected);
+    pool.GetTransactionAncestry(c3->GetHash(), ancestors, descendants);
+    BOOST_CHECK_EQUAL(ancestors, 4ULL);
+
+    // Limits are checked across the whole graph
+    CTxMemPool::setEntries setAncestors;
+    std::string err;
+    CTransactionRef c4 = make_tx(/* output_values */ {23 * COIN}, /* inputs */ {c3});
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(entry.FromTx(c4), setAncestors, 5, 1000000, 5, 1000000, err));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 4U);
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entry.FromTx(c4), setAncestors, 4, 1000000, 5, 1000000, err));
+    BOOST_CHECK_EQUAL(err, "too many unconfirmed ancestors [limit: 4]");
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entry.FromTx(c4), setAncestors, 5, 1000000, 3, 1000000, err));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,98 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <boost/test/unit_test.hpp>
+#include <metrics.h>
+#include <test/setup_common.h>
+
+#include <thread>
+
+BOOST_FIXTURE_TEST_SUITE(metrics_tests, BasicTestingSetup)
+
+static bool Contains(const std::string& text, const std::string& line)
+{
+    return text.find(line + "\n") != std::string::npos;
+}
+
+BOOST_AUTO_TEST_CASE(test_counter_across_threads)
+{
+    metrics::Counter counter("test_counter_total", "Test counter");
+    const int n_threads = 8;
+    const int n_incs = 10000;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n_threads; i++)
+        threads.emplace_back([&counter] {
+            for (int j = 0; j < n_incs; j++)
+                counter.Inc();
+        });
+    for (std::thread& t : threads)
+        t.join();
+
+    BOOST_CHECK_EQUAL(counter.Value(), (uint64_t)n_threads * n_incs);
+    counter.Inc(5);
+    BOOST_CHECK_EQUAL(counter.Value(), (uint64_t)n_threads * n_incs + 5);
+
+    // Scraping does not reset the counter
+    metrics::RenderAll();
+    BOOST_CHECK_EQUAL(counter.Value(), (uint64_t)n_threads * n_incs + 5);
+}
+
+BOOST_AUTO_TEST_CASE(test_gauge)
+{
+    metrics::Gauge gauge("test_gauge", "Test gauge");
+    gauge.Inc(10);
+    gauge.Dec(3);
+    BOOST_CHECK_EQUAL(gauge.Value(), 7);
+    gauge.Set(-2);
+    BOOST_CHECK_EQUAL(gauge.Value(), -2);
+
+    int value = 42;
+    metrics::Gauge callback_gauge("test_callback_gauge", "Test callback gauge", [&value] { return value; });
+    BOOST_CHECK_EQUAL(callback_gauge.Value(), 42);
+    value = 43;
+    BOOST_CHECK_EQUAL(callback_gauge.Value(), 43);
+}
+
+BOOST_AUTO_TEST_CASE(test_histogram)
+{
+    metrics::Histogram histogram("test_latency_seconds", "Test histogram", {0.1, 1, 10});
+    for (double value : {0.05, 0.1, 0.5, 5.0, 50.0})
+        histogram.Observe(value);
+    BOOST_CHECK_EQUAL(histogram.Count(), 5U);
+    BOOST_CHECK_CLOSE(histogram.Sum(), 55.65, 1e-9);
+
+    // Buckets are cumulative and inclusive of their upper bound
+    const std::string text = metrics::RenderAll();
+    BOOST_CHECK(Contains(text, "# TYPE test_latency_seconds histogram"));
+    BOOST_CHECK(Contains(text, "test_latency_seconds_bucket{le=\"0.1\"} 2"));
+    BOOST_CHECK(Contains(text, "test_latency_seconds_bucket{le=\"1\"} 3"));
+    BOOST_CHECK(Contains(text, "test_latency_seconds_bucket{le=\"10\"} 4"));
+    BOOST_CHECK(Contains(text, "test_latency_seconds_bucket{le=\"+Inf\"} 5"));
+    BOOST_CHECK(Contains(text, "test_latency_seconds_count 5"));
+}
+
+BOOST_AUTO_TEST_CASE(test_render_families)
+{
+    {
+        metrics::Gauge depth0("test_queue_depth", "Test queue depth", "buffer=\"0\"");
+        metrics::Gauge depth1("test_queue_depth", "Test queue depth", "buffer=\"1\"");
+        metrics::Counter other("test_other_total", "Other");
+        depth0.Set(3);
+        depth1.Set(4);
+
+        // A single header per family, followed by all of its samples
+        const std::string text = metrics::RenderAll();
+        const size_t help = text.find("# HELP test_queue_depth Test queue depth\n");
+        BOOST_CHECK(help != std::string::npos);
+        BOOST_CHECK(text.find("# HELP test_queue_depth", help + 1) == std::string::npos);
+        BOOST_CHECK(Contains(text, "# TYPE test_queue_depth gauge\ntest_queue_depth{buffer=\"0\"} 3\ntest_queue_depth{buffer=\"1\"} 4"));
+        BOOST_CHECK(Contains(text, "test_other_total 0"));
+    }
+
+    // Metrics unregister on destruction
+    BOOST_CHECK(metrics::RenderAll().find("test_queue_depth") == std::string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
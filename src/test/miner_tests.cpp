@@ -7,6 +7,8 @@
 #include <consensus/consensus.h>
 #include <consensus/merkle.h>
 #include <consensus/tx_verify.h>
+#include <consensus/validation.h>
+#include <key.h>
 #include <miner.h>
 #include <policy/policy.h>
 #include <script/standard.h>
@@ -16,6 +18,7 @@
 #include <util/system.h>
 #include <util/time.h>
 #include <validation.h>
+#include <validationinterface.h>
 
 #include <test/setup_common.h>
 
@@ -200,6 +203,57 @@ static void TestPackageSelection(const CChainParams& chainparams, const CScript&
     BOOST_CHECK(pblocktemplate->block.vtx[8]->GetHash() == hashLowFeeTx2);
 }
 
+static void TestSeedTxsSelection(const CChainParams& chainparams, const CScript& scriptPubKey, const std::vector<CTransactionRef>& txFirst) EXCLUSIVE_LOCKS_REQUIRED(cs_main, ::mempool.cs)
+{
+    // Test that the children of seeded transactions are scored without them
+    TestMemPoolEntryHelper entry;
+    mempool.clear();
+
+    // A high fee transaction, to be seeded
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(2);
+    tx.vout[0].nValue = 2500000000LL;
+    tx.vout[1].nValue = 2500000000LL - 1000000;
+    const CTransactionRef parent = MakeTransactionRef(tx);
+    mempool.addUnchecked(entry.Fee(1000000).Time(GetTime()).SpendsCoinbase(true).FromTx(tx));
+    const size_t tx_size = ::GetSerializeSize(tx, PROTOCOL_VERSION);
+
+    // A child of it below the block min tx fee, which only makes it with its parent counted
+    tx.vin[0].prevout = COutPoint(parent->GetHash(), 0);
+    tx.vout.resize(1);
+    CAmount fee = blockMinFeeRate.GetFee(tx_size) / 2;
+    tx.vout[0].nValue = 2500000000LL - fee;
+    const uint256 hashLowFeeChild = tx.GetHash();
+    mempool.addUnchecked(entry.Fee(fee).SpendsCoinbase(false).FromTx(tx));
+
+    // Another child, just above the block min tx fee, which should come after
+    tx.vin[0].prevout = COutPoint(parent->GetHash(), 1);
+    fee = blockMinFeeRate.GetFee(tx_size) * 2;
+    tx.vout[0].nValue = 2500000000LL - 1000000 - fee;
+    const uint256 hashChild = tx.GetHash();
+    mempool.addUnchecked(entry.Fee(fee).FromTx(tx));
+
+    // an unrelated transaction with a higher feerate than it
+    tx.vin[0].prevout = COutPoint(txFirst[1]->GetHash(), 0);
+    tx.vout[0].nValue = 5000000000LL - 10000;
+    const uint256 hashMediumFeeTx = tx.GetHash();
+    mempool.addUnchecked(entry.Fee(10000).SpendsCoinbase(true).FromTx(tx));
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey, {parent});
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 4U);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == parent->GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHash() == hashMediumFeeTx);
+    BOOST_CHECK(pblocktemplate->block.vtx[3]->GetHash() == hashChild);
+    for (const CTransactionRef& block_tx : pblocktemplate->block.vtx) {
+        BOOST_CHECK(block_tx->GetHash() != hashLowFeeChild);
+    }
+    mempool.clear();
+}
+
 // NOTE: These tests rely on CreateNewBlock doing its own self-validation!
 BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 {
@@ -516,8 +570,97 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     mempool.clear();
 
     TestPackageSelection(chainparams, scriptPubKey, txFirst);
+    TestSeedTxsSelection(chainparams, scriptPubKey, txFirst);
 
     fCheckpointsEnabled = true;
 }
 
+static CMutableTransaction SpendForTemplate(const COutPoint& prevout, CAmount value, const CKey* key = nullptr, const CScript& script = CScript())
+{
+    // Paid to a standard script anyone can spend
+    const CScript redeem_script = CScript() << OP_TRUE;
+    CMutableTransaction tx;
+    tx.vin.emplace_back(prevout);
+    tx.vout.emplace_back(value, GetScriptForDestination(ScriptHash(redeem_script)));
+    if (!key) {
+        tx.vin[0].scriptSig << ToByteVector(redeem_script);
+    } else {
+        std::vector<unsigned char> sig;
+        BOOST_CHECK(key->Sign(SignatureHash(script, tx, 0, SIGHASH_ALL, 0, SigVersion::BASE), sig));
+        sig.push_back((unsigned char)SIGHASH_ALL);
+        tx.vin[0].scriptSig << sig;
+    }
+    return tx;
+}
+
+static bool ToMemPoolForTemplate(const CMutableTransaction& tx)
+{
+    LOCK(cs_main);
+    CValidationState state;
+    return AcceptToMemoryPool(mempool, state, MakeTransactionRef(tx), nullptr, nullptr, true, 0);
+}
+
+static std::shared_ptr<const CBlockTemplate> GetValidTemplate(BlockTemplateCache& cache)
+{
+    SyncWithValidationInterfaceQueue();
+    const CBlockIndex* tip;
+    unsigned int transactions_updated;
+    std::shared_ptr<const CBlockTemplate> block_template = cache.Get(tip, transactions_updated);
+    LOCK(cs_main);
+    BOOST_CHECK(tip == ::ChainActive().Tip());
+    CValidationState state;
+    BOOST_CHECK(TestBlockValidity(state, Params(), block_template->block, ::ChainActive().Tip(), false, false));
+    CAmount fees = 0;
+    for (size_t i = 1; i < block_template->vTxFees.size(); i++) {
+        fees += block_template->vTxFees[i];
+    }
+    BOOST_CHECK_EQUAL(block_template->block.vtx[0]->vout[0].nValue, fees + GetBlockSubsidy(tip->nHeight + 1, Params().GetConsensus()));
+    return block_template;
+}
+
+BOOST_FIXTURE_TEST_CASE(block_template_cache, TestChain100Setup)
+{
+    const CScript coinbase_script = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    // Deferred rebuilds are left to Get(), as this scheduler isn't serviced
+    CScheduler idle_scheduler;
+    BlockTemplateCache cache(Params(), idle_scheduler);
+    RegisterValidationInterface(&cache);
+    // Removals from the mempool are notified as they are on a running node
+    GetMainSignals().RegisterWithMempoolSignals(mempool);
+
+    std::shared_ptr<const CBlockTemplate> empty = GetValidTemplate(cache);
+    BOOST_CHECK_EQUAL(empty->block.vtx.size(), 1U);
+
+    // Transactions entering the mempool are appended, without changing templates handed out before
+    const CMutableTransaction parent = SpendForTemplate(COutPoint(m_coinbase_txns[0]->GetHash(), 0), 49 * COIN, &coinbaseKey, coinbase_script);
+    const CMutableTransaction child = SpendForTemplate(COutPoint(parent.GetHash(), 0), 48 * COIN);
+    BOOST_REQUIRE(ToMemPoolForTemplate(parent));
+    BOOST_REQUIRE(ToMemPoolForTemplate(child));
+    std::shared_ptr<const CBlockTemplate> block_template = GetValidTemplate(cache);
+    BOOST_CHECK_EQUAL(empty->block.vtx.size(), 1U);
+    BOOST_REQUIRE_EQUAL(block_template->block.vtx.size(), 3U);
+    BOOST_CHECK(block_template->block.vtx[1]->GetHash() == parent.GetHash());
+    BOOST_CHECK(block_template->block.vtx[2]->GetHash() == child.GetHash());
+    BOOST_CHECK_EQUAL(block_template->vTxFees[2], COIN);
+
+    // and taken out again when they leave it
+    {
+        LOCK(mempool.cs);
+        mempool.removeRecursive(CTransaction(parent), MemPoolRemovalReason::REPLACED);
+    }
+    BOOST_CHECK_EQUAL(GetValidTemplate(cache)->block.vtx.size(), 1U);
+
+    // What is left of the template on a new tip is kept
+    BOOST_REQUIRE(ToMemPoolForTemplate(parent));
+    BOOST_REQUIRE(ToMemPoolForTemplate(child));
+    BOOST_CHECK_EQUAL(GetValidTemplate(cache)->block.vtx.size(), 3U);
+    CreateAndProcessBlock({parent}, coinbase_script);
+    block_template = GetValidTemplate(cache);
+    BOOST_REQUIRE_EQUAL(block_template->block.vtx.size(), 2U);
+    BOOST_CHECK(block_template->block.vtx[1]->GetHash() == child.GetHash());
+
+    GetMainSignals().UnregisterWithMempoolSignals(mempool);
+    UnregisterValidationInterface(&cache);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -11,6 +11,8 @@
 #include <serialize.h>
 #include <streams.h>
 #include <net.h>
+#include <netmessagemaker.h>
+#include <net_processing.h>
 #include <netbase.h>
 #include <chainparams.h>
 #include <util/memory.h>
@@ -304,4 +306,197 @@ BOOST_AUTO_TEST_CASE(LocalAddress_BasicLifecycle)
 }
 
 
+BOOST_AUTO_TEST_CASE(shared_payload)
+{
+    CConnman connman(0x1337, 0x1337);
+    CAddress addr(CService(CNetAddr(), 8333), NODE_NONE);
+    CNode node1(0, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", false);
+    CNode node2(1, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", false);
+
+    const std::vector<unsigned char> bytes{1, 2, 3, 4, 5};
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    std::shared_ptr<const CSharedNetPayload> payload = msgMaker.SerializeShared(0, bytes);
+    connman.PushMessage(&node1, CNetMsgMaker::MakeShared(NetMsgType::PING, payload));
+    connman.PushMessage(&node2, CNetMsgMaker::MakeShared(NetMsgType::PING, payload));
+    connman.PushMessage(&node2, msgMaker.Make(NetMsgType::PING, bytes));
+
+    LOCK2(node1.cs_vSend, node2.cs_vSend);
+    BOOST_REQUIRE_EQUAL(node1.vSendMsg.size(), 1U);
+    BOOST_REQUIRE_EQUAL(node2.vSendMsg.size(), 2U);
+    // Both peers' queues refer to the same bytes
+    BOOST_CHECK(node1.vSendMsg[0].payload.data() == node2.vSendMsg[0].payload.data());
+    BOOST_CHECK_EQUAL(node1.vSendMsg[0].size(), CMessageHeader::HEADER_SIZE + 6);
+    BOOST_CHECK_EQUAL(node2.nSendSize, 2 * (CMessageHeader::HEADER_SIZE + 6));
+    // and have the same header as a message serialized for one of them
+    for (const CQueuedNetMsg& msg : node2.vSendMsg) {
+        BOOST_CHECK(std::equal(msg.header, msg.header + CMessageHeader::HEADER_SIZE, node1.vSendMsg[0].header));
+        BOOST_CHECK(std::equal(msg.payload.begin(), msg.payload.end(), payload->data.begin()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(recv_buffer_pool)
+{
+    CNetRecvBufferPool pool(8192);
+    CSerializeData buffer = pool.Get(100);
+    BOOST_CHECK_EQUAL(buffer.capacity(), 4096U);
+    const char* data = buffer.data();
+    buffer.resize(100);
+    pool.Put(std::move(buffer));
+    BOOST_CHECK_EQUAL(pool.KeptBytes(), 4096U);
+    // Reused for any size of its class, and empty
+    buffer = pool.Get(4096);
+    BOOST_CHECK(buffer.data() == data);
+    BOOST_CHECK(buffer.empty());
+    BOOST_CHECK_EQUAL(pool.KeptBytes(), 0U);
+
+    // Only as many bytes are kept as allowed
+    pool.Put(pool.Get(5000));
+    pool.Put(pool.Get(100));
+    BOOST_CHECK_EQUAL(pool.KeptBytes(), 8192U);
+    // and buffers larger than all classes aren't
+    CNetRecvBufferPool large_pool(100 << 20);
+    const size_t largest_class = size_t{1} << CNetRecvBufferPool::MAX_CLASS_BITS;
+    buffer = large_pool.Get(largest_class + 1);
+    BOOST_CHECK(buffer.capacity() > largest_class);
+    large_pool.Put(std::move(buffer));
+    BOOST_CHECK_EQUAL(large_pool.KeptBytes(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(receive_window)
+{
+    CAddress addr(CService(CNetAddr(), 8333), NODE_NONE);
+    CNode node(0, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", false);
+
+    std::vector<char> payload(300000);
+    for (size_t i = 0; i < payload.size(); i++)
+        payload[i] = i * 7;
+    CMessageHeader hdr(Params().MessageStart(), NetMsgType::BLOCK, payload.size());
+    CDataStream header(SER_NETWORK, PROTOCOL_VERSION);
+    header << hdr;
+
+    bool complete = false;
+    unsigned int size = 0;
+    BOOST_CHECK(!node.GetReceiveWindow(1, size));
+    BOOST_REQUIRE(node.ReceiveMsgBytes(header.data(), 10, complete));
+    BOOST_CHECK(!node.GetReceiveWindow(1, size));
+    BOOST_REQUIRE(node.ReceiveMsgBytes(header.data() + 10, header.size() - 10, complete));
+
+    // Bytes received into the window are taken in place, up to where it ends
+    char* window = node.GetReceiveWindow(0x10000, size);
+    BOOST_REQUIRE(window);
+    BOOST_CHECK_EQUAL(size, 256U * 1024);
+    memcpy(window, payload.data(), 100000);
+    BOOST_REQUIRE(node.ReceiveMsgBytes(window, 100000, complete));
+    BOOST_CHECK(!complete);
+    // Until too little of the payload is left
+    BOOST_CHECK(!node.GetReceiveWindow(200001, size));
+    window = node.GetReceiveWindow(200000, size);
+    BOOST_REQUIRE(window);
+    BOOST_CHECK_EQUAL(size, 200000U);
+    memcpy(window, payload.data() + 100000, 150000);
+    BOOST_REQUIRE(node.ReceiveMsgBytes(window, 150000, complete));
+    BOOST_CHECK(!node.GetReceiveWindow(50001, size));
+    // which is copied as before, along with the next message
+    std::vector<char> rest(payload.begin() + 250000, payload.end());
+    rest.insert(rest.end(), header.begin(), header.end());
+    BOOST_REQUIRE(node.ReceiveMsgBytes(rest.data(), rest.size(), complete));
+    BOOST_CHECK(complete);
+
+    std::list<CNetMessage> msgs;
+    BOOST_CHECK_EQUAL(node.TakeCompleteMsgs(msgs), payload.size() + CMessageHeader::HEADER_SIZE);
+    BOOST_REQUIRE_EQUAL(msgs.size(), 1U);
+    const CNetMessage& msg = msgs.front();
+    BOOST_CHECK(msg.complete());
+    BOOST_REQUIRE_EQUAL(msg.vRecv.size(), payload.size());
+    BOOST_CHECK(std::equal(msg.vRecv.begin(), msg.vRecv.end(), payload.begin()));
+    BOOST_CHECK(msg.GetMessageHash() == Hash(payload.begin(), payload.end()));
+}
+
+BOOST_AUTO_TEST_CASE(receive_buffer_growth)
+{
+    CNetMessage msg(Params().MessageStart(), SER_NETWORK, PROTOCOL_VERSION);
+    CMessageHeader hdr(Params().MessageStart(), NetMsgType::BLOCK, MAX_PROTOCOL_MESSAGE_LENGTH);
+    CDataStream header(SER_NETWORK, PROTOCOL_VERSION);
+    header << hdr;
+    BOOST_REQUIRE_EQUAL(msg.readHeader(header.data(), header.size()), (int)header.size());
+
+    // A header alone doesn't have room made for the payload it declares
+    std::vector<char> payload(1024 * 1024);
+    for (size_t i = 0; i < payload.size(); i++)
+        payload[i] = i * 13;
+    BOOST_REQUIRE_EQUAL(msg.readData(payload.data(), 1), 1);
+    BOOST_CHECK(msg.vRecv.capacity() <= 512U * 1024);
+
+    // and it grows with what is received, keeping what was
+    size_t pos = 1;
+    while (pos < payload.size()) {
+        const unsigned int size = std::min<size_t>(payload.size() - pos, 100000);
+        char* window = msg.DataWindow(size);
+        memcpy(window, payload.data() + pos, size);
+        BOOST_REQUIRE_EQUAL(msg.readData(window, size), (int)size);
+        pos += size;
+        BOOST_CHECK(msg.vRecv.capacity() <= 2 * (pos + 256 * 1024));
+    }
+    BOOST_CHECK(!msg.complete());
+    BOOST_REQUIRE_EQUAL(msg.vRecv.size(), payload.size());
+    BOOST_CHECK(std::equal(msg.vRecv.begin(), msg.vRecv.end(), payload.begin()));
+}
+
+BOOST_AUTO_TEST_CASE(tx_announcement_order)
+{
+    CTxMemPool pool;
+    TxAnnouncementOrder order;
+    std::set<uint256> pending;
+    TestMemPoolEntryHelper entry;
+    FastRandomContext rng(true);
+
+    // Chains of transactions, each paying a random fee
+    {
+        LOCK2(cs_main, pool.cs);
+        for (int chain = 0; chain < 10; chain++) {
+            COutPoint prevout(InsecureRand256(), 0);
+            for (int n = 0; n < 5; n++) {
+                CMutableTransaction tx;
+                tx.vin.emplace_back(prevout);
+                tx.vout.emplace_back(COIN, CScript() << OP_TRUE);
+                pool.addUnchecked(entry.Fee(1000 + rng.randrange(10000)).FromTx(tx));
+                prevout = COutPoint(tx.GetHash(), 0);
+                pending.insert(tx.GetHash());
+                if (chain < 8) order.Add(tx.GetHash(), 0);
+            }
+        }
+    }
+    // Transactions queued since the ranking was computed, or which aren't in the mempool, aren't ranked
+    const uint256 gone = InsecureRand256();
+    order.Add(gone, 0);
+    pending.insert(gone);
+    std::shared_ptr<const TxAnnouncementOrder::Ranking> ranking = order.GetRanking(pool, TxAnnouncementOrder::RANKING_INTERVAL);
+    BOOST_CHECK_EQUAL(ranking->size(), 40U);
+    // The ranking is kept for an interval
+    order.Add(InsecureRand256(), 0);
+    BOOST_CHECK(order.GetRanking(pool, TxAnnouncementOrder::RANKING_INTERVAL + 1) == ranking);
+    BOOST_CHECK(order.GetRanking(pool, 2 * TxAnnouncementOrder::RANKING_INTERVAL) != ranking);
+
+    // Announced in the order of the mempool, the ranked ones first, and once no longer
+    // pending, whether they passed the filter or not
+    std::set<uint256> pending_mempool_order = pending;
+    std::vector<TxMempoolInfo> announced = PopTxAnnouncements(pool, *ranking, pending, 45, [](const TxMempoolInfo& info) { return true; });
+    std::vector<TxMempoolInfo> unranked = PopTxAnnouncements(pool, TxAnnouncementOrder::Ranking(), pending_mempool_order, 50, [](const TxMempoolInfo& info) { return true; });
+    BOOST_CHECK_EQUAL(announced.size(), 45U);
+    BOOST_CHECK_EQUAL(unranked.size(), 50U);
+    BOOST_CHECK_EQUAL(pending.size(), 6U);
+    BOOST_CHECK_EQUAL(pending_mempool_order.size(), 1U);
+    std::set<uint256> seen;
+    for (size_t i = 0; i < announced.size(); i++) {
+        const CTransaction& tx = *announced[i].tx;
+        if (i < 40) BOOST_CHECK(ranking->count(tx.GetHash()));
+        // Parents before children
+        if (pool.exists(tx.vin[0].prevout.hash)) BOOST_CHECK(seen.count(tx.vin[0].prevout.hash));
+        seen.insert(tx.GetHash());
+    }
+    for (size_t i = 1; i < 40; i++) {
+        BOOST_CHECK(!pool.CompareDepthAndScore(announced[i].tx->GetHash(), announced[i - 1].tx->GetHash()));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -11,6 +11,9 @@
 
 #include <test/setup_common.h>
 
+#include <functional>
+#include <memory>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(policyestimator_tests, BasicTestingSetup)
@@ -181,4 +184,88 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     }
 }
 
+//! Check that two estimators give the same estimates, in full detail
+static void CheckSameEstimates(const CBlockPolicyEstimator& a, const CBlockPolicyEstimator& b)
+{
+    for (int target : {1, 2, 5, 12, 30, 48}) {
+        for (bool conservative : {false, true}) {
+            FeeCalculation calc_a, calc_b;
+            BOOST_CHECK(a.estimateSmartFee(target, &calc_a, conservative) == b.estimateSmartFee(target, &calc_b, conservative));
+            BOOST_CHECK(calc_a.reason == calc_b.reason);
+            BOOST_CHECK_EQUAL(calc_a.returnedTarget, calc_b.returnedTarget);
+            BOOST_CHECK_EQUAL(calc_a.est.pass.inMempool, calc_b.est.pass.inMempool);
+            BOOST_CHECK_EQUAL(calc_a.est.fail.leftMempool, calc_b.est.fail.leftMempool);
+        }
+        for (FeeEstimateHorizon horizon : {FeeEstimateHorizon::SHORT_HALFLIFE, FeeEstimateHorizon::MED_HALFLIFE, FeeEstimateHorizon::LONG_HALFLIFE}) {
+            EstimationResult result_a, result_b;
+            BOOST_CHECK(a.estimateRawFee(target, 0.85, horizon, &result_a) == b.estimateRawFee(target, 0.85, horizon, &result_b));
+            BOOST_CHECK_EQUAL(result_a.fail.inMempool, result_b.fail.inMempool);
+            BOOST_CHECK_EQUAL(result_a.fail.leftMempool, result_b.fail.leftMempool);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(BlockPolicyEstimatesBetweenUpdates)
+{
+    // Estimates asked for after every update, which come from copies of the
+    // data made at various points, are the same as those of an estimator
+    // given the same updates but only asked once
+    CBlockPolicyEstimator feeEst;
+    TestMemPoolEntryHelper entry;
+    std::vector<CTxMemPoolEntry> entries;
+    entries.reserve(40 * 20);
+    std::vector<size_t> pending;
+    // Updates so far: a transaction entering or leaving the mempool, or a block
+    std::vector<std::function<void(CBlockPolicyEstimator&)>> updates;
+    auto update = [&](std::function<void(CBlockPolicyEstimator&)> f) {
+        f(feeEst);
+        updates.push_back(std::move(f));
+        FeeCalculation calc;
+        feeEst.estimateSmartFee(10, &calc, false);
+    };
+    auto check = [&]() {
+        CBlockPolicyEstimator replayed;
+        for (const auto& f : updates)
+            f(replayed);
+        CheckSameEstimates(feeEst, replayed);
+    };
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+
+    for (int height = 0; height < 40; height++) {
+        for (int n = 0; n < 20; n++) {
+            tx.vin[0].prevout.n = entries.size();
+            entries.push_back(entry.Fee(1000 * (1 + n)).Height(height).FromTx(tx));
+            const CTxMemPoolEntry* added = &entries.back();
+            update([added](CBlockPolicyEstimator& est) { est.processTransaction(*added, true); });
+            pending.push_back(entries.size() - 1);
+        }
+        // Some of the better paying transactions are mined
+        auto block = std::make_shared<std::vector<const CTxMemPoolEntry*>>();
+        for (auto it = pending.begin(); it != pending.end();) {
+            if (entries[*it].GetFee() > 10000 && (height + *it) % 3 == 0) {
+                block->push_back(&entries[*it]);
+                it = pending.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        update([block, height](CBlockPolicyEstimator& est) { est.processBlock(height + 1, *block); });
+        check();
+
+        // and the rest leaves the mempool unmined some blocks later
+        for (auto it = pending.begin(); it != pending.end();) {
+            if (entries[*it].GetHeight() + 5 <= (unsigned int)height) {
+                const uint256 hash = entries[*it].GetTx().GetHash();
+                update([hash](CBlockPolicyEstimator& est) { est.removeTx(hash, false); });
+                it = pending.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        check();
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
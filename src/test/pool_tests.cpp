@@ -0,0 +1,115 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <boost/test/unit_test.hpp>
+#include <coins.h>
+#include <memusage.h>
+#include <support/allocators/pool.h>
+#include <test/setup_common.h>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(basic_allocate_deallocate)
+{
+    PoolResource<32, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.ChunkSizeBytes(), 1024U);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0U);
+
+    // Blocks are carved one after another out of the same chunk
+    void* a = resource.Allocate(8, 8);
+    void* b = resource.Allocate(8, 8);
+    BOOST_CHECK_EQUAL((char*)b - (char*)a, 8);
+    void* c = resource.Allocate(17, 8);
+    BOOST_CHECK_EQUAL((char*)c - (char*)b, 8);
+    void* d = resource.Allocate(8, 8);
+    BOOST_CHECK_EQUAL((char*)d - (char*)c, 24);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+
+    // Freed blocks are reused by allocations of the same size only
+    resource.Deallocate(b, 8, 8);
+    resource.Deallocate(c, 17, 8);
+    BOOST_CHECK(resource.Allocate(24, 8) == c);
+    BOOST_CHECK(resource.Allocate(8, 8) == b);
+    BOOST_CHECK(resource.Allocate(8, 8) != b);
+
+    // Large or overaligned blocks do not come from the pool
+    void* large = resource.Allocate(33, 8);
+    void* overaligned = resource.Allocate(8, 16);
+    resource.Deallocate(large, 33, 8);
+    resource.Deallocate(overaligned, 8, 16);
+
+    // A new chunk is allocated once the current one is exhausted
+    for (int i = 0; i < 1024 / 32; i++)
+        resource.Allocate(32, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+
+    resource.Deallocate(a, 8, 8);
+    resource.Deallocate(d, 8, 8);
+}
+
+BOOST_AUTO_TEST_CASE(remaining_chunk_reused)
+{
+    PoolResource<16, 8> resource(24);
+    void* a = resource.Allocate(16, 8);
+    // The 8 bytes left in the first chunk go to the free list of 8 byte blocks
+    void* b = resource.Allocate(16, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    void* c = resource.Allocate(8, 8);
+    BOOST_CHECK_EQUAL((char*)c - (char*)a, 16);
+    resource.Deallocate(a, 16, 8);
+    resource.Deallocate(b, 16, 8);
+    resource.Deallocate(c, 8, 8);
+}
+
+BOOST_AUTO_TEST_CASE(unordered_map_with_pool)
+{
+    using Map = std::unordered_map<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                                   PoolAllocator<std::pair<const uint64_t, uint64_t>, sizeof(std::pair<const uint64_t, uint64_t>) + sizeof(void*) * 4>>;
+    Map::allocator_type::ResourceType resource;
+    {
+        Map map(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), &resource);
+        for (uint64_t i = 0; i < 100000; i++)
+            map[i] = i * 2;
+        for (uint64_t i = 0; i < 100000; i += 2)
+            map.erase(i);
+        BOOST_CHECK_EQUAL(map.size(), 50000U);
+        for (uint64_t i = 1; i < 100000; i += 2)
+            BOOST_CHECK_EQUAL(map.at(i), i * 2);
+
+        // Erased nodes are reused, without allocating more chunks
+        const size_t chunks = resource.NumAllocatedChunks();
+        for (uint64_t i = 0; i < 100000; i += 2)
+            map[i] = i;
+        BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), chunks);
+
+        // Memory usage accounts for the whole chunks
+        BOOST_CHECK(memusage::DynamicUsage(map) >= chunks * resource.ChunkSizeBytes());
+    }
+
+    // A default constructed allocator does not use any pool
+    Map map;
+    map[1] = 2;
+    BOOST_CHECK(!map.get_allocator().resource());
+    BOOST_CHECK_EQUAL(map.at(1), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_releases_pool)
+{
+    CCoinsView base;
+    CCoinsViewCache cache(&base);
+    const size_t empty_usage = cache.DynamicMemoryUsage();
+    for (uint32_t i = 0; i < 10000; i++)
+        cache.AddCoin(COutPoint(InsecureRand256(), i), Coin(CTxOut(1, CScript()), 1, false), false);
+    BOOST_CHECK(cache.DynamicMemoryUsage() > empty_usage + 10000 * sizeof(CCoinsCacheEntry));
+
+    // Flushing returns the memory of the pool
+    cache.Flush();
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), empty_usage);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
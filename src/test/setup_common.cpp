@@ -103,6 +103,8 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
     nScriptCheckThreads = 3;
     for (int i = 0; i < nScriptCheckThreads - 1; i++)
         threadGroup.create_thread([i]() { return ThreadScriptCheck(i); });
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        threadGroup.create_thread([i]() { return ThreadBlockCheck(i); });
 
     g_banman = MakeUnique<BanMan>(GetDataDir() / "banlist.dat", nullptr, DEFAULT_MISBEHAVING_BANTIME);
     g_connman = MakeUnique<CConnman>(0x1337, 0x1337); // Deterministic randomness for tests.
@@ -154,6 +156,13 @@ TestChain100Setup::CreateAndProcessBlock(const std::vector<CMutableTransaction>&
     block.vtx.resize(1);
     for (const CMutableTransaction& tx : txns)
         block.vtx.push_back(MakeTransactionRef(tx));
+    // and leave the fees of the mempool-selected txns out of the coinbase
+    {
+        LOCK(cs_main);
+        CMutableTransaction coinbase(*block.vtx[0]);
+        coinbase.vout[0].nValue = GetBlockSubsidy(::ChainActive().Height() + 1, chainparams.GetConsensus());
+        block.vtx[0] = MakeTransactionRef(std::move(coinbase));
+    }
     // IncrementExtraNonce creates a valid coinbase and merkleRoot
     {
         LOCK(cs_main);
@@ -0,0 +1,118 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <test/setup_common.h>
+#include <txprevalidation.h>
+#include <util/time.h>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <thread>
+
+BOOST_FIXTURE_TEST_SUITE(txprevalidation_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(prevalidator_queue)
+{
+    std::atomic<int> started{0};
+    std::atomic<int> checked{0};
+    std::atomic<int> notified{0};
+    std::atomic<bool> release{false};
+    CTxPreValidator prevalidator([&](const CTransaction&, const std::vector<CTxOut>&, CValidationState& state) {
+        started++;
+        while (!release)
+            MilliSleep(1);
+        checked++;
+        return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "checked");
+    }, 2);
+    const auto notify = [&notified] { notified++; };
+    const CTransactionRef tx = MakeTransactionRef(CMutableTransaction());
+
+    // Transactions not worth checking are done already
+    BOOST_CHECK(std::make_shared<CTxPreValidationJob>(tx)->IsDone());
+
+    // Without workers, jobs are done right away, unchecked
+    auto unchecked = std::make_shared<CTxPreValidationJob>(tx, std::vector<CTxOut>());
+    BOOST_CHECK(!prevalidator.Submit(unchecked, notify));
+    BOOST_CHECK(unchecked->IsDone());
+    BOOST_CHECK(unchecked->state.IsValid());
+
+    boost::thread_group workers;
+    workers.create_thread([&prevalidator] { prevalidator.Thread(); });
+    std::shared_ptr<CTxPreValidationJob> first;
+    do {
+        first = std::make_shared<CTxPreValidationJob>(tx, std::vector<CTxOut>());
+    } while (!prevalidator.Submit(first, notify));
+    while (started == 0)
+        MilliSleep(1);
+
+    // While the worker is busy, two more jobs can wait
+    std::vector<std::shared_ptr<CTxPreValidationJob>> queued;
+    for (int i = 0; i < 2; i++) {
+        queued.push_back(std::make_shared<CTxPreValidationJob>(tx, std::vector<CTxOut>()));
+        BOOST_CHECK(prevalidator.Submit(queued.back(), notify));
+        BOOST_CHECK(!queued.back()->IsDone());
+    }
+    auto overflow = std::make_shared<CTxPreValidationJob>(tx, std::vector<CTxOut>());
+    BOOST_CHECK(!prevalidator.Submit(overflow, notify));
+    BOOST_CHECK(overflow->IsDone());
+    BOOST_CHECK(!first->IsDone());
+
+    release = true;
+    while (notified < 3)
+        MilliSleep(1);
+    BOOST_CHECK(first->IsDone());
+    BOOST_CHECK_EQUAL(first->state.GetRejectReason(), "checked");
+    for (const auto& job : queued)
+        BOOST_CHECK(job->IsDone());
+    BOOST_CHECK_EQUAL(checked, 3);
+    BOOST_CHECK_EQUAL(notified, 3);
+    BOOST_CHECK(overflow->state.IsValid());
+
+    workers.interrupt_all();
+    workers.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(prevalidator_stop)
+{
+    std::atomic<int> started{0};
+    std::atomic<bool> release{false};
+    CTxPreValidator prevalidator([&](const CTransaction&, const std::vector<CTxOut>&, CValidationState&) {
+        started++;
+        // Not interrupted meanwhile, as MilliSleep would be
+        while (!release)
+            std::this_thread::yield();
+        return true;
+    });
+    std::atomic<int> notified{0};
+    const auto notify = [&notified] { notified++; };
+    const CTransactionRef tx = MakeTransactionRef(CMutableTransaction());
+
+    boost::thread_group workers;
+    workers.create_thread([&prevalidator] { prevalidator.Thread(); });
+    std::shared_ptr<CTxPreValidationJob> first;
+    do {
+        first = std::make_shared<CTxPreValidationJob>(tx, std::vector<CTxOut>());
+    } while (!prevalidator.Submit(first, notify));
+    while (started == 0)
+        MilliSleep(1);
+    auto queued = std::make_shared<CTxPreValidationJob>(tx, std::vector<CTxOut>());
+    BOOST_CHECK(prevalidator.Submit(queued, notify));
+
+    // The job being checked is finished, and the one queued given up on
+    workers.interrupt_all();
+    release = true;
+    workers.join_all();
+    BOOST_CHECK(first->IsDone());
+    BOOST_CHECK(queued->IsDone());
+    BOOST_CHECK_EQUAL(started, 1);
+    BOOST_CHECK_EQUAL(notified, 1);
+
+    // Nothing more is queued until a worker starts again
+    auto later = std::make_shared<CTxPreValidationJob>(tx, std::vector<CTxOut>());
+    BOOST_CHECK(!prevalidator.Submit(later, notify));
+    BOOST_CHECK_EQUAL(notified, 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
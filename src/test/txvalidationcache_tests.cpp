@@ -4,6 +4,7 @@
 
 #include <consensus/validation.h>
 #include <key.h>
+#include <policy/policy.h>
 #include <validation.h>
 #include <txmempool.h>
 #include <script/standard.h>
@@ -373,4 +374,88 @@ BOOST_FIXTURE_TEST_CASE(checkinputs_test, TestChain100Setup)
     }
 }
 
+
+BOOST_FIXTURE_TEST_CASE(prevalidate_test, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(m_coinbase_txns[0]->GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11*CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    // Changing an output invalidates the signature
+    CMutableTransaction bad_spend(spend);
+    bad_spend.vout[0].nValue = 12*CENT;
+    // Spends of unknown outputs are left until they are no longer orphans
+    CMutableTransaction orphan(spend);
+    orphan.vin[0].prevout.n = 1;
+
+    // Transactions which would fail cheaper checks aren't checked
+    CMutableTransaction no_fee(spend);
+    no_fee.vout[0].nValue = 50*COIN;
+    std::vector<CTxOut> spent_outputs, bad_spent_outputs;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(!PrepareTxPreValidation(CTransaction(orphan), spent_outputs));
+        BOOST_CHECK(!PrepareTxPreValidation(CTransaction(no_fee), spent_outputs));
+        BOOST_CHECK(PrepareTxPreValidation(CTransaction(bad_spend), bad_spent_outputs));
+        BOOST_CHECK(PrepareTxPreValidation(CTransaction(spend), spent_outputs));
+    }
+    BOOST_CHECK_EQUAL(spent_outputs.size(), 1U);
+    BOOST_CHECK(spent_outputs[0] == m_coinbase_txns[0]->vout[0]);
+
+    // Failures are reported as AcceptToMemoryPool reports them
+    CValidationState state;
+    BOOST_CHECK(PreValidateTransaction(CTransaction(spend), spent_outputs, state));
+    BOOST_CHECK(state.IsValid());
+    BOOST_CHECK(!PreValidateTransaction(CTransaction(bad_spend), bad_spent_outputs, state));
+    BOOST_CHECK(state.GetReason() == ValidationInvalidReason::CONSENSUS);
+    {
+        LOCK(cs_main);
+        CValidationState atmp_state;
+        BOOST_CHECK(!AcceptToMemoryPool(mempool, atmp_state, MakeTransactionRef(bad_spend), nullptr, nullptr, true, 0));
+        BOOST_CHECK(atmp_state.GetReason() == state.GetReason());
+        BOOST_CHECK_EQUAL(atmp_state.GetRejectReason(), state.GetRejectReason());
+    }
+
+    {
+        LOCK(cs_main);
+        CValidationState cache_state;
+
+        // The scripts of the valid spend are found in the script execution
+        // cache by the policy checks of AcceptToMemoryPool...
+        const CTransaction tx(spend);
+        PrecomputedTransactionData txdata(tx);
+        std::vector<CScriptCheck> scriptchecks;
+        BOOST_CHECK(CheckInputs(tx, cache_state, &::ChainstateActive().CoinsTip(), STANDARD_SCRIPT_VERIFY_FLAGS, true, false, txdata, &scriptchecks));
+        BOOST_CHECK(scriptchecks.empty());
+
+        // ... unlike those of the invalid one
+        const CTransaction bad_tx(bad_spend);
+        PrecomputedTransactionData bad_txdata(bad_tx);
+        BOOST_CHECK(CheckInputs(bad_tx, cache_state, &::ChainstateActive().CoinsTip(), STANDARD_SCRIPT_VERIFY_FLAGS, true, false, bad_txdata, &scriptchecks));
+        BOOST_CHECK_EQUAL(scriptchecks.size(), 1U);
+    }
+
+    // Transactions already in the mempool, or spending what a transaction in
+    // it spends, aren't checked
+    BOOST_CHECK(ToMemPool(spend));
+    CMutableTransaction conflict(spend);
+    conflict.vout[0].nValue = 10*CENT;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(!PrepareTxPreValidation(CTransaction(spend), spent_outputs));
+        BOOST_CHECK(!PrepareTxPreValidation(CTransaction(conflict), spent_outputs));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,178 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <compat/endian.h>
+#include <netbase.h>
+#include <rpc/server.h>
+#include <test/setup_common.h>
+#include <udprelay.h>
+#include <util/system.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <univalue.h>
+
+#include <string.h>
+
+namespace {
+// Chunks of the header and the body of the blocks sent. The chunks of two
+// headers fit in a 1 MiB budget, but not those of two headers and a body.
+const uint32_t HEADER_CHUNKS = 400;
+const uint32_t BODY_CHUNKS = 100;
+
+struct PartialBlockBudgetSetup : public TestingSetup {
+    UDPConnectionState state;
+    const CService peer{LookupNumeric("1.2.3.4", 4242)};
+
+    PartialBlockBudgetSetup()
+    {
+        gArgs.ForceSetArg("-udpblockbudget", "1");
+        state.connection.fTrusted = true;
+        state.state = STATE_INIT_COMPLETE;
+    }
+    ~PartialBlockBudgetSetup()
+    {
+        // Drops the partial blocks left over
+        BlockRecvShutdown();
+        gArgs.ForceSetArg("-udpblockbudget", "0");
+    }
+
+    //! Hand over a data chunk of a block from our trusted peer
+    void ReceiveChunk(uint64_t hash_prefix, uint32_t chunk_id, bool tip_blk, bool body = false)
+    {
+        UDPMessage msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.header.msg_type = (body ? MSG_TYPE_BLOCK_CONTENTS : MSG_TYPE_BLOCK_HEADER) | (tip_blk ? TIP_BLOCK : 0);
+        msg.msg.block.hash_prefix = htole64(hash_prefix);
+        msg.msg.block.obj_length = htole32((body ? BODY_CHUNKS : HEADER_CHUNKS) * FEC_CHUNK_SIZE);
+        msg.msg.block.chunk_id = chunk_id;
+        msg.msg.block.data[0] = chunk_id;
+        std::unique_lock<std::recursive_mutex> lock(cs_mapUDPNodes);
+        BOOST_CHECK(HandleBlockTxMessage(msg, sizeof(UDPMessageHeader) + sizeof(UDPBlockMessage), peer, state, std::chrono::steady_clock::now(), -1));
+    }
+
+    void ReceiveChunks(uint64_t hash_prefix, uint32_t count, bool tip_blk = false)
+    {
+        for (uint32_t i = 0; i < count; i++) {
+            ReceiveChunk(hash_prefix, i, tip_blk);
+        }
+    }
+
+    UniValue GetUsage()
+    {
+        JSONRPCRequest request;
+        request.strMethod = "getpartialblockusage";
+        request.params = UniValue(UniValue::VARR);
+        if (RPCIsInWarmup(nullptr)) SetRPCWarmupFinished();
+        return tableRPC.execute(request);
+    }
+};
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(udprelay_tests, PartialBlockBudgetSetup)
+
+BOOST_AUTO_TEST_CASE(partial_block_usage)
+{
+    UniValue usage = GetUsage();
+    BOOST_CHECK_EQUAL(usage["budget"].get_int64(), 1 << 20);
+    BOOST_CHECK_EQUAL(usage["usage"].get_int64(), 0);
+    BOOST_CHECK_EQUAL(usage["n_blks"].get_int64(), 0);
+
+    ReceiveChunks(1, 3);
+    usage = GetUsage();
+    BOOST_CHECK_EQUAL(usage["n_blks"].get_int64(), 1);
+    // The chunks of the header are stored in a file of its full size
+    BOOST_CHECK_EQUAL(usage["disk"].get_int64(), HEADER_CHUNKS * FEC_CHUNK_SIZE);
+    // and the decoder and the partial block are kept in memory
+    const int64_t memory = usage["memory"].get_int64();
+    BOOST_CHECK(memory > 0);
+    BOOST_CHECK(memory < int64_t(HEADER_CHUNKS * FEC_CHUNK_SIZE / 10));
+    BOOST_CHECK_EQUAL(usage["usage"].get_int64(), usage["disk"].get_int64() + memory);
+
+    // Once the body is seen, the chunk-coded block allocated when the header
+    // is decoded is counted as well
+    ReceiveChunk(1, 0, false, true);
+    usage = GetUsage();
+    BOOST_CHECK_EQUAL(usage["n_blks"].get_int64(), 1);
+    BOOST_CHECK_EQUAL(usage["disk"].get_int64(), (HEADER_CHUNKS + BODY_CHUNKS) * FEC_CHUNK_SIZE);
+    BOOST_CHECK(usage["memory"].get_int64() >= memory + BODY_CHUNKS * FEC_CHUNK_SIZE);
+    BOOST_CHECK_EQUAL(usage["usage"].get_int64(), usage["disk"].get_int64() + usage["memory"].get_int64());
+
+    BlockRecvShutdown();
+    usage = GetUsage();
+    BOOST_CHECK_EQUAL(usage["usage"].get_int64(), 0);
+    BOOST_CHECK_EQUAL(usage["n_blks"].get_int64(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(partial_block_eviction_order)
+{
+    const int64_t evicted = GetUsage()["evicted"].get_int64();
+    const int64_t dropped = GetUsage()["dropped"].get_int64();
+
+    ReceiveChunks(11, 5);
+    ReceiveChunks(12, 2);
+    BOOST_CHECK_EQUAL(GetUsage()["n_blks"].get_int64(), 2);
+
+    // A new block is the least complete of all, so it is dropped
+    ReceiveChunk(13, 0, false);
+    UniValue usage = GetUsage();
+    BOOST_CHECK_EQUAL(usage["n_blks"].get_int64(), 2);
+    BOOST_CHECK_EQUAL(usage["evicted"].get_int64(), evicted);
+    BOOST_CHECK_EQUAL(usage["dropped"].get_int64(), dropped + 1);
+
+    // and so are its later chunks, without it being taken up again
+    ReceiveChunks(13, 10);
+    usage = GetUsage();
+    BOOST_CHECK_EQUAL(usage["n_blks"].get_int64(), 2);
+    BOOST_CHECK_EQUAL(usage["dropped"].get_int64(), dropped + 1);
+
+    // The body of the most complete block makes room by evicting the least
+    // complete one
+    ReceiveChunk(11, 0, false, true);
+    usage = GetUsage();
+    BOOST_CHECK_EQUAL(usage["n_blks"].get_int64(), 1);
+    BOOST_CHECK_EQUAL(usage["evicted"].get_int64(), evicted + 1);
+    BOOST_CHECK_EQUAL(usage["dropped"].get_int64(), dropped + 1);
+    BOOST_CHECK(usage["usage"].get_int64() <= usage["budget"].get_int64());
+
+    // The evicted block isn't taken up again by its next chunks either
+    ReceiveChunk(12, 2, false);
+    ReceiveChunk(11, 1, false, true);
+    usage = GetUsage();
+    BOOST_CHECK_EQUAL(usage["n_blks"].get_int64(), 1);
+    BOOST_CHECK_EQUAL(usage["evicted"].get_int64(), evicted + 1);
+    BOOST_CHECK_EQUAL(usage["dropped"].get_int64(), dropped + 1);
+}
+
+BOOST_AUTO_TEST_CASE(partial_block_tip_exemption)
+{
+    const int64_t evicted = GetUsage()["evicted"].get_int64();
+    const int64_t dropped = GetUsage()["dropped"].get_int64();
+
+    ReceiveChunks(21, 5);
+    ReceiveChunks(22, 1, true);
+
+    // A tip block evicts a backfill block, even if more complete
+    ReceiveChunks(23, 1, true);
+    UniValue usage = GetUsage();
+    BOOST_CHECK_EQUAL(usage["n_blks"].get_int64(), 2);
+    BOOST_CHECK_EQUAL(usage["evicted"].get_int64(), evicted + 1);
+
+    // and is taken over the budget when there is none left, as tip blocks are
+    // neither evicted nor dropped
+    ReceiveChunks(24, 1, true);
+    usage = GetUsage();
+    BOOST_CHECK_EQUAL(usage["n_blks"].get_int64(), 3);
+    BOOST_CHECK_EQUAL(usage["evicted"].get_int64(), evicted + 1);
+    BOOST_CHECK_EQUAL(usage["dropped"].get_int64(), dropped);
+    BOOST_CHECK(usage["usage"].get_int64() > usage["budget"].get_int64());
+
+    // while backfill blocks are dropped
+    ReceiveChunks(25, 1);
+    usage = GetUsage();
+    BOOST_CHECK_EQUAL(usage["n_blks"].get_int64(), 3);
+    BOOST_CHECK_EQUAL(usage["dropped"].get_int64(), dropped + 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
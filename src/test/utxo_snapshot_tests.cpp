@@ -0,0 +1,142 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coins.h>
+#include <node/coinstats.h>
+#include <node/utxo_snapshot.h>
+#include <streams.h>
+#include <test/setup_common.h>
+#include <txdb.h>
+#include <util/system.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(utxo_snapshot_tests, BasicTestingSetup)
+
+//! Statistics of the coins of a database, as computed by GetUTXOStats
+static CCoinsStats HashCoins(CCoinsViewDB& db, const uint256& base)
+{
+    std::unique_ptr<CCoinsViewCursor> cursor(db.Cursor());
+    CCoinsStatsAccumulator accumulator(base);
+    for (; cursor->Valid(); cursor->Next()) {
+        COutPoint key;
+        Coin coin;
+        BOOST_REQUIRE(cursor->GetKey(key) && cursor->GetValue(coin));
+        accumulator.Add(key, coin);
+    }
+    return accumulator.Finalize();
+}
+
+//! Fill a database with coins spread over several chunks, deserialized by
+//! several threads when loaded, and return their statistics
+static CCoinsStats FillCoins(CCoinsViewDB& db, const uint256& base)
+{
+    CCoinsViewCache cache(&db);
+    for (size_t i = 0; i < 3 * SNAPSHOT_CHUNK_COINS + 1000; i++) {
+        const COutPoint outpoint(InsecureRand256(), InsecureRandRange(4));
+        cache.AddCoin(outpoint, Coin(CTxOut(InsecureRandRange(1000000), CScript() << OP_TRUE), 1 + InsecureRandRange(1000), InsecureRandBool()), false);
+    }
+    cache.SetBestBlock(base);
+    BOOST_REQUIRE(cache.Flush());
+    return HashCoins(db, base);
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_coins_roundtrip)
+{
+    const uint256 base = InsecureRand256();
+    CCoinsViewDB source("snapshot_source", 8 << 20, true, false);
+    const CCoinsStats expected = FillCoins(source, base);
+    const fs::path path = GetDataDir() / "snapshot_coins.dat";
+    {
+        CAutoFile file(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        std::unique_ptr<CCoinsViewCursor> cursor(source.Cursor());
+        CCoinsStats stats;
+        BOOST_REQUIRE(WriteSnapshotCoins(file, *cursor, stats));
+        BOOST_CHECK(stats.hashSerialized == expected.hashSerialized);
+        BOOST_CHECK_EQUAL(stats.nTransactionOutputs, expected.nTransactionOutputs);
+    }
+
+    CCoinsViewDB dest("snapshot_dest", 8 << 20, true, false);
+    {
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        CCoinsStats stats;
+        std::string error;
+        BOOST_REQUIRE(LoadSnapshotCoins(file, dest, base, stats, error));
+        BOOST_CHECK(stats.hashSerialized == expected.hashSerialized);
+        BOOST_CHECK_EQUAL(stats.nTransactionOutputs, expected.nTransactionOutputs);
+    }
+    // The best block is left to the caller
+    BOOST_CHECK(dest.GetBestBlock().IsNull());
+    CCoinsMap no_coins;
+    BOOST_REQUIRE(dest.BatchWrite(no_coins, base));
+    BOOST_CHECK(HashCoins(dest, base).hashSerialized == expected.hashSerialized);
+
+    // Coins loaded from a snapshot can be wiped
+    CCoinsViewDB wiped("snapshot_wiped", 8 << 20, true, false);
+    {
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        CCoinsStats stats;
+        std::string error;
+        BOOST_REQUIRE(LoadSnapshotCoins(file, wiped, base, stats, error));
+    }
+    BOOST_REQUIRE(wiped.WipeCoins());
+    std::unique_ptr<CCoinsViewCursor> cursor(wiped.Cursor());
+    BOOST_CHECK(!cursor->Valid());
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_coins_corrupt)
+{
+    const uint256 base = InsecureRand256();
+    CCoinsViewDB source("snapshot_source", 8 << 20, true, false);
+    FillCoins(source, base);
+    const fs::path path = GetDataDir() / "snapshot_corrupt.dat";
+    {
+        CAutoFile file(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        std::unique_ptr<CCoinsViewCursor> cursor(source.Cursor());
+        CCoinsStats stats;
+        BOOST_REQUIRE(WriteSnapshotCoins(file, *cursor, stats));
+    }
+
+    // The coins are hashed from another base block
+    {
+        CCoinsViewDB dest("snapshot_dest", 8 << 20, true, false);
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        CCoinsStats stats;
+        std::string error;
+        BOOST_CHECK(!LoadSnapshotCoins(file, dest, InsecureRand256(), stats, error));
+        BOOST_CHECK(error.find("hash") != std::string::npos);
+    }
+
+    // The file is truncated
+    fs::resize_file(path, fs::file_size(path) - 40);
+    {
+        CCoinsViewDB dest("snapshot_dest", 8 << 20, true, false);
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        CCoinsStats stats;
+        std::string error;
+        BOOST_CHECK(!LoadSnapshotCoins(file, dest, base, stats, error));
+        BOOST_CHECK(!error.empty());
+    }
+
+    // A chunk has bytes past its coins
+    {
+        CAutoFile file(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        std::vector<std::pair<COutPoint, Coin>> chunk;
+        chunk.emplace_back(COutPoint(InsecureRand256(), 0), Coin(CTxOut(1, CScript() << OP_TRUE), 1, false));
+        std::vector<unsigned char> data;
+        CVectorWriter(SER_DISK, CLIENT_VERSION, data, 0, chunk);
+        data.push_back(0);
+        file << data << std::vector<unsigned char>() << uint64_t{1} << uint256();
+    }
+    {
+        CCoinsViewDB dest("snapshot_dest", 8 << 20, true, false);
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        CCoinsStats stats;
+        std::string error;
+        BOOST_CHECK(!LoadSnapshotCoins(file, dest, base, stats, error));
+        BOOST_CHECK(error.find("malformed chunk") != std::string::npos);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,7 +3,12 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <chainparams.h>
+#include <consensus/merkle.h>
+#include <consensus/tx_verify.h>
+#include <consensus/validation.h>
 #include <net.h>
+#include <pow.h>
+#include <script/script.h>
 #include <validation.h>
 
 #include <test/setup_common.h>
@@ -74,4 +79,99 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+//! Grind the nonce of a block until its proof of work is valid
+static void SolveCheckBlock(CBlock& block, const Consensus::Params& params)
+{
+    while (!CheckProofOfWork(block.GetHash(), block.nBits, params))
+        block.nNonce++;
+}
+
+//! A regtest block with valid proof of work, of a coinbase and count transactions with sigops
+static CBlock MakeCheckBlock(const Consensus::Params& params, size_t count)
+{
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << OP_1 << OP_1;
+    coinbase.vout.emplace_back(50 * COIN, CScript() << OP_TRUE);
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    for (size_t i = 0; i < count; i++) {
+        CMutableTransaction tx;
+        tx.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+        tx.vout.emplace_back(1000, CScript() << OP_CHECKSIG << std::vector<unsigned char>(i % 7, 0) << OP_CHECKSIG);
+        block.vtx.push_back(MakeTransactionRef(tx));
+    }
+    block.nBits = UintToArith256(params.powLimit).GetCompact();
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    SolveCheckBlock(block, params);
+    return block;
+}
+
+//! Check a copy of a block without the block check threads, and with them, which must agree
+static bool CheckBlockBothWays(const CBlock& block, const Consensus::Params& params, std::string& reject_reason)
+{
+    const int prev_threads = nScriptCheckThreads;
+    nScriptCheckThreads = 0;
+    CValidationState serial_state;
+    const bool serial = CheckBlock(CBlock(block), serial_state, params);
+    nScriptCheckThreads = prev_threads;
+
+    CBlock copy(block);
+    CValidationState state;
+    const bool parallel = CheckBlock(copy, state, params);
+    BOOST_CHECK_EQUAL(serial, parallel);
+    BOOST_CHECK_EQUAL(serial_state.GetRejectReason(), state.GetRejectReason());
+    BOOST_CHECK_EQUAL(serial_state.GetDebugMessage(), state.GetDebugMessage());
+    BOOST_CHECK_EQUAL(copy.fChecked, parallel);
+    if (parallel) {
+        BOOST_REQUIRE_EQUAL(copy.vTxLegacySigOps.size(), copy.vtx.size());
+        for (size_t i = 0; i < copy.vtx.size(); i++)
+            BOOST_CHECK_EQUAL(copy.vTxLegacySigOps[i], GetLegacySigOpCount(*copy.vtx[i]));
+    }
+    reject_reason = state.GetRejectReason();
+    return parallel;
+}
+
+BOOST_AUTO_TEST_CASE(parallel_check_block)
+{
+    BOOST_REQUIRE(nScriptCheckThreads > 1);
+    const auto chainParams = CreateChainParams(CBaseChainParams::REGTEST);
+    const Consensus::Params& params = chainParams->GetConsensus();
+    std::string reason;
+
+    BOOST_CHECK(CheckBlockBothWays(MakeCheckBlock(params, 10), params, reason));
+    BOOST_CHECK(CheckBlockBothWays(MakeCheckBlock(params, 500), params, reason));
+
+    // Invalid transactions, of which the first one is reported
+    CBlock block = MakeCheckBlock(params, 500);
+    CMutableTransaction no_outputs(*block.vtx[300]);
+    no_outputs.vout.clear();
+    CMutableTransaction duplicate_inputs(*block.vtx[200]);
+    duplicate_inputs.vin.push_back(duplicate_inputs.vin[0]);
+    block.vtx[300] = MakeTransactionRef(no_outputs);
+    block.vtx[200] = MakeTransactionRef(duplicate_inputs);
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    SolveCheckBlock(block, params);
+    BOOST_CHECK(!CheckBlockBothWays(block, params, reason));
+    BOOST_CHECK_EQUAL(reason, "bad-txns-inputs-duplicate");
+
+    // Merkle root mismatch comes before invalid transactions
+    block.hashMerkleRoot = InsecureRand256();
+    SolveCheckBlock(block, params);
+    BOOST_CHECK(!CheckBlockBothWays(block, params, reason));
+    BOOST_CHECK_EQUAL(reason, "bad-txnmrklroot");
+
+    // Too many sigops
+    block = MakeCheckBlock(params, 500);
+    CMutableTransaction sigops(*block.vtx[400]);
+    const std::vector<unsigned char> checksigs(MAX_BLOCK_SIGOPS_COST / WITNESS_SCALE_FACTOR, OP_CHECKSIG);
+    sigops.vout[0].scriptPubKey = CScript(checksigs.begin(), checksigs.end());
+    block.vtx[400] = MakeTransactionRef(sigops);
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    SolveCheckBlock(block, params);
+    BOOST_CHECK(!CheckBlockBothWays(block, params, reason));
+    BOOST_CHECK_EQUAL(reason, "bad-blk-sigops");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,7 @@
 
 #include <txdb.h>
 
+#include <memusage.h>
 #include <pow.h>
 #include <random.h>
 #include <shutdown.h>
@@ -27,6 +28,8 @@ static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_SNAPSHOT_BASE = 'S';
+static const char DB_INDEX_CACHE = 'I';
 
 namespace {
 
@@ -60,6 +63,14 @@ bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
+size_t CCoinsViewDB::GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins, std::vector<bool> &found) const {
+    std::vector<CoinEntry> keys;
+    keys.reserve(outpoints.size());
+    for (const COutPoint& outpoint : outpoints)
+        keys.emplace_back(&outpoint);
+    return db.ReadMany(keys, coins, found);
+}
+
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
     return db.Exists(CoinEntry(&outpoint));
 }
@@ -80,6 +91,15 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    return WriteCoins(mapCoins, hashBlock, true);
+}
+
+bool CCoinsViewDB::WriteSnapshot(const CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    // The map is not modified when erase is false
+    return WriteCoins(const_cast<CCoinsMap&>(mapCoins), hashBlock, false);
+}
+
+bool CCoinsViewDB::WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -114,8 +134,12 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (erase) {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        } else {
+            ++it;
+        }
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -140,11 +164,199 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return ret;
 }
 
+bool CCoinsViewDB::LoadCoins(const std::vector<std::pair<COutPoint, Coin>>& coins) {
+    CDBBatch batch(db);
+    size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
+    for (const auto& coin : coins) {
+        batch.Write(CoinEntry(&coin.first), coin.second);
+        if (batch.SizeEstimate() > batch_size) {
+            if (!db.WriteBatch(batch))
+                return false;
+            batch.Clear();
+        }
+    }
+    return db.WriteBatch(batch);
+}
+
+bool CCoinsViewDB::WipeCoins() {
+    assert(GetBestBlock().IsNull());
+    std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+    CDBBatch batch(db);
+    size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
+    size_t count = 0;
+    COutPoint outpoint;
+    CoinEntry entry(&outpoint);
+    for (pcursor->Seek(DB_COIN); pcursor->Valid(); pcursor->Next()) {
+        if (!pcursor->GetKey(entry) || entry.key != DB_COIN)
+            break;
+        batch.Erase(entry);
+        count++;
+        if (batch.SizeEstimate() > batch_size) {
+            if (!db.WriteBatch(batch))
+                return false;
+            batch.Clear();
+        }
+    }
+    LogPrint(BCLog::COINDB, "Erasing %u coins from the coin database\n", count);
+    return db.WriteBatch(batch, true);
+}
+
 size_t CCoinsViewDB::EstimateSize() const
 {
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
 }
 
+CCoinsViewBackgroundFlush::~CCoinsViewBackgroundFlush()
+{
+    Wait();
+}
+
+bool CCoinsViewBackgroundFlush::GetCoin(const COutPoint &outpoint, Coin &coin) const
+{
+    // m_writing is only cleared once the snapshot is written, so the database
+    // is up to date whenever it reads false
+    if (m_writing) {
+        LOCK(m_mutex);
+        if (m_snapshot) {
+            CCoinsMap::const_iterator it = m_snapshot->find(outpoint);
+            if (it != m_snapshot->end()) {
+                if (it->second.coin.IsSpent())
+                    return false;
+                coin = it->second.coin;
+                return true;
+            }
+        }
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+size_t CCoinsViewBackgroundFlush::GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins, std::vector<bool> &found) const
+{
+    if (!m_writing)
+        return base->GetCoins(outpoints, coins, found);
+
+    // Outpoints in the snapshot are answered from it, and the others from the
+    // database in a single batch
+    coins.clear();
+    coins.resize(outpoints.size());
+    found.assign(outpoints.size(), false);
+    size_t count = 0;
+    std::vector<size_t> missing;
+    std::vector<COutPoint> missing_outpoints;
+    {
+        LOCK(m_mutex);
+        for (size_t i = 0; i < outpoints.size(); i++) {
+            CCoinsMap::const_iterator it;
+            if (m_snapshot && (it = m_snapshot->find(outpoints[i])) != m_snapshot->end()) {
+                if (!it->second.coin.IsSpent()) {
+                    coins[i] = it->second.coin;
+                    found[i] = true;
+                    count++;
+                }
+            } else {
+                missing.push_back(i);
+                missing_outpoints.push_back(outpoints[i]);
+            }
+        }
+    }
+    if (missing.empty())
+        return count;
+
+    std::vector<Coin> missing_coins;
+    std::vector<bool> missing_found;
+    base->GetCoins(missing_outpoints, missing_coins, missing_found);
+    for (size_t j = 0; j < missing.size(); j++) {
+        if (missing_found[j]) {
+            coins[missing[j]] = std::move(missing_coins[j]);
+            found[missing[j]] = true;
+            count++;
+        }
+    }
+    return count;
+}
+
+bool CCoinsViewBackgroundFlush::HaveCoin(const COutPoint &outpoint) const
+{
+    Coin coin;
+    return GetCoin(outpoint, coin);
+}
+
+uint256 CCoinsViewBackgroundFlush::GetBestBlock() const
+{
+    {
+        LOCK(m_mutex);
+        if (!m_snapshot_block.IsNull())
+            return m_snapshot_block;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewBackgroundFlush::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock)
+{
+    if (!Wait())
+        return false;
+    return base->BatchWrite(mapCoins, hashBlock);
+}
+
+bool CCoinsViewBackgroundFlush::StartWrite(CCoinsMap&& coins, const uint256& hashBlock, std::function<void()> on_written)
+{
+    if (!Wait())
+        return false;
+
+    size_t usage = memusage::DynamicUsage(coins);
+    for (const auto& entry : coins)
+        usage += entry.second.coin.DynamicMemoryUsage();
+    {
+        LOCK(m_mutex);
+        m_snapshot = MakeUnique<CCoinsMap>(std::move(coins));
+        m_snapshot_block = hashBlock;
+    }
+    m_snapshot_usage = usage;
+    m_on_written = std::move(on_written);
+    m_writing = true;
+    m_writer = std::thread(&TraceThread<std::function<void()> >, "coinsflush", std::function<void()>(std::bind(&CCoinsViewBackgroundFlush::ThreadWrite, this)));
+    return true;
+}
+
+void CCoinsViewBackgroundFlush::ThreadWrite()
+{
+    const int64_t start = GetTimeMicros();
+    uint256 hashBlock;
+    {
+        LOCK(m_mutex);
+        hashBlock = m_snapshot_block;
+    }
+    bool ok = false;
+    try {
+        ok = m_db.WriteSnapshot(*m_snapshot, hashBlock);
+    } catch (const std::runtime_error& e) {
+        LogPrintf("Error writing to coin database: %s\n", e.what());
+    }
+
+    // Release the snapshot outside of the lock
+    std::unique_ptr<CCoinsMap> written;
+    {
+        LOCK(m_mutex);
+        written = std::move(m_snapshot);
+        m_snapshot_block.SetNull();
+    }
+    if (!ok)
+        m_write_ok = false;
+    m_snapshot_usage = 0;
+    m_writing = false;
+    LogPrint(BCLog::COINDB, "Wrote %u coins to the coin database in the background in %.2fms\n", written->size(), (GetTimeMicros() - start) * 0.001);
+    if (ok && m_on_written)
+        m_on_written();
+    m_on_written = nullptr;
+}
+
+bool CCoinsViewBackgroundFlush::Wait()
+{
+    if (m_writer.joinable())
+        m_writer.join();
+    return m_write_ok;
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(gArgs.IsArgSet("-blocksdir") ? GetDataDir() / "blocks" / "index" : GetBlocksDir() / "index", nCacheSize, fMemory, fWipe) {
 }
 
@@ -245,6 +457,36 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+bool CBlockTreeDB::WriteSnapshotBase(const uint256& hash, uint64_t nChainTx) {
+    return Write(DB_SNAPSHOT_BASE, std::make_pair(hash, nChainTx), true);
+}
+
+bool CBlockTreeDB::ReadSnapshotBase(uint256& hash, uint64_t& nChainTx) {
+    std::pair<uint256, uint64_t> base;
+    if (!Read(DB_SNAPSHOT_BASE, base))
+        return false;
+    hash = base.first;
+    nChainTx = base.second;
+    return true;
+}
+
+bool CBlockTreeDB::WriteIndexCache(uint64_t id, uint64_t count) {
+    return Write(DB_INDEX_CACHE, std::make_pair(id, count), true);
+}
+
+bool CBlockTreeDB::ReadIndexCache(uint64_t& id, uint64_t& count) {
+    std::pair<uint64_t, uint64_t> cache;
+    if (!Read(DB_INDEX_CACHE, cache))
+        return false;
+    id = cache.first;
+    count = cache.second;
+    return true;
+}
+
+bool CBlockTreeDB::EraseIndexCache() {
+    return Erase(DB_INDEX_CACHE, true);
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
 {
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
@@ -10,10 +10,14 @@
 #include <dbwrapper.h>
 #include <chain.h>
 #include <primitives/block.h>
+#include <sync.h>
 
+#include <atomic>
+#include <functional>
 #include <map>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -54,15 +58,93 @@ public:
     explicit CCoinsViewDB(fs::path ldb_path, size_t nCacheSize, bool fMemory, bool fWipe);
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    size_t GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins, std::vector<bool> &found) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
 
+    //! Write the dirty entries of mapCoins like BatchWrite, but leave mapCoins untouched
+    bool WriteSnapshot(const CCoinsMap &mapCoins, const uint256 &hashBlock);
+
+    //! Write coins as they are, without touching the best block. Used to bulk
+    //! load a UTXO snapshot, whose coins are given in database order.
+    bool LoadCoins(const std::vector<std::pair<COutPoint, Coin>>& coins);
+
+    //! Erase all coins, e.g. those left by an interrupted snapshot load.
+    //! Only meant for a database without best block.
+    bool WipeCoins();
+
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
+
+private:
+    bool WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase);
+};
+
+/**
+ * CCoinsView writing snapshots of dirty coins to the coin database on a
+ * background thread, so that the chainstate cache can be flushed without
+ * holding cs_main for the duration of the database write.
+ *
+ * It sits right below the chainstate cache. While a snapshot is being written,
+ * coins are looked up in the snapshot before the database, as the database is
+ * only partially updated. Writes going through BatchWrite wait for the
+ * snapshot to be written first.
+ */
+class CCoinsViewBackgroundFlush final : public CCoinsViewBacked
+{
+private:
+    CCoinsViewDB& m_db;
+
+    mutable Mutex m_mutex;
+    //! Coins being written. Only reset under m_mutex, and not modified
+    //! otherwise while a write is in progress.
+    std::unique_ptr<CCoinsMap> m_snapshot;
+    uint256 m_snapshot_block GUARDED_BY(m_mutex);
+    std::atomic<size_t> m_snapshot_usage{0};
+
+    //! Whether m_snapshot is being written
+    std::atomic<bool> m_writing{false};
+    //! Cleared for good once a write fails
+    std::atomic<bool> m_write_ok{true};
+    //! Called on the writer thread once the snapshot is written
+    std::function<void()> m_on_written;
+    std::thread m_writer;
+
+    void ThreadWrite();
+
+public:
+    CCoinsViewBackgroundFlush(CCoinsView* base, CCoinsViewDB& db) : CCoinsViewBacked(base), m_db(db) {}
+    ~CCoinsViewBackgroundFlush();
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    size_t GetCoins(const std::vector<COutPoint> &outpoints, std::vector<Coin> &coins, std::vector<bool> &found) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+    uint256 GetBestBlock() const override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+
+    /**
+     * @brief Start writing a snapshot of coins to the database.
+     * @param (CCoinsMap&&) Dirty coins, as taken by CCoinsViewCache::SnapshotDirty.
+     * @param (const uint256&) Best block of the snapshot.
+     * @param (std::function<void()>) Called from the writer thread once the snapshot is written, if it is.
+     * @return (bool) False if a previous write failed.
+     */
+    bool StartWrite(CCoinsMap&& coins, const uint256& hashBlock, std::function<void()> on_written = {});
+
+    /**
+     * @brief Wait for the snapshot being written, if any.
+     * @return (bool) False if a write failed.
+     */
+    bool Wait();
+
+    bool IsWriting() const { return m_writing; }
+
+    //! Memory used by the snapshot being written
+    size_t DynamicMemoryUsage() const { return m_snapshot_usage; }
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -100,6 +182,12 @@ public:
     void ReadReindexing(bool &fReindexing);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    bool WriteSnapshotBase(const uint256& hash, uint64_t nChainTx);
+    bool ReadSnapshotBase(uint256& hash, uint64_t& nChainTx);
+    //! Identifier and number of entries of the block index cache file matching the database, if any
+    bool WriteIndexCache(uint64_t id, uint64_t count);
+    bool ReadIndexCache(uint64_t& id, uint64_t& count);
+    bool EraseIndexCache();
     bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
 };
 
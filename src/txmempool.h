@@ -6,11 +6,13 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <assert.h>
 #include <atomic>
 #include <map>
 #include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -131,6 +133,7 @@ public:
     int64_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
 
     mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    mutable uint64_t m_epoch{0}; //!< Last walk of the mempool's graph which visited this entry
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -532,19 +535,66 @@ public:
     const setEntries & GetMemPoolChildren(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
     uint64_t CalculateDescendantMaximum(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
 private:
-    typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
+    //! Hashes entries by address, which stays the same for as long as they are in mapTx
+    struct TxiterHasher {
+        size_t operator()(const txiter& it) const { return std::hash<const CTxMemPoolEntry*>()(&*it); }
+    };
+
+    typedef std::unordered_map<txiter, std::vector<txiter>, TxiterHasher> cacheMap;
 
     struct TxLinks {
         setEntries parents;
         setEntries children;
     };
 
-    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    typedef std::unordered_map<txiter, TxLinks, TxiterHasher> txlinksMap;
     txlinksMap mapLinks;
 
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
 
+    /**
+     * Walks of the graph of parents and children mark the entries they visit
+     * with the epoch of the walk, instead of collecting them in sets, and
+     * queue them in buffers kept from one walk to the next, so that walking
+     * doesn't allocate. Walks can't be nested. Only used with cs held.
+     */
+    mutable uint64_t m_epoch{0};
+    mutable bool m_walking{false};
+    mutable std::vector<txiter> m_walk_stage;
+    mutable std::vector<txiter> m_walk_found;
+
+    /** Starts a fresh walk for as long as it is in scope */
+    class WalkGuard
+    {
+    private:
+        const CTxMemPool& m_pool;
+
+    public:
+        explicit WalkGuard(const CTxMemPool& pool) : m_pool(pool)
+        {
+            assert(!m_pool.m_walking);
+            m_pool.m_walking = true;
+            ++m_pool.m_epoch;
+        }
+        ~WalkGuard() { m_pool.m_walking = false; }
+    };
+
+    /** Mark an entry visited by the walk in progress, returning whether it already was */
+    bool Visit(txiter it) const
+    {
+        if (it->m_epoch == m_epoch) return true;
+        it->m_epoch = m_epoch;
+        return false;
+    }
+
+    /**
+     * All in-mempool ancestors (or descendants) of an entry, excluding the
+     * entry itself, as linked in mapLinks. The result is valid until the
+     * next walk.
+     */
+    const std::vector<txiter>& WalkRelatives(txiter entry, bool ancestors) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+
     std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const EXCLUSIVE_LOCKS_REQUIRED(cs);
 
 public:
@@ -693,6 +743,8 @@ public:
     CTransactionRef get(const uint256& hash) const;
     TxMempoolInfo info(const uint256& hash) const;
     std::vector<TxMempoolInfo> infoAll() const;
+    /** Info on those of the given transactions in the mempool, once each, sorted as infoAll() is */
+    std::vector<TxMempoolInfo> infoSorted(const std::vector<uint256>& hashes) const;
 
     size_t DynamicMemoryUsage() const;
 
@@ -717,7 +769,8 @@ private:
             cacheMap &cachedDescendants,
             const std::set<uint256> &setExclude) EXCLUSIVE_LOCKS_REQUIRED(cs);
     /** Update ancestors of hash to add/remove it as a descendant transaction. */
-    void UpdateAncestorsOf(bool add, txiter hash, setEntries &setAncestors) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    template <typename Entries>
+    void UpdateAncestorsOf(bool add, txiter hash, const Entries &ancestors) EXCLUSIVE_LOCKS_REQUIRED(cs);
     /** Set ancestor state for an entry */
     void UpdateEntryForAncestors(txiter it, const setEntries &setAncestors) EXCLUSIVE_LOCKS_REQUIRED(cs);
     /** For each transaction being removed, update ancestors and any direct children.
@@ -0,0 +1,70 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <txprevalidation.h>
+
+#include <tinyformat.h>
+#include <util/threadnames.h>
+#include <validation.h>
+
+#include <boost/thread/thread.hpp>
+
+CTxPreValidator g_tx_prevalidator(PreValidateTransaction);
+
+bool CTxPreValidator::Submit(const std::shared_ptr<CTxPreValidationJob>& job, std::function<void()> notify)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        if (m_workers > 0 && m_queue.size() < m_max_queue) {
+            m_queue.emplace_back(job, std::move(notify));
+            m_cond_worker.notify_one();
+            return true;
+        }
+    }
+    job->m_done = true;
+    return false;
+}
+
+void CTxPreValidator::Thread()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        m_workers++;
+    }
+    try {
+        while (true) {
+            // Stopping gives up on the jobs queued, rather than checking them first
+            boost::this_thread::interruption_point();
+            std::pair<std::shared_ptr<CTxPreValidationJob>, std::function<void()>> job;
+            {
+                boost::unique_lock<boost::mutex> lock(m_mutex);
+                while (m_queue.empty())
+                    m_cond_worker.wait(lock);
+                job = std::move(m_queue.front());
+                m_queue.pop_front();
+            }
+            CTxPreValidationJob& checked = *job.first;
+            m_check(*checked.tx, checked.spent_outputs, checked.state);
+            checked.m_done = true;
+            if (job.second)
+                job.second();
+        }
+    } catch (const boost::thread_interrupted&) {
+        // Once no worker is left, the jobs queued are done unchecked, and what
+        // they would call dropped, as it needn't outlive the workers
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        if (--m_workers == 0) {
+            for (const auto& job : m_queue)
+                job.first->m_done = true;
+            m_queue.clear();
+        }
+        throw;
+    }
+}
+
+void ThreadTxPreValidation(int worker_num)
+{
+    util::ThreadRename(strprintf("txcheck.%i", worker_num));
+    g_tx_prevalidator.Thread();
+}
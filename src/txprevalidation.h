@@ -0,0 +1,100 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXPREVALIDATION_H
+#define BITCOIN_TXPREVALIDATION_H
+
+#include <consensus/validation.h>
+#include <primitives/transaction.h>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/** Maximum number of transaction pre-validation threads allowed */
+static const int MAX_TX_PREVALIDATION_THREADS = 16;
+/** -txprevalidationthreads default (number of threads checking the scripts of relayed transactions) */
+static const int DEFAULT_TX_PREVALIDATION_THREADS = 2;
+/** Transactions waiting for a pre-validation thread, beyond which they are accepted without */
+static const size_t MAX_TX_PREVALIDATION_QUEUE = 1000;
+
+/** A transaction received from a peer, to be accepted to the mempool once pre-validated */
+class CTxPreValidationJob
+{
+private:
+    friend class CTxPreValidator;
+    std::atomic<bool> m_done{false};
+
+public:
+    const CTransactionRef tx;
+    //! Outputs spent by the inputs of tx, in their order
+    const std::vector<CTxOut> spent_outputs;
+    //! Set by the checks, to be read once done. Invalid if the scripts failed.
+    CValidationState state;
+
+    //! A transaction to be checked
+    CTxPreValidationJob(CTransactionRef tx_in, std::vector<CTxOut> spent_outputs_in)
+        : tx(std::move(tx_in)), spent_outputs(std::move(spent_outputs_in)) {}
+    //! A transaction not worth checking, which is done right away
+    explicit CTxPreValidationJob(CTransactionRef tx_in) : m_done(true), tx(std::move(tx_in)) {}
+
+    //! Whether the checks are finished, or were never queued
+    bool IsDone() const { return m_done; }
+};
+
+/**
+ * Runs the script checks of transactions received from peers, which don't
+ * need cs_main, on a pool of worker threads ahead of AcceptToMemoryPool,
+ * which then finds the results in the signature and script execution
+ * caches. The message handler thread hands transactions over and accepts
+ * them once done, handling other messages meanwhile. Transactions whose
+ * scripts fail are rejected as AcceptToMemoryPool would reject them.
+ *
+ * Once the last worker stops, jobs still queued are given up on.
+ */
+class CTxPreValidator
+{
+private:
+    typedef std::function<bool(const CTransaction&, const std::vector<CTxOut>&, CValidationState&)> CheckFunction;
+
+    const CheckFunction m_check;
+    const size_t m_max_queue;
+
+    boost::mutex m_mutex;
+    //! Worker threads block on this when out of work
+    boost::condition_variable m_cond_worker;
+    //! Jobs not claimed by a worker yet, oldest first, with what to call once done
+    std::deque<std::pair<std::shared_ptr<CTxPreValidationJob>, std::function<void()>>> m_queue;
+    //! Worker threads running
+    int m_workers = 0;
+
+public:
+    explicit CTxPreValidator(CheckFunction check, size_t max_queue = MAX_TX_PREVALIDATION_QUEUE)
+        : m_check(std::move(check)), m_max_queue(max_queue) {}
+
+    /**
+     * @brief Queue the checks of a transaction.
+     * @param (const std::shared_ptr<CTxPreValidationJob>&) Job.
+     * @param (std::function<void()>) Called by the worker once the job is done, unless it is given up on.
+     * @return (bool) Whether the job was queued. Otherwise, as there are no
+     * workers or too many jobs queued already, it is marked done right away.
+     */
+    bool Submit(const std::shared_ptr<CTxPreValidationJob>& job, std::function<void()> notify);
+
+    /** Worker thread loop, until interrupted */
+    void Thread();
+};
+
+/** Pre-validates with PreValidateTransaction() for net_processing */
+extern CTxPreValidator g_tx_prevalidator;
+
+/** Run an instance of the transaction pre-validation thread */
+void ThreadTxPreValidation(int worker_num);
+
+#endif // BITCOIN_TXPREVALIDATION_H
@@ -11,6 +11,12 @@
 #include <univalue.h>
 
 class CBlock;
+class JSONWriter;
+
+/** Default codec version used to compress the txns of FEC-coded blocks (-udpblockcodec) */
+static const int64_t DEFAULT_UDP_BLOCK_CODEC = 1;
+/** Default memory and disk budget (in MiB) for blocks being received over UDP (-udpblockbudget), 0 = unlimited */
+static const int64_t DEFAULT_UDP_BLOCK_BUDGET = 0;
 
 std::vector<std::pair<unsigned short, uint64_t> > GetUDPInboundPorts(); // port, outbound bandwidth for group
 bool InitializeUDPConnections();
@@ -45,8 +51,10 @@ UniValue BlkChunkStatsToJSON(int target_height);
 UniValue MaxMinBlkChunkStatsToJSON();
 UniValue AllBlkChunkStatsToJSON();
 UniValue FecHitRatioToJson();
+UniValue PartialBlockUsageToJSON();
 
 UniValue UdpMulticastRxInfoToJson();
+void UdpMulticastRxInfoToJson(JSONWriter& ret); // members of the object above
 UniValue TxWindowInfoToJSON(int phy_idx, int log_idx);
 UniValue TxnTxInfoToJSON();
 UniValue TxQueueInfoToJSON();
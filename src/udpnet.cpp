@@ -17,6 +17,7 @@
 #include <crypto/poly1305.h>
 #include <hash.h>
 #include <init.h> // for ShutdownRequested()
+#include <jsonwriter.h>
 #include <validation.h>
 #include <net.h>
 #include <netbase.h>
@@ -24,6 +25,7 @@
 #include <primitives/transaction.h>
 #include <txmempool.h>
 #include <logging.h>
+#include <metrics.h>
 #include <util/strencodings.h>
 #include <util/time.h>
 
@@ -83,6 +85,20 @@ static std::map<CService, UDPConnectionInfo> mapPersistentNodes;
 
 static int g_mcast_log_interval = 10;
 
+static metrics::Counter udp_rx_packets("bitcoin_udp_rx_packets_total", "UDP packets received");
+static metrics::Counter udp_rx_bytes("bitcoin_udp_rx_bytes_total", "UDP bytes received");
+static metrics::Counter udp_rx_checksum_errors("bitcoin_udp_rx_checksum_errors_total", "UDP packets received with an invalid checksum");
+static metrics::Counter udp_tx_packets("bitcoin_udp_tx_packets_total", "UDP packets transmitted");
+static metrics::Counter udp_tx_bytes("bitcoin_udp_tx_bytes_total", "UDP bytes transmitted");
+static metrics::Counter udp_tx_errors("bitcoin_udp_tx_errors_total", "UDP transmissions that failed other than by a full socket buffer");
+// Messages waiting on the transmit buffers (one per priority) of all groups
+static metrics::Gauge udp_tx_queue_depth[] = {
+    {"bitcoin_udp_tx_queue_depth", "UDP messages queued for transmission", "buffer=\"high_prio\""},
+    {"bitcoin_udp_tx_queue_depth", "UDP messages queued for transmission", "buffer=\"best_effort\""},
+    {"bitcoin_udp_tx_queue_depth", "UDP messages queued for transmission", "buffer=\"bkgd_txn\""},
+    {"bitcoin_udp_tx_queue_depth", "UDP messages queued for transmission", "buffer=\"bkgd_block\""},
+};
+
 /*
  * UDP multicast service
  *
@@ -508,7 +524,8 @@ static bool InitializeUDPMulticast(std::vector<int> &udp_socks,
                       "    - dscp: %u\n"
                       "    - depth: %d\n"
                       "    - offset: %d\n"
-                      "    - interleave: %d\n",
+                      "    - interleave: %d\n"
+                      "    - fec overhead: %s\n",
                       mcast_info.physical_idx,
                       mcast_info.logical_idx,
                       mcast_info.mcast_ip,
@@ -517,7 +534,8 @@ static bool InitializeUDPMulticast(std::vector<int> &udp_socks,
                       mcast_info.dscp,
                       mcast_info.depth,
                       mcast_info.offset,
-                      mcast_info.interleave_size);
+                      mcast_info.interleave_size,
+                      mcast_info.fec_overhead.ToString());
         }
 
         /* Index based on multicast "addr", ifindex and logical index
@@ -554,8 +572,7 @@ static bool InitializeUDPMulticast(std::vector<int> &udp_socks,
 }
 
 /* Get information from the UDP multicast Rx instances */
-UniValue UdpMulticastRxInfoToJson() {
-    UniValue ret(UniValue::VOBJ);
+void UdpMulticastRxInfoToJson(JSONWriter& ret) {
     std::unique_lock<std::recursive_mutex> lock(cs_mapUDPNodes);
     const auto t_now = std::chrono::steady_clock::now();
     for (const auto& node : mapMulticastNodes) {
@@ -580,17 +597,26 @@ UniValue UdpMulticastRxInfoToJson() {
             unit    = "kbps";
         }
 
-        UniValue info(UniValue::VOBJ);
-        info.pushKV("bitrate", std::to_string(bitrate) + " " + unit);
-        info.pushKV("group", node.second.group);
-        info.pushKV("groupname", node.second.groupname);
-        info.pushKV("ifname", node.second.ifname);
-        info.pushKV("mcast_ip", node.second.mcast_ip);
-        info.pushKV("port", node.second.port);
-        info.pushKV("rcvd_bytes", stats.rcvd_bytes);
-        info.pushKV("trusted", node.second.trusted);
-        ret.__pushKV(std::get<0>(node.first).ToString(), info);
+        ret.Key(std::get<0>(node.first).ToString());
+        ret.BeginObject();
+        ret.PushKV("bitrate", std::to_string(bitrate) + " " + unit);
+        ret.PushKV("group", node.second.group);
+        ret.PushKV("groupname", node.second.groupname);
+        ret.PushKV("ifname", node.second.ifname);
+        ret.PushKV("mcast_ip", node.second.mcast_ip);
+        ret.PushKV("port", node.second.port);
+        ret.PushKV("rcvd_bytes", stats.rcvd_bytes);
+        ret.PushKV("trusted", node.second.trusted);
+        ret.EndObject();
     }
+}
+
+UniValue UdpMulticastRxInfoToJson() {
+    UniValue ret;
+    UniValueWriter writer(ret);
+    writer.BeginObject();
+    UdpMulticastRxInfoToJson(writer);
+    writer.EndObject();
     return ret;
 }
 
@@ -788,6 +814,9 @@ static void read_socket_func(evutil_socket_t fd, short event, void* arg) {
     assert(remoteaddrlen == sizeof(remoteaddr));
     CService c_remoteaddr(remoteaddr);
 
+    udp_rx_packets.Inc();
+    udp_rx_bytes.Inc(res);
+
     if (size_t(res) < sizeof(UDPMessageHeader) || size_t(res) >= sizeof(UDPMessage))
         return;
 
@@ -819,6 +848,7 @@ static void read_socket_func(evutil_socket_t fd, short event, void* arg) {
     if (it == mapUDPNodes.end())
         return;
     if (!CheckChecksum(it->second.connection.local_magic, msg, res)) {
+        udp_rx_checksum_errors.Inc();
         LogPrintf("UDP: Checksum error on message from %s\n", it->first.ToString());
         return;
     }
@@ -1020,12 +1050,14 @@ static inline void SendMessage(const UDPMessage& msg, const unsigned int length,
     const bool was_empty = buff.IsEmpty();
     lock.unlock();
 
-    buff.WriteElement([&](RingBufferElement& elem) {
+    const bool written = buff.WriteElement([&](RingBufferElement& elem) {
             elem.service = service;
             elem.length  = length;
             elem.magic   = magic;
             memcpy(&elem.msg, &msg, length);
         });
+    if (written)
+        udp_tx_queue_depth[&buff - queue.buffs.data()].Inc();
 
     if (was_empty)
         non_empty_queues_cv.notify_all();
@@ -1183,12 +1215,15 @@ static void do_send_messages() {
                     if (errno == EAGAIN || errno == EWOULDBLOCK) {
                         wouldblock = true;
                     } else {
+                        udp_tx_errors.Inc();
                         LogPrintf("UDP: sendto to group %d failed: %s\n",
                                   group, strerror(errno));
                     }
                     break;
                 }
                 consecutive_tx++;
+                udp_tx_packets.Inc();
+                udp_tx_bytes.Inc(res);
 
                 // Consume the transmission quota
                 if (!queue.unlimited)
@@ -1197,6 +1232,7 @@ static void do_send_messages() {
                 // Advance to the highest-priority non-empty buffer in this
                 // queue group
                 rd_proxy.ConfirmRead(next_tx->length);
+                udp_tx_queue_depth[queue.buff_id].Dec();
                 if (buff->IsEmpty()) {
                     queue.NextBuff();
                     if (queue.buff_id != -1)
@@ -1280,6 +1316,7 @@ UniValue TxQueueInfoToJSON()  {
 struct backfill_block {
     std::vector<UDPMessage> msgs;
     mutable size_t idx = 0; // index of next message to be transmitted
+    UDPBlockFECInfo fec_info;
 };
 
 struct backfill_block_window {
@@ -1386,7 +1423,7 @@ static void MulticastBackfillThread(const CService& mcastNode,
                 // Fill the FEC messages on this backfill block within the
                 // protected window of blocks
                 lock.lock();
-                UDPFillMessagesFromBlock(block, block_it->second.msgs, pindex->nHeight);
+                block_it->second.fec_info = UDPFillMessagesFromBlock(block, block_it->second.msgs, pindex->nHeight, info->fec_overhead);
                 pblock_window->bytes_in_window += block_it->second.msgs.size() * FEC_CHUNK_SIZE;
                 lock.unlock(); // safe to release (no other thread mutates the map)
 
@@ -1484,6 +1521,10 @@ static UniValue TxWindowFullInfoToJSON(std::shared_ptr<backfill_block_window> pb
         UniValue info(UniValue::VOBJ);
         info.pushKV("index", b.second.idx);
         info.pushKV("total", b.second.msgs.size());
+        info.pushKV("header_chunks", b.second.fec_info.header_chunks);
+        info.pushKV("header_overhead", b.second.fec_info.header_overhead);
+        info.pushKV("body_chunks", b.second.fec_info.body_chunks);
+        info.pushKV("body_overhead", b.second.fec_info.body_overhead);
         ret.__pushKV(std::to_string(b.first), info);
     }
     return ret;
@@ -1690,7 +1731,7 @@ void MulticastTxBlock(const int height) {
 
         // Each node gets a different set of FEC chunks
         std::vector<UDPMessage> msgs;
-        UDPFillMessagesFromBlock(block, msgs, pindex->nHeight);
+        UDPFillMessagesFromBlock(block, msgs, pindex->nHeight, node.second.fec_overhead);
 
         for (const auto& msg : msgs) {
             SendMessage(msg,
@@ -1809,6 +1850,8 @@ static UDPMulticastInfo ParseUDPMulticastInfo(const std::string& s, const bool t
         }
         info.bw  = atoi64(s.substr(mcastaddr_end + 1, bw_end - mcastaddr_end - 1));
 
+        std::string fec_loss_str, fec_fail_str;
+
         const size_t txn_per_sec_end = s.find(',', bw_end + 1);
         if (txn_per_sec_end == std::string::npos)
             info.txn_per_sec = atoi64(s.substr(bw_end + 1));
@@ -1838,7 +1881,21 @@ static UDPMulticastInfo ParseUDPMulticastInfo(const std::string& s, const bool t
                             info.dscp  = atoi(s.substr(offset_end + 1));
                         } else {
                             info.dscp  = atoi(s.substr(offset_end + 1, dscp_end - offset_end - 1));
-                            info.interleave_size = atoi(s.substr(dscp_end + 1));
+
+                            const size_t interleave_end = s.find(',', dscp_end + 1);
+                            if (interleave_end == std::string::npos) {
+                                info.interleave_size = atoi(s.substr(dscp_end + 1));
+                            } else {
+                                info.interleave_size = atoi(s.substr(dscp_end + 1, interleave_end - dscp_end - 1));
+
+                                const size_t fec_loss_end = s.find(',', interleave_end + 1);
+                                if (fec_loss_end == std::string::npos) {
+                                    LogPrintf("Failed to parse -udpmulticasttx option, FEC loss rate requires a target decode failure probability\n");
+                                    return info;
+                                }
+                                fec_loss_str = s.substr(interleave_end + 1, fec_loss_end - interleave_end - 1);
+                                fec_fail_str = s.substr(fec_loss_end + 1);
+                            }
                         }
                     }
                 }
@@ -1859,6 +1916,19 @@ static UDPMulticastInfo ParseUDPMulticastInfo(const std::string& s, const bool t
             LogPrintf("Failed to parse -udpmulticasttx option, offset must be < depth\n");
             return info;
         }
+
+        if (!fec_loss_str.empty()) {
+            double loss_rate, target_fail_prob;
+            if (!ParseDouble(fec_loss_str, &loss_rate) || loss_rate < 0 || loss_rate >= 1) {
+                LogPrintf("Failed to parse -udpmulticasttx option, FEC loss rate must be >= 0 and < 1\n");
+                return info;
+            }
+            if (!ParseDouble(fec_fail_str, &target_fail_prob) || target_fail_prob <= 0 || target_fail_prob >= 1) {
+                LogPrintf("Failed to parse -udpmulticasttx option, FEC target decode failure probability must be > 0 and < 1\n");
+                return info;
+            }
+            info.fec_overhead = FECOverheadPolicy::LossModel(loss_rate, target_fail_prob);
+        }
     } else {
         const size_t tx_ip_end = s.find(',', mcastaddr_end + 1);
         std::string tx_ip;
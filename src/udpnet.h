@@ -117,6 +117,7 @@ struct PartialBlockData {
     FECDecoder body_decoder; // Note that this may have been std::move()d if (currentlyProcessing)
     PartiallyDownloadedChunkBlock block_data;
     bool tip_blk; // Whether this is a block at the tip of the chain or an old/repeated block
+    bool header_accepted = false; // Whether the header was added to the block index ahead of the body
 
     int height = -1; // Block height
 
@@ -127,10 +128,16 @@ struct PartialBlockData {
     // nodes with chunks_avail set -> packets that were useful, packets provided
     std::map<CService, std::pair<uint32_t, uint32_t>> perNodeChunkCount;
 
+    // Memory and disk usage accounted against the partial block budget
+    size_t mem_usage = 0;
+    size_t disk_usage = 0;
+
     bool Init(const UDPMessage& msg);
     ReadStatus ProvideHeaderData(const CBlockHeaderAndLengthShortTxIDs& header);
     PartialBlockData(const CService& node, const UDPMessage& header_msg, const std::chrono::steady_clock::time_point& packet_recv); // Must be a MSG_TYPE_BLOCK_HEADER
+    ~PartialBlockData();
     void ReconstructBlockFromDecoder();
+    void UpdateUsage(); // Must hold state_mutex
 };
 
 class ChunksAvailableSet {
@@ -155,8 +162,8 @@ private:
 
 public:
     ChunksAvailableSet(bool hasAllChunks, size_t n_chunks, bool is_block_chunk) :
-        allSent(hasAllChunks), header_tracker_initd(!is_block_chunk),
-        block_tracker_initd(is_block_chunk) {
+        allSent(hasAllChunks), header_tracker_initd(false),
+        block_tracker_initd(false) {
             if (allSent) return;
             InitTracker(n_chunks, is_block_chunk);
     }
@@ -238,6 +245,7 @@ struct UDPMulticastInfo {
     uint16_t logical_idx;  /** logical idx for streams sharing physical idx */
     unsigned int txn_per_sec; /** txns to send per second (0 to disable) */
     char dscp;             /** Differentiated Services Code Point (DSCP) */
+    FECOverheadPolicy fec_overhead; /** overhead chunks of FEC-coded blocks */
 };
 
 struct UDPConnectionState {
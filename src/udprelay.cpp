@@ -8,12 +8,18 @@
 #include <consensus/consensus.h> // for MAX_BLOCK_SERIALIZED_SIZE
 #include <consensus/validation.h> // for CValidationState
 #include <logging.h>
+#include <memusage.h>
+#include <metrics.h>
 #include <streams.h>
+#include <util/system.h>
+#include <util/validation.h>
 #include <validation.h>
+#include <validationinterface.h>
 #include <version.h>
 #include <net.h>
 #include <net_processing.h>
 
+#include <algorithm>
 #include <queue>
 #include <condition_variable>
 #include <thread>
@@ -26,6 +32,7 @@
 #include <boost/thread.hpp>
 
 #define to_millis_double(t) (std::chrono::duration_cast<std::chrono::duration<double, std::chrono::milliseconds::period> >(t).count())
+#define to_seconds_double(t) (std::chrono::duration_cast<std::chrono::duration<double>>(t).count())
 #define DIV_CEIL(a, b) (((a) + (b) - 1) / (b))
 
 static CService TRUSTED_PEER_DUMMY;
@@ -37,6 +44,45 @@ static std::unordered_set<uint64_t> setBlocksRelayed;
 // of packets into more ProcessNewBlock calls, so we have to keep a separate
 // set here.
 static std::set<std::pair<uint64_t, CService>> setBlocksReceived;
+// Blocks evicted or dropped to stay within the partial block budget, and when.
+// Their chunks are ignored for a while, rather than have the partial block
+// recreated for each, until the object is likely no longer being sent.
+static std::map<std::pair<uint64_t, CService>, std::chrono::steady_clock::time_point> mapBlocksDropped;
+static const std::chrono::minutes PARTIAL_BLOCK_DROP_EXPIRY{10};
+
+// Memory and disk used by all partial blocks (see PartialBlockData::UpdateUsage)
+static std::atomic<size_t> partial_blocks_mem_usage{0};
+static std::atomic<size_t> partial_blocks_disk_usage{0};
+static metrics::Gauge partial_blocks_mem_usage_gauge("bitcoin_udp_partial_block_memory_bytes", "Heap memory used by blocks being received over UDP",
+                                                     [] { return (double)partial_blocks_mem_usage; });
+static metrics::Gauge partial_blocks_disk_usage_gauge("bitcoin_udp_partial_block_disk_bytes", "Disk space used by the FEC chunks of blocks being received over UDP",
+                                                      [] { return (double)partial_blocks_disk_usage; });
+static metrics::Gauge partial_blocks_count("bitcoin_udp_partial_blocks", "Blocks being received over UDP");
+// Partial blocks evicted and FEC objects dropped to stay within the budget
+static metrics::Counter partial_blocks_evicted("bitcoin_udp_partial_blocks_evicted_total", "Partial blocks evicted to stay within -udpblockbudget");
+static metrics::Counter partial_blocks_dropped("bitcoin_udp_partial_blocks_dropped_total", "FEC objects of partial blocks dropped to stay within -udpblockbudget");
+
+static metrics::Counter blocks_decoded("bitcoin_udp_blocks_decoded_total", "Blocks decoded from UDP");
+static metrics::Counter block_decode_failures("bitcoin_udp_block_decode_failures_total", "Blocks received over UDP that failed to decode");
+static metrics::Histogram block_decode_latency("bitcoin_udp_block_decode_seconds", "Time to reconstruct and deserialize a block once enough data is available");
+// Time from the first chunk received until the block is decoded
+static metrics::Histogram block_time_to_decode[] = {
+    {"bitcoin_udp_block_time_to_decode_seconds", "Time from the first chunk of a block until it is decoded", metrics::LATENCY_BUCKETS, "block=\"backfill\""},
+    {"bitcoin_udp_block_time_to_decode_seconds", "Time from the first chunk of a block until it is decoded", metrics::LATENCY_BUCKETS, "block=\"tip\""},
+};
+
+// Maximum memory and disk usage of partial blocks (0 = unlimited)
+static size_t GetPartialBlockBudget() {
+    return std::max<int64_t>(gArgs.GetArg("-udpblockbudget", DEFAULT_UDP_BLOCK_BUDGET), 0) << 20;
+}
+
+// Codec used to compress the txns of the FEC-coded blocks we send. Receivers
+// learn the codec from the block header, but must support it.
+static codec_version_t GetBlockCodecVersion() {
+    static const codec_version_t codec_version =
+        (gArgs.GetArg("-udpblockcodec", DEFAULT_UDP_BLOCK_CODEC) == codec_version_t::v2) ? codec_version_t::v2 : codec_version_t::v1;
+    return codec_version;
+}
 
 static std::map<std::pair<uint64_t, CService>, std::shared_ptr<PartialBlockData> >::iterator RemovePartialBlock(std::map<std::pair<uint64_t, CService>, std::shared_ptr<PartialBlockData> >::iterator it) {
     uint64_t const hash_prefix = it->first.first;
@@ -75,6 +121,66 @@ static void RemovePartialBlocks(uint64_t const hash_prefix) {
         it = RemovePartialBlock(it);
 }
 
+/* Fraction of the chunks of the initialized FEC objects of a partial block
+ * received so far */
+static double GetPartialBlockProgress(const PartialBlockData& b) {
+    const size_t expected = (b.header_initialized ? b.header_decoder.GetChunkCount() : 0) +
+        (b.blk_initialized ? b.body_decoder.GetChunkCount() : 0);
+    if (expected == 0)
+        return 0;
+    return std::min(1.0, double(b.header_decoder.GetChunksRcvd() + b.body_decoder.GetChunksRcvd()) / expected);
+}
+
+/* Make room for a FEC object about to be initialized on the partial block at
+ * `it` (or on a new partial block if `it` is the end of mapPartialBlocks) when
+ * it would exceed the partial block budget. Backfill (non-tip) blocks are
+ * evicted least complete first. Returns false if the new object should be
+ * dropped instead, as it belongs to a backfill block that is not more complete
+ * than any other. Tip blocks are never evicted nor dropped, even if over the
+ * budget. Note the FEC decoders keep their chunks on mmap'ed files, so most of
+ * the usage is disk space (and page cache) rather than heap memory. */
+static bool EnforcePartialBlockBudget(std::map<std::pair<uint64_t, CService>, std::shared_ptr<PartialBlockData> >::iterator it, bool tip_blk, size_t obj_size) EXCLUSIVE_LOCKS_REQUIRED(cs_mapUDPNodes) {
+    const size_t budget = GetPartialBlockBudget();
+    const auto usage = [] { return partial_blocks_mem_usage + partial_blocks_disk_usage; };
+    if (budget == 0 || usage() + obj_size <= budget)
+        return true;
+
+    struct EvictionCandidate {
+        double progress;
+        bool incoming;
+        std::map<std::pair<uint64_t, CService>, std::shared_ptr<PartialBlockData> >::iterator it;
+    };
+    std::vector<EvictionCandidate> candidates;
+    for (auto b = mapPartialBlocks.begin(); b != mapPartialBlocks.end(); b++) {
+        std::lock_guard<std::mutex> block_lock(b->second->state_mutex);
+        if (b->second->tip_blk || b->second->currentlyProcessing)
+            continue;
+        candidates.push_back({GetPartialBlockProgress(*b->second), b == it, b});
+    }
+    if (it == mapPartialBlocks.end() && !tip_blk)
+        candidates.push_back({0, true, it});
+
+    // Least complete first, dropping the incoming object on ties
+    std::sort(candidates.begin(), candidates.end(), [](const EvictionCandidate& a, const EvictionCandidate& b) {
+        return std::make_pair(a.progress, !a.incoming) < std::make_pair(b.progress, !b.incoming);
+    });
+
+    for (const EvictionCandidate& c : candidates) {
+        if (usage() + obj_size <= budget)
+            break;
+        if (c.incoming) {
+            partial_blocks_dropped.Inc();
+            return false;
+        }
+        LogPrint(BCLog::UDPNET, "UDP: Evicting partial block %016lx (height %d, %.1f%% received) to stay within the budget\n",
+                 c.it->first.first, c.it->second->height, 100 * c.progress);
+        mapBlocksDropped.emplace(c.it->first, std::chrono::steady_clock::now());
+        RemovePartialBlock(c.it);
+        partial_blocks_evicted.Inc();
+    }
+    return true;
+}
+
 static inline void SendMessageToNode(const UDPMessage& msg, unsigned int length, bool high_prio, uint64_t hash_prefix, std::map<CService, UDPConnectionState>::iterator it) {
     if ((it->second.state & STATE_INIT_COMPLETE) != STATE_INIT_COMPLETE)
         return;
@@ -356,7 +462,7 @@ void UDPRelayBlock(const CBlock& block, int nHeight) {
             initd = std::chrono::steady_clock::now();
 
         boost::optional<ChunkCodedBlock> codedBlock;
-        CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, codec_version_t::default_version, true);
+        CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, GetBlockCodecVersion(), true);
         headerAndIDs.setBlockHeight(nHeight);
         std::vector<unsigned char> header_data;
         header_data.reserve(2500 + 8 * block.vtx.size()); // Rather conservatively high estimate
@@ -584,15 +690,19 @@ void UDPFillMessagesFromTx(const CTransaction& tx, std::vector<std::pair<UDPMess
  * these can then complete the decoding right away. After them, the overhead
  * header chunks are sent and, lastly, the overhead block chunks.
  *
+ * The number of overhead chunks of each object is given by the stream's FEC
+ * overhead policy. With the loss-model policy, small objects (like the header)
+ * get only the few chunks they need to meet the target decode failure
+ * probability, rather than a fixed base overhead of tens of chunks.
+ *
  */
-void UDPFillMessagesFromBlock(const CBlock& block, std::vector<UDPMessage>& msgs,
-                              const int height, const size_t base_overhead,
-                              const double overhead) {
+UDPBlockFECInfo UDPFillMessagesFromBlock(const CBlock& block, std::vector<UDPMessage>& msgs,
+                                         const int height, const FECOverheadPolicy& fec_overhead) {
     const uint256 hashBlock(block.GetHash());
     const uint64_t hash_prefix = hashBlock.GetUint64(0);
 
     /* Block header */
-    CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, codec_version_t::default_version, true);
+    CBlockHeaderAndLengthShortTxIDs headerAndIDs(block, GetBlockCodecVersion(), true);
     headerAndIDs.setBlockHeight(height);
     /* NOTE: it is not mandatory to include the block height along
      * CBlockHeaderAndLengthShortTxIDs. However, it is useful to include it here
@@ -610,7 +720,7 @@ void UDPFillMessagesFromBlock(const CBlock& block, std::vector<UDPMessage>& msgs
     VectorOutputStream stream(&header_data, SER_NETWORK, PROTOCOL_VERSION);
     stream << headerAndIDs;
     const size_t n_header_chunks = DIV_CEIL(header_data.size(), FEC_CHUNK_SIZE);
-    const size_t header_overhead = base_overhead + (overhead * n_header_chunks);
+    const size_t header_overhead = fec_overhead.GetOverhead(n_header_chunks);
     const size_t n_header_fec_chunks = n_header_chunks + header_overhead;
     DataFECer header_fecer(header_data, n_header_fec_chunks);
     /* NOTE: the block header will typically be encoded by cm256, due to its
@@ -618,6 +728,10 @@ void UDPFillMessagesFromBlock(const CBlock& block, std::vector<UDPMessage>& msgs
      * necessary. Nevertheless, since chunks can be lost along the transport
      * link, some chunks of overhead are used. */
 
+    UDPBlockFECInfo fec_info;
+    fec_info.header_chunks   = n_header_chunks;
+    fec_info.header_overhead = header_overhead;
+
     /* First fill the minimum amount of header chunks for decoding
      *
      * NOTE: since cm256 is MDS, the minimum amount of header chunks is
@@ -639,18 +753,20 @@ void UDPFillMessagesFromBlock(const CBlock& block, std::vector<UDPMessage>& msgs
             FillBlockMessageHeader(msgs[offset + i], hash_prefix, MSG_TYPE_BLOCK_HEADER, header_data.size(), flags);
             CopyFECData(msgs[offset + i], header_fecer, n_header_chunks + i);
         }
-        return;
+        return fec_info;
     }
 
     ChunkCodedBlock codedBlock(block, headerAndIDs);
     const std::vector<unsigned char>& chunk_coded_block = codedBlock.GetCodedBlock();
     const size_t n_block_chunks = DIV_CEIL(chunk_coded_block.size(), FEC_CHUNK_SIZE);
-    const size_t block_overhead = base_overhead + (overhead * n_block_chunks);
+    const size_t block_overhead = fec_overhead.GetOverhead(n_block_chunks);
     const size_t n_block_fec_chunks = n_block_chunks + block_overhead;
     /* NOTE: on average wirehair needs about 0.02 chunks of overhead to recover,
      * meaning most often it doesn't need overhead at all. Again, we add
      * overhead chunks here in order to overcome loss along the link. */
     DataFECer block_fecer(chunk_coded_block, n_block_fec_chunks);
+    fec_info.body_chunks   = n_block_chunks;
+    fec_info.body_overhead = block_overhead;
 
     /* Minimum amount of block chunks for decoding
      *
@@ -679,13 +795,14 @@ void UDPFillMessagesFromBlock(const CBlock& block, std::vector<UDPMessage>& msgs
         CopyFECData(msgs[offset + i], block_fecer, n_block_chunks + i);
     }
 
-    return;
+    return fec_info;
 }
 
 static std::mutex block_process_mutex;
 static std::condition_variable block_process_cv;
 static std::atomic_bool block_process_shutdown(false);
 static std::queue<std::pair<std::pair<uint64_t, CService>, std::shared_ptr<PartialBlockData> > > block_process_queue;
+static metrics::Gauge block_process_queue_depth("bitcoin_udp_block_process_queue_depth", "Partial blocks waiting to be processed");
 static size_t queue_size_warn = 10; // Print queue size when it exceeds this
 
 static void DoBackgroundBlockProcessing(const std::pair<std::pair<uint64_t, CService>, std::shared_ptr<PartialBlockData> >& block_data) {
@@ -694,6 +811,7 @@ static void DoBackgroundBlockProcessing(const std::pair<std::pair<uint64_t, CSer
     // Instead we pass the processing back to ProcessNewBlockThread without cs_mapUDPNodes
     std::unique_lock<std::mutex> lock(block_process_mutex);
     block_process_queue.emplace(block_data);
+    block_process_queue_depth.Inc();
     if (block_process_queue.size() > queue_size_warn) {
         LogPrint(BCLog::FEC, "Block process queue size: %ld\n",
                  block_process_queue.size());
@@ -702,6 +820,49 @@ static void DoBackgroundBlockProcessing(const std::pair<std::pair<uint64_t, CSer
     block_process_cv.notify_all();
 }
 
+/* Validate the header of a tip block and add it to the block index as soon as
+ * it is decoded, rather than only once the body is. Returns false if the
+ * header is invalid. */
+static bool AcceptUDPBlockHeader(const CBlockHeader& header, PartialBlockData& block) {
+    CValidationState state;
+    const CBlockIndex* pindex = nullptr;
+    if (ProcessNewBlockHeaders({header}, state, Params(), &pindex)) {
+        block.header_accepted = true;
+        LogPrint(BCLog::UDPNET, "UDP: Block %s - Header accepted %lf ms after the first chunk\n",
+                 header.GetHash().ToString(), to_millis_double(std::chrono::steady_clock::now() - block.timeHeaderRecvd));
+        return true;
+    }
+    /* Blocks whose parent we do not have yet can still be stored out of order */
+    if (state.GetReason() == ValidationInvalidReason::BLOCK_MISSING_PREV ||
+        state.GetReason() == ValidationInvalidReason::BLOCK_TIME_FUTURE)
+        return true;
+    LogPrintf("UDP: Block %s - Invalid header: %s\n", header.GetHash().ToString(), FormatStateMessage(state));
+    return false;
+}
+
+/* Announce a reconstructed block as a compact block to high-bandwidth peers
+ * ahead of ProcessNewBlock, given that its header was already accepted. This
+ * is the announcement otherwise made by AcceptBlock, which is then skipped, as
+ * peers get a single fast announcement per height. */
+static void AnnounceUDPBlock(const std::shared_ptr<const CBlock>& pblock, const PartialBlockData& block) {
+    CValidationState state;
+    if (!CheckBlock(*pblock, state, Params().GetConsensus()))
+        return; // Leave it to ProcessNewBlock
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindex = LookupBlockIndex(pblock->GetHash());
+        if (!pindex || ::ChainstateActive().IsInitialBlockDownload() || ::ChainActive().Tip() != pindex->pprev)
+            return;
+        // The checks AcceptBlock makes before its announcement, such as those
+        // of the witness commitment, which CheckBlock can't make
+        if (!ContextualCheckBlock(*pblock, state, Params().GetConsensus(), pindex->pprev))
+            return;
+        GetMainSignals().NewPoWValidBlock(pindex, pblock);
+    }
+    LogPrint(BCLog::UDPNET, "UDP: Block %s - Announced to high-bandwidth peers %lf ms after the first chunk\n",
+             pblock->GetHash().ToString(), to_millis_double(std::chrono::steady_clock::now() - block.timeHeaderRecvd));
+}
+
 static void ProcessBlockThread() {
     const bool fBench = LogAcceptCategory(BCLog::BENCH);
 
@@ -717,6 +878,7 @@ static void ProcessBlockThread() {
         CService& node = process_block.first.second;
         PartialBlockData& block = *process_block.second;
         block_process_queue.pop();
+        block_process_queue_depth.Dec();
         process_lock.unlock();
 
         bool more_work;
@@ -777,7 +939,9 @@ static void ProcessBlockThread() {
                         pblockindex = LookupBlockIndex(header.header.GetHash());
                     }
                     block.chain_lookup = true;
-                    if (pblockindex) {
+                    /* The header alone may be known already, accepted early
+                     * from a partial block received from another peer */
+                    if (pblockindex && (pblockindex->nStatus & BLOCK_HAVE_DATA)) {
                         /* We do have the block already. Drop the partial block
                          * immediately and add it to setBlocksReceived, so that its
                          * subsequent chunks are ignored.*/
@@ -823,6 +987,14 @@ static void ProcessBlockThread() {
 
                 const uint256 blockHash = block.block_data.GetBlockHash();
 
+                if (block.tip_blk && !AcceptUDPBlockHeader(header.header, block)) {
+                    lock.unlock();
+                    std::lock_guard<std::recursive_mutex> udpNodesLock(cs_mapUDPNodes);
+                    setBlocksReceived.insert(process_block.first);
+                    RemovePartialBlock(process_block.first);
+                    break;
+                }
+
                 if (fBench) {
                     std::chrono::steady_clock::time_point header_provided(std::chrono::steady_clock::now());
                     LogPrintf("UDP: Block %s (height %7d) - Got full header and shorttxids from %s in %lf %lf %lf ms\n", blockHash.ToString(), block.height, block.nodeHeaderRecvd.ToString(), to_millis_double(data_copied - decode_start), to_millis_double(header_deserialized - data_copied), to_millis_double(header_provided - header_deserialized));
@@ -874,9 +1046,7 @@ static void ProcessBlockThread() {
                     break;
                 }
                 block.currentlyProcessing = true;
-                std::chrono::steady_clock::time_point reconstruct_start;
-                if (fBench)
-                    reconstruct_start = std::chrono::steady_clock::now();
+                const std::chrono::steady_clock::time_point reconstruct_start(std::chrono::steady_clock::now());
 
                 if (!block.block_data.IsBlockAvailable()) {
                     block.ReconstructBlockFromDecoder();
@@ -889,11 +1059,10 @@ static void ProcessBlockThread() {
 
                 ReadStatus status = block.block_data.FinalizeBlock();
 
-                std::chrono::steady_clock::time_point block_finalized;
-                if (fBench)
-                    block_finalized = std::chrono::steady_clock::now();
+                const std::chrono::steady_clock::time_point block_finalized(std::chrono::steady_clock::now());
 
                 if (status != READ_STATUS_OK) {
+                    block_decode_failures.Inc();
                     lock.unlock();
                     std::lock_guard<std::recursive_mutex> udpNodesLock(cs_mapUDPNodes);
 
@@ -910,6 +1079,9 @@ static void ProcessBlockThread() {
                     RemovePartialBlock(process_block.first);
                     break;
                 } else {
+                    blocks_decoded.Inc();
+                    block_decode_latency.Observe(to_seconds_double(block_finalized - reconstruct_start));
+                    block_time_to_decode[block.tip_blk].Observe(to_seconds_double(block_finalized - block.timeHeaderRecvd));
                     std::shared_ptr<const CBlock> pdecoded_block = block.block_data.GetBlock();
                     const CBlock& decoded_block = *pdecoded_block;
                     if (fBench) {
@@ -934,6 +1106,9 @@ static void ProcessBlockThread() {
                     if (fBench)
                         process_start = std::chrono::steady_clock::now();
 
+                    if (block.header_accepted)
+                        AnnounceUDPBlock(pdecoded_block, block);
+
                     /* Treat the block as a solicited block in case it came from
                      * a trusted peer */
                     const bool force_requested = (node == TRUSTED_PEER_DUMMY);
@@ -1059,6 +1234,13 @@ void BlockRecvShutdown() {
         process_block_thread->join();
         process_block_thread.reset();
     }
+
+    // Remove the chunk files of the blocks left incomplete while the data
+    // directory is still set
+    std::unique_lock<std::recursive_mutex> lock(cs_mapUDPNodes);
+    while (!mapPartialBlocks.empty())
+        RemovePartialBlock(mapPartialBlocks.begin());
+    mapBlocksDropped.clear();
 }
 
 // TODO: Use the one from net_processing (with appropriate lock-free-ness)
@@ -1066,7 +1248,9 @@ static std::vector<std::pair<uint256, CTransactionRef>> udpnet_dummy_extra_txn;
 ReadStatus PartialBlockData::ProvideHeaderData(const CBlockHeaderAndLengthShortTxIDs& header) {
     assert(in_header);
     in_header = false;
-    return block_data.InitData(header, udpnet_dummy_extra_txn);
+    const ReadStatus status = block_data.InitData(header, udpnet_dummy_extra_txn);
+    UpdateUsage();
+    return status;
 }
 
 bool PartialBlockData::Init(const UDPMessage& msg) {
@@ -1086,6 +1270,7 @@ bool PartialBlockData::Init(const UDPMessage& msg) {
         blk_len = obj_length;
         blk_initialized = true;
     }
+    UpdateUsage();
     return true;
 }
 
@@ -1099,8 +1284,29 @@ PartialBlockData::PartialBlockData(const CService& node, const UDPMessage& msg,
     {
        bool const ret = Init(msg);
        assert(ret);
+       partial_blocks_count.Inc();
     }
 
+PartialBlockData::~PartialBlockData() {
+    partial_blocks_count.Dec();
+    partial_blocks_mem_usage -= mem_usage;
+    partial_blocks_disk_usage -= disk_usage;
+}
+
+void PartialBlockData::UpdateUsage() {
+    size_t new_mem_usage = memusage::MallocUsage(sizeof(PartialBlockData)) + block_data.DynamicMemoryUsage() +
+        header_decoder.DynamicMemoryUsage() + body_decoder.DynamicMemoryUsage() + memusage::DynamicUsage(perNodeChunkCount);
+    // ProvideHeaderData will allocate the chunk-coded block, of the size of the
+    // body, so count it from when the body is first seen
+    if (in_header && blk_initialized)
+        new_mem_usage += blk_len;
+    const size_t new_disk_usage = header_decoder.GetStorageSize() + body_decoder.GetStorageSize();
+    partial_blocks_mem_usage += new_mem_usage - mem_usage;
+    partial_blocks_disk_usage += new_disk_usage - disk_usage;
+    mem_usage  = new_mem_usage;
+    disk_usage = new_disk_usage;
+}
+
 void PartialBlockData::ReconstructBlockFromDecoder() {
     assert(body_decoder.DecodeReady());
 
@@ -1220,6 +1426,28 @@ bool HandleBlockTxMessage(UDPMessage& msg, size_t length, const CService& node,
     if (setBlocksRelayed.count(msg.msg.block.hash_prefix) || setBlocksReceived.count(hash_peer_pair))
         return true;
 
+    if (!mapBlocksDropped.empty() && mapBlocksDropped.count(hash_peer_pair))
+        return true;
+
+    // Initializing a FEC object allocates the storage of all of its chunks,
+    // and the body that of the chunk-coded block once the header is decoded
+    if (n_chunks >= 2) {
+        auto partial_block_it = mapPartialBlocks.find(hash_peer_pair);
+        const bool new_obj = (partial_block_it == mapPartialBlocks.end()) ||
+            (is_blk_header_chunk ? !partial_block_it->second->header_initialized : !partial_block_it->second->blk_initialized);
+        const bool tip_blk = (partial_block_it == mapPartialBlocks.end()) ?
+            (msg.header.msg_type & TIP_BLOCK) : partial_block_it->second->tip_blk;
+        const size_t obj_size = n_chunks * FEC_CHUNK_SIZE + (is_blk_content_chunk ? msg.msg.block.obj_length : 0);
+        if (new_obj && !EnforcePartialBlockBudget(partial_block_it, tip_blk, obj_size)) {
+            // Drop the block, as in-flight backfill blocks complete or time
+            // out, and ignore it until the drop expires
+            mapBlocksDropped.emplace(hash_peer_pair, std::chrono::steady_clock::now());
+            if (partial_block_it != mapPartialBlocks.end())
+                RemovePartialBlock(partial_block_it);
+            return true;
+        }
+    }
+
     std::map<uint64_t, ChunksAvailableSet>::iterator chunks_avail_it = state.chunks_avail.find(msg.msg.block.hash_prefix);
 
     if (chunks_avail_it == state.chunks_avail.end()) {
@@ -1257,7 +1485,7 @@ bool HandleBlockTxMessage(UDPMessage& msg, size_t length, const CService& node,
          */
         chunks_avail_it = state.chunks_avail.emplace(std::piecewise_construct,
                                                      std::forward_as_tuple(hash_prefix),
-                                                     std::forward_as_tuple(they_have_block, n_chunks, is_blk_header_chunk)
+                                                     std::forward_as_tuple(they_have_block, n_chunks, is_blk_content_chunk)
             ).first;
     }
 
@@ -1402,6 +1630,7 @@ bool HandleBlockTxMessage(UDPMessage& msg, size_t length, const CService& node,
         LogPrintf("UDP: FEC chunk decode failed for chunk %d from block %lu from %s\n", msg.msg.block.chunk_id, msg.msg.block.hash_prefix, node.ToString());
         return true;
     }
+    block.UpdateUsage();
 
     std::chrono::steady_clock::time_point chunks_processed;
     if (fBench)
@@ -1501,6 +1730,12 @@ void ProcessDownloadTimerEvents() {
         else
             it++;
     }
+    for (auto it = mapBlocksDropped.begin(); it != mapBlocksDropped.end();) {
+        if (std::chrono::steady_clock::now() - it->second > PARTIAL_BLOCK_DROP_EXPIRY)
+            it = mapBlocksDropped.erase(it);
+        else
+            it++;
+    }
     //TODO: Prune setBlocksRelayed and setBlocksReceived to keep lookups fast?
 }
 
@@ -1645,3 +1880,18 @@ UniValue FecHitRatioToJson() {
     }
     return ret;
 }
+
+/* Return JSON with the memory and disk usage of the partial blocks against the
+ * budget set by -udpblockbudget */
+UniValue PartialBlockUsageToJSON() {
+    std::unique_lock<std::recursive_mutex> lock(cs_mapUDPNodes);
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("budget", (uint64_t)GetPartialBlockBudget());
+    ret.pushKV("usage", (uint64_t)(partial_blocks_mem_usage + partial_blocks_disk_usage));
+    ret.pushKV("memory", (uint64_t)partial_blocks_mem_usage);
+    ret.pushKV("disk", (uint64_t)partial_blocks_disk_usage);
+    ret.pushKV("n_blks", (uint64_t)mapPartialBlocks.size());
+    ret.pushKV("evicted", partial_blocks_evicted.Value());
+    ret.pushKV("dropped", partial_blocks_dropped.Value());
+    return ret;
+}
@@ -18,9 +18,17 @@ bool HandleBlockTxMessage(UDPMessage& msg, size_t length, const CService& node,
 
 void ProcessDownloadTimerEvents();
 
+// Number of data and overhead FEC chunks filled by UDPFillMessagesFromBlock
+struct UDPBlockFECInfo {
+    size_t header_chunks = 0;
+    size_t header_overhead = 0;
+    size_t body_chunks = 0; // zero for empty blocks (sent through the header only)
+    size_t body_overhead = 0;
+};
+
 // Each UDPMessage must be of sizeof(UDPMessageHeader) + MAX_UDP_MESSAGE_LENGTH in length!
-void UDPFillMessagesFromBlock(const CBlock& block, std::vector<UDPMessage>& msgs, int height,
-                              size_t base_overhead=60, double overhead=0.05);
+UDPBlockFECInfo UDPFillMessagesFromBlock(const CBlock& block, std::vector<UDPMessage>& msgs, int height,
+                                         const FECOverheadPolicy& fec_overhead = FECOverheadPolicy());
 void UDPFillMessagesFromTx(const CTransaction& tx, std::vector<std::pair<UDPMessage, size_t>>& msgs);
 
 #endif
@@ -6,6 +6,8 @@
 #include <validation.h>
 
 #include <arith_uint256.h>
+#include <blockfilemap.h>
+#include <blockindexcache.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkqueue.h>
@@ -14,6 +16,8 @@
 #include <consensus/tx_check.h>
 #include <consensus/tx_verify.h>
 #include <consensus/validation.h>
+#include <core_memusage.h>
+#include <crypto/common.h>
 #include <cuckoocache.h>
 #include <flatfile.h>
 #include <hash.h>
@@ -42,14 +46,17 @@
 #include <util/rbf.h>
 #include <util/strencodings.h>
 #include <util/system.h>
+#include <util/threadnames.h>
 #include <util/translation.h>
 #include <util/validation.h>
 #include <validationinterface.h>
 #include <warnings.h>
 
+#include <condition_variable>
 #include <future>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/thread.hpp>
@@ -85,6 +92,8 @@ BlockManager g_blockman;
 
 std::unique_ptr<CChainState> g_chainstate;
 
+BlockFileMaps g_block_file_maps;
+
 CChainState& ChainstateActive() {
     assert(g_chainstate);
     return *g_chainstate;
@@ -112,12 +121,14 @@ Mutex g_best_block_mutex;
 std::condition_variable g_best_block_cv;
 uint256 g_best_block;
 int nScriptCheckThreads = 0;
+int nCoinsPrefetchThreads = 0;
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
+bool fBackgroundFlush = DEFAULT_BACKGROUND_FLUSH;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
@@ -1146,21 +1157,51 @@ static bool WriteBlockToDisk(const CBlock& block, FlatFilePos& pos, const CMessa
     return true;
 }
 
+/**
+ * Map the block stored at pos, along with the message start and size before
+ * it. Returns false if it can't be mapped, leaving it to be read from the file.
+ */
+static bool MapBlockFromDisk(const FlatFilePos& pos, MappedBlockData& block)
+{
+    if (pos.nPos < 8)
+        return false;
+    const FlatFileSeq seq = BlockFileSeq();
+    const FlatFilePos hpos(pos.nFile, pos.nPos - 8);
+    MappedBlockData header;
+    if (!g_block_file_maps.Read(seq, hpos, 8, header))
+        return false;
+    const uint32_t blk_size = ReadLE32(header.data() + CMessageHeader::MESSAGE_START_SIZE);
+    if (blk_size > MAX_SIZE)
+        return false;
+    return g_block_file_maps.Read(seq, hpos, 8 + blk_size, block);
+}
+
 bool ReadBlockFromDisk(CBlock& block, const FlatFilePos& pos, const Consensus::Params& consensusParams)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    MappedBlockData mapped;
+    if (MapBlockFromDisk(pos, mapped)) {
+        // Deserialize straight from the mapping
+        try {
+            SpanReader(SER_DISK, CLIENT_VERSION, mapped.subspan(8).span()) >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
 
-    // Read block
-    try {
-        filein >> block;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        // Read block
+        try {
+            filein >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
 
     // Check the header
@@ -1186,8 +1227,21 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
-bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const FlatFilePos& pos, const CMessageHeader::MessageStartChars& message_start)
+bool ReadRawBlockFromDisk(MappedBlockData& block, const FlatFilePos& pos, const CMessageHeader::MessageStartChars& message_start)
 {
+    MappedBlockData mapped;
+    if (MapBlockFromDisk(pos, mapped)) {
+        if (memcmp(mapped.data(), message_start, CMessageHeader::MESSAGE_START_SIZE)) {
+            return error("%s: Block magic mismatch for %s: %s versus expected %s", __func__, pos.ToString(),
+                    HexStr(mapped.data(), mapped.data() + CMessageHeader::MESSAGE_START_SIZE),
+                    HexStr(message_start, message_start + CMessageHeader::MESSAGE_START_SIZE));
+        }
+        // Served from the mapping, without a copy
+        block = mapped.subspan(8);
+        return true;
+    }
+
+    std::shared_ptr<std::vector<uint8_t>> data = std::make_shared<std::vector<uint8_t>>();
     FlatFilePos hpos = pos;
     hpos.nPos -= 8; // Seek back 8 bytes for meta header
     CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
@@ -1212,16 +1266,17 @@ bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const FlatFilePos& pos, c
                     blk_size, MAX_SIZE);
         }
 
-        block.resize(blk_size); // Zeroing of memory is intentional here
-        filein.read((char*)block.data(), blk_size);
+        data->resize(blk_size); // Zeroing of memory is intentional here
+        filein.read((char*)data->data(), blk_size);
     } catch(const std::exception& e) {
         return error("%s: Read from block file failed: %s for %s", __func__, e.what(), pos.ToString());
     }
 
+    block = MappedBlockData(data, Span<const uint8_t>(data->data(), data->size()));
     return true;
 }
 
-bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start)
+bool ReadRawBlockFromDisk(MappedBlockData& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start)
 {
     FlatFilePos block_pos;
     {
@@ -1251,11 +1306,12 @@ CoinsViews::CoinsViews(
     bool in_memory,
     bool should_wipe) : m_dbview(
                             GetDataDir() / ldb_name, cache_size_bytes, in_memory, should_wipe),
-                        m_catcherview(&m_dbview) {}
+                        m_catcherview(&m_dbview),
+                        m_flushview(&m_catcherview, m_dbview) {}
 
 void CoinsViews::InitCache()
 {
-    m_cacheview = MakeUnique<CCoinsViewCache>(&m_catcherview);
+    m_cacheview = MakeUnique<CCoinsViewCache>(&m_flushview);
 }
 
 // NOTE: for now m_blockman is set to a global, but this will be changed
@@ -1468,7 +1524,7 @@ int GetSpendHeight(const CCoinsViewCache& inputs)
 }
 
 
-static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
+static ShardedCuckooCache<uint256, SignatureCacheHasher> scriptExecutionCache;
 static uint256 scriptExecutionCacheNonce(GetRandHash());
 
 void InitScriptExecutionCache() {
@@ -1480,6 +1536,17 @@ void InitScriptExecutionCache() {
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+/** Key of the script execution cache entry for the scripts of a transaction checked with some flags */
+static uint256 ScriptExecutionCacheEntry(const CTransaction& tx, unsigned int flags)
+{
+    uint256 hashCacheEntry;
+    // We only use the first 19 bytes of nonce to avoid a second SHA
+    // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
+    static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
+    CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+    return hashCacheEntry;
+}
+
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set.
@@ -1510,12 +1577,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
     // correct (ie that the transaction hash which is in tx's prevouts
     // properly commits to the scriptPubKey in the inputs view of that
     // transaction).
-    uint256 hashCacheEntry;
-    // We only use the first 19 bytes of nonce to avoid a second SHA
-    // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
-    static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
-    CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
-    AssertLockHeld(cs_main); //TODO: Remove this requirement by making CuckooCache not require external locks
+    const uint256 hashCacheEntry = ScriptExecutionCacheEntry(tx, flags);
     if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
         return true;
     }
@@ -1573,6 +1635,103 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
     return true;
 }
 
+bool PrepareTxPreValidation(const CTransaction& tx, std::vector<CTxOut>& spent_outputs)
+{
+    AssertLockHeld(cs_main);
+    // The checks of AcceptToMemoryPool ahead of the scripts which are cheap,
+    // so that only transactions which may well be accepted are checked
+    CValidationState state;
+    std::string reason;
+    if (tx.IsCoinBase() || !CheckTransaction(tx, state) || (fRequireStandard && !IsStandardTx(tx, reason)))
+        return false;
+
+    LOCK(::mempool.cs);
+    if (::mempool.exists(tx.GetHash()))
+        return false;
+    // Replacements are left to AcceptToMemoryPool altogether
+    for (const CTxIn& txin : tx.vin) {
+        if (::mempool.GetConflictTx(txin.prevout))
+            return false;
+    }
+    // Missing outputs make an orphan, which isn't worth checking yet
+    CCoinsViewMemPool view_mempool(&::ChainstateActive().CoinsTip(), ::mempool);
+    CCoinsViewCache view(&view_mempool);
+    CAmount value_in = 0;
+    for (const CTxIn& txin : tx.vin) {
+        const Coin& coin = view.AccessCoin(txin.prevout);
+        if (coin.IsSpent())
+            return false;
+        value_in += coin.out.nValue;
+        if (!MoneyRange(coin.out.nValue) || !MoneyRange(value_in))
+            return false;
+    }
+    if (fRequireStandard && (!AreInputsStandard(tx, view) || (tx.HasWitness() && !IsWitnessStandard(tx, view))))
+        return false;
+    CAmount fees = value_in - tx.GetValueOut();
+    if (fees < 0)
+        return false;
+    ::mempool.ApplyDelta(tx.GetHash(), fees);
+    const size_t size = GetVirtualTransactionSize(tx);
+    if (fees < ::minRelayTxFee.GetFee(size) ||
+        fees < ::mempool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(size))
+        return false;
+
+    spent_outputs.clear();
+    spent_outputs.reserve(tx.vin.size());
+    for (const CTxIn& txin : tx.vin) {
+        spent_outputs.push_back(view.AccessCoin(txin.prevout).out);
+    }
+    return true;
+}
+
+/** The script checks of CheckInputs, against the outputs spent given in the order of the inputs */
+static bool CheckInputScripts(const CTransaction& tx, const std::vector<CTxOut>& spent_outputs, unsigned int flags, PrecomputedTransactionData& txdata, CValidationState& state)
+{
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        CScriptCheck check(spent_outputs[i], tx, i, flags, true /* cacheStore */, &txdata);
+        if (check())
+            continue;
+        if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
+            CScriptCheck check2(spent_outputs[i], tx, i, flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, true /* cacheStore */, &txdata);
+            if (check2())
+                return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
+        }
+        return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
+    }
+    return true;
+}
+
+bool PreValidateTransaction(const CTransaction& tx, const std::vector<CTxOut>& spent_outputs, CValidationState& state)
+{
+    assert(spent_outputs.size() == tx.vin.size());
+    // The entry is keyed on the wtxid and the flags. The wtxid commits to the
+    // scripts and witnesses, and to the outpoints spent rather than to the
+    // outputs themselves. As an outpoint only ever names one output, the
+    // result holds, as in CheckInputs, wherever those outpoints are unspent.
+    const uint256 cache_entry = ScriptExecutionCacheEntry(tx, STANDARD_SCRIPT_VERIFY_FLAGS);
+    if (scriptExecutionCache.contains(cache_entry, false))
+        return true;
+
+    // Verified signatures go to the signature cache, which has its own lock
+    PrecomputedTransactionData txdata(tx);
+    if (!CheckInputScripts(tx, spent_outputs, STANDARD_SCRIPT_VERIFY_FLAGS, txdata, state)) {
+        // As in the policy script checks of AcceptToMemoryPool, so that the
+        // failure is reported the same
+        CValidationState state_dummy;
+        if (!tx.HasWitness() && CheckInputScripts(tx, spent_outputs, STANDARD_SCRIPT_VERIFY_FLAGS & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), txdata, state_dummy) &&
+                !CheckInputScripts(tx, spent_outputs, STANDARD_SCRIPT_VERIFY_FLAGS & ~SCRIPT_VERIFY_CLEANSTACK, txdata, state_dummy)) {
+            state.Invalid(ValidationInvalidReason::TX_WITNESS_MUTATED, false,
+                    state.GetRejectCode(), state.GetRejectReason(), state.GetDebugMessage());
+        }
+        return false;
+    }
+
+    // The script checks of AcceptToMemoryPool with the policy flags are then
+    // skipped altogether
+    scriptExecutionCache.insert(cache_entry);
+    return true;
+}
+
 static bool UndoWriteToDisk(const CBlockUndo& blockundo, FlatFilePos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
 {
     // Open history file to append
@@ -1787,6 +1946,76 @@ void ThreadScriptCheck(int worker_num) {
     scriptcheckqueue.Thread();
 }
 
+/** Context-free checks of the transactions of a block at or above this size are spread over threads */
+static const size_t MIN_PARALLEL_BLOCK_CHECK_TXS = 64;
+/** Transactions checked by each CBlockTxCheck */
+static const size_t BLOCK_TX_CHECK_RANGE = 16;
+
+namespace {
+/** Results of the context-free checks of one transaction */
+struct BlockTxCheckResult {
+    //! Serialized size without witness
+    size_t stripped_size = 0;
+    unsigned int legacy_sigops = 0;
+};
+
+/**
+ * Context-free checks of a range of the transactions of a block, as in
+ * CheckBlock, done on the block check queue. A failure only tells that some
+ * transaction is invalid; CheckBlock then finds which one serially.
+ */
+class CBlockTxCheck
+{
+private:
+    const CBlock* block = nullptr;
+    size_t begin = 0;
+    size_t end = 0;
+    std::vector<BlockTxCheckResult>* results = nullptr;
+
+public:
+    CBlockTxCheck() {}
+    CBlockTxCheck(const CBlock& blockIn, size_t beginIn, size_t endIn, std::vector<BlockTxCheckResult>& resultsIn)
+        : block(&blockIn), begin(beginIn), end(endIn), results(&resultsIn) {}
+
+    bool operator()()
+    {
+        for (size_t i = begin; i < end; i++) {
+            const CTransaction& tx = *block->vtx[i];
+            CValidationState state;
+            // Must check for duplicate inputs (see CVE-2018-17144)
+            if (!CheckTransaction(tx, state, true))
+                return false;
+            BlockTxCheckResult& result = (*results)[i];
+            result.stripped_size = ::GetSerializeSize(tx, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+            result.legacy_sigops = GetLegacySigOpCount(tx);
+        }
+        return true;
+    }
+
+    void swap(CBlockTxCheck& check)
+    {
+        std::swap(block, check.block);
+        std::swap(begin, check.begin);
+        std::swap(end, check.end);
+        std::swap(results, check.results);
+    }
+};
+} // namespace
+
+static CCheckQueue<CBlockTxCheck> blockcheckqueue(8);
+
+void ThreadBlockCheck(int worker_num) {
+    util::ThreadRename(strprintf("blockchk.%i", worker_num));
+    blockcheckqueue.Thread();
+}
+
+static CCoinsPrefetcher coinsprefetcher;
+
+void ThreadCoinsPrefetch(int worker_num) {
+    util::ThreadRename(strprintf("prefetch.%i", worker_num));
+    coinsprefetcher.Thread();
+}
+
 VersionBitsCache versionbitscache GUARDED_BY(cs_main);
 
 int32_t ComputeBlockVersion(const CBlockIndex* pindexPrev, const Consensus::Params& params)
@@ -2136,7 +2365,8 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         // * legacy (always)
         // * p2sh (when P2SH enabled in flags and excludes coinbase)
         // * witness (when witness enabled in flags and excludes coinbase)
-        nSigOpsCost += GetTransactionSigOpCost(tx, view, flags);
+        const unsigned int legacy_sigops = block.vTxLegacySigOps.size() == block.vtx.size() ? block.vTxLegacySigOps[i] : GetLegacySigOpCount(tx);
+        nSigOpsCost += GetTransactionSigOpCost(tx, view, flags, legacy_sigops);
         if (nSigOpsCost > MAX_BLOCK_SIGOPS_COST)
             return state.Invalid(ValidationInvalidReason::CONSENSUS, error("ConnectBlock(): too many sigops"),
                              REJECT_INVALID, "bad-blk-sigops");
@@ -2250,7 +2480,8 @@ bool CChainState::FlushStateToDisk(
             nLastFlush = nNow;
         }
         int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
-        int64_t cacheSize = CoinsTip().DynamicMemoryUsage();
+        // Include the coins of a background flush, which are still in memory
+        int64_t cacheSize = CoinsTip().DynamicMemoryUsage() + m_coins_views->m_flushview.DynamicMemoryUsage();
         int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
         // The cache is large and we're within 10% and 10 MiB of the limit, but we have time now (not in the middle of a block processing).
         bool fCacheLarge = mode == FlushStateMode::PERIODIC && cacheSize > std::max((9 * nTotalSpace) / 10, nTotalSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024);
@@ -2304,10 +2535,38 @@ bool CChainState::FlushStateToDisk(
                 return AbortNode(state, "Disk space is too low!", _("Error: Disk space is too low!").translated, CClientUIInterface::MSG_NOPREFIX);
             }
             // Flush the chainstate (which may refer to block index entries).
-            if (!CoinsTip().Flush())
-                return AbortNode(state, "Failed to write to coin database");
+            // Coins being prefetched may be outdated by the flush.
+            coinsprefetcher.NotifyFlush();
+            const int64_t nFlushStart = GetTimeMicros();
+            CCoinsViewBackgroundFlush& flushview = m_coins_views->m_flushview;
+            // Unless the coins database has to be up to date once we return, only
+            // write the dirty coins, from a snapshot in the background. Clean coins
+            // stay cached, except for those exceeding the cache size.
+            const bool fBackground = fBackgroundFlush && mode != FlushStateMode::ALWAYS && !fFlushForPrune;
+            if (fBackground) {
+                if (!flushview.Wait())
+                    return AbortNode(state, "Failed to write to coin database");
+                // When the cache is too large, keep up to half of the space for it,
+                // leaving room for the snapshot and for the cache to grow
+                const size_t nKeepSize = (fCacheLarge || fCacheCritical) ? nTotalSpace / 2 : std::numeric_limits<size_t>::max();
+                CCoinsMap snapshot;
+                const size_t nEvicted = CoinsTip().SnapshotDirty(snapshot, nKeepSize);
+                LogPrint(BCLog::COINDB, "Flushing %u coins in the background, %u evicted from the cache\n", snapshot.size(), nEvicted);
+                // Only once the coins are written is the chain state flushed
+                const CBlockLocator locator = m_chain.GetLocator();
+                if (!flushview.StartWrite(std::move(snapshot), CoinsTip().GetBestBlock(), [locator] { GetMainSignals().ChainStateFlushed(locator); }))
+                    return AbortNode(state, "Failed to write to coin database");
+            } else {
+                if (!CoinsTip().Flush())
+                    return AbortNode(state, "Failed to write to coin database");
+                full_flush_completed = true;
+            }
+            // Time spent holding cs_main to flush the chainstate
+            static int64_t nFlushHoldMax = 0;
+            const int64_t nFlushHold = GetTimeMicros() - nFlushStart;
+            nFlushHoldMax = std::max(nFlushHoldMax, nFlushHold);
+            LogPrint(BCLog::BENCH, "  - Flush chainstate (%s): %.2fms [max %.2fms]\n", fBackground ? "background" : "full", MILLI * nFlushHold, MILLI * nFlushHoldMax);
             nLastFlush = nNow;
-            full_flush_completed = true;
         }
     }
     if (full_flush_completed) {
@@ -2462,6 +2721,9 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
+static uint64_t nPrefetchInputs = 0;
+static uint64_t nPrefetchHits = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2531,11 +2793,12 @@ public:
 
 /**
  * Connect a new block to m_chain. pblock is either nullptr or a pointer to a CBlock
- * corresponding to pindexNew, to bypass loading it again from disk.
+ * corresponding to pindexNew, to bypass loading it again from disk. prefetch is
+ * either nullptr or the job prefetching the coins spent by the block.
  *
  * The block is added to connectTrace if connection succeeds.
  */
-bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool)
+bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, const std::shared_ptr<CCoinsPrefetchJob>& prefetch, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool)
 {
     assert(pindexNew->pprev == m_chain.Tip());
     // Read block from disk.
@@ -2554,6 +2817,17 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
+    if (prefetch) {
+        const CoinsPrefetchStats stats = coinsprefetcher.Apply(prefetch, CoinsTip());
+        nPrefetchInputs += stats.n_inputs;
+        nPrefetchHits += stats.n_hits;
+        int64_t nTimePrefetched = GetTimeMicros(); nTimePrefetch += nTimePrefetched - nTime2;
+        LogPrint(BCLog::BENCH, "  - Prefetch coins: %.2fms, %u fetched, %u/%u inputs cached (%.2f%%)%s [%.2fs (%.2f%% hits)]\n",
+                 (nTimePrefetched - nTime2) * MILLI, stats.n_fetched, stats.n_hits, stats.n_inputs,
+                 stats.n_inputs ? 100.0 * stats.n_hits / stats.n_inputs : 100.0, stats.stale ? " (stale)" : "",
+                 nTimePrefetch * MICRO, nPrefetchInputs ? 100.0 * nPrefetchHits / nPrefetchInputs : 100.0);
+        nTime2 = nTimePrefetched;
+    }
     {
         CCoinsViewCache view(&CoinsTip());
         bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
@@ -2590,6 +2864,26 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     return true;
 }
 
+/**
+ * Read a block from disk, unless pblock is already set, and start prefetching
+ * the coins it spends. Returns nullptr if prefetching is disabled or the block
+ * cannot be read, in which case the error is reported when it is connected.
+ */
+std::shared_ptr<CCoinsPrefetchJob> CChainState::PrefetchBlockCoins(const CBlockIndex* pindex, std::shared_ptr<const CBlock>& pblock, const CChainParams& chainparams)
+{
+    if (!nCoinsPrefetchThreads)
+        return nullptr;
+    if (!pblock) {
+        std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*pblockNew, pindex, chainparams.GetConsensus()))
+            return nullptr;
+        pblock = pblockNew;
+    }
+    // Read below the cache, but above the database, which may be missing the
+    // coins of a background flush
+    return coinsprefetcher.Prefetch(*pblock, CoinsTip(), m_coins_views->m_flushview);
+}
+
 /**
  * Return the tip of the chain with the most work in it, that isn't
  * known to be invalid (it's however far from certain to be valid).
@@ -2710,8 +3004,32 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
         nHeight = nTargetHeight;
 
         // Connect new blocks.
-        for (CBlockIndex *pindexConnect : reverse_iterate(vpindexToConnect)) {
-            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
+        for (auto it = vpindexToConnect.rbegin(); it != vpindexToConnect.rend(); ++it) {
+            CBlockIndex *pindexConnect = *it;
+            std::shared_ptr<const CBlock> pblockConnect = pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>();
+            std::shared_ptr<CCoinsPrefetchJob> prefetch;
+            if (m_next_prefetch.pindex == pindexConnect) {
+                if (!pblockConnect)
+                    pblockConnect = std::move(m_next_prefetch.pblock);
+                prefetch = std::move(m_next_prefetch.job);
+            } else {
+                if (m_next_prefetch.job)
+                    coinsprefetcher.Cancel(m_next_prefetch.job);
+                prefetch = PrefetchBlockCoins(pindexConnect, pblockConnect, chainparams);
+            }
+            m_next_prefetch = NextBlockPrefetch();
+
+            // Read the next block and prefetch its coins while this one is
+            // connected, which may be in a later call.
+            if (prefetch && std::next(it) != vpindexToConnect.rend()) {
+                m_next_prefetch.pindex = *std::next(it);
+                m_next_prefetch.pblock = m_next_prefetch.pindex == pindexMostWork ? pblock : std::shared_ptr<const CBlock>();
+                m_next_prefetch.job = PrefetchBlockCoins(m_next_prefetch.pindex, m_next_prefetch.pblock, chainparams);
+                if (!m_next_prefetch.job)
+                    m_next_prefetch = NextBlockPrefetch();
+            }
+
+            if (!ConnectTip(state, chainparams, pindexConnect, pblockConnect, prefetch, connectTrace, disconnectpool)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (state.GetReason() != ValidationInvalidReason::BLOCK_MUTATED) {
@@ -3274,11 +3592,36 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
     if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW))
         return false;
 
+    // The transactions of large blocks are checked on the block check queue
+    // while the merkle root is computed here. Results are only looked at in
+    // the order of the checks below, so that the same error is reported as
+    // when checking serially. If the queue is in use by another thread, e.g.
+    // one of several importing blocks, this thread checks on its own.
+    std::vector<BlockTxCheckResult> tx_results;
+    boost::unique_lock<boost::mutex> control_lock(blockcheckqueue.ControlMutex, boost::defer_lock);
+    const bool parallel = nScriptCheckThreads > 1 && block.vtx.size() >= MIN_PARALLEL_BLOCK_CHECK_TXS &&
+                          block.vtx.size() * WITNESS_SCALE_FACTOR <= MAX_BLOCK_WEIGHT && control_lock.try_lock();
+    if (parallel) {
+        tx_results.resize(block.vtx.size());
+        std::vector<CBlockTxCheck> checks;
+        for (size_t begin = 0; begin < block.vtx.size(); begin += BLOCK_TX_CHECK_RANGE)
+            checks.emplace_back(block, begin, std::min(block.vtx.size(), begin + BLOCK_TX_CHECK_RANGE), tx_results);
+        blockcheckqueue.Add(checks);
+    }
+
+    bool merkle_mismatch = false;
+    bool mutated = false;
+    if (fCheckMerkleRoot)
+        merkle_mismatch = block.hashMerkleRoot != BlockMerkleRoot(block, &mutated);
+
+    // The checks refer to tx_results, so they have to be finished before returning
+    const bool txs_valid = !parallel || blockcheckqueue.Wait();
+    if (parallel)
+        control_lock.unlock();
+
     // Check the merkle root.
     if (fCheckMerkleRoot) {
-        bool mutated;
-        uint256 hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
-        if (block.hashMerkleRoot != hashMerkleRoot2)
+        if (merkle_mismatch)
             return state.Invalid(ValidationInvalidReason::BLOCK_MUTATED, false, REJECT_INVALID, "bad-txnmrklroot", "hashMerkleRoot mismatch");
 
         // Check for merkle tree malleability (CVE-2012-2459): repeating sequences
@@ -3295,7 +3638,15 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
     // checks that use witness data may be performed here.
 
     // Size limits
-    if (block.vtx.empty() || block.vtx.size() * WITNESS_SCALE_FACTOR > MAX_BLOCK_WEIGHT || ::GetSerializeSize(block, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) * WITNESS_SCALE_FACTOR > MAX_BLOCK_WEIGHT)
+    size_t stripped_size;
+    if (parallel && txs_valid) {
+        stripped_size = ::GetSerializeSize(CBlockHeader(block), PROTOCOL_VERSION) + GetSizeOfCompactSize(block.vtx.size());
+        for (const BlockTxCheckResult& result : tx_results)
+            stripped_size += result.stripped_size;
+    } else {
+        stripped_size = ::GetSerializeSize(block, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    }
+    if (block.vtx.empty() || block.vtx.size() * WITNESS_SCALE_FACTOR > MAX_BLOCK_WEIGHT || stripped_size * WITNESS_SCALE_FACTOR > MAX_BLOCK_WEIGHT)
         return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-blk-length", "size limits failed");
 
     // First transaction must be coinbase, the rest must not be
@@ -3307,21 +3658,27 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
 
     // Check transactions
     // Must check for duplicate inputs (see CVE-2018-17144)
-    for (const auto& tx : block.vtx)
-        if (!CheckTransaction(*tx, state, true))
-            return state.Invalid(state.GetReason(), false, state.GetRejectCode(), state.GetRejectReason(),
-                                 strprintf("Transaction check failed (tx hash %s) %s", tx->GetHash().ToString(), state.GetDebugMessage()));
+    if (!parallel || !txs_valid) {
+        for (const auto& tx : block.vtx)
+            if (!CheckTransaction(*tx, state, true))
+                return state.Invalid(state.GetReason(), false, state.GetRejectCode(), state.GetRejectReason(),
+                                     strprintf("Transaction check failed (tx hash %s) %s", tx->GetHash().ToString(), state.GetDebugMessage()));
+    }
 
+    std::vector<unsigned int> tx_sigops(block.vtx.size());
     unsigned int nSigOps = 0;
-    for (const auto& tx : block.vtx)
+    for (size_t i = 0; i < block.vtx.size(); i++)
     {
-        nSigOps += GetLegacySigOpCount(*tx);
+        tx_sigops[i] = parallel && txs_valid ? tx_results[i].legacy_sigops : GetLegacySigOpCount(*block.vtx[i]);
+        nSigOps += tx_sigops[i];
     }
     if (nSigOps * WITNESS_SCALE_FACTOR > MAX_BLOCK_SIGOPS_COST)
         return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-blk-sigops", "out-of-bounds SigOpCount");
 
-    if (fCheckPOW && fCheckMerkleRoot)
+    if (fCheckPOW && fCheckMerkleRoot) {
+        block.vTxLegacySigOps = std::move(tx_sigops);
         block.fChecked = true;
+    }
 
     return true;
 }
@@ -3456,7 +3813,7 @@ static bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationSta
  *  in ConnectBlock().
  *  Note that -reindex-chainstate skips the validation that happens here!
  */
-static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
+bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
 {
     const int nHeight = pindexPrev == nullptr ? 0 : pindexPrev->nHeight + 1;
 
@@ -3870,6 +4227,7 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         FlatFilePos pos(*it, 0);
+        g_block_file_maps.Invalidate(BlockFileSeq(), *it);
         fs::remove(BlockFileSeq().FileName(pos));
         fs::remove(UndoFileSeq().FileName(pos));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4029,23 +4387,40 @@ bool BlockManager::LoadBlockIndex(
     CBlockTreeDB& blocktree,
     std::set<CBlockIndex*, CBlockIndexWorkComparator>& block_index_candidates)
 {
-    if (!blocktree.LoadBlockIndexGuts(consensus_params, [this](const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return this->InsertBlockIndex(hash); }))
-        return false;
+    std::vector<CBlockIndex*> sorted_by_height;
+    if (!LoadBlockIndexCache(consensus_params, blocktree, sorted_by_height)) {
+        if (!blocktree.LoadBlockIndexGuts(consensus_params, [this](const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return this->InsertBlockIndex(hash); }))
+            return false;
 
-    // Calculate nChainWork
-    std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(m_block_index.size());
-    for (const std::pair<const uint256, CBlockIndex*>& item : m_block_index)
-    {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
-    }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    for (const std::pair<int, CBlockIndex*>& item : vSortedByHeight)
+        std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
+        vSortedByHeight.reserve(m_block_index.size());
+        for (const std::pair<const uint256, CBlockIndex*>& item : m_block_index)
+        {
+            CBlockIndex* pindex = item.second;
+            vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
+        }
+        sort(vSortedByHeight.begin(), vSortedByHeight.end());
+        sorted_by_height.reserve(vSortedByHeight.size());
+        for (const std::pair<int, CBlockIndex*>& item : vSortedByHeight)
+            sorted_by_height.push_back(item.second);
+    }
+
+    uint256 snapshot_hash;
+    uint64_t snapshot_chain_tx = 0;
+    blocktree.ReadSnapshotBase(snapshot_hash, snapshot_chain_tx);
+
+    // Calculate nChainWork, the work of each block on its own taking a
+    // division which is spread across threads
+    std::vector<arith_uint256> proofs(sorted_by_height.size());
+    ForEachBlockIndexRange(sorted_by_height.size(), [&](size_t begin, size_t end) {
+        for (size_t n = begin; n < end; n++)
+            proofs[n] = GetBlockProof(*sorted_by_height[n]);
+    });
+    for (size_t n = 0; n < sorted_by_height.size(); n++)
     {
         if (ShutdownRequested()) return false;
-        CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        CBlockIndex* pindex = sorted_by_height[n];
+        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + proofs[n];
         pindex->nTimeMax = (pindex->pprev ? std::max(pindex->pprev->nTimeMax, pindex->nTime) : pindex->nTime);
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
@@ -4061,6 +4436,11 @@ bool BlockManager::LoadBlockIndex(
                 pindex->nChainTx = pindex->nTx;
             }
         }
+        if (!snapshot_hash.IsNull() && pindex->GetBlockHash() == snapshot_hash) {
+            // The ancestors of the snapshot base have no transactions
+            pindex->nChainTx = snapshot_chain_tx;
+            m_snapshot_base = pindex;
+        }
         if (!(pindex->nStatus & BLOCK_FAILED_MASK) && pindex->pprev && (pindex->pprev->nStatus & BLOCK_FAILED_MASK)) {
             pindex->nStatus |= BLOCK_FAILED_CHILD;
             setDirtyBlockIndex.insert(pindex);
@@ -4079,9 +4459,102 @@ bool BlockManager::LoadBlockIndex(
     return true;
 }
 
+bool BlockManager::LoadBlockIndexCache(
+    const Consensus::Params& consensus_params,
+    CBlockTreeDB& blocktree,
+    std::vector<CBlockIndex*>& sorted_by_height)
+{
+    uint64_t id, count;
+    if (!blocktree.ReadIndexCache(id, count))
+        return false;
+    // The block index is going to be written to before the cache file is written again
+    blocktree.EraseIndexCache();
+
+    const int64_t start = GetTimeMillis();
+    BlockIndexCacheReader reader;
+    if (!m_block_index.empty() || count > (uint64_t)std::numeric_limits<int32_t>::max() ||
+        !reader.Open(GetBlockIndexCachePath(), id, count)) {
+        LogPrintf("%s: the block index cache file doesn't match the database, ignoring it\n", __func__);
+        return false;
+    }
+
+    // Entries are read and checked by as many threads as there are cores,
+    // except for their insertion in m_block_index
+    std::vector<CBlockIndex*> entries(count);
+    std::vector<int32_t> prevs(count);
+    std::atomic<bool> ok{true};
+    ForEachBlockIndexRange(count, [&](size_t begin, size_t end) {
+        for (size_t n = begin; n < end; n++) {
+            entries[n] = new CBlockIndex();
+            reader.Read(n, *entries[n], prevs[n]);
+            if (!CheckProofOfWork(reader.GetHash(n), entries[n]->nBits, consensus_params))
+                ok = false;
+        }
+    });
+
+    m_block_index.reserve(count);
+    for (size_t n = 0; ok && n < count; n++) {
+        auto ret = m_block_index.emplace(reader.GetHash(n), entries[n]);
+        if (!ret.second) {
+            ok = false;
+            break;
+        }
+        entries[n]->phashBlock = &ret.first->first;
+    }
+
+    ForEachBlockIndexRange(ok ? count : 0, [&](size_t begin, size_t end) {
+        for (size_t n = begin; n < end; n++) {
+            CBlockIndex* pindex = entries[n];
+            const int32_t prev = prevs[n];
+            if (prev == -1) {
+                if (pindex->nHeight != 0)
+                    ok = false;
+            } else if (prev < 0 || (size_t)prev >= n || entries[prev]->nHeight != pindex->nHeight - 1) {
+                ok = false;
+            } else {
+                pindex->pprev = entries[prev];
+            }
+        }
+    });
+
+    if (!ok) {
+        LogPrintf("%s: the block index cache file is corrupt, ignoring it\n", __func__);
+        for (CBlockIndex* pindex : entries)
+            delete pindex;
+        m_block_index.clear();
+        return false;
+    }
+
+    LogPrintf("%s: loaded %u block index entries from the cache file in %dms\n", __func__, count, GetTimeMillis() - start);
+    sorted_by_height = std::move(entries);
+    return true;
+}
+
+void BlockManager::WriteBlockIndexCache(CBlockTreeDB& blocktree)
+{
+    // Everything in the cache file has to be in the database
+    if (!setDirtyBlockIndex.empty())
+        return;
+
+    const int64_t start = GetTimeMillis();
+    std::vector<const CBlockIndex*> entries;
+    entries.reserve(m_block_index.size());
+    for (const std::pair<const uint256, CBlockIndex*>& item : m_block_index)
+        entries.push_back(item.second);
+    std::sort(entries.begin(), entries.end(), [](const CBlockIndex* a, const CBlockIndex* b) {
+        return a->nHeight < b->nHeight;
+    });
+
+    const uint64_t id = GetRand(std::numeric_limits<uint64_t>::max());
+    if (WriteBlockIndexCacheFile(GetBlockIndexCachePath(), id, entries) && blocktree.WriteIndexCache(id, entries.size())) {
+        LogPrintf("%s: wrote %u block index entries to the cache file in %dms\n", __func__, entries.size(), GetTimeMillis() - start);
+    }
+}
+
 void BlockManager::Unload() {
     m_failed_blocks.clear();
     m_blocks_unlinked.clear();
+    m_snapshot_base = nullptr;
 
     for (const BlockMap::value_type& entry : m_block_index) {
         delete entry.second;
@@ -4172,6 +4645,46 @@ bool CChainState::LoadChainTip(const CChainParams& chainparams)
     return true;
 }
 
+bool CChainState::AcceptSnapshotHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+{
+    AssertLockHeld(cs_main);
+    for (const CBlockHeader& header : headers) {
+        if (!m_blockman.AcceptBlockHeader(header, state, chainparams, ppindex))
+            return false;
+    }
+    return true;
+}
+
+bool CChainState::ActivateSnapshotBase(CBlockIndex* pindex, unsigned int nChainTx)
+{
+    AssertLockHeld(cs_main);
+    assert(m_chain.Tip() == nullptr || m_chain.Tip()->pprev == nullptr);
+
+    pindex->nChainTx = nChainTx;
+    pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+    // Its transactions were validated with their witnesses by the node the
+    // snapshot comes from, so it must not be rewound
+    if (IsWitnessEnabled(pindex->pprev, Params().GetConsensus()))
+        pindex->nStatus |= BLOCK_OPT_WITNESS;
+    setDirtyBlockIndex.insert(pindex);
+    setBlockIndexCandidates.insert(pindex);
+    m_blockman.m_snapshot_base = pindex;
+
+    // Make sure the block index is on disk before the coins database points at
+    // the snapshot base
+    std::vector<const CBlockIndex*> vBlocks(setDirtyBlockIndex.begin(), setDirtyBlockIndex.end());
+    setDirtyBlockIndex.clear();
+    {
+        LOCK(cs_LastBlockFile);
+        if (!pblocktree->WriteBatchSync({}, nLastBlockFile, vBlocks))
+            return error("%s: failed to write to block index database", __func__);
+    }
+    fHavePruned = true;
+    if (!pblocktree->WriteFlag("prunedblockfiles", true) || !pblocktree->WriteSnapshotBase(pindex->GetBlockHash(), nChainTx))
+        return error("%s: failed to write to block index database", __func__);
+    return true;
+}
+
 CVerifyDB::CVerifyDB()
 {
     uiInterface.ShowProgress(_("Verifying blocks...").translated, 0, false);
@@ -4427,6 +4940,10 @@ bool CChainState::RewindBlockIndex(const CChainParams& params)
     int nHeight = 1;
     {
         LOCK(cs_main);
+        // The blocks up to the base of a UTXO snapshot were validated by the
+        // node the snapshot comes from
+        if (m_blockman.m_snapshot_base && m_chain.Contains(m_blockman.m_snapshot_base))
+            nHeight = m_blockman.m_snapshot_base->nHeight + 1;
         while (nHeight <= m_chain.Height()) {
             // Although SCRIPT_VERIFY_WITNESS is now generally enforced on all
             // blocks in ConnectBlock, we don't need to go back and
@@ -4527,6 +5044,13 @@ void CChainState::UnloadBlockIndex() {
 // May NOT be used after any connections are up as much
 // of the peer-processing logic assumes a consistent
 // block index state
+void WriteBlockIndexCache()
+{
+    AssertLockHeld(cs_main);
+    if (pblocktree)
+        g_blockman.WriteBlockIndexCache(*pblocktree);
+}
+
 void UnloadBlockIndex()
 {
     LOCK(cs_main);
@@ -4600,61 +5124,303 @@ bool LoadGenesisBlock(const CChainParams& chainparams)
     return ::ChainstateActive().LoadGenesisBlock(chainparams);
 }
 
+namespace {
+
+/** A block found in a file being imported, as it goes through the stages of the import */
+struct ImportedBlock
+{
+    //! Order of the block in the file
+    uint64_t seq = 0;
+    //! Position of the block in the file, for block files being reindexed
+    FlatFilePos pos;
+    //! Size of the block in the file
+    size_t size = 0;
+    //! Memory taken by the block: its bytes as read, then the block once deserialized
+    size_t usage = 0;
+    //! The block as found in the file, until deserialized
+    std::vector<unsigned char> raw;
+    //! The block, or nullptr if it failed to deserialize
+    std::shared_ptr<CBlock> block;
+    uint256 hash;
+    std::string error;
+};
+
+/**
+ * Blocks of a file being imported, handed from the thread reading the file
+ * to the threads deserializing and checking blocks, and then back in file
+ * order to the thread accepting them. The blocks in between take up to
+ * about MAX_IMPORT_BYTES_IN_FLIGHT of memory, as they are read and then as
+ * deserialized, which can take a few times more.
+ */
+class BlockImportPipeline
+{
+private:
+    static const size_t MAX_IMPORT_BYTES_IN_FLIGHT = 64 << 20;
+
+    Mutex m_mutex;
+    std::condition_variable m_cond;
+    //! Blocks read, waiting to be deserialized
+    std::deque<ImportedBlock> m_read GUARDED_BY(m_mutex);
+    //! Blocks deserialized, waiting for the blocks before them to be accepted
+    std::map<uint64_t, ImportedBlock> m_parsed GUARDED_BY(m_mutex);
+    size_t m_bytes_in_flight GUARDED_BY(m_mutex) = 0;
+    uint64_t m_blocks_read GUARDED_BY(m_mutex) = 0;
+    uint64_t m_next_accepted GUARDED_BY(m_mutex) = 0;
+    bool m_read_done GUARDED_BY(m_mutex) = false;
+    bool m_stopped GUARDED_BY(m_mutex) = false;
+
+public:
+    //! Microseconds spent reading, deserializing (on all threads) and accepting blocks, waits excluded
+    std::atomic<int64_t> m_read_time{0}, m_parse_time{0}, m_accept_time{0};
+    std::atomic<uint64_t> m_bytes_read{0};
+
+    //! Queue a block read from the file, waiting for room. Returns false once stopped.
+    bool PushRead(ImportedBlock&& item)
+    {
+        WAIT_LOCK(m_mutex, lock);
+        m_cond.wait(lock, [&] { return m_stopped || m_bytes_in_flight == 0 || m_bytes_in_flight + item.usage <= MAX_IMPORT_BYTES_IN_FLIGHT; });
+        if (m_stopped)
+            return false;
+        item.seq = m_blocks_read++;
+        m_bytes_in_flight += item.usage;
+        m_read.push_back(std::move(item));
+        m_cond.notify_all();
+        return true;
+    }
+
+    //! Mark the end of the file
+    void ReadDone()
+    {
+        LOCK(m_mutex);
+        m_read_done = true;
+        m_cond.notify_all();
+    }
+
+    //! Take a block to deserialize, waiting for one. Returns false once there are no more.
+    bool PopRead(ImportedBlock& item)
+    {
+        WAIT_LOCK(m_mutex, lock);
+        m_cond.wait(lock, [&] { return m_stopped || m_read_done || !m_read.empty(); });
+        if (m_stopped || m_read.empty())
+            return false;
+        item = std::move(m_read.front());
+        m_read.pop_front();
+        return true;
+    }
+
+    //! Queue a block deserialized, which took read_usage as read
+    void PushParsed(ImportedBlock&& item, size_t read_usage)
+    {
+        LOCK(m_mutex);
+        m_bytes_in_flight += item.usage - read_usage;
+        const uint64_t seq = item.seq;
+        m_parsed.emplace(seq, std::move(item));
+        m_cond.notify_all();
+    }
+
+    //! Take the next block in file order, waiting for it. Returns false once there are no more.
+    bool PopParsed(ImportedBlock& item)
+    {
+        WAIT_LOCK(m_mutex, lock);
+        m_cond.wait(lock, [&] {
+            return m_stopped || (!m_parsed.empty() && m_parsed.begin()->first == m_next_accepted) ||
+                   (m_read_done && m_next_accepted == m_blocks_read);
+        });
+        if (m_stopped || m_parsed.empty() || m_parsed.begin()->first != m_next_accepted)
+            return false;
+        item = std::move(m_parsed.begin()->second);
+        m_parsed.erase(m_parsed.begin());
+        m_next_accepted++;
+        return true;
+    }
+
+    //! Release the room taken by a block once accepted
+    void Release(size_t usage)
+    {
+        LOCK(m_mutex);
+        m_bytes_in_flight -= usage;
+        m_cond.notify_all();
+    }
+
+    //! Make all stages give up
+    void Stop()
+    {
+        LOCK(m_mutex);
+        m_stopped = true;
+        m_cond.notify_all();
+    }
+};
+
+//! Threads deserializing blocks of an import
+static const int MAX_IMPORT_PARSE_THREADS = 8;
+//! Blocks with an unknown parent kept in memory rather than read again from disk
+static const size_t MAX_UNKNOWN_PARENT_BYTES = 128 << 20;
+
+/**
+ * A block with an unknown parent, in memory while the file it was found in is
+ * imported, unless it didn't fit in MAX_UNKNOWN_PARENT_BYTES
+ */
+struct UnknownParentBlock
+{
+    FlatFilePos pos;
+    std::shared_ptr<const CBlock> block;
+    //! Memory taken by the block
+    size_t usage;
+};
+
+//! Read the blocks of a file into the pipeline
+static void ReadBlockFile(CBufferedFile& blkdat, const CChainParams& chainparams, const FlatFilePos* dbp, BlockImportPipeline& pipeline)
+{
+    int64_t start = GetTimeMicros();
+    uint64_t nRewind = blkdat.GetPos();
+    while (!blkdat.eof()) {
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+            blkdat.FindByte(chainparams.MessageStart()[0]);
+            nRewind = blkdat.GetPos()+1;
+            blkdat >> buf;
+            if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            break;
+        }
+        try {
+            // read block, to be deserialized by another thread
+            uint64_t nBlockPos = blkdat.GetPos();
+            ImportedBlock item;
+            if (dbp)
+                item.pos = FlatFilePos(dbp->nFile, nBlockPos);
+            item.size = nSize;
+            item.raw.resize(nSize);
+            item.usage = memusage::DynamicUsage(item.raw);
+            blkdat.SetLimit(nBlockPos + nSize);
+            blkdat.SetPos(nBlockPos);
+            blkdat.read((char*)item.raw.data(), nSize);
+            nRewind = blkdat.GetPos();
+
+            pipeline.m_read_time += GetTimeMicros() - start;
+            pipeline.m_bytes_read += nSize;
+            if (!pipeline.PushRead(std::move(item)))
+                break;
+            start = GetTimeMicros();
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+        }
+    }
+    pipeline.m_read_time += GetTimeMicros() - start;
+}
+
+//! Deserialize, hash and run the context-free checks of blocks of the pipeline
+static void ParseImportedBlocks(const Consensus::Params& consensus_params, BlockImportPipeline& pipeline)
+{
+    ImportedBlock item;
+    while (pipeline.PopRead(item)) {
+        const int64_t start = GetTimeMicros();
+        const size_t read_usage = item.usage;
+        item.usage = 0;
+        try {
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+            VectorReader(SER_DISK, CLIENT_VERSION, item.raw, 0) >> *pblock;
+            item.hash = pblock->GetHash();
+            // Sets fChecked on success, so that AcceptBlock skips these
+            // checks; failures are left for AcceptBlock to handle.
+            CValidationState state;
+            CheckBlock(*pblock, state, consensus_params);
+            item.usage = memusage::MallocUsage(sizeof(CBlock)) + RecursiveDynamicUsage(*pblock);
+            item.block = std::move(pblock);
+        } catch (const std::exception& e) {
+            item.error = e.what();
+        }
+        std::vector<unsigned char>().swap(item.raw);
+        pipeline.m_parse_time += GetTimeMicros() - start;
+        pipeline.PushParsed(std::move(item), read_usage);
+    }
+}
+
+} // namespace
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFilePos *dbp)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, FlatFilePos> mapBlocksUnknownParent;
+    // Blocks with unknown parent (only used for reindex), found in this file
+    // or in earlier ones, of which only the positions are kept
+    static std::multimap<uint256, UnknownParentBlock> mapBlocksUnknownParent;
+    size_t unknown_parent_bytes = 0;
     int64_t nStart = GetTimeMillis();
 
     int nLoaded = 0;
+    uint64_t blocks_seen = 0;
+    const int parse_threads = std::max(1, std::min(GetNumCores() - 1, MAX_IMPORT_PARSE_THREADS));
+    BlockImportPipeline pipeline;
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
+        // The file is read and its blocks deserialized and checked on threads
+        // of their own, while blocks are accepted in file order on this one
+        std::vector<std::thread> threads;
+        threads.emplace_back([&] {
+            util::ThreadRename("loadblkread");
             try {
-                // locate a header
-                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> buf;
-                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
+                ReadBlockFile(blkdat, chainparams, dbp, pipeline);
+            } catch (const std::exception& e) {
+                LogPrintf("%s: %s\n", __func__, e.what());
             }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-                CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                uint256 hash = block.GetHash();
+            pipeline.ReadDone();
+        });
+        for (int n = 0; n < parse_threads; n++) {
+            threads.emplace_back([&, n] {
+                util::ThreadRename(strprintf("loadblkparse.%i", n));
+                ParseImportedBlocks(chainparams.GetConsensus(), pipeline);
+            });
+        }
+        auto stop_threads = [&] {
+            pipeline.Stop();
+            for (std::thread& thread : threads)
+                thread.join();
+            threads.clear();
+        };
+
+        try {
+            ImportedBlock item;
+            while (pipeline.PopParsed(item)) {
+                boost::this_thread::interruption_point();
+                const int64_t accept_start = GetTimeMicros();
+                blocks_seen++;
+                const size_t item_usage = item.usage;
+                if (!item.block) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, item.error);
+                    pipeline.Release(item_usage);
+                    continue;
+                }
+                const FlatFilePos* block_pos = dbp ? &item.pos : nullptr;
+                std::shared_ptr<CBlock> pblock = std::move(item.block);
+                const uint256& hash = item.hash;
+                bool failed = false;
                 {
                     LOCK(cs_main);
                     // detect out of order blocks, and store them for later
-                    if (hash != chainparams.GetConsensus().hashGenesisBlock && !LookupBlockIndex(block.hashPrevBlock)) {
+                    if (hash != chainparams.GetConsensus().hashGenesisBlock && !LookupBlockIndex(pblock->hashPrevBlock)) {
                         LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                                block.hashPrevBlock.ToString());
-                        if (dbp)
-                            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+                                pblock->hashPrevBlock.ToString());
+                        if (dbp) {
+                            // Kept in memory within a bound, or read again from disk otherwise
+                            const bool keep = unknown_parent_bytes + item_usage <= MAX_UNKNOWN_PARENT_BYTES;
+                            if (keep)
+                                unknown_parent_bytes += item_usage;
+                            mapBlocksUnknownParent.emplace(pblock->hashPrevBlock, UnknownParentBlock{item.pos, keep ? pblock : nullptr, item_usage});
+                        }
+                        pipeline.Release(item_usage);
+                        pipeline.m_accept_time += GetTimeMicros() - accept_start;
                         continue;
                     }
 
@@ -4662,16 +5428,19 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFi
                     CBlockIndex* pindex = LookupBlockIndex(hash);
                     if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
                       CValidationState state;
-                      if (::ChainstateActive().AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr)) {
+                      if (::ChainstateActive().AcceptBlock(pblock, state, chainparams, nullptr, true, block_pos, nullptr)) {
                           nLoaded++;
                       }
                       if (state.IsError()) {
-                          break;
+                          failed = true;
                       }
                     } else if (hash != chainparams.GetConsensus().hashGenesisBlock && pindex->nHeight % 1000 == 0) {
                       LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), pindex->nHeight);
                     }
                 }
+                pipeline.Release(item_usage);
+                if (failed)
+                    break;
 
                 // Activate the genesis block so normal node progress can continue
                 if (hash == chainparams.GetConsensus().hashGenesisBlock) {
@@ -4689,17 +5458,24 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFi
                 while (!queue.empty()) {
                     uint256 head = queue.front();
                     queue.pop_front();
-                    std::pair<std::multimap<uint256, FlatFilePos>::iterator, std::multimap<uint256, FlatFilePos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+                    std::pair<std::multimap<uint256, UnknownParentBlock>::iterator, std::multimap<uint256, UnknownParentBlock>::iterator> range = mapBlocksUnknownParent.equal_range(head);
                     while (range.first != range.second) {
-                        std::multimap<uint256, FlatFilePos>::iterator it = range.first;
-                        std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
-                        if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
+                        std::multimap<uint256, UnknownParentBlock>::iterator it = range.first;
+                        std::shared_ptr<const CBlock> pblockrecursive = it->second.block;
+                        if (pblockrecursive) {
+                            unknown_parent_bytes -= it->second.usage;
+                        } else {
+                            std::shared_ptr<CBlock> pblockread = std::make_shared<CBlock>();
+                            if (ReadBlockFromDisk(*pblockread, it->second.pos, chainparams.GetConsensus()))
+                                pblockrecursive = pblockread;
+                        }
+                        if (pblockrecursive)
                         {
                             LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
                                     head.ToString());
                             LOCK(cs_main);
                             CValidationState dummy;
-                            if (::ChainstateActive().AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
+                            if (::ChainstateActive().AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second.pos, nullptr))
                             {
                                 nLoaded++;
                                 queue.push_back(pblockrecursive->GetHash());
@@ -4710,15 +5486,27 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFi
                         NotifyHeaderTip();
                     }
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                pipeline.m_accept_time += GetTimeMicros() - accept_start;
             }
+        } catch (...) {
+            stop_threads();
+            throw;
         }
+        stop_threads();
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
-    if (nLoaded > 0)
-        LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    // The children of blocks in later files are read again from disk
+    for (auto& entry : mapBlocksUnknownParent) {
+        entry.second.block.reset();
+    }
+    if (nLoaded > 0) {
+        const double read_time = std::max<int64_t>(pipeline.m_read_time, 1) * 0.000001;
+        const double parse_time = std::max<int64_t>(pipeline.m_parse_time, 1) * 0.000001 / parse_threads;
+        const double accept_time = std::max<int64_t>(pipeline.m_accept_time, 1) * 0.000001;
+        LogPrintf("Loaded %i blocks from external file in %dms (read %.1f MiB/s, deserialized and checked %.1f blocks/s on %d threads, accepted %.1f blocks/s)\n",
+                  nLoaded, GetTimeMillis() - nStart, pipeline.m_bytes_read / read_time / 1048576, blocks_seen / parse_time, parse_threads, blocks_seen / accept_time);
+    }
     return nLoaded > 0;
 }
 
@@ -4763,11 +5551,27 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
     CBlockIndex* pindexFirstNotTransactionsValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_TRANSACTIONS (regardless of being valid or not).
     CBlockIndex* pindexFirstNotChainValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
     CBlockIndex* pindexFirstNotScriptsValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
+    // The base of a UTXO snapshot has no transactions, and nor do its
+    // ancestors, which were validated by the node the snapshot comes from.
+    // It stands for them: they are treated as processed and valid in its
+    // subtree, and restored to what they are below it on the way back.
+    const CBlockIndex* const snapshot_base = m_blockman.m_snapshot_base;
+    CBlockIndex* pindexFirstNeverProcessedBelowSnapshot = nullptr;
+    CBlockIndex* pindexFirstNotTransactionsValidBelowSnapshot = nullptr;
+    CBlockIndex* pindexFirstNotChainValidBelowSnapshot = nullptr;
+    CBlockIndex* pindexFirstNotScriptsValidBelowSnapshot = nullptr;
     while (pindex != nullptr) {
         nNodes++;
+        if (pindex == snapshot_base) {
+            pindexFirstNeverProcessedBelowSnapshot = pindexFirstNeverProcessed;
+            pindexFirstNotTransactionsValidBelowSnapshot = pindexFirstNotTransactionsValid;
+            pindexFirstNotChainValidBelowSnapshot = pindexFirstNotChainValid;
+            pindexFirstNotScriptsValidBelowSnapshot = pindexFirstNotScriptsValid;
+            pindexFirstNeverProcessed = pindexFirstNotTransactionsValid = pindexFirstNotChainValid = pindexFirstNotScriptsValid = nullptr;
+        }
         if (pindexFirstInvalid == nullptr && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
         if (pindexFirstMissing == nullptr && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
-        if (pindexFirstNeverProcessed == nullptr && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
+        if (pindexFirstNeverProcessed == nullptr && pindex->nTx == 0 && pindex != snapshot_base) pindexFirstNeverProcessed = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotTreeValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotTransactionsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS) pindexFirstNotTransactionsValid = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotChainValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
@@ -4791,7 +5595,7 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
             if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
         }
         if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
-        assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
+        assert(pindex == snapshot_base || ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
         // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to HaveTxsDownloaded().
         assert((pindexFirstNeverProcessed == nullptr) == pindex->HaveTxsDownloaded());
         assert((pindexFirstNotTransactionsValid == nullptr) == pindex->HaveTxsDownloaded());
@@ -4879,6 +5683,12 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
             if (pindex == pindexFirstNotTransactionsValid) pindexFirstNotTransactionsValid = nullptr;
             if (pindex == pindexFirstNotChainValid) pindexFirstNotChainValid = nullptr;
             if (pindex == pindexFirstNotScriptsValid) pindexFirstNotScriptsValid = nullptr;
+            if (pindex == snapshot_base) {
+                pindexFirstNeverProcessed = pindexFirstNeverProcessedBelowSnapshot;
+                pindexFirstNotTransactionsValid = pindexFirstNotTransactionsValidBelowSnapshot;
+                pindexFirstNotChainValid = pindexFirstNotChainValidBelowSnapshot;
+                pindexFirstNotScriptsValid = pindexFirstNotScriptsValidBelowSnapshot;
+            }
             // Find our parent.
             CBlockIndex* pindexPar = pindex->pprev;
             // Find which child we just visited.
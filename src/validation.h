@@ -12,6 +12,7 @@
 
 #include <amount.h>
 #include <coins.h>
+#include <coinsprefetch.h>
 #include <crypto/common.h> // for ReadLE64
 #include <fs.h>
 #include <policy/feerate.h>
@@ -32,6 +33,7 @@
 #include <utility>
 #include <vector>
 
+class BlockFileMaps;
 class CChainState;
 class CBlockIndex;
 class CBlockTreeDB;
@@ -42,6 +44,7 @@ class CConnman;
 class CScriptCheck;
 class CBlockPolicyEstimator;
 class CTxMemPool;
+class MappedBlockData;
 class CValidationState;
 struct ChainTxData;
 
@@ -80,6 +83,10 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of coins prefetching threads allowed */
+static const int MAX_COINS_PREFETCH_THREADS = 16;
+/** -prefetchthreads default (number of threads reading the coins of blocks ahead of their connection) */
+static const int DEFAULT_COINS_PREFETCH_THREADS = 4;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -101,6 +108,8 @@ static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/** Default for -backgroundflush, writing the chainstate to disk on a background thread when not forced to flush */
+static const bool DEFAULT_BACKGROUND_FLUSH = true;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 /** Block download timeout base, expressed in millionths of the block interval (i.e. 10 min) */
@@ -149,8 +158,10 @@ extern uint256 g_best_block;
 extern std::atomic_bool fImporting;
 extern std::atomic_bool fReindex;
 extern int nScriptCheckThreads;
+extern int nCoinsPrefetchThreads;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
+extern bool fBackgroundFlush;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
@@ -246,8 +257,31 @@ bool LoadGenesisBlock(const CChainParams& chainparams);
 bool LoadBlockIndex(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 /** Unload database information */
 void UnloadBlockIndex();
+/** Write the block index cache file read at the next startup, after a final flush of the chainstate. */
+void WriteBlockIndexCache() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck(int worker_num);
+/** Run an instance of the thread doing context-free checks of block transactions */
+void ThreadBlockCheck(int worker_num);
+/** Run an instance of the coins prefetching thread */
+void ThreadCoinsPrefetch(int worker_num);
+/**
+ * Whether a transaction received from a peer is worth checking ahead of
+ * AcceptToMemoryPool with PreValidateTransaction, as it passes the cheap
+ * checks AcceptToMemoryPool makes first: the context-free and standardness
+ * checks, and those of its inputs against the mempool and the chain tip,
+ * which must all be there and not spent in the mempool, and of its fee.
+ * If so, sets spent_outputs to the outputs it spends.
+ */
+bool PrepareTxPreValidation(const CTransaction& tx, std::vector<CTxOut>& spent_outputs) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+/**
+ * Check the scripts of a transaction prepared with PrepareTxPreValidation
+ * with the policy flags, without holding cs_main. Signatures verified end up
+ * in the signature cache and passing scripts in the script execution cache,
+ * where AcceptToMemoryPool finds them. On a failure, state is set as the
+ * policy script checks of AcceptToMemoryPool would set it.
+ */
+bool PreValidateTransaction(const CTransaction& tx, const std::vector<CTxOut>& spent_outputs, CValidationState& state);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256& hash, CTransactionRef& tx, const Consensus::Params& params, uint256& hashBlock, const CBlockIndex* const blockIndex = nullptr);
 /**
@@ -368,8 +402,8 @@ void InitScriptExecutionCache();
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const FlatFilePos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
-bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const FlatFilePos& pos, const CMessageHeader::MessageStartChars& message_start);
-bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
+bool ReadRawBlockFromDisk(MappedBlockData& block, const FlatFilePos& pos, const CMessageHeader::MessageStartChars& message_start);
+bool ReadRawBlockFromDisk(MappedBlockData& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
 
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
 
@@ -378,6 +412,9 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
 /** Context-independent validity checks */
 bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
+/** Validity checks of a block which depend on its parent, such as those of its witness commitment and its transactions' finality */
+bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 /** Check a block is completely valid from start to finish (only works on top of our current best block) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
@@ -469,6 +506,13 @@ public:
      */
     std::multimap<CBlockIndex*, CBlockIndex*> m_blocks_unlinked;
 
+    /**
+     * Block the chainstate was loaded at from a UTXO snapshot, if any. Neither
+     * it nor its ancestors have block data, and its nChainTx comes from the
+     * snapshot.
+     */
+    CBlockIndex* m_snapshot_base = nullptr;
+
     /**
      * Load the blocktree off disk and into memory. Populate certain metadata
      * per index entry (nStatus, nChainWork, nTimeMax, etc.) as well as peripheral
@@ -483,6 +527,21 @@ public:
         std::set<CBlockIndex*, CBlockIndexWorkComparator>& block_index_candidates)
         EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+    /**
+     * Load the entries of the blocktree from the block index cache file, if
+     * it matches the database, instead of from the database itself.
+     *
+     * @param[out] sorted_by_height  The entries loaded, parents first.
+     */
+    bool LoadBlockIndexCache(
+        const Consensus::Params& consensus_params,
+        CBlockTreeDB& blocktree,
+        std::vector<CBlockIndex*>& sorted_by_height)
+        EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    /** Write the block index cache file for the next startup, once all of the blocktree is in the database. */
+    void WriteBlockIndexCache(CBlockTreeDB& blocktree) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
     /** Clear all data members. */
     void Unload() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
@@ -520,12 +579,17 @@ public:
     //! This view wraps access to the leveldb instance and handles read errors gracefully.
     CCoinsViewErrorCatcher m_catcherview GUARDED_BY(cs_main);
 
+    //! This view writes the changes flushed from the cache to leveldb on a background
+    //! thread, and serves them until they are written. It can be read without cs_main.
+    CCoinsViewBackgroundFlush m_flushview;
+
     //! This is the top layer of the cache hierarchy - it keeps as many coins in memory as
     //! can fit per the dbcache setting.
     std::unique_ptr<CCoinsViewCache> m_cacheview GUARDED_BY(cs_main);
 
-    //! This constructor initializes CCoinsViewDB and CCoinsViewErrorCatcher instances, but it
-    //! *does not* create a CCoinsViewCache instance by default. This is done separately because the
+    //! This constructor initializes the CCoinsViewDB, CCoinsViewErrorCatcher and
+    //! CCoinsViewBackgroundFlush instances, but it *does not* create a CCoinsViewCache instance by
+    //! default. This is done separately because the
     //! presence of the cache has implications on whether or not we're allowed to flush the cache's
     //! state to disk, which should not be done until the health of the database is verified.
     //!
@@ -587,6 +651,15 @@ private:
     //! Manages the UTXO set, which is a reflection of the contents of `m_chain`.
     std::unique_ptr<CoinsViews> m_coins_views;
 
+    //! Block read ahead of its connection, whose coins are being prefetched
+    //! while the previous block is connected.
+    struct NextBlockPrefetch {
+        const CBlockIndex* pindex = nullptr;
+        std::shared_ptr<const CBlock> pblock;
+        std::shared_ptr<CCoinsPrefetchJob> job;
+    };
+    NextBlockPrefetch m_next_prefetch GUARDED_BY(cs_main);
+
 public:
     CChainState(BlockManager& blockman) : m_blockman(blockman) {}
     CChainState();
@@ -727,9 +800,23 @@ public:
     /** Update the chain tip based on database information, i.e. CoinsTip()'s best block. */
     bool LoadChainTip(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+    /**
+     * Add the headers of a UTXO snapshot to the block index. Unlike
+     * ProcessNewBlockHeaders, this may be called before the chain has a tip.
+     */
+    bool AcceptSnapshotHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    /**
+     * Make pindex the base of a chainstate loaded from a UTXO snapshot: it is
+     * considered fully validated, with nChainTx transactions up to it, and
+     * blocks up to it are considered pruned. Written to disk right away.
+     */
+    bool ActivateSnapshotBase(CBlockIndex* pindex, unsigned int nChainTx) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 private:
     bool ActivateBestChainStep(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace) EXCLUSIVE_LOCKS_REQUIRED(cs_main, ::mempool.cs);
-    bool ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions& disconnectpool) EXCLUSIVE_LOCKS_REQUIRED(cs_main, ::mempool.cs);
+    bool ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, const std::shared_ptr<CCoinsPrefetchJob>& prefetch, ConnectTrace& connectTrace, DisconnectedBlockTransactions& disconnectpool) EXCLUSIVE_LOCKS_REQUIRED(cs_main, ::mempool.cs);
+    std::shared_ptr<CCoinsPrefetchJob> PrefetchBlockCoins(const CBlockIndex* pindex, std::shared_ptr<const CBlock>& pblock, const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     void InvalidBlockFound(CBlockIndex *pindex, const CValidationState &state) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     CBlockIndex* FindMostWorkChain() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
@@ -771,6 +858,9 @@ extern std::unique_ptr<CChainState> g_chainstate;
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern std::unique_ptr<CBlockTreeDB> pblocktree;
 
+/** Block files kept mapped for reading blocks */
+extern BlockFileMaps g_block_file_maps;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
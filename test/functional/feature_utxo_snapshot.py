@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+# Copyright (c) 2019 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test bootstrapping a node from a UTXO snapshot.
+
+- Node0 mines a chain and writes a snapshot of its UTXO set with dumptxoutset.
+- Node1 refuses to load the snapshot without a trusted hash, or with a wrong one.
+- Node1 loads the snapshot with its trusted hash, and ends up with the same
+  UTXO set as node0 at the snapshot base, without having its blocks.
+- Node1 then syncs the blocks mined on top of it, including across a restart.
+"""
+import os
+import shutil
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.test_node import ErrorMatch
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    connect_nodes,
+)
+
+SNAPSHOT_HEIGHT = 150
+
+
+def utxo_set(node):
+    """The UTXO set of a node, as far as gettxoutsetinfo tells, but for its size on disk"""
+    info = node.gettxoutsetinfo()
+    del info["disk_size"]
+    return info
+
+
+class UTXOSnapshotTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [[], ["-prune=550"]]
+
+    def setup_network(self):
+        # Node1 stays apart until it is bootstrapped from the snapshot
+        self.setup_nodes()
+
+    def run_test(self):
+        node0 = self.nodes[0]
+        node0.generatetoaddress(SNAPSHOT_HEIGHT, node0.get_deterministic_priv_key().address)
+        snapshot = node0.dumptxoutset("utxo.dat")
+        assert_equal(snapshot["base_height"], SNAPSHOT_HEIGHT)
+        assert_equal(snapshot["base_hash"], node0.getbestblockhash())
+        assert_equal(snapshot["coins_written"], node0.gettxoutsetinfo()["txouts"])
+        assert_equal(snapshot["hash_serialized_2"], node0.gettxoutsetinfo()["hash_serialized_2"])
+        assert os.path.exists(snapshot["path"])
+        assert_raises_rpc_error(-8, "already exists", node0.dumptxoutset, "utxo.dat")
+
+        self.stop_node(1)
+        # Snapshots are only loaded into an empty chainstate
+        shutil.rmtree(os.path.join(self.nodes[1].datadir, "regtest"))
+        load_args = ["-prune=550", "-loadutxosnapshot={}".format(snapshot["path"])]
+
+        self.log.info("Refuse a snapshot without a trusted hash")
+        self.nodes[1].assert_start_raises_init_error(load_args, "No trusted hash for a snapshot at block {}".format(snapshot["base_hash"]), match=ErrorMatch.PARTIAL_REGEX)
+
+        self.log.info("Refuse a snapshot with a wrong hash")
+        self.nodes[1].assert_start_raises_init_error(load_args + ["-loadutxosnapshothash=" + "11" * 32], "The snapshot hash is {}, but {} was expected".format(snapshot["hash_serialized_2"], "11" * 32), match=ErrorMatch.PARTIAL_REGEX)
+
+        self.log.info("Load a snapshot with its trusted hash")
+        self.start_node(1, load_args + ["-loadutxosnapshothash=" + snapshot["hash_serialized_2"]])
+        node1 = self.nodes[1]
+        assert_equal(node1.getbestblockhash(), snapshot["base_hash"])
+        assert_equal(node1.getblockcount(), SNAPSHOT_HEIGHT)
+        assert_equal(utxo_set(node1), utxo_set(node0))
+        # The blocks up to the snapshot base were never downloaded
+        assert node1.getblockchaininfo()["pruned"]
+        assert_raises_rpc_error(-1, "Block not", node1.getblock, snapshot["base_hash"])
+
+        self.log.info("Sync the blocks on top of the snapshot")
+        connect_nodes(node1, 0)
+        node0.generatetoaddress(10, node0.get_deterministic_priv_key().address)
+        self.sync_blocks()
+        assert_equal(utxo_set(node1), utxo_set(node0))
+
+        self.log.info("Restart from the snapshot chainstate, which is not loaded again")
+        self.restart_node(1, load_args + ["-loadutxosnapshothash=" + snapshot["hash_serialized_2"]])
+        assert_equal(self.nodes[1].getbestblockhash(), node0.getbestblockhash())
+        connect_nodes(self.nodes[1], 0)
+        node0.generatetoaddress(5, node0.get_deterministic_priv_key().address)
+        self.sync_blocks()
+        assert_equal(utxo_set(self.nodes[1]), utxo_set(node0))
+
+
+if __name__ == '__main__':
+    UTXOSnapshotTest().main()
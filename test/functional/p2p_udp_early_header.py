@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+# Copyright (c) 2019 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test early header processing of blocks received over UDP.
+
+A node receiving a block over UDP should accept its header as soon as it is
+decoded and, if the block can be reconstructed, announce it as a compact
+block to its high-bandwidth peers ahead of the full block validation.
+
+Node0 relays blocks to node1 over UDP only. A mininode connected to node1
+requests high-bandwidth compact block announcements and measures the latency
+between the block being mined on node0 and the announcement. It checks that
+the announcement is made before the block is connected, including for a
+block which then fails to connect.
+"""
+import os
+import time
+
+from test_framework.blocktools import create_block, create_coinbase
+from test_framework.messages import msg_getheaders, msg_sendcmpct
+from test_framework.mininode import P2PInterface, mininode_lock
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    p2p_port,
+    wait_until,
+)
+
+UDP_MAGIC = ["node0pass", "node1pass"]
+INVALID_CB_NO_BAN_VERSION = 70015
+
+
+class CmpctBlockListener(P2PInterface):
+    def __init__(self):
+        super().__init__()
+        self.cmpctblock_times = {}
+
+    def peer_connect(self, *args, **kwargs):
+        create_conn = super().peer_connect(*args, **kwargs)
+        # Blocks are only announced ahead of their validation to peers which
+        # won't ban for invalid compact blocks
+        self.on_connection_send_msg.nVersion = INVALID_CB_NO_BAN_VERSION
+        return create_conn
+
+    def on_cmpctblock(self, message):
+        block = message.header_and_shortids.header
+        block.calc_sha256()
+        self.cmpctblock_times[block.sha256] = time.time()
+
+    def sync_headers(self, node):
+        # Get the tip header, so that the next block can be announced directly
+        tip = node.getblockheader(node.getbestblockhash())
+        msg = msg_getheaders()
+        msg.locator.vHave = [int(tip["previousblockhash"], 16)]
+        self.send_message(msg)
+        self.wait_for_header(int(tip["hash"], 16))
+
+
+class UDPEarlyHeaderTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.num_nodes = 2
+
+    def setup_network(self):
+        # Connect the nodes over UDP only, listening on their p2p port numbers
+        self.extra_args = [["-udpport={},0".format(p2p_port(i)), "-debug=udpnet", "-debug=net"] for i in range(self.num_nodes)]
+        self.setup_nodes()
+        for i, j in [(0, 1), (1, 0)]:
+            self.nodes[i].addudpnode("127.0.0.1:{}".format(p2p_port(j)), UDP_MAGIC[i], UDP_MAGIC[j], False, "add")
+        # lastrecv is only set once the connection is established
+        wait_until(lambda: all(peer["lastrecv"] > 0 for node in self.nodes for peer in node.getudppeerinfo()), timeout=60)
+
+    def mine_and_wait_udp_sync(self):
+        block_hash = self.nodes[0].generatetoaddress(1, self.nodes[0].get_deterministic_priv_key().address)[0]
+        wait_until(lambda: self.nodes[1].getbestblockhash() == block_hash, timeout=30)
+        return block_hash
+
+    def run_test(self):
+        node1 = self.nodes[1]
+        assert_equal(len(node1.getpeerinfo()), 0)
+
+        self.log.info("Relay a block over UDP to get both nodes out of IBD")
+        self.mine_and_wait_udp_sync()
+
+        self.log.info("Request high-bandwidth compact block announcements from node1")
+        listener = node1.add_p2p_connection(CmpctBlockListener())
+        listener.sync_headers(node1)
+        sendcmpct = msg_sendcmpct()
+        sendcmpct.announce = True
+        sendcmpct.version = 2
+        listener.send_and_ping(sendcmpct)
+
+        self.log.info("Check that a block received over UDP is announced ahead of its validation")
+        with node1.assert_debug_log(expected_msgs=["Header accepted", "Announced to high-bandwidth peers"]):
+            mined = time.time()
+            block_hash = self.mine_and_wait_udp_sync()
+            wait_until(lambda: int(block_hash, 16) in listener.cmpctblock_times, timeout=30, lock=mininode_lock)
+        with mininode_lock:
+            latency = listener.cmpctblock_times[int(block_hash, 16)] - mined
+        self.log.info("Header-to-peer latency: {:.1f} ms".format(latency * 1000))
+        # The compact block was sent before the block was connected
+        self.assert_logged_before(node1, "sending header-and-ids {}".format(block_hash), "UpdateTip: new best={}".format(block_hash))
+
+        self.log.info("Check that a block failing to connect is announced before it is found invalid")
+        tip = self.nodes[0].getbestblockhash()
+        coinbase = create_coinbase(self.nodes[0].getblockcount() + 1)
+        # Only ConnectBlock checks the value of the coinbase, so node0 relays
+        # the block over UDP before finding it invalid
+        coinbase.vout[0].nValue += 1
+        coinbase.rehash()
+        block = create_block(int(tip, 16), coinbase, self.nodes[0].getblock(tip)["time"] + 1)
+        block.solve()
+        assert_equal(self.nodes[0].submitblock(block.serialize().hex()), "bad-cb-amount")
+        wait_until(lambda: block.sha256 in listener.cmpctblock_times, timeout=30, lock=mininode_lock)
+        wait_until(lambda: any(t["hash"] == block.hash and t["status"] == "invalid" for t in node1.getchaintips()), timeout=30)
+        assert_equal(node1.getbestblockhash(), tip)
+        self.assert_logged_before(node1, "sending header-and-ids {}".format(block.hash), "ConnectBlock {} failed".format(block.hash))
+
+    def assert_logged_before(self, node, first, second):
+        with open(os.path.join(node.datadir, node.chain, "debug.log"), encoding="utf-8") as log:
+            lines = log.read().splitlines()
+        first_line = next(i for i, line in enumerate(lines) if first in line)
+        second_line = next(i for i, line in enumerate(lines) if second in line)
+        assert first_line < second_line, "'{}' was not logged before '{}'".format(first, second)
+
+if __name__ == '__main__':
+    UDPEarlyHeaderTest().main()
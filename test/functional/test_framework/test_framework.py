@@ -532,7 +532,11 @@ class BitcoinTestFramework(metaclass=BitcoinTestMetaClass):
 
             os.rmdir(cache_path('wallets'))  # Remove empty wallets dir
             for entry in os.listdir(cache_path()):
-                if entry not in ['chainstate', 'blocks']:  # Only keep chainstate and blocks folder
+                if entry in ['chainstate', 'blocks']:  # Only keep chainstate and blocks folder
+                    continue
+                if os.path.isdir(cache_path(entry)):  # e.g. the out-of-order blocks folder
+                    shutil.rmtree(cache_path(entry))
+                else:
                     os.remove(cache_path(entry))
 
         for i in range(self.num_nodes):